@@ -1,4 +1,8 @@
-INCLUDEPATH += $$PWD/../../3rdparty/civetweb/include
+# The patched copy of civetweb lives in the build directory of civet.pro
+CIVETWEB_SOURCES = $$PWD/../../3rdparty/civetweb
+CIVETWEB_PATCHED = $$shadowed($$PWD)/civetweb
+
+INCLUDEPATH += $$CIVETWEB_PATCHED/include
 CONFIG += link_pkgconfig
-PKGCONFIG += libssl
+PKGCONFIG += libssl libcrypto zlib
 LIBS += -lpthread
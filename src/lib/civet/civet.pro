@@ -13,8 +13,17 @@ DEFINES += NDEBUG \
     USE_IPV6 \
     USE_WEBSOCKET
 
-HEADERS += ../../3rdparty/civetweb/include/civetweb.h \
-    ../../3rdparty/civetweb/include/CivetServer.h
+# Patches a copy of civetweb in the build directory, to expose what the
+# WebSockets need
+!system($$shell_quote($$PWD/patch-civetweb.sh) \
+        $$shell_quote($$CIVETWEB_SOURCES) \
+        $$shell_quote($$PWD/patches) \
+        $$shell_quote($$CIVETWEB_PATCHED)) {
+    error("Failed to patch civetweb")
+}
 
-SOURCES += ../../3rdparty/civetweb/src/civetweb.c \
-    ../../3rdparty/civetweb/src/CivetServer.cpp
+HEADERS += $$CIVETWEB_PATCHED/include/civetweb.h \
+    $$CIVETWEB_PATCHED/include/CivetServer.h
+
+SOURCES += $$CIVETWEB_PATCHED/src/civetweb.c \
+    $$CIVETWEB_PATCHED/src/CivetServer.cpp
@@ -0,0 +1,20 @@
+#!/bin/sh
+
+# Copies the civetweb sources to the output path, and applies the patches
+# to that copy, so that the submodule is never modified
+
+if [ -z "$1" ] || [ -z "$2" ] || [ -z "$3" ]; then
+    echo "Please provide the civetweb, the patches and the output paths"
+    exit 1
+fi
+
+# Start from the pristine sources each time, so the patches always apply
+# to the commit the submodule is pinned to
+rm -rf "$3" || exit 1
+mkdir -p "$3" || exit 1
+cp -R "$1/include" "$1/src" "$3" || exit 1
+
+cd "$3" || exit 1
+for file in "$2"/*.patch; do
+    patch -p1 -N -s --no-backup-if-mismatch < "$file" || exit 1
+done
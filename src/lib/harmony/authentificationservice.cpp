@@ -30,6 +30,7 @@
  */
 
 #include "iauthentificationservice.h"
+#include "private/sessionstore.h"
 #include <iomanip>
 #include <sstream>
 #include <chrono>
@@ -40,36 +41,57 @@
 
 static const int PASSWORD_LENGTH = 8;
 static constexpr int PASSWORD_MAX = std::pow(10, PASSWORD_LENGTH) - 1;
-static const int PASSWORD_ATTEMPTS_MAX = 3;
+static const int PASSWORD_FAILURES_MAX = 1000;
 static const int VALIDITY_DURATION = 86400;
+static const int ACCESS_VALIDITY_DURATION = 900;
+static const int REFRESH_VALIDITY_DURATION = 30 * 86400;
 namespace chrono = std::chrono;
 
 namespace harmony
 {
 
+using SessionStore = private_impl::SessionStore;
+
+static qint64 currentTime()
+{
+    chrono::time_point<std::chrono::system_clock> now = chrono::system_clock::now();
+    return chrono::duration_cast<chrono::seconds>(now.time_since_epoch()).count();
+}
+
 class AuthentificationService: public IAuthentificationService
 {
 public:
     explicit AuthentificationService(const QByteArray &key, PasswordChangedCallback_t passwordChangedCallback);
     std::string password() const override;
-    JsonWebToken authenticate(const std::string &password) override;
+    JsonWebToken authenticate(const std::string &password, JsonWebToken *refreshToken) override;
+    JsonWebToken refresh(const QByteArray &refreshJwt, JsonWebToken *refreshToken) override;
     QByteArray hashJwt(const JsonWebToken &token) override;
-    bool isAuthorized(const QByteArray &jwt) override;
+    bool isAuthorized(const QByteArray &jwt, JsonWebToken::Claims *claims) override;
+    bool revoke(const QByteArray &jwt, const QByteArray &sid) override;
+    void revokeAll() override;
+    void setRevokedCallback(RevokedCallback_t &&revokedCallback) override;
 private:
+    static QByteArray createId();
+    JsonWebToken createToken(qint64 iat, int validity, const QByteArray &sid, JsonWebToken::Claims::Use use);
     bool comparePassword(const std::string &password) const;
     void setPassword(const std::string &password, bool init);
-    void decrementPasswordAttempts();
+    void countPasswordFailure();
     void generatePassword(bool init = false);
-    std::atomic_int m_passwordAttempts {0};
+    void notifyRevoked(const QByteArray &jti);
     std::string m_password {};
-    const QByteArray m_key {};
+    // Failed attempts of every client since the password was generated
+    std::atomic_int m_passwordFailures {0};
+    const JsonWebTokenVerifier m_verifier;
+    SessionStore m_sessions {};
     const PasswordChangedCallback_t m_passwordChangedCallback {};
     mutable std::mutex m_mutex {};
+    RevokedCallback_t m_revokedCallback {};
+    std::mutex m_revokedMutex {};
 };
 
 AuthentificationService::AuthentificationService(const QByteArray &key,
                                                  PasswordChangedCallback_t passwordChangedCallback)
-    : m_key{key}, m_passwordChangedCallback{std::move(passwordChangedCallback)}
+    : m_verifier{key}, m_passwordChangedCallback{std::move(passwordChangedCallback)}
 {
     generatePassword(true);
 }
@@ -80,49 +102,128 @@ std::string AuthentificationService::password() const
     return m_password;
 }
 
-JsonWebToken AuthentificationService::authenticate(const std::string &password)
+JsonWebToken AuthentificationService::authenticate(const std::string &password, JsonWebToken *refreshToken)
 {
+    // Failed attempts are throttled per client by the server, so that
+    // one client cannot force a new password on everyone, and are also
+    // counted for every client, so that clients that change their
+    // address cannot try every password
     if (!comparePassword(password)) {
-        decrementPasswordAttempts();
+        countPasswordFailure();
         return JsonWebToken{};
     }
 
     generatePassword();
 
-    chrono::time_point<std::chrono::system_clock> now {chrono::system_clock::now()};
-    long int iat {chrono::duration_cast<chrono::seconds>(now.time_since_epoch()).count()};
+    qint64 iat {currentTime()};
+    const QByteArray &sid = createId();
+    if (!refreshToken) {
+        return createToken(iat, VALIDITY_DURATION, sid, JsonWebToken::Claims::Use::Access);
+    }
 
-    QString jti = QUuid::createUuid().toString().remove("{").remove("}"); // TODO: save the JTI
-    QJsonObject payload {};
-    payload.insert("iat", static_cast<int>(iat));
-    payload.insert("exp", static_cast<int>(iat) + VALIDITY_DURATION);
-    payload.insert("jti", jti);
-    return JsonWebToken{payload};
+    *refreshToken = createToken(iat, REFRESH_VALIDITY_DURATION, sid, JsonWebToken::Claims::Use::Refresh);
+    return createToken(iat, ACCESS_VALIDITY_DURATION, sid, JsonWebToken::Claims::Use::Access);
+}
+
+JsonWebToken AuthentificationService::refresh(const QByteArray &refreshJwt, JsonWebToken *refreshToken)
+{
+    JsonWebToken::Claims claims {};
+    if (!m_verifier.verify(refreshJwt, claims) || claims.use != JsonWebToken::Claims::Use::Refresh) {
+        return JsonWebToken{};
+    }
+
+    qint64 now {currentTime()};
+    if (now >= claims.exp || !m_sessions.contains(claims.jti, now)) {
+        return JsonWebToken{};
+    }
+
+    if (refreshToken) {
+        // Only one of concurrent rotations of the same refresh token succeeds
+        if (!m_sessions.remove(claims.jti)) {
+            return JsonWebToken{};
+        }
+        *refreshToken = createToken(now, REFRESH_VALIDITY_DURATION, claims.sid, JsonWebToken::Claims::Use::Refresh);
+    }
+    return createToken(now, ACCESS_VALIDITY_DURATION, claims.sid, JsonWebToken::Claims::Use::Access);
 }
 
 QByteArray AuthentificationService::hashJwt(const JsonWebToken &token)
 {
-    return token.toJwt(m_key);
+    return m_verifier.toJwt(token);
 }
 
-bool AuthentificationService::isAuthorized(const QByteArray &jwt)
+bool AuthentificationService::isAuthorized(const QByteArray &jwt, JsonWebToken::Claims *claims)
 {
-    JsonWebToken token {JsonWebToken::fromJwt(jwt, m_key)};
-    if (token.isNull()) {
+    JsonWebToken::Claims verifiedClaims {};
+    if (!m_verifier.verify(jwt, verifiedClaims)) {
         return false;
     }
 
-    chrono::time_point<std::chrono::system_clock> now = chrono::system_clock::now();
-    int currentTime = chrono::duration_cast<chrono::seconds>(now.time_since_epoch()).count();
+    qint64 now {currentTime()};
+    if (now >= verifiedClaims.exp) {
+        return false;
+    }
+
+    if (verifiedClaims.use != JsonWebToken::Claims::Use::Access) {
+        return false;
+    }
 
-    int exp = token.payload().value("exp").toInt();
-    if (currentTime >= exp) {
+    if (!m_sessions.contains(verifiedClaims.jti, now)) {
         return false;
     }
 
+    if (claims) {
+        *claims = verifiedClaims;
+    }
+    return true;
+}
+
+bool AuthentificationService::revoke(const QByteArray &jwt, const QByteArray &sid)
+{
+    JsonWebToken::Claims claims {};
+    if (!m_verifier.verify(jwt, claims)) {
+        return false;
+    }
+    if (!sid.isEmpty() && claims.sid != sid) {
+        return false;
+    }
+    if (!m_sessions.remove(claims.jti)) {
+        return false;
+    }
+    notifyRevoked(claims.jti);
     return true;
 }
 
+void AuthentificationService::revokeAll()
+{
+    m_sessions.clear();
+    notifyRevoked(QByteArray());
+}
+
+void AuthentificationService::setRevokedCallback(RevokedCallback_t &&revokedCallback)
+{
+    std::lock_guard<std::mutex> lock {m_revokedMutex};
+    m_revokedCallback = std::move(revokedCallback);
+}
+
+QByteArray AuthentificationService::createId()
+{
+    return QUuid::createUuid().toByteArray().mid(1, 36);
+}
+
+JsonWebToken AuthentificationService::createToken(qint64 iat, int validity, const QByteArray &sid,
+                                                  JsonWebToken::Claims::Use use)
+{
+    JsonWebToken::Claims claims {};
+    claims.iat = iat;
+    claims.exp = iat + validity;
+    claims.jti = createId();
+    claims.sid = sid;
+    claims.use = use;
+    m_sessions.add(claims.jti, claims.exp, iat);
+    return JsonWebToken{claims};
+}
+
 bool AuthentificationService::comparePassword(const std::string &password) const
 {
     std::lock_guard<std::mutex> lock {m_mutex};
@@ -140,10 +241,10 @@ void AuthentificationService::setPassword(const std::string &password, bool init
     }
 }
 
-void AuthentificationService::decrementPasswordAttempts()
+void AuthentificationService::countPasswordFailure()
 {
-    --m_passwordAttempts;
-    if (m_passwordAttempts <= 0) {
+    // Only the failure that reaches the limit generates a new password
+    if (++m_passwordFailures == PASSWORD_FAILURES_MAX) {
         generatePassword();
     }
 }
@@ -171,13 +272,22 @@ void AuthentificationService::generatePassword(bool init)
     std::string password = ss.str();
 
     setPassword(password, init);
-    m_passwordAttempts = PASSWORD_ATTEMPTS_MAX;
+    m_passwordFailures = 0;
 
 #ifdef HARMONY_DEBUG
     qCDebug(QLoggingCategory("auth-service")) << "Current password:" << QString::fromStdString(m_password);
 #endif
 }
 
+// The callback is called under the lock, so that it is not called anymore once it is reset
+void AuthentificationService::notifyRevoked(const QByteArray &jti)
+{
+    std::lock_guard<std::mutex> lock {m_revokedMutex};
+    if (m_revokedCallback) {
+        m_revokedCallback(jti);
+    }
+}
+
 IAuthentificationService::Ptr IAuthentificationService::create(const QByteArray &key,
                                                                PasswordChangedCallback_t &&passwordChangedCallback)
 {
@@ -32,6 +32,8 @@
 #include "idbusengine.h"
 #include "private/dbusengineimpl.h"
 #include "private/adaptor.h"
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonObject>
 #include <QtCore/QLoggingCategory>
 #include <QtDBus/QDBusConnection>
 
@@ -42,16 +44,18 @@ static const char *SERVICE = "harbour.harmony";
 static const char *PATH = "/";
 
 DBusEngineImpl::DBusEngineImpl(const QByteArray &key, IAuthentificationService::PasswordChangedCallback_t &&passwordChangedCallback, int port, const std::string &publicFolder)
-    : QObject(), m_passwordChangedCallback(passwordChangedCallback)
+    : QObject(), m_passwordChangedCallback(passwordChangedCallback), m_broadcastRelay(*this)
 {
     m_engine = IEngine::create(key, [this](const std::string &password) {
         emit PasswordChanged(QString::fromStdString(password));
         m_passwordChangedCallback(password);
     }, port, publicFolder);
+    m_engine->addCallback(m_broadcastRelay);
 }
 
 DBusEngineImpl::~DBusEngineImpl()
 {
+    m_engine->removeCallback(m_broadcastRelay);
     QDBusConnection connection {QDBusConnection::sessionBus()};
     connection.unregisterObject(PATH);
     connection.unregisterService(SERVICE);
@@ -98,6 +102,27 @@ std::string DBusEngineImpl::password() const
     return m_engine->password();
 }
 
+void DBusEngineImpl::revokeSessions()
+{
+    m_engine->revokeSessions();
+}
+
+Reply DBusEngineImpl::invoke(const std::string &extension, const Endpoint &endpoint,
+                             const QUrlQuery &params, const QJsonDocument &body) const
+{
+    return m_engine->invoke(extension, endpoint, params, body);
+}
+
+void DBusEngineImpl::addCallback(IExtensionManager::ICallback &callback)
+{
+    m_engine->addCallback(callback);
+}
+
+void DBusEngineImpl::removeCallback(IExtensionManager::ICallback &callback)
+{
+    m_engine->removeCallback(callback);
+}
+
 bool DBusEngineImpl::IsRunning() const
 {
     return isRunning();
@@ -118,6 +143,62 @@ QString DBusEngineImpl::Password() const
     return QString::fromStdString(password());
 }
 
+void DBusEngineImpl::RevokeSessions()
+{
+    revokeSessions();
+}
+
+/*
+ * method is get, post or delete, params is a query string, like
+ * key=value&key2=value2, and body is a JSON document. The reply is
+ * {"status": 200, "body": {...}}, like the replies to WebSocket calls.
+ * Other methods are answered with {"status": 400}.
+ */
+QString DBusEngineImpl::Invoke(const QString &extension, const QString &endpoint, const QString &method,
+                               const QString &params, const QString &body)
+{
+    Endpoint::Type type {Endpoint::Type::Invalid};
+    const QString &lowerMethod = method.toLower();
+    if (lowerMethod == "get") {
+        type = Endpoint::Type::Get;
+    } else if (lowerMethod == "post") {
+        type = Endpoint::Type::Post;
+    } else if (lowerMethod == "delete") {
+        type = Endpoint::Type::Delete;
+    }
+
+    QJsonObject reply {};
+    if (type == Endpoint::Type::Invalid) {
+        reply.insert("status", 400);
+        return QString::fromUtf8(QJsonDocument(reply).toJson(QJsonDocument::Compact));
+    }
+
+    const Reply &result = invoke(extension.toStdString(), Endpoint(type, endpoint.toStdString()),
+                                 QUrlQuery(params), QJsonDocument::fromJson(body.toUtf8()));
+    reply.insert("status", result.status());
+    if (result.type() == Reply::Type::Json) {
+        const QJsonDocument &value = result.valueJson();
+        if (value.isObject()) {
+            reply.insert("body", value.object());
+        } else if (value.isArray()) {
+            reply.insert("body", value.array());
+        }
+    }
+    return QString::fromUtf8(QJsonDocument(reply).toJson(QJsonDocument::Compact));
+}
+
+DBusEngineImpl::BroadcastRelay::BroadcastRelay(DBusEngineImpl &engine)
+    : m_engine(engine)
+{
+}
+
+// Signals are queued to the D-Bus adaptor, that lives in the thread of the engine
+void DBusEngineImpl::BroadcastRelay::operator()(const harmony::Broadcast &broadcast) const
+{
+    emit m_engine.BroadcastReceived(QString::fromStdString(broadcast.topic()), broadcast.data(),
+                                    broadcast.type() == harmony::Broadcast::Type::Binary);
+}
+
 IDBusEngine::Ptr IDBusEngine::create(const QByteArray &key,
                                      IAuthentificationService::PasswordChangedCallback_t &&passwordChangedCallback,
                                      int port, const std::string &publicFolder)
@@ -50,18 +50,37 @@ public:
     bool start() override;
     bool stop() override;
     std::string password() const;
+    void revokeSessions() override;
+    Reply invoke(const std::string &extension, const Endpoint &endpoint,
+                 const QUrlQuery &params, const QJsonDocument &body) const override;
+    void addCallback(IExtensionManager::ICallback &callback) override;
+    void removeCallback(IExtensionManager::ICallback &callback) override;
 private slots:
     bool IsRunning() const;
     bool Start();
     bool Stop();
     QString Password() const;
+    void RevokeSessions();
+    QString Invoke(const QString &extension, const QString &endpoint, const QString &method,
+                   const QString &params, const QString &body);
 signals:
     void PasswordChanged(const QString &password);
+    void BroadcastReceived(const QString &topic, const QByteArray &data, bool binary);
 private:
+    // Relays the broadcasts of the extensions to D-Bus
+    class BroadcastRelay: public IExtensionManager::ICallback
+    {
+    public:
+        explicit BroadcastRelay(DBusEngineImpl &engine);
+        void operator()(const harmony::Broadcast &broadcast) const override;
+    private:
+        DBusEngineImpl &m_engine;
+    };
     explicit DBusEngineImpl(const QByteArray &key, IAuthentificationService::PasswordChangedCallback_t &&passwordChangedCallback,
                             int port, const std::string &publicFolder);
     IEngine::Ptr m_engine;
     const IAuthentificationService::PasswordChangedCallback_t m_passwordChangedCallback {};
+    BroadcastRelay m_broadcastRelay;
 };
 
 }
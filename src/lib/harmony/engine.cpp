@@ -30,6 +30,7 @@
  */
 
 #include "iengine.h"
+#include <map>
 #include "iauthentificationservice.h"
 #include "iextensionmanager.h"
 #include "iserver.h"
@@ -47,10 +48,17 @@ public:
     bool start() override;
     bool stop() override;
     std::string password() const override;
+    void revokeSessions() override;
+    Reply invoke(const std::string &extension, const Endpoint &endpoint,
+                 const QUrlQuery &params, const QJsonDocument &body) const override;
+    void addCallback(IExtensionManager::ICallback &callback) override;
+    void removeCallback(IExtensionManager::ICallback &callback) override;
 private:
     IAuthentificationService::Ptr m_authentificationService {};
     IExtensionManager::Ptr m_extensionManager {};
     IServer::Ptr m_server {};
+    // Endpoints by extension id and endpoint name
+    std::map<std::pair<std::string, std::string>, std::pair<const Extension *, Endpoint>> m_endpoints {};
 };
 
 Engine::Engine(const QByteArray &key,
@@ -60,6 +68,11 @@ Engine::Engine(const QByteArray &key,
     , m_extensionManager{IExtensionManager::create()}
     , m_server{IServer::create(*m_authentificationService, *m_extensionManager, port, publicFolder)}
 {
+    for (const Extension *extension : m_extensionManager->extensions()) {
+        for (const Endpoint &endpoint : extension->endpoints()) {
+            m_endpoints.emplace(std::make_pair(extension->id(), endpoint.name()), std::make_pair(extension, endpoint));
+        }
+    }
 }
 
 bool Engine::isRunning() const
@@ -86,6 +99,34 @@ std::string Engine::password() const
     return m_authentificationService->password();
 }
 
+void Engine::revokeSessions()
+{
+    m_authentificationService->revokeAll();
+}
+
+Reply Engine::invoke(const std::string &extension, const Endpoint &endpoint,
+                     const QUrlQuery &params, const QJsonDocument &body) const
+{
+    auto it = m_endpoints.find(std::make_pair(extension, endpoint.name()));
+    if (it == m_endpoints.end()) {
+        return Reply(404, QJsonDocument());
+    }
+    if (it->second.second.type() != endpoint.type()) {
+        return Reply(405, QJsonDocument());
+    }
+    return it->second.first->handleRequest(endpoint, params, body);
+}
+
+void Engine::addCallback(IExtensionManager::ICallback &callback)
+{
+    m_extensionManager->addCallback(callback);
+}
+
+void Engine::removeCallback(IExtensionManager::ICallback &callback)
+{
+    m_extensionManager->removeCallback(callback);
+}
+
 IEngine::Ptr IEngine::create(const QByteArray &key,
                              IAuthentificationService::PasswordChangedCallback_t &&passwordChangedCallback,
                              int port, const std::string &publicFolder)
@@ -32,36 +32,72 @@
 #include "iextensionmanager.h"
 #include <QtCore/QPluginLoader>
 #include <QtCore/QCoreApplication>
+#include <QtCore/QJsonDocument>
+#include <mutex>
 #include <set>
+#include "private/broadcastdispatcher.h"
+#include "private/statestore.h"
 
 namespace harmony
 {
 
+using BroadcastDispatcher = private_impl::BroadcastDispatcher;
+using StateStore = private_impl::StateStore;
+
 class ExtensionManager: public IExtensionManager
 {
 public:
-    explicit ExtensionManager();
+    explicit ExtensionManager(int queueCapacity);
     ~ExtensionManager();
     std::vector<Extension *> extensions() const override;
     void addCallback(ICallback &callback) override;
     void removeCallback(ICallback &callback) override;
+    Statistics statistics() const override;
+    bool state(const std::string &topic, quint64 &version, QJsonObject &state) const override;
 private:
+    void notify(const Broadcast &broadcast);
+    void publishState(const std::string &topic, const QJsonObject &state);
+    void dispatch(const Broadcast &broadcast) const;
     std::vector<Extension *> m_extensions {};
     std::set<ICallback *> m_callbacks {};
+    // Held while dispatching, so that removed callbacks are not called anymore
+    mutable std::mutex m_callbacksMutex {};
+    StateStore m_states {};
+    // Held while publishing, so that the patches are queued in order
+    mutable std::mutex m_statesMutex {};
+    BroadcastDispatcher m_dispatcher;
 };
 
 
-ExtensionManager::ExtensionManager()
+ExtensionManager::ExtensionManager(int queueCapacity)
+    : m_dispatcher{queueCapacity, [this](const Broadcast &broadcast) { dispatch(broadcast); }}
 {
     QList<QObject *> staticPlugins = QPluginLoader::staticInstances();
     for (QObject *object : staticPlugins) {
         Extension *extension = qobject_cast<Extension *>(object);
         if (extension) {
             m_extensions.push_back(extension);
-            QObject::connect(extension, &Extension::broadcast, [this](const QString &data) {
-                for (ICallback *callback : m_callbacks) {
-                    (*callback)(data.toLocal8Bit());
-                }
+            const std::string id {extension->id()};
+            QObject::connect(extension, &Extension::broadcast, [this, id](const QString &data) {
+                notify(Broadcast(id, data.toUtf8()));
+            });
+            QObject::connect(extension, &Extension::broadcastToTopic, [this](const QString &topic, const QString &data) {
+                notify(Broadcast(topic.toStdString(), data.toUtf8()));
+            });
+            QObject::connect(extension, &Extension::broadcastUtf8, [this, id](const QByteArray &data) {
+                notify(Broadcast(id, data));
+            });
+            QObject::connect(extension, &Extension::broadcastUtf8ToTopic, [this](const QString &topic, const QByteArray &data) {
+                notify(Broadcast(topic.toStdString(), data));
+            });
+            QObject::connect(extension, &Extension::broadcastBinary, [this, id](const QByteArray &data) {
+                notify(Broadcast(id, data, Broadcast::Type::Binary));
+            });
+            QObject::connect(extension, &Extension::broadcastBinaryToTopic, [this](const QString &topic, const QByteArray &data) {
+                notify(Broadcast(topic.toStdString(), data, Broadcast::Type::Binary));
+            });
+            QObject::connect(extension, &Extension::broadcastState, [this](const QString &topic, const QJsonObject &state) {
+                publishState(topic.toStdString(), state);
             });
         }
     }
@@ -69,6 +105,7 @@ ExtensionManager::ExtensionManager()
 
 ExtensionManager::~ExtensionManager()
 {
+    m_dispatcher.stop();
     // Destroy plugins to workaround a Qt bug
     for (Extension *extension : m_extensions) {
         delete extension;
@@ -83,17 +120,60 @@ std::vector<Extension *> ExtensionManager::extensions() const
 
 void ExtensionManager::addCallback(IExtensionManager::ICallback &callback)
 {
+    std::lock_guard<std::mutex> lock {m_callbacksMutex};
     m_callbacks.insert(&callback);
 }
 
 void ExtensionManager::removeCallback(IExtensionManager::ICallback &callback)
 {
+    std::lock_guard<std::mutex> lock {m_callbacksMutex};
     m_callbacks.erase(&callback);
 }
 
-IExtensionManager::Ptr IExtensionManager::create()
+IExtensionManager::Statistics ExtensionManager::statistics() const
+{
+    return m_dispatcher.statistics();
+}
+
+bool ExtensionManager::state(const std::string &topic, quint64 &version, QJsonObject &state) const
+{
+    std::lock_guard<std::mutex> lock {m_statesMutex};
+    return m_states.snapshot(topic, version, state);
+}
+
+// Called from the thread that emitted the broadcast
+void ExtensionManager::notify(const Broadcast &broadcast)
+{
+    m_dispatcher.post(broadcast);
+}
+
+// Called from the thread that emitted the state
+void ExtensionManager::publishState(const std::string &topic, const QJsonObject &state)
+{
+    std::lock_guard<std::mutex> lock {m_statesMutex};
+    quint64 version {0};
+    QJsonObject patch {};
+    if (!m_states.update(topic, state, version, patch)) {
+        return;
+    }
+    QJsonObject object {};
+    object.insert("version", static_cast<double>(version));
+    object.insert("patch", patch);
+    notify(Broadcast(topic, QJsonDocument(object).toJson(QJsonDocument::Compact)));
+}
+
+// Called from the dispatcher thread
+void ExtensionManager::dispatch(const Broadcast &broadcast) const
+{
+    std::lock_guard<std::mutex> lock {m_callbacksMutex};
+    for (ICallback *callback : m_callbacks) {
+        (*callback)(broadcast);
+    }
+}
+
+IExtensionManager::Ptr IExtensionManager::create(int queueCapacity)
 {
-    return Ptr(new ExtensionManager());
+    return Ptr(new ExtensionManager(queueCapacity));
 }
 
 }
@@ -7,7 +7,7 @@ CONFIG += staticlib
 
 include(../../config.pri)
 
-INCLUDEPATH += ../../3rdparty/civetweb/include/
+include(../civet/civet-deps.pri)
 
 HEADERS += \
     iserver.h \
@@ -15,7 +15,23 @@ HEADERS += \
     iauthentificationservice.h \
     harmonyextension.h \
     iextensionmanager.h \
+    private/admissioncontrol.h \
+    private/broadcastcoalescer.h \
+    private/broadcastdispatcher.h \
+    private/broadcasthistory.h \
+    private/copyonwrite.h \
     private/enhancedcivetserver.h \
+    private/epollwebsocketserver.h \
+    private/eventstream.h \
+    private/hmacsha256.h \
+    private/outboundqueue.h \
+    private/permessagedeflate.h \
+    private/ratelimiter.h \
+    private/sessionstore.h \
+    private/statestore.h \
+    private/topicindex.h \
+    private/websocketframe.h \
+    private/websocketwriter.h \
     iengine.h
 
 SOURCES += \
@@ -24,7 +40,22 @@ SOURCES += \
     authentificationservice.cpp \
     harmonyextension.cpp \
     extensionmanager.cpp \
+    private/admissioncontrol.cpp \
+    private/broadcastcoalescer.cpp \
+    private/broadcastdispatcher.cpp \
+    private/broadcasthistory.cpp \
     private/enhancedcivetserver.cpp \
+    private/epollwebsocketserver.cpp \
+    private/eventstream.cpp \
+    private/hmacsha256.cpp \
+    private/outboundqueue.cpp \
+    private/permessagedeflate.cpp \
+    private/ratelimiter.cpp \
+    private/sessionstore.cpp \
+    private/statestore.cpp \
+    private/topicindex.cpp \
+    private/websocketframe.cpp \
+    private/websocketwriter.cpp \
     engine.cpp
 
 RESOURCES += \
@@ -42,6 +42,9 @@ static_assert(std::is_move_constructible<Endpoint>::value, "Endpoint must be mov
 static_assert(std::is_copy_constructible<Reply>::value, "Reply must be copy constructible");
 static_assert(std::is_move_constructible<Reply>::value, "Reply must be move constructible");
 
+static_assert(std::is_copy_constructible<Broadcast>::value, "Broadcast must be copy constructible");
+static_assert(std::is_move_constructible<Broadcast>::value, "Broadcast must be move constructible");
+
 Endpoint::Endpoint()
 {
 }
@@ -115,6 +118,40 @@ QJsonDocument Reply::valueJson() const
     return QJsonDocument::fromJson(QByteArray::fromStdString(m_value));
 }
 
+Broadcast::Broadcast()
+{
+}
+
+Broadcast::Broadcast(const std::string &topic, const QByteArray &data, Type type)
+    : m_topic{topic}, m_data{data}, m_type{type}
+{
+}
+
+bool Broadcast::operator==(const Broadcast &other) const
+{
+    return m_topic == other.m_topic && m_data == other.m_data && m_type == other.m_type;
+}
+
+bool Broadcast::isNull() const
+{
+    return m_topic.empty();
+}
+
+std::string Broadcast::topic() const
+{
+    return m_topic;
+}
+
+QByteArray Broadcast::data() const
+{
+    return m_data;
+}
+
+Broadcast::Type Broadcast::type() const
+{
+    return m_type;
+}
+
 Extension::Extension(QObject *parent)
     : QObject(parent)
 {
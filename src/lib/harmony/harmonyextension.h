@@ -36,6 +36,7 @@
 #include <QtCore/QtPlugin>
 #include <QtCore/QUrlQuery>
 #include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
 
 namespace harmony
 {
@@ -84,6 +85,37 @@ private:
     const std::string m_value {};
 };
 
+/**
+ * @brief A message pushed to the WebSocket clients
+ *
+ * Clients that subscribed to topics only receive the broadcasts of
+ * these topics. Clients that never subscribed receive every broadcast.
+ *
+ * Text broadcasts are UTF-8 encoded, and are sent as text frames. Binary
+ * broadcasts are sent as binary frames. In both cases, the data is
+ * implicitly shared up to the sockets.
+ */
+class Broadcast final
+{
+public:
+    enum class Type
+    {
+        Text,
+        Binary
+    };
+    explicit Broadcast();
+    explicit Broadcast(const std::string &topic, const QByteArray &data, Type type = Type::Text);
+    bool operator==(const Broadcast &other) const;
+    bool isNull() const;
+    std::string topic() const;
+    QByteArray data() const;
+    Type type() const;
+private:
+    const std::string m_topic {};
+    const QByteArray m_data {};
+    const Type m_type {Type::Text};
+};
+
 /**
  * @brief Extension interface for Harmony
  *
@@ -117,7 +149,24 @@ class Extension : public QObject, public IExtension
 public:
     explicit Extension(QObject *parent = 0);
 Q_SIGNALS:
+    // Broadcast to the topic named after the extension id
     void broadcast(const QString &data) const;
+    // Topics are shared by all extensions, and should be prefixed by the extension id
+    void broadcastToTopic(const QString &topic, const QString &data) const;
+    // Same as broadcast, with data that is already UTF-8 encoded
+    void broadcastUtf8(const QByteArray &data) const;
+    void broadcastUtf8ToTopic(const QString &topic, const QByteArray &data) const;
+    // Broadcast binary frames
+    void broadcastBinary(const QByteArray &data) const;
+    void broadcastBinaryToTopic(const QString &topic, const QByteArray &data) const;
+    /*
+     * Publish the new state of a document. Only what changed since the
+     * previous state is broadcast to the topic, as
+     * {"version": 2, "patch": {...}}, where patch is a JSON merge patch.
+     * Clients get the whole state from /api/state?topic=topic, and
+     * fetch it again when they miss a version.
+     */
+    void broadcastState(const QString &topic, const QJsonObject &state) const;
 };
 
 }
@@ -44,13 +44,59 @@ class IAuthentificationService
 public:
     using Ptr = std::unique_ptr<IAuthentificationService>;
     using PasswordChangedCallback_t = std::function<void(const std::string &password)>;
+    // Called with the jti of a revoked token, or with an empty jti when all tokens are revoked
+    using RevokedCallback_t = std::function<void(const QByteArray &jti)>;
     IAuthentificationService & operator=(const IAuthentificationService &) = delete;
     IAuthentificationService & operator=(IAuthentificationService &&) = delete;
     virtual ~IAuthentificationService() {}
     virtual std::string password() const = 0;
-    virtual JsonWebToken authenticate(const std::string &password) = 0;
+    /**
+     * @brief Authenticate with the pairing password
+     *
+     * If refreshToken is provided, it is filled with a long-lived refresh
+     * token, and the returned access token is short-lived. Otherwise, the
+     * returned token is valid for a day.
+     *
+     * The password is rotated when it is used, and after 1000 failed
+     * attempts, counted across every client, so that clients that
+     * avoid the per client limit of the server cannot try every
+     * password.
+     */
+    virtual JsonWebToken authenticate(const std::string &password, JsonWebToken *refreshToken = nullptr) = 0;
+    /**
+     * @brief Exchange a refresh token for a new access token
+     *
+     * The password is not rotated. If refreshToken is provided, the
+     * refresh token that was used is revoked, and refreshToken is filled
+     * with a new one, so that the session slides as long as the client
+     * keeps using it.
+     */
+    virtual JsonWebToken refresh(const QByteArray &refreshJwt, JsonWebToken *refreshToken = nullptr) = 0;
     virtual QByteArray hashJwt(const JsonWebToken &token) = 0;
-    virtual bool isAuthorized(const QByteArray &jwt) = 0;
+    /**
+     * @brief Check that an access token is valid and was not revoked
+     *
+     * If claims is provided, it is filled with the claims of the token,
+     * so that callers can track its expiration.
+     */
+    virtual bool isAuthorized(const QByteArray &jwt, JsonWebToken::Claims *claims = nullptr) = 0;
+    /**
+     * @brief Revoke a token
+     *
+     * If sid is not empty, the token is only revoked if it belongs to
+     * this session, so that a client cannot revoke the tokens of others.
+     */
+    virtual bool revoke(const QByteArray &jwt, const QByteArray &sid = QByteArray()) = 0;
+    virtual void revokeAll() = 0;
+    /**
+     * @brief Set the callback called when tokens are revoked
+     *
+     * Connections that were authorized once, like WebSockets, use it
+     * to close themselves when their token is revoked. The callback is
+     * not called anymore once this method returns, so an empty callback
+     * can be set before the callee is destroyed.
+     */
+    virtual void setRevokedCallback(RevokedCallback_t &&revokedCallback) = 0;
     static Ptr create(const QByteArray &key,
                       PasswordChangedCallback_t &&passwordChangedCallback = PasswordChangedCallback_t());
 };
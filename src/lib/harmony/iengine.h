@@ -34,7 +34,11 @@
 
 #include <memory>
 #include <QtCore/QByteArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QUrlQuery>
+#include "harmonyextension.h"
 #include "iauthentificationservice.h"
+#include "iextensionmanager.h"
 
 namespace harmony
 {
@@ -48,6 +52,18 @@ public:
     virtual bool start() = 0;
     virtual bool stop() = 0;
     virtual std::string password() const = 0;
+    virtual void revokeSessions() = 0;
+    /*
+     * Calls an extension endpoint in process, like a request to
+     * /api/extension/endpoint, without HTTP and without token. The
+     * reply has the 404 status if the endpoint does not exist, and 405
+     * if it exists with another type. Works when the server is stopped.
+     */
+    virtual Reply invoke(const std::string &extension, const Endpoint &endpoint,
+                         const QUrlQuery &params, const QJsonDocument &body) const = 0;
+    // Broadcasts of the extensions, called from a dispatcher thread
+    virtual void addCallback(IExtensionManager::ICallback &callback) = 0;
+    virtual void removeCallback(IExtensionManager::ICallback &callback) = 0;
     static Ptr create(const QByteArray &key,
                       IAuthentificationService::PasswordChangedCallback_t &&passwordChangedCallback = IAuthentificationService::PasswordChangedCallback_t(),
                       int port = 8080, const std::string &publicFolder = std::string());
@@ -45,16 +45,39 @@ public:
     {
     public:
         virtual ~ICallback() {}
-        virtual void operator()(const QByteArray &data) const = 0;
+        virtual void operator()(const Broadcast &broadcast) const = 0;
+    };
+    /**
+     * @brief Statistics of the broadcast queue
+     *
+     * depth is the number of broadcasts waiting to be dispatched, and
+     * maxDepth the highest depth that was reached. dropped counts the
+     * broadcasts that were discarded because the queue was full.
+     */
+    struct Statistics
+    {
+        int depth {0};
+        int maxDepth {0};
+        quint64 dispatched {0};
+        quint64 dropped {0};
     };
     using Ptr = std::unique_ptr<IExtensionManager>;
     IExtensionManager & operator=(const IExtensionManager &) = delete;
     IExtensionManager & operator=(IExtensionManager &&) = delete;
     virtual ~IExtensionManager() {}
     virtual std::vector<Extension *> extensions() const = 0;
+    // Callbacks are called from a dispatcher thread, and are not called anymore once removed
     virtual void addCallback(ICallback &callback) = 0;
     virtual void removeCallback(ICallback &callback) = 0;
-    static Ptr create();
+    virtual Statistics statistics() const = 0;
+    // Latest state published on a topic, returns false if there is none
+    virtual bool state(const std::string &topic, quint64 &version, QJsonObject &state) const = 0;
+    /*
+     * Broadcasts are queued, and dispatched by a dedicated thread, so
+     * that emitting them does not block the extension. When more than
+     * queueCapacity broadcasts are waiting, the oldest one is dropped.
+     */
+    static Ptr create(int queueCapacity = 1024);
 };
 
 }
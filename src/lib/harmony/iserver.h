@@ -32,7 +32,10 @@
 #ifndef ISERVER_H
 #define ISERVER_H
 
+#include <cstdint>
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace harmony
 {
@@ -42,6 +45,189 @@ class IExtensionManager;
 class IServer
 {
 public:
+    /**
+     * @brief Server tuning
+     *
+     * Options are applied when the server is started.
+     */
+    struct Options
+    {
+        struct WebSocket
+        {
+            /**
+             * @brief What to do when the outbound queue of a WebSocket is full
+             *
+             * - DropOldest drops the oldest pending message.
+             * - Coalesce replaces a pending message that has the same
+             *   coalescing key, and drops the oldest one otherwise.
+             * - Disconnect closes the WebSocket.
+             */
+            enum class OverflowPolicy
+            {
+                DropOldest,
+                Coalesce,
+                Disconnect
+            };
+            /**
+             * @brief permessage-deflate compression
+             *
+             * The server does not keep its compression context between
+             * messages, so that a broadcast is compressed once for all
+             * the clients. Clients are asked to use a window of at most
+             * clientMaxWindowBits, and to reset their context between
+             * messages if clientContextTakeover is false, which bounds
+             * the memory used per connection. Messages smaller than
+             * minSize are not compressed.
+             */
+            struct Deflate
+            {
+                bool enabled {true};
+                int level {6};
+                int minSize {128};
+                int serverMaxWindowBits {15};
+                int clientMaxWindowBits {12};
+                bool clientContextTakeover {true};
+            };
+            int queueCapacity {256};
+            OverflowPolicy overflowPolicy {OverflowPolicy::DropOldest};
+            /**
+             * @brief Writers, and write timeout in milliseconds
+             *
+             * writerCount threads write the queued messages. They never
+             * wait for a slow client: a message that does not fit in the
+             * socket is kept in the queue, and is tried again later, so
+             * the overflow policy applies while the client does not
+             * read. WebSockets that do not accept any data for
+             * writeTimeout are closed.
+             */
+            int writerCount {2};
+            int writeTimeout {10000};
+            int maxMessageSize {1024 * 1024};
+            Deflate deflate {};
+            /**
+             * @brief Window during which broadcasts are merged, in milliseconds
+             *
+             * Only the broadcasts of coalescedTopics are merged, for topics
+             * where only the latest value matters, like a state: the latest
+             * broadcast of each of these topics is sent at the end of the
+             * window. Broadcasts of the other topics are events, that are
+             * sent immediately. 0 sends all the broadcasts immediately.
+             */
+            int coalesceWindow {0};
+            std::vector<std::string> coalescedTopics {};
+            /**
+             * @brief Heartbeat, in milliseconds
+             *
+             * WebSockets that did not send anything for pingInterval are
+             * pinged, and are closed if they still did not answer after
+             * pingTimeout. 0 disables the heartbeat. The heartbeat thread
+             * also closes the WebSockets whose token expired, so it keeps
+             * running, once per second, when the heartbeat is disabled.
+             */
+            int pingInterval {30000};
+            int pingTimeout {10000};
+            /**
+             * @brief Number of broadcasts kept for clients that resume
+             *
+             * Clients that send {"resume": sequence, "epoch": epoch} get
+             * the broadcasts they missed since sequence, and sequence
+             * numbers from then on. Sequence numbers start again each
+             * time the server starts, with a new epoch, that is sent
+             * back to clients. 0 disables the history.
+             */
+            int historySize {256};
+            /**
+             * @brief Event loop for WebSockets
+             *
+             * If eventLoopPort is not 0, WebSockets are also served on
+             * /api/ws on this port, by a single epoll thread, instead of
+             * holding a civetweb worker thread each. Their messages are
+             * handled by eventLoopWorkers threads. The event loop is a side
+             * loop, that only serves WebSockets: it is not an HTTP backend,
+             * so HTTP requests, event streams, and WebSockets on the main
+             * port are still served by civetweb.
+             *
+             * eventLoopShards event loops listen on the port with
+             * SO_REUSEPORT, and the kernel spreads the connections between
+             * them. Each shard has its own workers. With eventLoopAffinity,
+             * the threads of each shard run on their own CPU.
+             */
+            int eventLoopPort {0};
+            int eventLoopWorkers {2};
+            int eventLoopShards {1};
+            bool eventLoopAffinity {false};
+        };
+        /**
+         * @brief Number of civetweb worker threads
+         *
+         * Requests, WebSockets and event streams hold a worker thread
+         * as long as they are connected, so this bounds the number of
+         * clients that are served at the same time.
+         */
+        int threadCount {50};
+        /**
+         * @brief Listeners for local clients
+         *
+         * If loopbackPort is not 0, the server also serves plain HTTP
+         * on this port, on 127.0.0.1 and ::1. If localSocket is not
+         * empty, WebSockets are also served on /api/ws, without TLS,
+         * on this Unix domain socket. It is in the abstract namespace
+         * if it starts with '@'. Otherwise, the socket file is only
+         * accessible by the user running the server, and a socket left
+         * by a previous run is replaced, but any other kind of file
+         * makes the server fail to start. Local clients still need
+         * tokens.
+         */
+        int loopbackPort {0};
+        std::string localSocket {};
+        /**
+         * @brief Admission control
+         *
+         * At most maxRequests requests, and maxRouteRequests requests
+         * per route, are handled at the same time. Up to maxWaiting other
+         * requests wait at most maxWaitMs for their turn. Requests that
+         * are not admitted are answered with 503 Service Unavailable and
+         * a Retry-After of retryAfter seconds, before their token or body
+         * is read. Every request served over HTTP is limited, including
+         * static files and /ping, and its route is its path. 0 disables
+         * a limit. Event streams and WebSockets are not limited.
+         */
+        struct Admission
+        {
+            int maxRequests {0};
+            int maxRouteRequests {0};
+            int maxWaiting {16};
+            int maxWaitMs {100};
+            int retryAfter {1};
+        };
+        WebSocket webSocket {};
+        Admission admission {};
+    };
+    /**
+     * @brief Load of an event loop shard
+     *
+     * connections is the number of open WebSockets, accepted and
+     * messages are counted since the server started.
+     */
+    struct ShardStatistics
+    {
+        int connections {0};
+        std::uint64_t accepted {0};
+        std::uint64_t messages {0};
+    };
+    /**
+     * @brief Requests admitted and shed by the admission control
+     *
+     * inFlight and waiting are the current numbers of requests, admitted
+     * and shed are counted since the server was created.
+     */
+    struct AdmissionStatistics
+    {
+        int inFlight {0};
+        int waiting {0};
+        std::uint64_t admitted {0};
+        std::uint64_t shed {0};
+    };
     using Ptr = std::unique_ptr<IServer>;
     IServer & operator=(const IServer &) = delete;
     IServer & operator=(IServer &&) = delete;
@@ -50,9 +236,14 @@ public:
     virtual void setPort(int port) = 0;
     virtual std::string publicFolder() const = 0;
     virtual void setPublicFolder(const std::string &publicFolder) = 0;
+    virtual Options options() const = 0;
+    virtual void setOptions(const Options &options) = 0;
     virtual bool isRunning() const = 0;
     virtual bool start() = 0;
     virtual void stop() = 0;
+    // One entry per event loop shard, empty if the event loop is not used
+    virtual std::vector<ShardStatistics> shardStatistics() const = 0;
+    virtual AdmissionStatistics admissionStatistics() const = 0;
     // Do not create multiple servers, not supported by civetweb
     static Ptr create(IAuthentificationService &authentificationService,
                       IExtensionManager &extensionManager,
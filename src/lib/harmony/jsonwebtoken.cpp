@@ -30,21 +30,417 @@
  */
 
 #include "jsonwebtoken.h"
+#include <string.h>
 #include <QtCore/QJsonDocument>
-#include <QtCore/QList>
-#include <QtCore/QMessageAuthenticationCode>
+#include "private/hmacsha256.h"
+
+// Base64url encoded {"alg":"HS256","typ":"JWT"}
+static const char *JWT_HEADER = "eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9";
+static const char *USE_REFRESH = "refresh";
+static const int PAYLOAD_BUFFER_SIZE = 512;
+// Integer claims have at most 18 digits, so that they always fit in a qint64
+static const int MAX_INTEGER_DIGITS = 18;
+static const qint64 MAX_INTEGER = Q_INT64_C(999999999999999999);
+static const QByteArray::Base64Options BASE64_OPTIONS = QByteArray::Base64UrlEncoding | QByteArray::OmitTrailingEquals;
 
 namespace harmony
 {
 
+using HmacSha256 = private_impl::HmacSha256;
+using Claims = JsonWebToken::Claims;
+
 static_assert(std::is_copy_constructible<JsonWebToken>::value, "JsonWebToken must be copy constructible");
 static_assert(std::is_copy_assignable<JsonWebToken>::value, "JsonWebToken must be copy assignable");
 static_assert(std::is_move_constructible<JsonWebToken>::value, "JsonWebToken must be move constructible");
 static_assert(std::is_move_assignable<JsonWebToken>::value, "JsonWebToken must be move assignable");
 
-static QByteArray makeSignature(const QByteArray &jwt, const QByteArray &key)
+static int fromBase64UrlDigit(char digit)
+{
+    if (digit >= 'A' && digit <= 'Z') {
+        return digit - 'A';
+    }
+    if (digit >= 'a' && digit <= 'z') {
+        return digit - 'a' + 26;
+    }
+    if (digit >= '0' && digit <= '9') {
+        return digit - '0' + 52;
+    }
+    if (digit == '-') {
+        return 62;
+    }
+    if (digit == '_') {
+        return 63;
+    }
+    return -1;
+}
+
+// Returns the decoded size, or -1 if the data is not unpadded base64url
+static int fromBase64Url(const char *data, int size, char *decoded, int capacity)
 {
-    return QMessageAuthenticationCode::hash(jwt, key, QCryptographicHash::Sha256).toHex();
+    if (size % 4 == 1 || size * 3 / 4 > capacity) {
+        return -1;
+    }
+
+    quint32 accumulator {0};
+    int bits {0};
+    int decodedSize {0};
+    for (int i = 0; i < size; ++i) {
+        int value = fromBase64UrlDigit(data[i]);
+        if (value < 0) {
+            return -1;
+        }
+        accumulator = (accumulator << 6) | static_cast<quint32>(value);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            decoded[decodedSize++] = static_cast<char>((accumulator >> bits) & 0xff);
+        }
+    }
+    // Non canonical encoding
+    if ((accumulator & ((1u << bits) - 1)) != 0) {
+        return -1;
+    }
+    return decodedSize;
+}
+
+static void skipSpaces(const char *&it, const char *end)
+{
+    while (it != end && (*it == ' ' || *it == '\t' || *it == '\n' || *it == '\r')) {
+        ++it;
+    }
+}
+
+// Reads the closing brace of the object, that can only be followed by spaces
+static bool readObjectEnd(const char *it, const char *end)
+{
+    ++it;
+    skipSpaces(it, end);
+    return it == end;
+}
+
+// Reads a string without escaped characters
+static bool readString(const char *&it, const char *end, const char *&stringBegin, const char *&stringEnd)
+{
+    if (it == end || *it != '"') {
+        return false;
+    }
+    stringBegin = ++it;
+    while (it != end && *it != '"') {
+        if (*it == '\\') {
+            return false;
+        }
+        ++it;
+    }
+    if (it == end) {
+        return false;
+    }
+    stringEnd = it++;
+    return true;
+}
+
+static bool isDigit(char character)
+{
+    return character >= '0' && character <= '9';
+}
+
+static bool readInteger(const char *&it, const char *end, qint64 &value)
+{
+    bool negative = (it != end && *it == '-');
+    if (negative) {
+        ++it;
+    }
+    if (it == end || !isDigit(*it)) {
+        return false;
+    }
+    const char *begin = it;
+    value = 0;
+    while (it != end && isDigit(*it)) {
+        if (it - begin == MAX_INTEGER_DIGITS) {
+            return false;
+        }
+        value = value * 10 + (*it - '0');
+        ++it;
+    }
+    if (negative) {
+        value = -value;
+    }
+    // Fractions and exponents are handled by the slow path
+    return it == end || (*it != '.' && *it != 'e' && *it != 'E');
+}
+
+static bool skipDigits(const char *&it, const char *end)
+{
+    const char *begin = it;
+    while (it != end && isDigit(*it)) {
+        ++it;
+    }
+    return it != begin;
+}
+
+static bool skipKeyword(const char *&it, const char *end, const char *keyword)
+{
+    const int size = strlen(keyword);
+    if (end - it < size || memcmp(it, keyword, size) != 0) {
+        return false;
+    }
+    it += size;
+    return true;
+}
+
+// Skips true, false, null or a number
+static bool skipLiteral(const char *&it, const char *end)
+{
+    if (it == end) {
+        return false;
+    }
+    if (*it == 't') {
+        return skipKeyword(it, end, "true");
+    }
+    if (*it == 'f') {
+        return skipKeyword(it, end, "false");
+    }
+    if (*it == 'n') {
+        return skipKeyword(it, end, "null");
+    }
+
+    if (*it == '-') {
+        ++it;
+    }
+    if (!skipDigits(it, end)) {
+        return false;
+    }
+    if (it != end && *it == '.') {
+        ++it;
+        if (!skipDigits(it, end)) {
+            return false;
+        }
+    }
+    if (it != end && (*it == 'e' || *it == 'E')) {
+        ++it;
+        if (it != end && (*it == '+' || *it == '-')) {
+            ++it;
+        }
+        if (!skipDigits(it, end)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Fast path to read the claims from a flat JSON object, like the one
+ * created by toJwt. It fails on anything unusual, like nested values
+ * or escaped strings, and the caller should then use QJsonDocument.
+ */
+static bool readClaims(const char *it, const char *end, Claims &claims)
+{
+    skipSpaces(it, end);
+    if (it == end || *it != '{') {
+        return false;
+    }
+    ++it;
+    skipSpaces(it, end);
+    if (it != end && *it == '}') {
+        return readObjectEnd(it, end);
+    }
+
+    while (it != end) {
+        const char *keyBegin {nullptr};
+        const char *keyEnd {nullptr};
+        if (!readString(it, end, keyBegin, keyEnd)) {
+            return false;
+        }
+        skipSpaces(it, end);
+        if (it == end || *it != ':') {
+            return false;
+        }
+        ++it;
+        skipSpaces(it, end);
+
+        const int keySize = keyEnd - keyBegin;
+        if (keySize == 3 && memcmp(keyBegin, "iat", 3) == 0) {
+            if (!readInteger(it, end, claims.iat)) {
+                return false;
+            }
+        } else if (keySize == 3 && memcmp(keyBegin, "exp", 3) == 0) {
+            if (!readInteger(it, end, claims.exp)) {
+                return false;
+            }
+        } else if (keySize == 3 && memcmp(keyBegin, "jti", 3) == 0) {
+            const char *valueBegin {nullptr};
+            const char *valueEnd {nullptr};
+            if (!readString(it, end, valueBegin, valueEnd)) {
+                return false;
+            }
+            claims.jti = QByteArray(valueBegin, valueEnd - valueBegin);
+        } else if (keySize == 3 && memcmp(keyBegin, "sid", 3) == 0) {
+            const char *valueBegin {nullptr};
+            const char *valueEnd {nullptr};
+            if (!readString(it, end, valueBegin, valueEnd)) {
+                return false;
+            }
+            claims.sid = QByteArray(valueBegin, valueEnd - valueBegin);
+        } else if (keySize == 3 && memcmp(keyBegin, "use", 3) == 0) {
+            const char *valueBegin {nullptr};
+            const char *valueEnd {nullptr};
+            if (!readString(it, end, valueBegin, valueEnd)) {
+                return false;
+            }
+            const bool refresh = valueEnd - valueBegin == static_cast<int>(strlen(USE_REFRESH))
+                    && memcmp(valueBegin, USE_REFRESH, valueEnd - valueBegin) == 0;
+            claims.use = refresh ? Claims::Use::Refresh : Claims::Use::Access;
+        } else if (it != end && *it == '"') {
+            const char *valueBegin {nullptr};
+            const char *valueEnd {nullptr};
+            if (!readString(it, end, valueBegin, valueEnd)) {
+                return false;
+            }
+        } else if (!skipLiteral(it, end)) {
+            return false;
+        }
+
+        skipSpaces(it, end);
+        if (it == end) {
+            return false;
+        }
+        if (*it == '}') {
+            return readObjectEnd(it, end);
+        }
+        if (*it != ',') {
+            return false;
+        }
+        ++it;
+        skipSpaces(it, end);
+    }
+    return false;
+}
+
+// Out of range values are clamped, since converting them is undefined
+static qint64 integerFromValue(const QJsonValue &value)
+{
+    const double number = value.toDouble();
+    if (number >= MAX_INTEGER) {
+        return MAX_INTEGER;
+    }
+    if (number <= -MAX_INTEGER) {
+        return -MAX_INTEGER;
+    }
+    return static_cast<qint64>(number);
+}
+
+static Claims claimsFromPayload(const QJsonObject &payload)
+{
+    Claims claims {};
+    claims.iat = integerFromValue(payload.value("iat"));
+    claims.exp = integerFromValue(payload.value("exp"));
+    claims.jti = payload.value("jti").toString().toUtf8();
+    claims.sid = payload.value("sid").toString().toUtf8();
+    claims.use = payload.value("use").toString() == USE_REFRESH ? Claims::Use::Refresh : Claims::Use::Access;
+    return claims;
+}
+
+static QJsonObject payloadFromClaims(const Claims &claims)
+{
+    QJsonObject payload {};
+    if (claims.iat != 0) {
+        payload.insert("iat", static_cast<double>(claims.iat));
+    }
+    if (claims.exp != 0) {
+        payload.insert("exp", static_cast<double>(claims.exp));
+    }
+    if (!claims.jti.isEmpty()) {
+        payload.insert("jti", QString::fromUtf8(claims.jti));
+    }
+    if (!claims.sid.isEmpty()) {
+        payload.insert("sid", QString::fromUtf8(claims.sid));
+    }
+    if (claims.use == Claims::Use::Refresh) {
+        payload.insert("use", QString(USE_REFRESH));
+    }
+    return payload;
+}
+
+static bool isNullClaims(const Claims &claims)
+{
+    return claims.iat == 0 && claims.exp == 0 && claims.jti.isEmpty() && claims.sid.isEmpty()
+            && claims.use == Claims::Use::Access;
+}
+
+static bool needsEscaping(const QByteArray &string)
+{
+    for (char character : string) {
+        if (character == '"' || character == '\\' || static_cast<unsigned char>(character) < 0x20) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static QByteArray serializeClaims(const Claims &claims)
+{
+    if (needsEscaping(claims.jti) || needsEscaping(claims.sid)) {
+        return QJsonDocument(payloadFromClaims(claims)).toJson(QJsonDocument::Compact);
+    }
+
+    // Same layout as QJsonDocument, with sorted keys
+    QByteArray json {};
+    json.reserve(64 + claims.jti.size() + claims.sid.size());
+    json.append('{');
+    if (claims.exp != 0) {
+        json.append("\"exp\":");
+        json.append(QByteArray::number(claims.exp));
+    }
+    if (claims.iat != 0) {
+        json.append(json.size() > 1 ? ",\"iat\":" : "\"iat\":");
+        json.append(QByteArray::number(claims.iat));
+    }
+    if (!claims.jti.isEmpty()) {
+        json.append(json.size() > 1 ? ",\"jti\":\"" : "\"jti\":\"");
+        json.append(claims.jti);
+        json.append('"');
+    }
+    if (!claims.sid.isEmpty()) {
+        json.append(json.size() > 1 ? ",\"sid\":\"" : "\"sid\":\"");
+        json.append(claims.sid);
+        json.append('"');
+    }
+    if (claims.use == Claims::Use::Refresh) {
+        json.append(json.size() > 1 ? ",\"use\":\"" : "\"use\":\"");
+        json.append(USE_REFRESH);
+        json.append('"');
+    }
+    json.append('}');
+    return json;
+}
+
+// Checks the shape and the signature of the JWT, and locates the payload
+static bool checkJwt(const HmacSha256 &hmac, const QByteArray &jwt,
+                     const char *&payloadBegin, const char *&payloadEnd)
+{
+    const char *begin = jwt.constData();
+    const char *end = begin + jwt.size();
+    const char *headerEnd = static_cast<const char *>(memchr(begin, '.', end - begin));
+    if (!headerEnd) {
+        return false;
+    }
+    payloadBegin = headerEnd + 1;
+    payloadEnd = static_cast<const char *>(memchr(payloadBegin, '.', end - payloadBegin));
+    if (!payloadEnd) {
+        return false;
+    }
+    const char *signature = payloadEnd + 1;
+    if (memchr(signature, '.', end - signature)) {
+        return false;
+    }
+
+    unsigned char digest[HmacSha256::DIGEST_SIZE];
+    int digestSize = fromBase64Url(signature, end - signature, reinterpret_cast<char *>(digest),
+                                   HmacSha256::DIGEST_SIZE);
+    if (digestSize != HmacSha256::DIGEST_SIZE) {
+        return false;
+    }
+
+    return hmac.verify(begin, payloadEnd - begin, digest);
 }
 
 JsonWebToken::JsonWebToken()
@@ -52,65 +448,95 @@ JsonWebToken::JsonWebToken()
 }
 
 JsonWebToken::JsonWebToken(const QJsonObject &payload)
-    : m_payload{payload}
+    : m_claims{claimsFromPayload(payload)}, m_payload{payload}
+{
+}
+
+JsonWebToken::JsonWebToken(const Claims &claims)
+    : m_claims{claims}
 {
 }
 
 bool JsonWebToken::operator==(const JsonWebToken &other) const
 {
-    return m_payload == other.m_payload;
+    if (m_payload.isEmpty() && other.m_payload.isEmpty()) {
+        return m_claims.iat == other.m_claims.iat && m_claims.exp == other.m_claims.exp
+                && m_claims.jti == other.m_claims.jti && m_claims.sid == other.m_claims.sid
+                && m_claims.use == other.m_claims.use;
+    }
+    return payload() == other.payload();
 }
 
 bool JsonWebToken::isNull() const
 {
-    return m_payload.isEmpty();
+    return m_payload.isEmpty() && isNullClaims(m_claims);
+}
+
+const JsonWebToken::Claims & JsonWebToken::claims() const
+{
+    return m_claims;
 }
 
 QJsonObject JsonWebToken::payload() const
 {
-    return m_payload;
+    if (!m_payload.isEmpty()) {
+        return m_payload;
+    }
+    return payloadFromClaims(m_claims);
 }
 
 QByteArray JsonWebToken::toJwt(const QByteArray &key) const
 {
-    QByteArray jwt {};
+    return JsonWebTokenVerifier(key).toJwt(*this);
+}
+
+JsonWebToken JsonWebToken::fromJwt(const QByteArray &jwt, const QByteArray &key)
+{
+    return JsonWebTokenVerifier(key).fromJwt(jwt);
+}
+
+JsonWebTokenVerifier::JsonWebTokenVerifier(const QByteArray &key)
+    : m_hmac{new HmacSha256(key)}
+{
+}
 
-    QJsonObject header {};
-    header.insert("typ", "JWT");
-    header.insert("alg", "HS256");
-    QJsonDocument headerDocument {header};
-    const QByteArray &headerArray = headerDocument.toJson(QJsonDocument::Compact).toBase64();
+JsonWebTokenVerifier::~JsonWebTokenVerifier()
+{
+}
 
-    QJsonDocument payloadDocument {m_payload};
-    const QByteArray &payloadArray = payloadDocument.toJson(QJsonDocument::Compact).toBase64();
+QByteArray JsonWebTokenVerifier::toJwt(const JsonWebToken &token) const
+{
+    const QByteArray &payloadJson = token.m_payload.isEmpty()
+            ? serializeClaims(token.m_claims) : QJsonDocument(token.m_payload).toJson(QJsonDocument::Compact);
+    const QByteArray &payloadArray = payloadJson.toBase64(BASE64_OPTIONS);
 
-    jwt.append(headerArray);
-    jwt.append(".");
+    QByteArray jwt {};
+    jwt.reserve(strlen(JWT_HEADER) + payloadArray.size() + 2 + (4 * HmacSha256::DIGEST_SIZE + 2) / 3);
+    jwt.append(JWT_HEADER);
+    jwt.append('.');
     jwt.append(payloadArray);
 
-    const QByteArray &signature = makeSignature(jwt, key);
+    unsigned char digest[HmacSha256::DIGEST_SIZE];
+    if (!m_hmac->sign(jwt.constData(), jwt.size(), digest)) {
+        return QByteArray();
+    }
 
-    jwt.append(".");
-    jwt.append(signature);
+    jwt.append('.');
+    jwt.append(QByteArray::fromRawData(reinterpret_cast<const char *>(digest),
+                                       HmacSha256::DIGEST_SIZE).toBase64(BASE64_OPTIONS));
     return jwt;
 }
 
-JsonWebToken JsonWebToken::fromJwt(const QByteArray &jwt, const QByteArray &key)
+JsonWebToken JsonWebTokenVerifier::fromJwt(const QByteArray &jwt) const
 {
-    QList<QByteArray> splitted = jwt.split('.');
-    if (splitted.count() != 3) {
-        return JsonWebToken();
-    }
-    QByteArray message {};
-    message.append(splitted.at(0));
-    message.append(".");
-    message.append(splitted.at(1));
-
-    if (makeSignature(message, key) != splitted.at(2)) {
+    const char *payloadBegin {nullptr};
+    const char *payloadEnd {nullptr};
+    if (!checkJwt(*m_hmac, jwt, payloadBegin, payloadEnd)) {
         return JsonWebToken();
     }
 
-    QJsonDocument document = QJsonDocument::fromJson(QByteArray::fromBase64(splitted.at(1)));
+    const QByteArray &payload = QByteArray::fromRawData(payloadBegin, payloadEnd - payloadBegin);
+    QJsonDocument document = QJsonDocument::fromJson(QByteArray::fromBase64(payload, QByteArray::Base64UrlEncoding));
     if (!document.isObject()) {
         return JsonWebToken();
     }
@@ -118,4 +544,29 @@ JsonWebToken JsonWebToken::fromJwt(const QByteArray &jwt, const QByteArray &key)
     return JsonWebToken(document.object());
 }
 
+bool JsonWebTokenVerifier::verify(const QByteArray &jwt, JsonWebToken::Claims &claims) const
+{
+    const char *payloadBegin {nullptr};
+    const char *payloadEnd {nullptr};
+    if (!checkJwt(*m_hmac, jwt, payloadBegin, payloadEnd)) {
+        return false;
+    }
+
+    char buffer[PAYLOAD_BUFFER_SIZE];
+    int size = fromBase64Url(payloadBegin, payloadEnd - payloadBegin, buffer, PAYLOAD_BUFFER_SIZE);
+    Claims fastClaims {};
+    if (size >= 0 && readClaims(buffer, buffer + size, fastClaims)) {
+        claims = std::move(fastClaims);
+        return true;
+    }
+
+    const QByteArray &payload = QByteArray::fromRawData(payloadBegin, payloadEnd - payloadBegin);
+    QJsonDocument document = QJsonDocument::fromJson(QByteArray::fromBase64(payload, QByteArray::Base64UrlEncoding));
+    if (!document.isObject()) {
+        return false;
+    }
+    claims = claimsFromPayload(document.object());
+    return true;
+}
+
 }
@@ -32,11 +32,17 @@
 #ifndef JSONWEBTOKEN_H
 #define JSONWEBTOKEN_H
 
+#include <memory>
 #include <QtCore/QJsonObject>
 
 namespace harmony
 {
 
+namespace private_impl
+{
+class HmacSha256;
+}
+
 /**
  * @brief A simple implementation of Auth0's jwt
  *
@@ -48,21 +54,75 @@ namespace harmony
  * For more information, visit http://jwt.io.
  *
  * This class only supports HMAC-SHA256 based JSON web tokens.
+ * Tokens are encoded in base64url, with a raw 32 bytes signature.
+ *
+ * Harmony only uses the registered iat, exp and jti claims, a "sid"
+ * claim that identifies the session of the token, and a "use" claim
+ * that marks refresh tokens. They are available through
+ * claims(), that do not require a QJsonObject. An arbitrary payload
+ * can still be used, and is available through payload().
  */
 class JsonWebToken final
 {
 public:
+    struct Claims
+    {
+        enum class Use
+        {
+            Access,
+            Refresh
+        };
+        qint64 iat {0};
+        qint64 exp {0};
+        QByteArray jti {};
+        // Shared by the access and refresh tokens of a session
+        QByteArray sid {};
+        Use use {Use::Access};
+    };
     explicit JsonWebToken();
     explicit JsonWebToken(const QJsonObject &payload);
+    explicit JsonWebToken(const Claims &claims);
     bool operator==(const JsonWebToken &other) const;
     bool isNull() const;
+    const Claims & claims() const;
     QJsonObject payload() const;
     QByteArray toJwt(const QByteArray &key) const;
     static JsonWebToken fromJwt(const QByteArray &jwt, const QByteArray &key);
 private:
+    friend class JsonWebTokenVerifier;
+    Claims m_claims {};
+    // Only set when created from an arbitrary payload
     QJsonObject m_payload {};
 };
 
+/**
+ * @brief Signs and verifies JSON web tokens with a given key
+ *
+ * The HMAC key state is computed once, when the verifier is created,
+ * so that signing and verifying tokens are cheap. Signatures are
+ * compared in constant time.
+ *
+ * JsonWebToken::toJwt and JsonWebToken::fromJwt are convenience
+ * methods that create a temporary verifier.
+ *
+ * toJwt returns an empty array if signing fails, and tokens whose
+ * signature cannot be computed are rejected.
+ */
+class JsonWebTokenVerifier final
+{
+public:
+    explicit JsonWebTokenVerifier(const QByteArray &key);
+    ~JsonWebTokenVerifier();
+    JsonWebTokenVerifier(const JsonWebTokenVerifier &) = delete;
+    JsonWebTokenVerifier & operator=(const JsonWebTokenVerifier &) = delete;
+    QByteArray toJwt(const JsonWebToken &token) const;
+    JsonWebToken fromJwt(const QByteArray &jwt) const;
+    // Only reads the claims, without building a QJsonObject
+    bool verify(const QByteArray &jwt, JsonWebToken::Claims &claims) const;
+private:
+    std::unique_ptr<const private_impl::HmacSha256> m_hmac {};
+};
+
 }
 
 #endif // JSONWEBTOKEN_H
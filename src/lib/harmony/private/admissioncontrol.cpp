@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "admissioncontrol.h"
+
+namespace harmony { namespace private_impl {
+
+AdmissionControl::AdmissionControl()
+{
+}
+
+void AdmissionControl::setOptions(const Options &options)
+{
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        m_options = options;
+    }
+    m_condition.notify_all();
+}
+
+int AdmissionControl::retryAfter() const
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    return m_options.retryAfter;
+}
+
+bool AdmissionControl::acquire(const std::string &route)
+{
+    std::unique_lock<std::mutex> lock {m_mutex};
+    if (!isAvailable(route)) {
+        if (m_statistics.waiting >= m_options.maxWaiting || m_options.maxWaitMs <= 0) {
+            ++m_statistics.shed;
+            return false;
+        }
+        ++m_statistics.waiting;
+        const bool available = m_condition.wait_for(lock, std::chrono::milliseconds(m_options.maxWaitMs), [this, &route]() {
+            return isAvailable(route);
+        });
+        --m_statistics.waiting;
+        if (!available) {
+            ++m_statistics.shed;
+            return false;
+        }
+    }
+    ++m_statistics.inFlight;
+    ++m_routes[route];
+    ++m_statistics.admitted;
+    return true;
+}
+
+void AdmissionControl::release(const std::string &route)
+{
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        --m_statistics.inFlight;
+        auto it = m_routes.find(route);
+        if (it != m_routes.end() && --it->second <= 0) {
+            m_routes.erase(it);
+        }
+    }
+    // Waiters might be waiting for another route
+    m_condition.notify_all();
+}
+
+AdmissionControl::Statistics AdmissionControl::statistics() const
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    return m_statistics;
+}
+
+bool AdmissionControl::isAvailable(const std::string &route) const
+{
+    if (m_options.maxRequests > 0 && m_statistics.inFlight >= m_options.maxRequests) {
+        return false;
+    }
+    if (m_options.maxRouteRequests > 0) {
+        auto it = m_routes.find(route);
+        if (it != m_routes.end() && it->second >= m_options.maxRouteRequests) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}}
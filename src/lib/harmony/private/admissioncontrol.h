@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef ADMISSIONCONTROL_H
+#define ADMISSIONCONTROL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include "iserver.h"
+
+namespace harmony { namespace private_impl {
+
+/**
+ * @brief Limits the number of requests that are handled at the same time
+ *
+ * Requests are admitted while there are less than maxRequests requests
+ * in flight, and less than maxRouteRequests on their route. Other
+ * requests wait for a slot for at most maxWaitMs, if less than
+ * maxWaiting requests are already waiting, and are shed otherwise, so
+ * that bursts are answered quickly instead of piling up in civetweb.
+ */
+class AdmissionControl final
+{
+public:
+    using Options = IServer::Options::Admission;
+    using Statistics = IServer::AdmissionStatistics;
+    explicit AdmissionControl();
+    AdmissionControl(const AdmissionControl &) = delete;
+    AdmissionControl & operator=(const AdmissionControl &) = delete;
+    void setOptions(const Options &options);
+    int retryAfter() const;
+    // Returns false if the request is shed. Admitted requests are released
+    bool acquire(const std::string &route);
+    void release(const std::string &route);
+    Statistics statistics() const;
+private:
+    bool isAvailable(const std::string &route) const;
+    Options m_options {};
+    std::map<std::string, int> m_routes {};
+    Statistics m_statistics {};
+    mutable std::mutex m_mutex {};
+    std::condition_variable m_condition {};
+};
+
+}}
+
+#endif // ADMISSIONCONTROL_H
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "broadcastcoalescer.h"
+
+namespace harmony { namespace private_impl {
+
+BroadcastCoalescer::BroadcastCoalescer(FlushFunction_t flushFunction)
+    : m_flushFunction{std::move(flushFunction)}
+{
+}
+
+BroadcastCoalescer::~BroadcastCoalescer()
+{
+    stop();
+}
+
+void BroadcastCoalescer::start(std::chrono::milliseconds window, const std::vector<std::string> &topics)
+{
+    stop();
+    std::lock_guard<std::mutex> lock {m_mutex};
+    m_window = window;
+    m_coalesced = std::set<std::string>(topics.begin(), topics.end());
+    m_stopping = false;
+    if (m_window.count() > 0 && !m_coalesced.empty()) {
+        m_thread = std::thread(&BroadcastCoalescer::run, this);
+    }
+}
+
+void BroadcastCoalescer::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        m_stopping = true;
+    }
+    m_condition.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    std::lock_guard<std::mutex> lock {m_mutex};
+    m_window = std::chrono::milliseconds(0);
+}
+
+bool BroadcastCoalescer::push(const Broadcast &broadcast)
+{
+    std::unique_lock<std::mutex> lock {m_mutex};
+    if (m_window.count() <= 0 || m_stopping || m_coalesced.find(broadcast.topic()) == m_coalesced.end()) {
+        return false;
+    }
+
+    auto it = m_topics.find(broadcast.topic());
+    if (it != m_topics.end()) {
+        m_pending.erase(it->second);
+        m_topics.erase(it);
+    }
+    const bool empty = m_pending.empty();
+    m_pending.push_back(broadcast);
+    m_topics.emplace(broadcast.topic(), std::prev(m_pending.end()));
+    lock.unlock();
+
+    // Only the first broadcast starts a window
+    if (empty) {
+        m_condition.notify_one();
+    }
+    return true;
+}
+
+int BroadcastCoalescer::count() const
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    return m_pending.size();
+}
+
+void BroadcastCoalescer::run()
+{
+    std::unique_lock<std::mutex> lock {m_mutex};
+    while (true) {
+        m_condition.wait(lock, [this]() {
+            return m_stopping || !m_pending.empty();
+        });
+        if (!m_stopping) {
+            const auto deadline = std::chrono::steady_clock::now() + m_window;
+            m_condition.wait_until(lock, deadline, [this]() {
+                return m_stopping;
+            });
+        }
+
+        std::list<Broadcast> pending {};
+        pending.swap(m_pending);
+        m_topics.clear();
+        const bool stopping = m_stopping;
+        lock.unlock();
+        for (const Broadcast &broadcast : pending) {
+            m_flushFunction(broadcast);
+        }
+        if (stopping) {
+            return;
+        }
+        lock.lock();
+    }
+}
+
+}}
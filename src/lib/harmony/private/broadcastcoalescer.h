@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef BROADCASTCOALESCER_H
+#define BROADCASTCOALESCER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "harmonyextension.h"
+
+namespace harmony { namespace private_impl {
+
+/**
+ * @brief Merges bursts of broadcasts
+ *
+ * Broadcasts of the coalesced topics are held for a window, that starts
+ * with the first pending broadcast. Only the latest broadcast of each
+ * topic is kept, and they are all flushed when the window ends, so that
+ * a storm of updates turns into at most one message per topic and per
+ * window.
+ *
+ * With an empty window, or for the other topics, push returns false and
+ * the caller should send the broadcast by itself.
+ */
+class BroadcastCoalescer final
+{
+public:
+    using FlushFunction_t = std::function<void (const Broadcast &broadcast)>;
+    explicit BroadcastCoalescer(FlushFunction_t flushFunction);
+    ~BroadcastCoalescer();
+    BroadcastCoalescer(const BroadcastCoalescer &) = delete;
+    BroadcastCoalescer & operator=(const BroadcastCoalescer &) = delete;
+    void start(std::chrono::milliseconds window, const std::vector<std::string> &topics);
+    // Flushes the pending broadcasts
+    void stop();
+    bool push(const Broadcast &broadcast);
+    int count() const;
+private:
+    void run();
+    const FlushFunction_t m_flushFunction {};
+    std::chrono::milliseconds m_window {0};
+    std::set<std::string> m_coalesced {};
+    std::list<Broadcast> m_pending {};
+    std::map<std::string, std::list<Broadcast>::iterator> m_topics {};
+    std::thread m_thread {};
+    bool m_stopping {false};
+    mutable std::mutex m_mutex {};
+    std::condition_variable m_condition {};
+};
+
+}}
+
+#endif // BROADCASTCOALESCER_H
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "broadcastdispatcher.h"
+#include <algorithm>
+
+namespace harmony { namespace private_impl {
+
+BroadcastDispatcher::BroadcastDispatcher(int capacity, DispatchFunction_t dispatchFunction)
+    : m_capacity{std::max(capacity, 1)}, m_dispatchFunction{std::move(dispatchFunction)}
+{
+    m_worker = std::thread(&BroadcastDispatcher::run, this);
+}
+
+BroadcastDispatcher::~BroadcastDispatcher()
+{
+    stop();
+}
+
+void BroadcastDispatcher::post(const Broadcast &broadcast)
+{
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        if (m_stopping) {
+            ++m_statistics.dropped;
+            return;
+        }
+        if (static_cast<int>(m_queue.size()) >= m_capacity) {
+            m_queue.pop_front();
+            ++m_statistics.dropped;
+        }
+        m_queue.push_back(broadcast);
+        m_statistics.depth = m_queue.size();
+        m_statistics.maxDepth = std::max(m_statistics.maxDepth, m_statistics.depth);
+    }
+    m_condition.notify_one();
+}
+
+void BroadcastDispatcher::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        m_stopping = true;
+    }
+    m_condition.notify_one();
+    if (m_worker.joinable()) {
+        m_worker.join();
+    }
+}
+
+BroadcastDispatcher::Statistics BroadcastDispatcher::statistics() const
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    return m_statistics;
+}
+
+void BroadcastDispatcher::run()
+{
+    std::unique_lock<std::mutex> lock {m_mutex};
+    while (true) {
+        m_condition.wait(lock, [this]() {
+            return m_stopping || !m_queue.empty();
+        });
+        if (m_queue.empty()) {
+            return;
+        }
+
+        std::deque<Broadcast> queue {};
+        queue.swap(m_queue);
+        m_statistics.depth = 0;
+        lock.unlock();
+        for (const Broadcast &broadcast : queue) {
+            m_dispatchFunction(broadcast);
+        }
+        lock.lock();
+        m_statistics.dispatched += queue.size();
+    }
+}
+
+}}
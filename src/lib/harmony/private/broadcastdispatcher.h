@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef BROADCASTDISPATCHER_H
+#define BROADCASTDISPATCHER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "iextensionmanager.h"
+
+namespace harmony { namespace private_impl {
+
+/**
+ * @brief Dispatches broadcasts from a dedicated thread
+ *
+ * Any thread can post a broadcast, which only queues it. A single
+ * worker takes all the queued broadcasts at once, and dispatches them
+ * in order. The queue is bounded: when it is full, the oldest broadcast
+ * is dropped, so that posting never blocks.
+ */
+class BroadcastDispatcher final
+{
+public:
+    using DispatchFunction_t = std::function<void (const Broadcast &broadcast)>;
+    using Statistics = IExtensionManager::Statistics;
+    explicit BroadcastDispatcher(int capacity, DispatchFunction_t dispatchFunction);
+    ~BroadcastDispatcher();
+    BroadcastDispatcher(const BroadcastDispatcher &) = delete;
+    BroadcastDispatcher & operator=(const BroadcastDispatcher &) = delete;
+    void post(const Broadcast &broadcast);
+    // Dispatches the queued broadcasts, and stops the worker
+    void stop();
+    Statistics statistics() const;
+private:
+    void run();
+    const int m_capacity {0};
+    const DispatchFunction_t m_dispatchFunction {};
+    std::deque<Broadcast> m_queue {};
+    Statistics m_statistics {};
+    bool m_stopping {false};
+    std::thread m_worker {};
+    mutable std::mutex m_mutex {};
+    std::condition_variable m_condition {};
+};
+
+}}
+
+#endif // BROADCASTDISPATCHER_H
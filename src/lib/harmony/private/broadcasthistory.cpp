@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "broadcasthistory.h"
+#include <algorithm>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QtEndian>
+#include <QtCore/QUuid>
+#include <CivetServer.h>
+
+namespace harmony { namespace private_impl {
+
+BroadcastHistory::Entry::Entry(const QByteArray &epoch, quint64 sequence, const Broadcast &broadcast)
+    : m_epoch{epoch}, m_sequence{sequence}, m_broadcast{broadcast}
+{
+}
+
+quint64 BroadcastHistory::Entry::sequence() const
+{
+    return m_sequence;
+}
+
+const Broadcast & BroadcastHistory::Entry::broadcast() const
+{
+    return m_broadcast;
+}
+
+BroadcastHistory::Message_t BroadcastHistory::Entry::message()
+{
+    if (m_message) {
+        return m_message;
+    }
+
+    if (m_broadcast.type() == Broadcast::Type::Binary) {
+        QByteArray payload (sizeof(quint64), '\0');
+        qToBigEndian<quint64>(m_sequence, reinterpret_cast<uchar *>(payload.data()));
+        payload.append(m_broadcast.data());
+        m_message = std::make_shared<WebSocketMessage>(WEBSOCKET_OPCODE_BINARY, payload);
+    } else {
+        QJsonObject object {};
+        object.insert("seq", static_cast<double>(m_sequence));
+        object.insert("topic", QString::fromStdString(m_broadcast.topic()));
+        object.insert("data", QString::fromUtf8(m_broadcast.data()));
+        m_message = std::make_shared<WebSocketMessage>(WEBSOCKET_OPCODE_TEXT,
+                                                       QJsonDocument(object).toJson(QJsonDocument::Compact));
+    }
+    return m_message;
+}
+
+QByteArray BroadcastHistory::Entry::event()
+{
+    if (m_event.isEmpty()) {
+        m_event = BroadcastHistory::event(eventId(m_epoch, m_sequence), m_broadcast);
+    }
+    return m_event;
+}
+
+QByteArray BroadcastHistory::event(const QByteArray &id, const Broadcast &broadcast)
+{
+    QByteArray event {};
+    if (!id.isEmpty()) {
+        event.append("id: ");
+        event.append(id);
+        event.append('\n');
+    }
+    event.append("event: ");
+    event.append(QByteArray::fromStdString(broadcast.topic()));
+    event.append('\n');
+
+    // Each line of the data is a data field
+    const QByteArray &data = broadcast.data();
+    int start {0};
+    do {
+        int end = data.indexOf('\n', start);
+        if (end < 0) {
+            end = data.size();
+        }
+        const int length = end > start && data.at(end - 1) == '\r' ? end - start - 1 : end - start;
+        event.append("data: ");
+        event.append(data.constData() + start, length);
+        event.append('\n');
+        start = end + 1;
+    } while (start <= data.size());
+    event.append('\n');
+    return event;
+}
+
+QByteArray BroadcastHistory::eventId(const QByteArray &epoch, quint64 sequence)
+{
+    QByteArray id {epoch};
+    id.append(':');
+    id.append(QByteArray::number(sequence));
+    return id;
+}
+
+bool BroadcastHistory::parseEventId(const QByteArray &id, QByteArray &epoch, quint64 &sequence)
+{
+    const int separator = id.indexOf(':');
+    if (separator < 0) {
+        return false;
+    }
+    bool ok {false};
+    sequence = id.mid(separator + 1).toULongLong(&ok);
+    epoch = id.left(separator);
+    return ok;
+}
+
+BroadcastHistory::BroadcastHistory(int capacity)
+    : m_capacity{std::max(capacity, 1)}, m_epoch{createEpoch()}
+{
+}
+
+int BroadcastHistory::capacity() const
+{
+    return m_capacity;
+}
+
+QByteArray BroadcastHistory::epoch() const
+{
+    return m_epoch;
+}
+
+quint64 BroadcastHistory::sequence() const
+{
+    return m_sequence;
+}
+
+BroadcastHistory::Entry & BroadcastHistory::push(const Broadcast &broadcast)
+{
+    if (static_cast<int>(m_entries.size()) >= m_capacity) {
+        m_entries.pop_front();
+    }
+    m_entries.emplace_back(m_epoch, ++m_sequence, broadcast);
+    return m_entries.back();
+}
+
+bool BroadcastHistory::since(const QByteArray &epoch, quint64 sequence, std::vector<Entry *> &entries)
+{
+    entries.clear();
+    if (epoch != m_epoch || sequence > m_sequence) {
+        // From an older server
+        return false;
+    }
+    if (sequence == m_sequence) {
+        return true;
+    }
+    if (m_entries.empty() || m_entries.front().sequence() > sequence + 1) {
+        return false;
+    }
+
+    for (Entry &entry : m_entries) {
+        if (entry.sequence() > sequence) {
+            entries.push_back(&entry);
+        }
+    }
+    return true;
+}
+
+// Sequence numbers start again, in a new epoch
+void BroadcastHistory::clear()
+{
+    m_epoch = createEpoch();
+    m_sequence = 0;
+    m_entries.clear();
+}
+
+QByteArray BroadcastHistory::createEpoch()
+{
+    return QUuid::createUuid().toByteArray().mid(1, 8);
+}
+
+}}
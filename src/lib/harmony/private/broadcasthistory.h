@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef BROADCASTHISTORY_H
+#define BROADCASTHISTORY_H
+
+#include <deque>
+#include <memory>
+#include <vector>
+#include <QtCore/QtGlobal>
+#include "harmonyextension.h"
+#include "websocketframe.h"
+
+namespace harmony { namespace private_impl {
+
+/**
+ * @brief Bounded history of the latest broadcasts
+ *
+ * Broadcasts are numbered from 1, and the latest ones are kept, so that
+ * a client that reconnects can get the broadcasts it missed. Sequence
+ * numbers start again with each history, so each history has a random
+ * epoch, and sequence numbers of another epoch cannot be resumed.
+ *
+ * Clients that asked for sequence numbers receive text broadcasts as
+ * {"seq": 1, "topic": "topic", "data": "data"}, and binary broadcasts
+ * prefixed by the sequence number, as a 64 bits big endian integer.
+ * Server-Sent Events clients receive text broadcasts as events, whose
+ * id is epoch:sequence, and whose type is the topic.
+ *
+ * This class is not thread-safe.
+ */
+class BroadcastHistory final
+{
+public:
+    using Message_t = std::shared_ptr<const WebSocketMessage>;
+    class Entry final
+    {
+    public:
+        explicit Entry(const QByteArray &epoch, quint64 sequence, const Broadcast &broadcast);
+        quint64 sequence() const;
+        const Broadcast & broadcast() const;
+        // The message and the event are built once, when a client needs them
+        Message_t message();
+        QByteArray event();
+    private:
+        const QByteArray m_epoch {};
+        const quint64 m_sequence {0};
+        const Broadcast m_broadcast {};
+        Message_t m_message {};
+        QByteArray m_event {};
+    };
+    // Encodes a text broadcast as a Server-Sent Event, without id if id is empty
+    static QByteArray event(const QByteArray &id, const Broadcast &broadcast);
+    static QByteArray eventId(const QByteArray &epoch, quint64 sequence);
+    // Splits an event id built by eventId
+    static bool parseEventId(const QByteArray &id, QByteArray &epoch, quint64 &sequence);
+    explicit BroadcastHistory(int capacity);
+    BroadcastHistory(const BroadcastHistory &) = delete;
+    BroadcastHistory & operator=(const BroadcastHistory &) = delete;
+    int capacity() const;
+    QByteArray epoch() const;
+    quint64 sequence() const;
+    // Records a broadcast, and returns its entry
+    Entry & push(const Broadcast &broadcast);
+    // Returns false if some broadcasts after sequence were evicted, or were never sent in this epoch
+    bool since(const QByteArray &epoch, quint64 sequence, std::vector<Entry *> &entries);
+    void clear();
+private:
+    static QByteArray createEpoch();
+    const int m_capacity {0};
+    QByteArray m_epoch {};
+    quint64 m_sequence {0};
+    std::deque<Entry> m_entries {};
+};
+
+}}
+
+#endif // BROADCASTHISTORY_H
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef COPYONWRITE_H
+#define COPYONWRITE_H
+
+#include <memory>
+#include <mutex>
+
+namespace harmony { namespace private_impl {
+
+/**
+ * @brief RCU-style container for data that is read much more often than written
+ *
+ * Readers load a shared pointer to an immutable version of the data,
+ * without taking any lock, and keep using it for as long as they need.
+ * Writers are serialized: they copy the current version, modify the
+ * copy, and publish it. A version is freed when its last reader
+ * releases it.
+ */
+template<class T>
+class CopyOnWrite final
+{
+public:
+    using Ptr = std::shared_ptr<const T>;
+    explicit CopyOnWrite()
+        : m_data{std::make_shared<const T>()}
+    {
+    }
+    CopyOnWrite(const CopyOnWrite &) = delete;
+    CopyOnWrite & operator=(const CopyOnWrite &) = delete;
+    Ptr load() const
+    {
+        return std::atomic_load(&m_data);
+    }
+    // Function is called with a modifiable copy, and returns true if the copy should be published
+    template<class Function>
+    bool update(Function function)
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        std::shared_ptr<T> data = std::make_shared<T>(*std::atomic_load(&m_data));
+        if (!function(*data)) {
+            return false;
+        }
+        std::atomic_store(&m_data, Ptr(std::move(data)));
+        return true;
+    }
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        std::atomic_store(&m_data, Ptr(std::make_shared<const T>()));
+    }
+private:
+    Ptr m_data {};
+    std::mutex m_mutex {};
+};
+
+}}
+
+#endif // COPYONWRITE_H
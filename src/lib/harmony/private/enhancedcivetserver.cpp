@@ -31,17 +31,54 @@
 
 #include "enhancedcivetserver.h"
 #include <assert.h>
+#include <string.h>
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
 #include <QtCore/QDebug>
+#include <QtCore/QLoggingCategory>
+
+static const int WEBSOCKET_FIN = 0x80;
+static const int WEBSOCKET_RSV1 = 0x40;
+// Close frame payloads, with the 1001 (going away) and 1008 (policy violation) status codes
+static const char CLOSE_GOING_AWAY[] = {'\x03', '\xe9'};
+static const char CLOSE_POLICY_VIOLATION[] = {'\x03', '\xf0'};
+// Deadlines are checked at least this often
+static const int DEADLINE_RESOLUTION_MS = 1000;
+// Largest TLS record, and an upper bound of what TLS adds to each record
+static const int TLS_RECORD_SIZE = 16384;
+static const int TLS_RECORD_OVERHEAD = 64;
 
 namespace harmony { namespace private_impl {
 
-EnhancedCivetServer::EnhancedCivetServer(const char **options, const mg_callbacks *callbacks)
-    : CivetServer(options, callbacks)
+CivetRequestCallbacks::CivetRequestCallbacks(const mg_callbacks &callbacks, CivetRequestHandler *requestHandler)
+    : m_requestCallbacks(callbacks), m_requestHandler{requestHandler}
+{
+}
+
+EnhancedCivetServer::EnhancedCivetServer(const char **options, const mg_callbacks *callbacks,
+                                         const WebSocketOptions &webSocketOptions,
+                                         CivetRequestHandler *requestHandler)
+    : CivetRequestCallbacks(requestCallbacks(callbacks, requestHandler), requestHandler)
+    , CivetServer(options, &m_requestCallbacks), m_webSocketOptions{webSocketOptions}
 {
+    m_heartbeat = std::thread(&EnhancedCivetServer::wsHeartbeat, this);
 }
 
 EnhancedCivetServer::~EnhancedCivetServer()
 {
+    {
+        std::lock_guard<std::mutex> lock (m_mutex);
+        m_stopping = true;
+    }
+    m_heartbeatCondition.notify_all();
+    if (m_heartbeat.joinable()) {
+        m_heartbeat.join();
+    }
     close();
 }
 
@@ -58,9 +95,7 @@ std::string EnhancedCivetServer::getParameters(mg_connection *connection)
 std::string EnhancedCivetServer::getPostData(mg_connection *connection)
 {
     const char *formParams = NULL;
-    const struct mg_request_info *ri = mg_get_request_info(connection);
-    assert(ri != NULL);
-    EnhancedCivetServer *me = static_cast<EnhancedCivetServer *>(ri->user_data);
+    EnhancedCivetServer *me = server(connection);
     assert(me != NULL);
     mg_lock_context(me->context);
     CivetConnection &conobj = me->connections[connection];
@@ -105,73 +140,409 @@ void EnhancedCivetServer::addWebSocketHandler(const std::string &uri, CivetWebSo
 bool EnhancedCivetServer::wsWrite(mg_connection *connection, int opcode, const QByteArray &data)
 {
     int value = mg_websocket_write(connection, opcode, data.data(), data.size());
-    if (value == 0 && wsExists(connection)) {
-        wsRemove(connection);
+    if (value == 0) {
+        wsWriteFailed(connection);
     }
     return value >= 0;
 }
 
+bool EnhancedCivetServer::wsWriteFrame(mg_connection *connection, const QByteArray &frame)
+{
+    // Like mg_websocket_write, but the frame is written with a single call.
+    // Static, so that it can be called by writers while the server is
+    // being destroyed, and close handlers are still running
+    mg_lock_connection(connection);
+    int value = mg_write(connection, frame.data(), frame.size());
+    mg_unlock_connection(connection);
+    if (value == 0) {
+        wsWriteFailed(connection);
+    }
+    return value > 0;
+}
+
+/*
+ * The socket has room for the frame if the bytes that it still has to
+ * send leave enough of its buffer. Frames that are larger than the
+ * buffer are written when it is empty, and might block for the write
+ * timeout at most.
+ */
+WebSocketWriteResult EnhancedCivetServer::wsTryWriteFrame(mg_connection *connection, const QByteArray &frame)
+{
+    const int socket = mg_get_socket(connection);
+    if (socket < 0) {
+        return WebSocketWriteResult::Failed;
+    }
+    int queued {0};
+    int buffer {0};
+    socklen_t size = sizeof(buffer);
+    if (ioctl(socket, SIOCOUTQ, &queued) == 0
+            && getsockopt(socket, SOL_SOCKET, SO_SNDBUF, &buffer, &size) == 0) {
+        // The kernel doubles SO_SNDBUF for its bookkeeping, and TLS adds a header to each record
+        const int needed = frame.size() + (frame.size() / TLS_RECORD_SIZE + 1) * TLS_RECORD_OVERHEAD;
+        if (queued > 0 && buffer / 2 - queued < needed) {
+            return WebSocketWriteResult::WouldBlock;
+        }
+    }
+    return wsWriteFrame(connection, frame) ? WebSocketWriteResult::Written : WebSocketWriteResult::Failed;
+}
+
+WebSocketWriteResult EnhancedCivetServer::wsWriteMessage(mg_connection *connection, const WebSocketMessage &message)
+{
+    EnhancedCivetServer *me = server(connection);
+    const int windowBits = me->wsDeflateWindowBits(connection);
+    if (windowBits > 0) {
+        return wsTryWriteFrame(connection, message.deflatedFrame(me->m_webSocketOptions.deflate, windowBits));
+    }
+    return wsTryWriteFrame(connection, message.frame());
+}
+
+void EnhancedCivetServer::wsClose(mg_connection *connection)
+{
+    // The thread of the connection returns from its blocking read
+    const int socket = mg_get_socket(connection);
+    if (socket >= 0) {
+        shutdown(socket, SHUT_RDWR);
+    }
+}
+
+EnhancedCivetServer * EnhancedCivetServer::server(const mg_connection *connection)
+{
+    const struct mg_request_info *request_info = mg_get_request_info(connection);
+    assert(request_info != NULL);
+    // CivetServer is not the first base class
+    return static_cast<EnhancedCivetServer *>(static_cast<CivetServer *>(request_info->user_data));
+}
+
+mg_callbacks EnhancedCivetServer::requestCallbacks(const mg_callbacks *callbacks,
+                                                   CivetRequestHandler *requestHandler)
+{
+    mg_callbacks requestCallbacks;
+    memset(&requestCallbacks, 0, sizeof(requestCallbacks));
+    if (callbacks) {
+        requestCallbacks = *callbacks;
+    }
+    if (requestHandler) {
+        requestCallbacks.begin_request = &EnhancedCivetServer::beginRequestHandler;
+        requestCallbacks.end_request = &EnhancedCivetServer::endRequestHandler;
+    }
+    return requestCallbacks;
+}
+
+int EnhancedCivetServer::beginRequestHandler(mg_connection *connection)
+{
+    EnhancedCivetServer *me = server(connection);
+    // civetweb does not handle the request any further if not 0
+    return me->m_requestHandler->handleBegin(me, connection) ? 0 : 1;
+}
+
+void EnhancedCivetServer::endRequestHandler(const mg_connection *connection, int status)
+{
+    Q_UNUSED(status);
+    EnhancedCivetServer *me = server(connection);
+    me->m_requestHandler->handleEnd(me, connection);
+}
+
+void EnhancedCivetServer::wsWriteFailed(mg_connection *connection)
+{
+    EnhancedCivetServer *me = server(connection);
+    if (me->wsExists(connection)) {
+        me->wsRemove(connection);
+    }
+}
+
+EnhancedCivetServer::WebSocketEntries_t::const_iterator
+EnhancedCivetServer::wsLowerBound(const WebSocketEntries_t &entries, const mg_connection *connection)
+{
+    return std::lower_bound(entries.begin(), entries.end(), connection,
+                            [](const WebSocketEntry &entry, const mg_connection *value) {
+        return std::less<const mg_connection *>()(entry.connection, value);
+    });
+}
+
+const EnhancedCivetServer::WebSocketEntry * EnhancedCivetServer::wsFind(const WebSocketEntries_t &entries,
+                                                                        const mg_connection *connection)
+{
+    auto it = wsLowerBound(entries, connection);
+    return it != entries.end() && it->connection == connection ? &(*it) : nullptr;
+}
+
 bool EnhancedCivetServer::wsExists(const mg_connection *connection) const
 {
-    std::lock_guard<std::mutex> lock (m_mutex);
-    return m_webSockets.find(connection) != m_webSockets.end();
+    return wsFind(*m_webSockets.load(), connection) != nullptr;
+}
+
+int EnhancedCivetServer::wsDeflateWindowBits(const mg_connection *connection) const
+{
+    const std::shared_ptr<WebSocket> &webSocket = wsState(connection);
+    return webSocket ? webSocket->deflateWindowBits : 0;
+}
+
+// The state outlives the WebSocket for the callers that still use it
+std::shared_ptr<EnhancedCivetServer::WebSocket> EnhancedCivetServer::wsState(const mg_connection *connection) const
+{
+    const CopyOnWrite<WebSocketEntries_t>::Ptr &entries = m_webSockets.load();
+    const WebSocketEntry *entry = wsFind(*entries, connection);
+    return entry ? entry->webSocket : std::shared_ptr<WebSocket>();
 }
 
 void EnhancedCivetServer::wsRemove(const mg_connection *connection)
 {
+    m_webSockets.update([connection](WebSocketEntries_t &entries) {
+        auto it = wsLowerBound(entries, connection);
+        if (it == entries.end() || it->connection != connection) {
+            return false;
+        }
+        entries.erase(it);
+        return true;
+    });
+}
+
+// Any frame from the client proves that it is alive
+bool EnhancedCivetServer::wsAlive(const mg_connection *connection)
+{
+    const std::shared_ptr<WebSocket> &webSocket = wsState(connection);
+    std::lock_guard<std::mutex> lock (m_mutex);
+    if (!webSocket || webSocket->closed) {
+        return false;
+    }
+    webSocket->lastSeen = std::chrono::steady_clock::now();
+    webSocket->pinged = false;
+    return true;
+}
+
+void EnhancedCivetServer::wsSetDeadline(const mg_connection *connection,
+                                        std::chrono::steady_clock::time_point deadline)
+{
+    const std::shared_ptr<WebSocket> &webSocket = wsState(connection);
     std::lock_guard<std::mutex> lock (m_mutex);
-    m_webSockets.erase(connection);
+    if (webSocket) {
+        webSocket->deadline = deadline;
+    }
+}
+
+/*
+ * Single thread that pings idle WebSockets, and closes the ones that
+ * did not answer, or that reached their deadline. Their handler is
+ * notified right away, so that they leave the broadcast set, and their
+ * socket is shut down, so that the civetweb thread that is blocked
+ * reading from a half-open connection is released.
+ */
+void EnhancedCivetServer::wsHeartbeat()
+{
+    const bool heartbeat = m_webSocketOptions.pingInterval > 0 && m_webSocketOptions.pingTimeout > 0;
+    const std::chrono::milliseconds interval {m_webSocketOptions.pingInterval};
+    const std::chrono::milliseconds timeout {m_webSocketOptions.pingTimeout};
+    std::chrono::milliseconds tick {DEADLINE_RESOLUTION_MS};
+    if (heartbeat) {
+        tick = std::min(tick, std::min(interval, timeout));
+    }
+    const QByteArray &ping = WebSocketFrame::build(WEBSOCKET_OPCODE_PING, QByteArray());
+    const QByteArray &goingAway = WebSocketFrame::build(WEBSOCKET_OPCODE_CONNECTION_CLOSE,
+                                                        QByteArray(CLOSE_GOING_AWAY, sizeof(CLOSE_GOING_AWAY)));
+    const QByteArray &expired = WebSocketFrame::build(WEBSOCKET_OPCODE_CONNECTION_CLOSE,
+                                                      QByteArray(CLOSE_POLICY_VIOLATION, sizeof(CLOSE_POLICY_VIOLATION)));
+
+    struct Closed
+    {
+        mg_connection *connection;
+        CivetWebSocketHandler *handler;
+        const QByteArray *frame;
+    };
+
+    std::unique_lock<std::mutex> lock (m_mutex);
+    while (!m_heartbeatCondition.wait_for(lock, tick, [this]() { return m_stopping; })) {
+        const auto now = std::chrono::steady_clock::now();
+        std::vector<mg_connection *> pinged {};
+        std::vector<Closed> closed {};
+        const CopyOnWrite<WebSocketEntries_t>::Ptr &entries = m_webSockets.load();
+        for (const WebSocketEntry &entry : *entries) {
+            mg_connection *connection = const_cast<mg_connection *>(entry.connection);
+            WebSocket &state = *entry.webSocket;
+            if (state.closed) {
+                continue;
+            }
+            if (now >= state.deadline) {
+                state.closed = true;
+                closed.push_back({connection, state.handler, &expired});
+                m_heartbeatBusy.insert(connection);
+            } else if (heartbeat && state.pinged && now - state.lastSeen >= interval + timeout) {
+                state.closed = true;
+                closed.push_back({connection, state.handler, &goingAway});
+                m_heartbeatBusy.insert(connection);
+            } else if (heartbeat && !state.pinged && now - state.lastSeen >= interval) {
+                state.pinged = true;
+                pinged.push_back(connection);
+                m_heartbeatBusy.insert(connection);
+            }
+        }
+        if (pinged.empty() && closed.empty()) {
+            continue;
+        }
+        lock.unlock();
+
+        // Slow clients are not waited for, and are closed if they do not answer
+        for (mg_connection *connection : pinged) {
+            wsTryWriteFrame(connection, ping);
+        }
+        for (const Closed &entry : closed) {
+#ifdef HARMONY_DEBUG
+            qCDebug(QLoggingCategory("enhanced-civet-server")) << "Closing WebSocket" << entry.connection;
+#endif
+            wsTryWriteFrame(entry.connection, *entry.frame);
+            entry.handler->handleClose(this, entry.connection);
+            // The connection is not released while it is busy
+            wsClose(entry.connection);
+        }
+
+        lock.lock();
+        m_heartbeatBusy.clear();
+        m_heartbeatCondition.notify_all();
+    }
 }
 
 int EnhancedCivetServer::wsConnectHandler(const mg_connection *connection, void *cwData)
 {
-    const struct mg_request_info *request_info = mg_get_request_info(connection);
-    assert(request_info != NULL);
-    EnhancedCivetServer *me = static_cast<EnhancedCivetServer *>(request_info->user_data);
+    EnhancedCivetServer *me = server(connection);
     assert (!me->wsExists(connection));
 
     bool ok = static_cast<CivetWebSocketHandler *>(cwData)->handleConnect(me, connection);
-    if (ok) {
-        std::lock_guard<std::mutex> lock (me->m_mutex);
-        me->m_webSockets.insert(connection);
+    if (!ok) {
+        return 1;
+    }
+
+    std::shared_ptr<WebSocket> webSocket {std::make_shared<WebSocket>()};
+    webSocket->handler = static_cast<CivetWebSocketHandler *>(cwData);
+    const char *offers = mg_get_header(connection, "Sec-WebSocket-Extensions");
+    QByteArray extensions {};
+    if (offers) {
+        PerMessageDeflate::Parameters parameters {};
+        extensions = PerMessageDeflate::negotiate(me->m_webSocketOptions.deflate, offers, parameters);
+        if (!extensions.isEmpty()) {
+            webSocket->deflateWindowBits = parameters.serverMaxWindowBits;
+            webSocket->inflater.reset(new Inflater(parameters, me->m_webSocketOptions.maxMessageSize));
+        }
+    }
+
+    me->m_webSockets.update([connection, &webSocket](WebSocketEntries_t &entries) {
+        entries.insert(wsLowerBound(entries, connection), WebSocketEntry {connection, std::move(webSocket)});
+        return true;
+    });
+
+    if (!extensions.isEmpty()) {
+        // Written by civetweb in the handshake, right after this handler
+        const QByteArray &headers = "Sec-WebSocket-Extensions: " + extensions + "\r\n";
+        mg_set_websocket_handshake_headers(connection, headers.constData());
     }
 
-    return ok ? 0 : 1; // Accept when returing true
+    return 0; // Accept when returning 0
 }
 
 void EnhancedCivetServer::wsReadyHandler(mg_connection *connection, void *cwData)
 {
-    const struct mg_request_info *request_info = mg_get_request_info(connection);
-    assert(request_info != NULL);
-    EnhancedCivetServer *me = static_cast<EnhancedCivetServer *>(request_info->user_data);
+    EnhancedCivetServer *me = server(connection);
     assert (me->wsExists(connection));
+    // Writes that do not fit in the socket fail after the write timeout, instead of blocking
+    const int socket = mg_get_socket(connection);
+    if (socket >= 0 && me->m_webSocketOptions.writeTimeout > 0) {
+        timeval timeout {};
+        timeout.tv_sec = me->m_webSocketOptions.writeTimeout / 1000;
+        timeout.tv_usec = (me->m_webSocketOptions.writeTimeout % 1000) * 1000;
+        setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
     static_cast<CivetWebSocketHandler *>(cwData)->handleReady(me, connection);
 }
 
 int EnhancedCivetServer::wsDataHandler(mg_connection *connection, int bits, char *data, size_t len, void *cwData)
 {
-    const struct mg_request_info *request_info = mg_get_request_info(connection);
-    assert(request_info != NULL);
-    EnhancedCivetServer *me = static_cast<EnhancedCivetServer *>(request_info->user_data);
-    assert (me->wsExists(connection));
-    int opcode = bits & 0xf;
-    if (opcode != WEBSOCKET_OPCODE_TEXT && opcode != WEBSOCKET_OPCODE_BINARY) {
+    EnhancedCivetServer *me = server(connection);
+    if (!me->wsAlive(connection)) {
+        // Closed by the heartbeat
+        return 0;
+    }
+    switch (bits & 0xf) {
+    case WEBSOCKET_OPCODE_PING:
+        return wsWriteFrame(connection, WebSocketFrame::build(WEBSOCKET_OPCODE_PONG, QByteArray(data, len))) ? 1 : 0;
+    case WEBSOCKET_OPCODE_PONG:
+        return 1;
+    case WEBSOCKET_OPCODE_CONTINUATION:
+    case WEBSOCKET_OPCODE_TEXT:
+    case WEBSOCKET_OPCODE_BINARY:
+        // Close handler handles removal of the websocket
+        return me->wsHandleMessage(connection, static_cast<CivetWebSocketHandler *>(cwData), bits, data, len) ? 1 : 0;
+    default:
         return 0;
     }
+}
+
+bool EnhancedCivetServer::wsHandleMessage(mg_connection *connection, CivetWebSocketHandler *handler,
+                                          int bits, const char *data, size_t len)
+{
+    // Only the thread of the connection uses its fragments
+    const std::shared_ptr<WebSocket> &webSocket = wsState(connection);
+    const int opcode = bits & 0xf;
+    const bool fin = (bits & WEBSOCKET_FIN) != 0;
+    const bool compressed = (bits & WEBSOCKET_RSV1) != 0;
+    if (!webSocket || (compressed && webSocket->deflateWindowBits == 0)) {
+        return false;
+    }
+
+    // Fast path: an uncompressed message in a single frame
+    if (fin && !compressed && opcode != WEBSOCKET_OPCODE_CONTINUATION && webSocket->fragmentsBits == 0) {
+        return handler->handleData(this, connection, bits, data, len);
+    }
+
+    if (opcode == WEBSOCKET_OPCODE_CONTINUATION) {
+        if (webSocket->fragmentsBits == 0) {
+            return false;
+        }
+        webSocket->fragments.append(data, len);
+    } else {
+        if (webSocket->fragmentsBits != 0) {
+            return false;
+        }
+        webSocket->fragmentsBits = bits;
+        webSocket->fragments = QByteArray(data, len);
+    }
+
+    if (webSocket->fragments.size() > m_webSocketOptions.maxMessageSize) {
+        return false;
+    }
+    if (!fin) {
+        return true;
+    }
+
+    QByteArray message {};
+    message.swap(webSocket->fragments);
+    const int messageBits = webSocket->fragmentsBits;
+    webSocket->fragmentsBits = 0;
+    if ((messageBits & WEBSOCKET_RSV1) != 0) {
+        QByteArray inflated {};
+        if (!webSocket->inflater->inflate(message, inflated)) {
+            return false;
+        }
+        message.swap(inflated);
+    }
 
-    // Close handler handles removal of the websocket
-    return static_cast<CivetWebSocketHandler *>(cwData)->handleData(me, connection, bits, data, len) ? 1 : 0;
+    return handler->handleData(this, connection, WEBSOCKET_FIN | (messageBits & 0xf), message.constData(), message.size());
 }
 
 void EnhancedCivetServer::wsCloseHandler(const mg_connection *connection, void *cwData)
 {
-    const struct mg_request_info *request_info = mg_get_request_info(connection);
-    assert(request_info != NULL);
-    EnhancedCivetServer *me = static_cast<EnhancedCivetServer *>(request_info->user_data);
-    assert (me->wsExists(connection));
-    static_cast<CivetWebSocketHandler *>(cwData)->handleClose(me, connection);
+    EnhancedCivetServer *me = server(connection);
+    bool closed {false};
+    {
+        // The connection is released after this handler
+        std::unique_lock<std::mutex> lock (me->m_mutex);
+        me->m_heartbeatCondition.wait(lock, [me, connection]() {
+            return me->m_heartbeatBusy.find(connection) == me->m_heartbeatBusy.end();
+        });
+        const std::shared_ptr<WebSocket> &webSocket = me->wsState(connection);
+        closed = webSocket && webSocket->closed;
+    }
+    if (!closed) {
+        static_cast<CivetWebSocketHandler *>(cwData)->handleClose(me, connection);
+    }
     me->wsRemove(connection);
 }
 
 }}
-
@@ -33,9 +33,18 @@
 #define ENHANCEDCIVETSERVER_H
 
 #include <CivetServer.h>
-#include <set>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
 #include <QtCore/QByteArray>
+#include "copyonwrite.h"
+#include "iserver.h"
+#include "permessagedeflate.h"
+#include "websocketframe.h"
 
 namespace harmony { namespace private_impl {
 
@@ -53,25 +62,101 @@ public:
     virtual void handleClose(EnhancedCivetServer *server, const mg_connection *connection) = 0;
 };
 
-class EnhancedCivetServer final : public CivetServer
+class CivetRequestHandler
+{
+public:
+    virtual ~CivetRequestHandler() {}
+    CivetRequestHandler & operator=(const CivetRequestHandler &) = delete;
+    CivetRequestHandler & operator=(CivetRequestHandler &&) = delete;
+    // Called before any request is handled, returns false if the request is already answered
+    virtual bool handleBegin(EnhancedCivetServer *server, mg_connection *connection) = 0;
+    // Called once the request is handled, even if handleBegin answered it
+    virtual void handleEnd(EnhancedCivetServer *server, const mg_connection *connection) = 0;
+};
+
+// Used by civetweb as soon as CivetServer is constructed, so it is a base
+// class of EnhancedCivetServer, that is constructed before CivetServer
+struct CivetRequestCallbacks
+{
+    explicit CivetRequestCallbacks(const mg_callbacks &callbacks, CivetRequestHandler *requestHandler);
+    const mg_callbacks m_requestCallbacks;
+    CivetRequestHandler * const m_requestHandler;
+};
+
+class EnhancedCivetServer final : private CivetRequestCallbacks, public CivetServer
 {
 public:
-    EnhancedCivetServer(const char **options, const struct mg_callbacks *callbacks = 0);
+    using WebSocketOptions = IServer::Options::WebSocket;
+    // requestHandler, if set, is called for every request, including WebSocket handshakes
+    EnhancedCivetServer(const char **options, const struct mg_callbacks *callbacks = 0,
+                        const WebSocketOptions &webSocketOptions = WebSocketOptions(),
+                        CivetRequestHandler *requestHandler = nullptr);
     ~EnhancedCivetServer();
     static std::string getParameters(mg_connection *connection);
     static std::string getPostData(mg_connection *connection);
     void addWebSocketHandler(const std::string &uri, CivetWebSocketHandler *handler);
     // These methods do not perform any check on mg_connection
-    bool wsWrite(mg_connection *connection, int opcode, const QByteArray &data);
+    static bool wsWrite(mg_connection *connection, int opcode, const QByteArray &data);
+    // Writes a frame built by WebSocketFrame, blocking at most for the write timeout
+    static bool wsWriteFrame(mg_connection *connection, const QByteArray &frame);
+    // Writes a frame only if the socket has room for it, so that it does not block
+    static WebSocketWriteResult wsTryWriteFrame(mg_connection *connection, const QByteArray &frame);
+    // Writes the compressed frame if the connection negotiated permessage-deflate, without blocking
+    static WebSocketWriteResult wsWriteMessage(mg_connection *connection, const WebSocketMessage &message);
+    // Shuts the socket down, so that the close handler is called when civetweb notices it
+    static void wsClose(mg_connection *connection);
+    // The WebSocket is closed when the deadline is reached
+    void wsSetDeadline(const mg_connection *connection, std::chrono::steady_clock::time_point deadline);
 private:
+    struct WebSocket
+    {
+        CivetWebSocketHandler *handler {nullptr};
+        // Heartbeat, used under m_mutex
+        std::chrono::steady_clock::time_point lastSeen {std::chrono::steady_clock::now()};
+        bool pinged {false};
+        bool closed {false};
+        std::chrono::steady_clock::time_point deadline {std::chrono::steady_clock::time_point::max()};
+        // Window of the compressed messages, 0 without permessage-deflate. Set before the WebSocket is published
+        int deflateWindowBits {0};
+        std::unique_ptr<Inflater> inflater {};
+        // Fragments of the message being received, only used by the thread of the connection
+        QByteArray fragments {};
+        int fragmentsBits {0};
+    };
+    struct WebSocketEntry
+    {
+        const mg_connection *connection;
+        std::shared_ptr<WebSocket> webSocket;
+    };
+    using WebSocketEntries_t = std::vector<WebSocketEntry>;
+    static EnhancedCivetServer * server(const mg_connection *connection);
+    static mg_callbacks requestCallbacks(const mg_callbacks *callbacks, CivetRequestHandler *requestHandler);
+    static int beginRequestHandler(mg_connection *connection);
+    static void endRequestHandler(const mg_connection *connection, int status);
+    static WebSocketEntries_t::const_iterator wsLowerBound(const WebSocketEntries_t &entries,
+                                                           const mg_connection *connection);
+    static const WebSocketEntry * wsFind(const WebSocketEntries_t &entries, const mg_connection *connection);
+    static void wsWriteFailed(mg_connection *connection);
     bool wsExists(const mg_connection *connection) const;
+    int wsDeflateWindowBits(const mg_connection *connection) const;
+    std::shared_ptr<WebSocket> wsState(const mg_connection *connection) const;
     void wsRemove(const mg_connection *connection);
+    bool wsAlive(const mg_connection *connection);
+    void wsHeartbeat();
+    bool wsHandleMessage(mg_connection *connection, CivetWebSocketHandler *handler, int bits, const char *data, size_t len);
     static int wsConnectHandler(const mg_connection *connection, void *cwData);
     static void wsReadyHandler(mg_connection *connection, void *cwData);
     static int wsDataHandler(mg_connection *connection, int bits, char *data, size_t len, void *cwData);
     static void wsCloseHandler(const mg_connection *connection, void *cwData);
-    std::set<const mg_connection *> m_webSockets;
+    const WebSocketOptions m_webSocketOptions;
+    // WebSockets, sorted by connection, and looked up without locking on every frame
+    CopyOnWrite<WebSocketEntries_t> m_webSockets;
+    // WebSockets used by the heartbeat, that should not be released yet
+    std::set<const mg_connection *> m_heartbeatBusy;
+    std::thread m_heartbeat;
+    bool m_stopping {false};
     mutable std::mutex m_mutex;
+    std::condition_variable m_heartbeatCondition;
 };
 
 }}
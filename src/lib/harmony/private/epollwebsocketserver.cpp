@@ -0,0 +1,1084 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "epollwebsocketserver.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <openssl/err.h>
+#include <openssl/sha.h>
+#include <openssl/ssl.h>
+#include <CivetServer.h>
+#include <QtCore/QDebug>
+#include <QtCore/QList>
+#include <QtCore/QLoggingCategory>
+
+static const int WEBSOCKET_FIN = 0x80;
+static const int WEBSOCKET_RSV1 = 0x40;
+static const int WEBSOCKET_RSV2_RSV3 = 0x30;
+static const int WEBSOCKET_MASKED = 0x80;
+// Close frame payloads, with the 1000, 1001, 1002, 1008 and 1009 status codes
+static const char CLOSE_NORMAL[] = {'\x03', '\xe8'};
+static const char CLOSE_GOING_AWAY[] = {'\x03', '\xe9'};
+static const char CLOSE_PROTOCOL_ERROR[] = {'\x03', '\xea'};
+static const char CLOSE_POLICY_VIOLATION[] = {'\x03', '\xf0'};
+static const char CLOSE_TOO_BIG[] = {'\x03', '\xf1'};
+static const char WEBSOCKET_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+static const int MAX_EVENTS = 64;
+static const int READ_SIZE = 16384;
+static const int MAX_HEADER_SIZE = 8192;
+// Writes would block while more than this is waiting to be sent to a connection
+static const int OUTPUT_HIGH_WATER = 256 * 1024;
+// Connections that do not finish their handshake, or their closing handshake, are dropped
+static const int HANDSHAKE_TIMEOUT_MS = 10000;
+static const int CLOSE_TIMEOUT_MS = 5000;
+// Deadlines are checked at least this often
+static const int DEADLINE_RESOLUTION_MS = 1000;
+
+namespace harmony { namespace private_impl {
+
+EpollWebSocketServer::Connection::Connection(int fd, ssl_st *ssl)
+    : fd{fd}, ssl{ssl}, accepted{ssl == nullptr}
+{
+}
+
+EpollWebSocketServer::EpollWebSocketServer(int port, const std::string &certificatePath, const std::string &uri,
+                                           IHandler &handler, const WebSocketOptions &options, int workerCount,
+                                           int cpu)
+    : m_uri{uri}, m_handler{handler}, m_options{options}
+{
+    // Like civetweb, write to closed sockets without being killed
+    signal(SIGPIPE, SIG_IGN);
+    try {
+        if (!certificatePath.empty()) {
+            SSL_library_init();
+            SSL_load_error_strings();
+            m_context = SSL_CTX_new(SSLv23_server_method());
+            if (!m_context
+                || SSL_CTX_use_certificate_chain_file(m_context, certificatePath.c_str()) != 1
+                || SSL_CTX_use_PrivateKey_file(m_context, certificatePath.c_str(), SSL_FILETYPE_PEM) != 1) {
+                throw Exception("Failed to load the certificate");
+            }
+            SSL_CTX_set_options(m_context, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+            // Idle connections do not keep their buffers
+            SSL_CTX_set_mode(m_context, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER
+                                        | SSL_MODE_RELEASE_BUFFERS);
+        }
+        listen(port);
+        open();
+    } catch (const Exception &) {
+        release();
+        throw;
+    }
+    startThreads(workerCount, cpu);
+}
+
+EpollWebSocketServer::EpollWebSocketServer(const std::string &localPath, const std::string &uri, IHandler &handler,
+                                           const WebSocketOptions &options, int workerCount)
+    : m_uri{uri}, m_handler{handler}, m_options{options}
+{
+    signal(SIGPIPE, SIG_IGN);
+    try {
+        listenLocal(localPath);
+        open();
+    } catch (const Exception &) {
+        release();
+        throw;
+    }
+    startThreads(workerCount, -1);
+}
+
+EpollWebSocketServer::~EpollWebSocketServer()
+{
+    stop();
+    release();
+}
+
+void EpollWebSocketServer::open()
+{
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    m_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_epoll < 0 || m_wake < 0) {
+        throw Exception("Failed to create the event loop");
+    }
+    epoll_event event {};
+    event.events = EPOLLIN;
+    event.data.ptr = &m_listener;
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_listener, &event) != 0) {
+        throw Exception("Failed to watch the listening socket");
+    }
+    event.data.ptr = &m_wake;
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wake, &event) != 0) {
+        throw Exception("Failed to watch the wake up event");
+    }
+}
+
+void EpollWebSocketServer::startThreads(int workerCount, int cpu)
+{
+    m_loop = std::thread(&EpollWebSocketServer::run, this);
+    for (int i = 0; i < std::max(workerCount, 1); ++i) {
+        m_workers.emplace_back(&EpollWebSocketServer::work, this);
+    }
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_setaffinity_np(m_loop.native_handle(), sizeof(cpus), &cpus);
+        for (std::thread &worker : m_workers) {
+            pthread_setaffinity_np(worker.native_handle(), sizeof(cpus), &cpus);
+        }
+    }
+}
+
+void EpollWebSocketServer::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        m_stopping = true;
+    }
+    wake();
+    if (m_loop.joinable()) {
+        m_loop.join();
+    }
+
+    // The close handlers that were posted by the event loop are called first
+    {
+        std::lock_guard<std::mutex> lock {m_workersMutex};
+        m_workersStopping = true;
+    }
+    m_workersCondition.notify_all();
+    for (std::thread &worker : m_workers) {
+        worker.join();
+    }
+    m_workers.clear();
+}
+
+bool EpollWebSocketServer::wsExists(const mg_connection *connection) const
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    return m_webSockets.find(connection) != m_webSockets.end();
+}
+
+WebSocketWriteResult EpollWebSocketServer::wsWriteMessage(mg_connection *connection, const WebSocketMessage &message)
+{
+    ConnectionPtr state {};
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        auto it = m_webSockets.find(connection);
+        if (it == m_webSockets.end()) {
+            return WebSocketWriteResult::Failed;
+        }
+        state = it->second;
+    }
+
+    const QByteArray &frame = state->deflate ? message.deflatedFrame(m_options.deflate, state->deflateWindowBits)
+                                             : message.frame();
+    bool scheduled {false};
+    {
+        std::lock_guard<std::mutex> lock {state->mutex};
+        if (state->closed) {
+            return WebSocketWriteResult::Failed;
+        }
+        // Frames larger than the limit are queued once the output is empty
+        if (!state->output.isEmpty() && state->output.size() + frame.size() > OUTPUT_HIGH_WATER) {
+            return WebSocketWriteResult::WouldBlock;
+        }
+        state->output.append(frame);
+        scheduled = !state->flushScheduled;
+        state->flushScheduled = true;
+    }
+    if (scheduled) {
+        {
+            std::lock_guard<std::mutex> lock {m_mutex};
+            m_flushes.push_back(state);
+        }
+        wake();
+    }
+    return WebSocketWriteResult::Written;
+}
+
+void EpollWebSocketServer::wsClose(mg_connection *connection)
+{
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        auto it = m_webSockets.find(connection);
+        if (it == m_webSockets.end()) {
+            return;
+        }
+        m_closes.push_back(it->second);
+    }
+    wake();
+}
+
+void EpollWebSocketServer::wsSetDeadline(const mg_connection *connection,
+                                         std::chrono::steady_clock::time_point deadline)
+{
+    ConnectionPtr state {};
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        auto it = m_webSockets.find(connection);
+        if (it == m_webSockets.end()) {
+            return;
+        }
+        state = it->second;
+    }
+    std::lock_guard<std::mutex> lock {state->mutex};
+    state->deadline = deadline;
+}
+
+int EpollWebSocketServer::count() const
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    return m_webSockets.size();
+}
+
+EpollWebSocketServer::Statistics EpollWebSocketServer::statistics() const
+{
+    Statistics statistics {};
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        statistics.connections = m_webSockets.size();
+        statistics.accepted = m_accepted;
+    }
+    std::lock_guard<std::mutex> lock {m_workersMutex};
+    statistics.messages = m_messages;
+    return statistics;
+}
+
+mg_connection * EpollWebSocketServer::handle(Connection *connection)
+{
+    return reinterpret_cast<mg_connection *>(connection);
+}
+
+void EpollWebSocketServer::release()
+{
+    if (m_listener >= 0) {
+        ::close(m_listener);
+        m_listener = -1;
+    }
+    if (!m_localPath.empty()) {
+        unlink(m_localPath.c_str());
+        m_localPath.clear();
+    }
+    if (m_wake >= 0) {
+        ::close(m_wake);
+        m_wake = -1;
+    }
+    if (m_epoll >= 0) {
+        ::close(m_epoll);
+        m_epoll = -1;
+    }
+    if (m_context) {
+        SSL_CTX_free(m_context);
+        m_context = nullptr;
+    }
+}
+
+void EpollWebSocketServer::listen(int port)
+{
+    m_listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_listener < 0) {
+        throw Exception("Failed to create the listening socket");
+    }
+    // Shards listen on the same port, and the kernel balances the connections between them
+    int reuse {1};
+    setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (setsockopt(m_listener, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) != 0) {
+        throw Exception("Failed to share port " + std::to_string(port));
+    }
+    sockaddr_in address {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(m_listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0
+        || ::listen(m_listener, SOMAXCONN) != 0) {
+        throw Exception("Failed to listen on port " + std::to_string(port));
+    }
+}
+
+// Paths that start with @ are in the abstract namespace, and are not files
+void EpollWebSocketServer::listenLocal(const std::string &path)
+{
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        throw Exception("Invalid local socket path " + path);
+    }
+    std::copy(path.begin(), path.end(), address.sun_path);
+    const bool abstract = path.front() == '@';
+    if (abstract) {
+        address.sun_path[0] = '\0';
+    } else {
+        // Replaces the socket of a previous run, but nothing else
+        struct stat status {};
+        if (lstat(path.c_str(), &status) == 0) {
+            if (!S_ISSOCK(status.st_mode)) {
+                throw Exception("Not replacing " + path + ", that is not a socket");
+            }
+            unlink(path.c_str());
+        }
+    }
+
+    m_listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_listener < 0) {
+        throw Exception("Failed to create the local socket");
+    }
+    const socklen_t size = offsetof(sockaddr_un, sun_path) + path.size() + (abstract ? 0 : 1);
+    if (bind(m_listener, reinterpret_cast<sockaddr *>(&address), size) != 0) {
+        throw Exception("Failed to bind " + path);
+    }
+    if (!abstract) {
+        m_localPath = path;
+        // Only the user running the server can connect, whatever the umask
+        if (chmod(path.c_str(), S_IRUSR | S_IWUSR) != 0) {
+            throw Exception("Failed to set the permissions of " + path);
+        }
+    }
+    if (::listen(m_listener, SOMAXCONN) != 0) {
+        throw Exception("Failed to listen on " + path);
+    }
+}
+
+void EpollWebSocketServer::run()
+{
+    std::chrono::milliseconds tick {DEADLINE_RESOLUTION_MS};
+    if (m_options.pingInterval > 0 && m_options.pingTimeout > 0) {
+        tick = std::min(tick, std::min(std::chrono::milliseconds(m_options.pingInterval),
+                                       std::chrono::milliseconds(m_options.pingTimeout)));
+    }
+    auto nextTick = std::chrono::steady_clock::now() + tick;
+
+    epoll_event events[MAX_EVENTS];
+    while (true) {
+        const auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(nextTick - std::chrono::steady_clock::now());
+        const int count = epoll_wait(m_epoll, events, MAX_EVENTS, std::max<int>(timeout.count(), 0));
+        if (count < 0 && errno != EINTR) {
+            qCWarning(QLoggingCategory("epoll-websocket-server")) << "epoll_wait failed" << errno;
+            return;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            void *data = events[i].data.ptr;
+            if (data == &m_listener) {
+                accept();
+                continue;
+            }
+            if (data == &m_wake) {
+                uint64_t value {0};
+                while (::read(m_wake, &value, sizeof(value)) > 0) {
+                }
+                continue;
+            }
+            // The connection might have been dropped while handling a previous event
+            Connection *connection = static_cast<Connection *>(data);
+            if (m_connections.find(connection) == m_connections.end()) {
+                continue;
+            }
+            if ((events[i].events & (EPOLLERR | EPOLLHUP)) != 0 && (events[i].events & EPOLLIN) == 0) {
+                destroy(*connection);
+                continue;
+            }
+            process(*connection);
+        }
+
+        // Frames queued by the writers, and connections rejected by the handler or closed by the writers
+        std::vector<ConnectionPtr> flushes {};
+        std::vector<ConnectionPtr> rejected {};
+        std::vector<ConnectionPtr> closes {};
+        bool stopping {false};
+        {
+            std::lock_guard<std::mutex> lock {m_mutex};
+            flushes.swap(m_flushes);
+            rejected.swap(m_rejected);
+            closes.swap(m_closes);
+            stopping = m_stopping;
+        }
+        for (const ConnectionPtr &connection : rejected) {
+            if (m_connections.find(connection.get()) != m_connections.end()) {
+                close(*connection, CLOSE_NORMAL);
+                send(*connection);
+            }
+        }
+        // Writers send their own close frame
+        for (const ConnectionPtr &connection : closes) {
+            if (m_connections.find(connection.get()) != m_connections.end()) {
+                close(*connection, nullptr);
+                send(*connection);
+            }
+        }
+        for (const ConnectionPtr &connection : flushes) {
+            if (m_connections.find(connection.get()) != m_connections.end()) {
+                send(*connection);
+            }
+        }
+
+        if (stopping) {
+            std::vector<Connection *> connections {};
+            for (const auto &entry : m_connections) {
+                close(*entry.second, entry.second->upgraded ? CLOSE_GOING_AWAY : nullptr);
+                connections.push_back(entry.first);
+            }
+            // Best effort, the close frames are not waited for
+            for (Connection *connection : connections) {
+                flush(*connection);
+                destroy(*connection);
+            }
+            m_destroyed.clear();
+            return;
+        }
+
+        if (std::chrono::steady_clock::now() >= nextTick) {
+            heartbeat();
+            nextTick = std::chrono::steady_clock::now() + tick;
+        }
+        m_destroyed.clear();
+    }
+}
+
+void EpollWebSocketServer::wake()
+{
+    const uint64_t value {1};
+    const ssize_t written = ::write(m_wake, &value, sizeof(value));
+    Q_UNUSED(written);
+}
+
+void EpollWebSocketServer::accept()
+{
+    std::uint64_t accepted {0};
+    while (true) {
+        const int fd = ::accept4(m_listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            const int error = errno;
+            if (error == EINTR || error == ECONNABORTED) {
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> lock {m_mutex};
+                m_accepted += accepted;
+            }
+            if (error == EMFILE || error == ENFILE) {
+                // Stop accepting until the next tick, instead of spinning on the listening socket
+                epoll_event event {};
+                event.data.ptr = &m_listener;
+                epoll_ctl(m_epoll, EPOLL_CTL_MOD, m_listener, &event);
+                m_acceptPaused = true;
+            }
+            return;
+        }
+
+        int noDelay {1};
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        ssl_st *ssl {nullptr};
+        if (m_context) {
+            ssl = SSL_new(m_context);
+            if (!ssl) {
+                ::close(fd);
+                continue;
+            }
+            SSL_set_fd(ssl, fd);
+            SSL_set_accept_state(ssl);
+        }
+
+        ConnectionPtr connection {std::make_shared<Connection>(fd, ssl)};
+        epoll_event event {};
+        event.events = EPOLLIN;
+        event.data.ptr = connection.get();
+        if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+            if (ssl) {
+                SSL_free(ssl);
+            }
+            ::close(fd);
+            continue;
+        }
+        connection->events = EPOLLIN;
+        m_connections.emplace(connection.get(), connection);
+        ++accepted;
+    }
+}
+
+void EpollWebSocketServer::process(Connection &connection)
+{
+    connection.wantWrite = false;
+    if (!connection.accepted && !handshake(connection)) {
+        destroy(connection);
+        return;
+    }
+    if (connection.accepted && !read(connection)) {
+        destroy(connection);
+        return;
+    }
+    send(connection);
+}
+
+// Non-blocking TLS handshake, that resumes when the socket is ready
+bool EpollWebSocketServer::handshake(Connection &connection)
+{
+    ERR_clear_error();
+    const int result = SSL_accept(connection.ssl);
+    if (result == 1) {
+        connection.accepted = true;
+        return true;
+    }
+    switch (SSL_get_error(connection.ssl, result)) {
+    case SSL_ERROR_WANT_READ:
+        return true;
+    case SSL_ERROR_WANT_WRITE:
+        connection.wantWrite = true;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Reads and parses everything that is available. Returns false if the connection is lost
+bool EpollWebSocketServer::read(Connection &connection)
+{
+    char buffer[READ_SIZE];
+    while (true) {
+        int size {0};
+        if (connection.ssl) {
+            ERR_clear_error();
+            size = SSL_read(connection.ssl, buffer, sizeof(buffer));
+            if (size <= 0) {
+                switch (SSL_get_error(connection.ssl, size)) {
+                case SSL_ERROR_WANT_READ:
+                    return true;
+                case SSL_ERROR_WANT_WRITE:
+                    connection.wantWrite = true;
+                    return true;
+                default:
+                    return false;
+                }
+            }
+        } else {
+            size = ::recv(connection.fd, buffer, sizeof(buffer), 0);
+            if (size == 0) {
+                return false;
+            }
+            if (size < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+        }
+
+        // What is received after the close frame is discarded
+        if (connection.closing) {
+            continue;
+        }
+        connection.input.append(buffer, size);
+        if (!connection.upgraded) {
+            upgrade(connection);
+        }
+        if (connection.upgraded && !connection.closing) {
+            parseFrames(connection);
+        }
+    }
+}
+
+void EpollWebSocketServer::upgrade(Connection &connection)
+{
+    const int end = connection.input.indexOf("\r\n\r\n");
+    if (end < 0) {
+        if (connection.input.size() > MAX_HEADER_SIZE) {
+            reject(connection, "431 Request Header Fields Too Large");
+        }
+        return;
+    }
+    const QList<QByteArray> &lines = connection.input.left(end).split('\n');
+    connection.input.remove(0, end + 4);
+
+    const QList<QByteArray> &request = lines.first().trimmed().split(' ');
+    if (request.size() != 3 || request.at(0) != "GET" || !request.at(2).startsWith("HTTP/1.")) {
+        reject(connection, "400 Bad Request");
+        return;
+    }
+    QByteArray path {request.at(1)};
+    const int query = path.indexOf('?');
+    if (query >= 0) {
+        path.truncate(query);
+    }
+    if (path != QByteArray::fromStdString(m_uri)) {
+        reject(connection, "404 Not Found");
+        return;
+    }
+
+    std::map<QByteArray, QByteArray> headers {};
+    for (int i = 1; i < lines.size(); ++i) {
+        const QByteArray &line = lines.at(i);
+        const int colon = line.indexOf(':');
+        if (colon > 0) {
+            headers[line.left(colon).trimmed().toLower()] = line.mid(colon + 1).trimmed();
+        }
+    }
+    const QByteArray &key = headers["sec-websocket-key"];
+    if (!headers["upgrade"].toLower().contains("websocket") || !headers["connection"].toLower().contains("upgrade")
+        || headers["sec-websocket-version"] != "13" || key.isEmpty()) {
+        reject(connection, "400 Bad Request");
+        return;
+    }
+
+    const QByteArray &accept = key + WEBSOCKET_GUID;
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    SHA1(reinterpret_cast<const unsigned char *>(accept.constData()), accept.size(), digest);
+    QByteArray response {"HTTP/1.1 101 Switching Protocols\r\n"
+                         "Upgrade: websocket\r\n"
+                         "Connection: Upgrade\r\n"
+                         "Sec-WebSocket-Accept: "};
+    response.append(QByteArray(reinterpret_cast<const char *>(digest), SHA_DIGEST_LENGTH).toBase64());
+    response.append("\r\n");
+    const QByteArray &offers = headers["sec-websocket-extensions"];
+    if (!offers.isEmpty()) {
+        PerMessageDeflate::Parameters parameters {};
+        const QByteArray &extensions = PerMessageDeflate::negotiate(m_options.deflate, offers, parameters);
+        if (!extensions.isEmpty()) {
+            connection.deflate = true;
+            connection.deflateWindowBits = parameters.serverMaxWindowBits;
+            connection.inflater.reset(new Inflater(parameters, m_options.maxMessageSize));
+            response.append("Sec-WebSocket-Extensions: ");
+            response.append(extensions);
+            response.append("\r\n");
+        }
+    }
+    response.append("\r\n");
+    append(connection, response);
+
+    connection.upgraded = true;
+    connection.lastSeen = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock {m_mutex};
+    m_webSockets.emplace(handle(&connection), m_connections.at(&connection));
+}
+
+void EpollWebSocketServer::parseFrames(Connection &connection)
+{
+    int offset {0};
+    while (!connection.closing) {
+        const unsigned char *data = reinterpret_cast<const unsigned char *>(connection.input.constData()) + offset;
+        const int available = connection.input.size() - offset;
+        if (available < 2) {
+            break;
+        }
+        const int bits = data[0];
+        quint64 size = data[1] & 0x7f;
+        int headerSize {2};
+        if (size == 126) {
+            if (available < 4) {
+                break;
+            }
+            size = (quint64(data[2]) << 8) | data[3];
+            headerSize = 4;
+        } else if (size == 127) {
+            if (available < 10) {
+                break;
+            }
+            size = 0;
+            for (int i = 2; i < 10; ++i) {
+                size = (size << 8) | data[i];
+            }
+            headerSize = 10;
+        }
+        // Clients must mask their frames
+        if ((data[1] & WEBSOCKET_MASKED) == 0) {
+            close(connection, CLOSE_PROTOCOL_ERROR);
+            break;
+        }
+        if (size > static_cast<quint64>(m_options.maxMessageSize)) {
+            close(connection, CLOSE_TOO_BIG);
+            break;
+        }
+        const int frameSize = headerSize + 4 + static_cast<int>(size);
+        if (available < frameSize) {
+            break;
+        }
+
+        const unsigned char *mask = data + headerSize;
+        QByteArray payload (reinterpret_cast<const char *>(mask + 4), static_cast<int>(size));
+        char *unmasked = payload.data();
+        for (int i = 0; i < payload.size(); ++i) {
+            unmasked[i] ^= mask[i % 4];
+        }
+        offset += frameSize;
+        handleFrame(connection, bits, payload);
+    }
+    connection.input.remove(0, offset);
+}
+
+void EpollWebSocketServer::handleFrame(Connection &connection, int bits, QByteArray &payload)
+{
+    // Any frame from the client proves that it is alive
+    connection.lastSeen = std::chrono::steady_clock::now();
+    connection.pinged = false;
+
+    const int opcode = bits & 0xf;
+    const bool fin = (bits & WEBSOCKET_FIN) != 0;
+    const bool compressed = (bits & WEBSOCKET_RSV1) != 0;
+    if ((bits & WEBSOCKET_RSV2_RSV3) != 0 || (compressed && !connection.deflate)) {
+        close(connection, CLOSE_PROTOCOL_ERROR);
+        return;
+    }
+
+    switch (opcode) {
+    case WEBSOCKET_OPCODE_PING:
+    case WEBSOCKET_OPCODE_PONG:
+    case WEBSOCKET_OPCODE_CONNECTION_CLOSE:
+        if (!fin || compressed || payload.size() > 125) {
+            close(connection, CLOSE_PROTOCOL_ERROR);
+        } else if (opcode == WEBSOCKET_OPCODE_PING) {
+            append(connection, WebSocketFrame::build(WEBSOCKET_OPCODE_PONG, payload));
+        } else if (opcode == WEBSOCKET_OPCODE_CONNECTION_CLOSE) {
+            close(connection, CLOSE_NORMAL);
+        }
+        return;
+    case WEBSOCKET_OPCODE_CONTINUATION:
+        if (connection.fragmentsBits == 0 || compressed) {
+            close(connection, CLOSE_PROTOCOL_ERROR);
+            return;
+        }
+        connection.fragments.append(payload);
+        break;
+    case WEBSOCKET_OPCODE_TEXT:
+    case WEBSOCKET_OPCODE_BINARY:
+        if (connection.fragmentsBits != 0) {
+            close(connection, CLOSE_PROTOCOL_ERROR);
+            return;
+        }
+        connection.fragmentsBits = bits;
+        connection.fragments.swap(payload);
+        break;
+    default:
+        close(connection, CLOSE_PROTOCOL_ERROR);
+        return;
+    }
+
+    if (connection.fragments.size() > m_options.maxMessageSize) {
+        close(connection, CLOSE_TOO_BIG);
+        return;
+    }
+    if (!fin) {
+        return;
+    }
+
+    Task task {};
+    task.data.swap(connection.fragments);
+    task.bits = WEBSOCKET_FIN | (connection.fragmentsBits & 0xf);
+    const bool deflated = (connection.fragmentsBits & WEBSOCKET_RSV1) != 0;
+    connection.fragmentsBits = 0;
+    if (deflated) {
+        QByteArray inflated {};
+        if (!connection.inflater->inflate(task.data, inflated)) {
+            close(connection, CLOSE_TOO_BIG);
+            return;
+        }
+        task.data.swap(inflated);
+    }
+    post(m_connections.at(&connection), std::move(task));
+}
+
+// Writes what is waiting. Returns false if the connection is lost
+bool EpollWebSocketServer::flush(Connection &connection)
+{
+    connection.writeBlocked = false;
+    while (true) {
+        if (connection.sent == connection.sending.size()) {
+            connection.sending.clear();
+            connection.sent = 0;
+            std::lock_guard<std::mutex> lock {connection.mutex};
+            connection.sending.swap(connection.output);
+            connection.flushScheduled = false;
+            if (connection.sending.isEmpty()) {
+                return true;
+            }
+        }
+
+        const char *data = connection.sending.constData() + connection.sent;
+        const int size = connection.sending.size() - connection.sent;
+        int written {0};
+        if (connection.ssl) {
+            ERR_clear_error();
+            written = SSL_write(connection.ssl, data, size);
+            if (written <= 0) {
+                switch (SSL_get_error(connection.ssl, written)) {
+                case SSL_ERROR_WANT_WRITE:
+                    connection.writeBlocked = true;
+                    return true;
+                case SSL_ERROR_WANT_READ:
+                    return true;
+                default:
+                    return false;
+                }
+            }
+        } else {
+            written = ::send(connection.fd, data, size, MSG_NOSIGNAL);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    connection.writeBlocked = true;
+                    return true;
+                }
+                return false;
+            }
+        }
+        connection.sent += written;
+    }
+}
+
+void EpollWebSocketServer::send(Connection &connection)
+{
+    if (!flush(connection)) {
+        destroy(connection);
+        return;
+    }
+    // Closing connections are dropped once their close frame is written
+    if (connection.closing && connection.sending.isEmpty()) {
+        destroy(connection);
+        return;
+    }
+    updateEvents(connection);
+}
+
+void EpollWebSocketServer::updateEvents(Connection &connection)
+{
+    unsigned int events = EPOLLIN;
+    if (connection.writeBlocked || connection.wantWrite) {
+        events |= EPOLLOUT;
+    }
+    if (events == connection.events) {
+        return;
+    }
+    epoll_event event {};
+    event.events = events;
+    event.data.ptr = &connection;
+    epoll_ctl(m_epoll, EPOLL_CTL_MOD, connection.fd, &event);
+    connection.events = events;
+}
+
+// Queues data from the event loop, that is not limited like the writers
+void EpollWebSocketServer::append(Connection &connection, const QByteArray &data)
+{
+    std::lock_guard<std::mutex> lock {connection.mutex};
+    connection.output.append(data);
+}
+
+void EpollWebSocketServer::reject(Connection &connection, const char *status)
+{
+    QByteArray response {"HTTP/1.1 "};
+    response.append(status);
+    response.append("\r\nConnection: close\r\nContent-Length: 0\r\n\r\n");
+    append(connection, response);
+    close(connection, nullptr);
+}
+
+/*
+ * Starts closing a connection, with a close frame if status is set.
+ * The writers and the handler are released right away, and the
+ * connection is dropped once the pending data is written. The handle
+ * stays valid until the handler is notified.
+ */
+void EpollWebSocketServer::close(Connection &connection, const char *status)
+{
+    if (connection.closing) {
+        return;
+    }
+#ifdef HARMONY_DEBUG
+    qCDebug(QLoggingCategory("epoll-websocket-server")) << "Closing WebSocket" << &connection;
+#endif
+    if (status) {
+        append(connection, WebSocketFrame::build(WEBSOCKET_OPCODE_CONNECTION_CLOSE, QByteArray(status, 2)));
+    }
+    connection.closing = true;
+    connection.closingSince = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock {connection.mutex};
+        connection.closed = true;
+    }
+    if (connection.upgraded) {
+        Task task {};
+        task.close = true;
+        post(m_connections.at(&connection), std::move(task));
+    }
+}
+
+void EpollWebSocketServer::destroy(Connection &connection)
+{
+    close(connection, nullptr);
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, connection.fd, nullptr);
+    if (connection.ssl) {
+        SSL_free(connection.ssl);
+        connection.ssl = nullptr;
+    }
+    ::close(connection.fd);
+    // Released at the end of the iteration at the earliest, or when no worker uses it anymore
+    auto it = m_connections.find(&connection);
+    m_destroyed.push_back(std::move(it->second));
+    m_connections.erase(it);
+}
+
+/*
+ * Pings idle WebSockets, and closes the ones that did not answer, or
+ * that reached their deadline. Connections that are stuck in one of
+ * the handshakes are dropped.
+ */
+void EpollWebSocketServer::heartbeat()
+{
+    const bool enabled = m_options.pingInterval > 0 && m_options.pingTimeout > 0;
+    const std::chrono::milliseconds interval {m_options.pingInterval};
+    const std::chrono::milliseconds timeout {m_options.pingTimeout};
+    const auto now = std::chrono::steady_clock::now();
+
+    if (m_acceptPaused) {
+        epoll_event event {};
+        event.events = EPOLLIN;
+        event.data.ptr = &m_listener;
+        epoll_ctl(m_epoll, EPOLL_CTL_MOD, m_listener, &event);
+        m_acceptPaused = false;
+    }
+
+    std::vector<Connection *> dropped {};
+    std::vector<Connection *> updated {};
+    for (const auto &entry : m_connections) {
+        Connection &connection = *entry.second;
+        if (connection.closing) {
+            if (now - connection.closingSince >= std::chrono::milliseconds(CLOSE_TIMEOUT_MS)) {
+                dropped.push_back(&connection);
+            }
+            continue;
+        }
+        if (!connection.upgraded) {
+            if (now - connection.lastSeen >= std::chrono::milliseconds(HANDSHAKE_TIMEOUT_MS)) {
+                dropped.push_back(&connection);
+            }
+            continue;
+        }
+
+        std::chrono::steady_clock::time_point deadline {};
+        {
+            std::lock_guard<std::mutex> lock {connection.mutex};
+            deadline = connection.deadline;
+        }
+        if (now >= deadline) {
+            close(connection, CLOSE_POLICY_VIOLATION);
+        } else if (enabled && connection.pinged && now - connection.lastSeen >= interval + timeout) {
+            close(connection, CLOSE_GOING_AWAY);
+        } else if (enabled && !connection.pinged && now - connection.lastSeen >= interval) {
+            connection.pinged = true;
+            append(connection, WebSocketFrame::build(WEBSOCKET_OPCODE_PING, QByteArray()));
+        } else {
+            continue;
+        }
+        updated.push_back(&connection);
+    }
+
+    for (Connection *connection : dropped) {
+        destroy(*connection);
+    }
+    for (Connection *connection : updated) {
+        send(*connection);
+    }
+}
+
+void EpollWebSocketServer::post(const ConnectionPtr &connection, Task task)
+{
+    bool scheduled {false};
+    {
+        std::lock_guard<std::mutex> lock {m_workersMutex};
+        connection->tasks.push_back(std::move(task));
+        if (!connection->scheduled) {
+            connection->scheduled = true;
+            m_ready.push_back(connection);
+            scheduled = true;
+        }
+    }
+    if (scheduled) {
+        m_workersCondition.notify_one();
+    }
+}
+
+// Workers handle the messages of a connection in order, like the civetweb thread of the connection would
+void EpollWebSocketServer::work()
+{
+    std::unique_lock<std::mutex> lock {m_workersMutex};
+    while (true) {
+        m_workersCondition.wait(lock, [this]() { return m_workersStopping || !m_ready.empty(); });
+        if (m_ready.empty()) {
+            return;
+        }
+
+        ConnectionPtr connection {m_ready.front()};
+        m_ready.pop_front();
+        while (!connection->tasks.empty()) {
+            Task task {std::move(connection->tasks.front())};
+            connection->tasks.pop_front();
+            const bool rejected = connection->rejected;
+            lock.unlock();
+
+            bool ok {true};
+            if (task.close) {
+                m_handler.handleClose(this, handle(connection.get()));
+                std::lock_guard<std::mutex> stateLock {m_mutex};
+                m_webSockets.erase(handle(connection.get()));
+            } else if (!rejected) {
+                ok = m_handler.handleData(this, handle(connection.get()), task.bits,
+                                          task.data.constData(), task.data.size());
+            }
+            if (!ok) {
+                {
+                    std::lock_guard<std::mutex> stateLock {m_mutex};
+                    m_rejected.push_back(connection);
+                }
+                wake();
+            }
+
+            lock.lock();
+            connection->rejected = connection->rejected || !ok;
+            if (!task.close) {
+                ++m_messages;
+            }
+        }
+        connection->scheduled = false;
+    }
+}
+
+}}
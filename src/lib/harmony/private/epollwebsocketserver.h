@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef EPOLLWEBSOCKETSERVER_H
+#define EPOLLWEBSOCKETSERVER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <QtCore/QByteArray>
+#include "iserver.h"
+#include "permessagedeflate.h"
+#include "websocketframe.h"
+
+struct mg_connection;
+struct ssl_st;
+struct ssl_ctx_st;
+
+namespace harmony { namespace private_impl {
+
+/**
+ * @brief WebSocket server built on an epoll event loop
+ *
+ * civetweb serves each connection from one of its worker threads, so
+ * every open WebSocket holds a thread. This server multiplexes all the
+ * WebSockets on a single thread, that accepts the connections, runs
+ * TLS with non-blocking OpenSSL, parses the HTTP upgrade, and reads and
+ * writes the frames. Complete messages are passed to the handler by a
+ * fixed pool of workers, so that handlers can call extensions without
+ * stalling the event loop.
+ *
+ * Connections are identified by mg_connection pointers, so that they
+ * can go through the same WebSocket pipeline as civetweb connections,
+ * but they are opaque handles, that can only be used with this server.
+ */
+class EpollWebSocketServer final
+{
+public:
+    using WebSocketOptions = IServer::Options::WebSocket;
+    using Statistics = IServer::ShardStatistics;
+    class IHandler
+    {
+    public:
+        virtual ~IHandler() {}
+        // Messages of a connection are handled in order, by one worker at a time. Returns false to close it
+        virtual bool handleData(EpollWebSocketServer *server, mg_connection *connection,
+                                int bits, const char *data, size_t len) = 0;
+        // Called once, after the last message of the connection
+        virtual void handleClose(EpollWebSocketServer *server, const mg_connection *connection) = 0;
+    };
+    class Exception: public std::runtime_error
+    {
+    public:
+        explicit Exception(const std::string &message) : std::runtime_error(message) {}
+    };
+    /*
+     * Serves WebSockets on uri. TLS is used if certificatePath is not empty.
+     * The port is opened with SO_REUSEPORT, so that several servers can
+     * share it. If cpu is not negative, the threads only run on this CPU.
+     */
+    explicit EpollWebSocketServer(int port, const std::string &certificatePath, const std::string &uri,
+                                  IHandler &handler, const WebSocketOptions &options, int workerCount,
+                                  int cpu = -1);
+    // Serves WebSockets on uri, without TLS, on a Unix domain socket
+    explicit EpollWebSocketServer(const std::string &localPath, const std::string &uri, IHandler &handler,
+                                  const WebSocketOptions &options, int workerCount);
+    ~EpollWebSocketServer();
+    EpollWebSocketServer(const EpollWebSocketServer &) = delete;
+    EpollWebSocketServer & operator=(const EpollWebSocketServer &) = delete;
+    // Closes the connections, and waits until their handlers are notified
+    void stop();
+    // Connections exist from their upgrade until their handler is notified that they are closed
+    bool wsExists(const mg_connection *connection) const;
+    // Queues the frame, unless too much data is already waiting to be sent, so that it does not block
+    WebSocketWriteResult wsWriteMessage(mg_connection *connection, const WebSocketMessage &message);
+    // Closes the connection once what is queued is written
+    void wsClose(mg_connection *connection);
+    // The WebSocket is closed when the deadline is reached
+    void wsSetDeadline(const mg_connection *connection, std::chrono::steady_clock::time_point deadline);
+    int count() const;
+    Statistics statistics() const;
+private:
+    struct Task
+    {
+        int bits {0};
+        QByteArray data {};
+        bool close {false};
+    };
+    struct Connection
+    {
+        explicit Connection(int fd, ssl_st *ssl);
+        const int fd {-1};
+        ssl_st *ssl {nullptr};
+        // Used by the event loop only
+        bool accepted {false};
+        bool upgraded {false};
+        bool closing {false};
+        bool wantWrite {false};
+        bool writeBlocked {false};
+        unsigned int events {0};
+        QByteArray input {};
+        QByteArray sending {};
+        int sent {0};
+        bool deflate {false};
+        int deflateWindowBits {0};
+        std::unique_ptr<Inflater> inflater {};
+        QByteArray fragments {};
+        int fragmentsBits {0};
+        std::chrono::steady_clock::time_point lastSeen {std::chrono::steady_clock::now()};
+        std::chrono::steady_clock::time_point closingSince {};
+        bool pinged {false};
+        // Guarded by mutex
+        QByteArray output {};
+        bool closed {false};
+        bool flushScheduled {false};
+        std::chrono::steady_clock::time_point deadline {std::chrono::steady_clock::time_point::max()};
+        std::mutex mutex {};
+        // Guarded by the workers mutex
+        std::deque<Task> tasks {};
+        bool scheduled {false};
+        bool rejected {false};
+    };
+    using ConnectionPtr = std::shared_ptr<Connection>;
+    static mg_connection * handle(Connection *connection);
+    void release();
+    void open();
+    void startThreads(int workerCount, int cpu);
+    void listen(int port);
+    void listenLocal(const std::string &path);
+    void run();
+    void wake();
+    void accept();
+    void process(Connection &connection);
+    bool handshake(Connection &connection);
+    bool read(Connection &connection);
+    void upgrade(Connection &connection);
+    void parseFrames(Connection &connection);
+    void handleFrame(Connection &connection, int bits, QByteArray &payload);
+    bool flush(Connection &connection);
+    void updateEvents(Connection &connection);
+    void append(Connection &connection, const QByteArray &data);
+    void send(Connection &connection);
+    void reject(Connection &connection, const char *status);
+    void close(Connection &connection, const char *status);
+    void destroy(Connection &connection);
+    void heartbeat();
+    void post(const ConnectionPtr &connection, Task task);
+    void work();
+    const std::string m_uri {};
+    IHandler &m_handler;
+    const WebSocketOptions m_options {};
+    int m_listener {-1};
+    // Removed when the server is destroyed
+    std::string m_localPath {};
+    int m_epoll {-1};
+    int m_wake {-1};
+    bool m_acceptPaused {false};
+    ssl_ctx_st *m_context {nullptr};
+    std::thread m_loop {};
+    std::vector<std::thread> m_workers {};
+    // Every connection, used by the event loop only
+    std::map<Connection *, ConnectionPtr> m_connections {};
+    // Connections destroyed during an iteration of the event loop, released at its end,
+    // so that their addresses are not reused by accept() for events of the same batch
+    std::vector<ConnectionPtr> m_destroyed {};
+    // Guarded by m_mutex
+    std::map<const mg_connection *, ConnectionPtr> m_webSockets {};
+    std::vector<ConnectionPtr> m_flushes {};
+    std::vector<ConnectionPtr> m_rejected {};
+    std::vector<ConnectionPtr> m_closes {};
+    bool m_stopping {false};
+    std::uint64_t m_accepted {0};
+    mutable std::mutex m_mutex {};
+    // Worker queue
+    std::deque<ConnectionPtr> m_ready {};
+    bool m_workersStopping {false};
+    std::uint64_t m_messages {0};
+    mutable std::mutex m_workersMutex {};
+    std::condition_variable m_workersCondition {};
+};
+
+}}
+
+#endif // EPOLLWEBSOCKETSERVER_H
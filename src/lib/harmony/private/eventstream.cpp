@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "eventstream.h"
+#include <algorithm>
+
+namespace harmony { namespace private_impl {
+
+EventStream::EventStream(int capacity, const std::unordered_set<std::string> &topics)
+    : m_capacity{std::max(capacity, 1)}, m_topics{topics}
+{
+}
+
+bool EventStream::receives(const std::string &topic) const
+{
+    return m_topics.empty() || m_topics.find(topic) != m_topics.end();
+}
+
+void EventStream::setDeadline(std::chrono::steady_clock::time_point deadline)
+{
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        m_deadline = deadline;
+    }
+    m_condition.notify_all();
+}
+
+void EventStream::push(const QByteArray &event)
+{
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        if (m_closed) {
+            return;
+        }
+        if (static_cast<int>(m_events.size()) >= m_capacity) {
+            m_events.pop_front();
+            ++m_dropped;
+        }
+        m_events.push_back(event);
+    }
+    m_condition.notify_one();
+}
+
+bool EventStream::wait(std::deque<QByteArray> &events, std::chrono::milliseconds timeout)
+{
+    events.clear();
+    std::unique_lock<std::mutex> lock {m_mutex};
+    // The deadline is not reached late because of a long timeout
+    const std::chrono::steady_clock::time_point now {std::chrono::steady_clock::now()};
+    const std::chrono::steady_clock::time_point until {m_deadline - now > timeout ? now + timeout : m_deadline};
+    m_condition.wait_until(lock, until, [this]() {
+        return m_closed || !m_events.empty() || std::chrono::steady_clock::now() >= m_deadline;
+    });
+    if (m_closed || std::chrono::steady_clock::now() >= m_deadline) {
+        return false;
+    }
+    events.swap(m_events);
+    return true;
+}
+
+void EventStream::close()
+{
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        m_closed = true;
+        m_events.clear();
+    }
+    m_condition.notify_all();
+}
+
+int EventStream::dropped() const
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    return m_dropped;
+}
+
+}}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef EVENTSTREAM_H
+#define EVENTSTREAM_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <QtCore/QByteArray>
+
+namespace harmony { namespace private_impl {
+
+/**
+ * @brief Events waiting to be written to a Server-Sent Events client
+ *
+ * Broadcasts push events that were encoded once for all the clients,
+ * and the thread that serves the client waits for them and writes
+ * them. The queue is bounded, and drops the oldest event when full.
+ */
+class EventStream final
+{
+public:
+    // An empty set of topics receives every topic
+    explicit EventStream(int capacity, const std::unordered_set<std::string> &topics);
+    EventStream(const EventStream &) = delete;
+    EventStream & operator=(const EventStream &) = delete;
+    bool receives(const std::string &topic) const;
+    // The stream is closed when the deadline is reached
+    void setDeadline(std::chrono::steady_clock::time_point deadline);
+    void push(const QByteArray &event);
+    // Waits up to timeout for events. Returns false once the stream is closed, or reached its deadline
+    bool wait(std::deque<QByteArray> &events, std::chrono::milliseconds timeout);
+    void close();
+    int dropped() const;
+private:
+    const int m_capacity {0};
+    const std::unordered_set<std::string> m_topics {};
+    std::deque<QByteArray> m_events {};
+    int m_dropped {0};
+    bool m_closed {false};
+    std::chrono::steady_clock::time_point m_deadline {std::chrono::steady_clock::time_point::max()};
+    mutable std::mutex m_mutex {};
+    std::condition_variable m_condition {};
+};
+
+}}
+
+#endif // EVENTSTREAM_H
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "hmacsha256.h"
+#include <string.h>
+#include <memory>
+#include <new>
+#include <openssl/crypto.h>
+
+static const int BLOCK_SIZE = SHA256_CBLOCK;
+
+namespace harmony { namespace private_impl {
+
+namespace {
+
+struct DigestContextDeleter
+{
+    void operator()(EVP_MD_CTX *context) const
+    {
+        EVP_MD_CTX_free(context);
+    }
+};
+
+// Scratch context of the calling thread, that the precomputed states are copied to
+EVP_MD_CTX * scratchContext()
+{
+    static thread_local std::unique_ptr<EVP_MD_CTX, DigestContextDeleter> context {EVP_MD_CTX_new()};
+    if (!context) {
+        throw std::bad_alloc();
+    }
+    return context.get();
+}
+
+EVP_MD_CTX * keyedContext(const unsigned char *block, unsigned char pad)
+{
+    unsigned char padded[BLOCK_SIZE];
+    for (int i = 0; i < BLOCK_SIZE; ++i) {
+        padded[i] = block[i] ^ pad;
+    }
+    EVP_MD_CTX *context = EVP_MD_CTX_new();
+    if (!context || EVP_DigestInit_ex(context, EVP_sha256(), nullptr) != 1
+        || EVP_DigestUpdate(context, padded, BLOCK_SIZE) != 1) {
+        EVP_MD_CTX_free(context);
+        OPENSSL_cleanse(padded, BLOCK_SIZE);
+        throw std::bad_alloc();
+    }
+    OPENSSL_cleanse(padded, BLOCK_SIZE);
+    return context;
+}
+
+}
+
+HmacSha256::HmacSha256(const QByteArray &key)
+{
+    unsigned char block[BLOCK_SIZE];
+    memset(block, 0, BLOCK_SIZE);
+    if (key.size() > BLOCK_SIZE) {
+        unsigned int size {0};
+        EVP_Digest(key.constData(), key.size(), block, &size, EVP_sha256(), nullptr);
+    } else {
+        memcpy(block, key.constData(), key.size());
+    }
+
+    try {
+        m_inner = keyedContext(block, 0x36);
+        m_outer = keyedContext(block, 0x5c);
+    } catch (...) {
+        EVP_MD_CTX_free(m_inner);
+        OPENSSL_cleanse(block, BLOCK_SIZE);
+        throw;
+    }
+    OPENSSL_cleanse(block, BLOCK_SIZE);
+}
+
+HmacSha256::~HmacSha256()
+{
+    EVP_MD_CTX_free(m_inner);
+    EVP_MD_CTX_free(m_outer);
+}
+
+bool HmacSha256::sign(const char *data, int size, unsigned char *digest) const
+{
+    unsigned char innerDigest[DIGEST_SIZE];
+    EVP_MD_CTX *context = scratchContext();
+    if (EVP_MD_CTX_copy_ex(context, m_inner) != 1
+        || EVP_DigestUpdate(context, data, size) != 1
+        || EVP_DigestFinal_ex(context, innerDigest, nullptr) != 1) {
+        return false;
+    }
+
+    return EVP_MD_CTX_copy_ex(context, m_outer) == 1
+            && EVP_DigestUpdate(context, innerDigest, DIGEST_SIZE) == 1
+            && EVP_DigestFinal_ex(context, digest, nullptr) == 1;
+}
+
+bool HmacSha256::verify(const char *data, int size, const unsigned char *digest) const
+{
+    unsigned char expected[DIGEST_SIZE];
+    if (!sign(data, size, expected)) {
+        return false;
+    }
+    return CRYPTO_memcmp(expected, digest, DIGEST_SIZE) == 0;
+}
+
+}}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef HMACSHA256_H
+#define HMACSHA256_H
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <QtCore/QByteArray>
+
+namespace harmony { namespace private_impl {
+
+/**
+ * @brief HMAC-SHA256 with precomputed key state
+ *
+ * The inner and outer SHA256 states, that absorb the padded key, are
+ * computed once in the constructor. Signing a message only copies these
+ * states into a digest context owned by the calling thread, so the key
+ * is never re-derived, and nothing is allocated after the first call.
+ *
+ * This class is immutable after construction and can be shared between
+ * threads.
+ */
+class HmacSha256 final
+{
+public:
+    static const int DIGEST_SIZE = SHA256_DIGEST_LENGTH;
+    explicit HmacSha256(const QByteArray &key);
+    ~HmacSha256();
+    HmacSha256(const HmacSha256 &) = delete;
+    HmacSha256 & operator=(const HmacSha256 &) = delete;
+    // Returns false if OpenSSL fails, leaving digest undefined
+    bool sign(const char *data, int size, unsigned char *digest) const;
+    // Compares in constant time, and fails if signing fails
+    bool verify(const char *data, int size, const unsigned char *digest) const;
+private:
+    EVP_MD_CTX *m_inner {nullptr};
+    EVP_MD_CTX *m_outer {nullptr};
+};
+
+}}
+
+#endif // HMACSHA256_H
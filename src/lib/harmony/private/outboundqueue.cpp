@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "outboundqueue.h"
+#include <algorithm>
+
+namespace harmony { namespace private_impl {
+
+OutboundQueue::OutboundQueue(int capacity, OverflowPolicy overflowPolicy)
+    : m_capacity{std::max(capacity, 1)}, m_overflowPolicy{overflowPolicy}
+{
+}
+
+bool OutboundQueue::push(OutboundMessage message)
+{
+    if (message.reply) {
+        if (m_replies >= m_capacity) {
+            clear();
+            return false;
+        }
+        ++m_replies;
+        m_messages.push_back(std::move(message));
+        return true;
+    }
+
+    if (m_broadcasts < m_capacity) {
+        ++m_broadcasts;
+        m_messages.push_back(std::move(message));
+        return true;
+    }
+
+    switch (m_overflowPolicy) {
+    case OverflowPolicy::Disconnect:
+        clear();
+        return false;
+    case OverflowPolicy::Coalesce:
+        if (!message.key.isEmpty()) {
+            std::deque<OutboundMessage>::iterator it = std::find_if(m_messages.begin(), m_messages.end(),
+                                                                    [&message](const OutboundMessage &pending) {
+                return !pending.reply && pending.key == message.key;
+            });
+            if (it != m_messages.end()) {
+                *it = std::move(message);
+                ++m_dropped;
+                return true;
+            }
+        }
+        break;
+    case OverflowPolicy::DropOldest:
+        break;
+    }
+
+    // The oldest broadcast is dropped
+    m_messages.erase(std::find_if(m_messages.begin(), m_messages.end(), [](const OutboundMessage &pending) {
+        return !pending.reply;
+    }));
+    m_messages.push_back(std::move(message));
+    ++m_dropped;
+    return true;
+}
+
+void OutboundQueue::pushFront(OutboundMessage message)
+{
+    if (message.reply) {
+        ++m_replies;
+    } else {
+        ++m_broadcasts;
+    }
+    m_messages.push_front(std::move(message));
+}
+
+OutboundMessage OutboundQueue::pop()
+{
+    OutboundMessage message {std::move(m_messages.front())};
+    m_messages.pop_front();
+    if (message.reply) {
+        --m_replies;
+    } else {
+        --m_broadcasts;
+    }
+    return message;
+}
+
+bool OutboundQueue::isEmpty() const
+{
+    return m_messages.empty();
+}
+
+int OutboundQueue::count() const
+{
+    return m_messages.size();
+}
+
+int OutboundQueue::dropped() const
+{
+    return m_dropped;
+}
+
+void OutboundQueue::clear()
+{
+    m_dropped += m_messages.size();
+    m_messages.clear();
+    m_broadcasts = 0;
+    m_replies = 0;
+}
+
+}}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef OUTBOUNDQUEUE_H
+#define OUTBOUNDQUEUE_H
+
+#include <deque>
+#include <memory>
+#include <QtCore/QByteArray>
+#include "iserver.h"
+#include "websocketframe.h"
+
+namespace harmony { namespace private_impl {
+
+struct OutboundMessage
+{
+    // Shared by all the connections it is sent to
+    std::shared_ptr<const WebSocketMessage> message {};
+    // Messages with the same non-empty key can replace each other
+    QByteArray key {};
+    // Replies to the client, that are never dropped
+    bool reply {false};
+};
+
+/**
+ * @brief Bounded queue of messages waiting to be written to a WebSocket
+ *
+ * Broadcasts and replies are bounded separately, by the capacity. The
+ * overflow policy only drops or replaces broadcasts: a client that does
+ * not read its replies is disconnected instead.
+ *
+ * The queue is not thread-safe: it is guarded by its owner.
+ */
+class OutboundQueue final
+{
+public:
+    using OverflowPolicy = IServer::Options::WebSocket::OverflowPolicy;
+    explicit OutboundQueue(int capacity, OverflowPolicy overflowPolicy);
+    // Returns false if the WebSocket should be disconnected
+    bool push(OutboundMessage message);
+    // Puts back a message that could not be written yet, before the others
+    void pushFront(OutboundMessage message);
+    OutboundMessage pop();
+    bool isEmpty() const;
+    int count() const;
+    int dropped() const;
+    void clear();
+private:
+    std::deque<OutboundMessage> m_messages {};
+    const int m_capacity {0};
+    int m_broadcasts {0};
+    int m_replies {0};
+    const OverflowPolicy m_overflowPolicy {OverflowPolicy::DropOldest};
+    int m_dropped {0};
+};
+
+}}
+
+#endif // OUTBOUNDQUEUE_H
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "permessagedeflate.h"
+#include <algorithm>
+#include <QtCore/QList>
+
+static const char *EXTENSION_NAME = "permessage-deflate";
+// Smallest window that can be negotiated. Clients can use it, but the server cannot
+static const int MIN_OFFERED_WINDOW_BITS = 8;
+static const int MEMORY_LEVEL = 8;
+static const int CHUNK_SIZE = 4096;
+// Trailer of a sync flush, that is removed from compressed messages
+static const char TRAILER[] = {'\x00', '\x00', '\xff', '\xff'};
+
+namespace harmony { namespace private_impl {
+
+const int PerMessageDeflate::MIN_WINDOW_BITS;
+const int PerMessageDeflate::MAX_WINDOW_BITS;
+
+static bool readWindowBits(const QByteArray &value, int &windowBits)
+{
+    bool ok {false};
+    windowBits = value.toInt(&ok);
+    return ok && windowBits >= MIN_OFFERED_WINDOW_BITS && windowBits <= PerMessageDeflate::MAX_WINDOW_BITS;
+}
+
+static bool negotiateOffer(const PerMessageDeflate::Options &options, const QList<QByteArray> &offer,
+                           QByteArray &response, PerMessageDeflate::Parameters &parameters)
+{
+    if (offer.isEmpty() || offer.first().trimmed() != EXTENSION_NAME) {
+        return false;
+    }
+
+    int serverWindowBits = PerMessageDeflate::serverWindowBits(options);
+    int clientWindowBits {0};
+    bool hasServerWindowBits {false};
+    bool hasClientWindowBits {false};
+    bool clientNoContextTakeover {false};
+    for (int i = 1; i < offer.count(); ++i) {
+        const QByteArray &parameter = offer.at(i).trimmed();
+        const int equal = parameter.indexOf('=');
+        const QByteArray &name = (equal < 0 ? parameter : parameter.left(equal)).trimmed();
+        QByteArray value = equal < 0 ? QByteArray() : parameter.mid(equal + 1).trimmed();
+        if (value.startsWith('"') && value.endsWith('"') && value.size() >= 2) {
+            value = value.mid(1, value.size() - 2);
+        }
+
+        if (name == "server_no_context_takeover" && value.isEmpty()) {
+            // We never keep the context
+        } else if (name == "client_no_context_takeover" && value.isEmpty()) {
+            clientNoContextTakeover = true;
+        } else if (name == "server_max_window_bits" && !hasServerWindowBits) {
+            // Messages are compressed with a smaller window for this client. zlib cannot compress
+            // with a 256 bytes window, so this offer is declined
+            int windowBits {0};
+            if (!readWindowBits(value, windowBits) || windowBits < PerMessageDeflate::MIN_WINDOW_BITS) {
+                return false;
+            }
+            serverWindowBits = std::min(serverWindowBits, windowBits);
+            hasServerWindowBits = true;
+        } else if (name == "client_max_window_bits" && !hasClientWindowBits) {
+            clientWindowBits = PerMessageDeflate::MAX_WINDOW_BITS;
+            if (!value.isEmpty() && !readWindowBits(value, clientWindowBits)) {
+                return false;
+            }
+            hasClientWindowBits = true;
+        } else {
+            return false;
+        }
+    }
+
+    // Without client_max_window_bits, the client uses the largest window
+    const int maxClientWindowBits = std::max(std::min(options.clientMaxWindowBits, PerMessageDeflate::MAX_WINDOW_BITS),
+                                             MIN_OFFERED_WINDOW_BITS);
+    if (!hasClientWindowBits && maxClientWindowBits < PerMessageDeflate::MAX_WINDOW_BITS) {
+        return false;
+    }
+
+    // The client window is never larger than the one offered by the client
+    parameters.serverMaxWindowBits = serverWindowBits;
+    parameters.clientMaxWindowBits = hasClientWindowBits ? std::min(clientWindowBits, maxClientWindowBits)
+                                                         : PerMessageDeflate::MAX_WINDOW_BITS;
+    parameters.clientContextTakeover = options.clientContextTakeover && !clientNoContextTakeover;
+
+    response = EXTENSION_NAME;
+    response.append("; server_no_context_takeover");
+    if (hasServerWindowBits) {
+        response.append("; server_max_window_bits=");
+        response.append(QByteArray::number(serverWindowBits));
+    }
+    if (!parameters.clientContextTakeover) {
+        response.append("; client_no_context_takeover");
+    }
+    if (hasClientWindowBits) {
+        response.append("; client_max_window_bits=");
+        response.append(QByteArray::number(parameters.clientMaxWindowBits));
+    }
+    return true;
+}
+
+QByteArray PerMessageDeflate::negotiate(const Options &options, const QByteArray &offers, Parameters &parameters)
+{
+    if (!options.enabled) {
+        return QByteArray();
+    }
+
+    for (const QByteArray &offer : offers.split(',')) {
+        QByteArray response {};
+        if (negotiateOffer(options, offer.split(';'), response, parameters)) {
+            return response;
+        }
+    }
+    return QByteArray();
+}
+
+int PerMessageDeflate::serverWindowBits(const Options &options)
+{
+    return std::max(std::min(options.serverMaxWindowBits, MAX_WINDOW_BITS), MIN_WINDOW_BITS);
+}
+
+QByteArray PerMessageDeflate::deflate(const Options &options, int windowBits, const QByteArray &message)
+{
+    windowBits = std::max(std::min(windowBits, MAX_WINDOW_BITS), MIN_WINDOW_BITS);
+    z_stream stream {};
+    if (deflateInit2(&stream, options.level, Z_DEFLATED, -windowBits, MEMORY_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return QByteArray();
+    }
+
+    QByteArray compressed {};
+    compressed.resize(deflateBound(&stream, message.size()) + sizeof(TRAILER));
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(message.data()));
+    stream.avail_in = message.size();
+    stream.next_out = reinterpret_cast<Bytef *>(compressed.data());
+    stream.avail_out = compressed.size();
+    int result = ::deflate(&stream, Z_SYNC_FLUSH);
+    const int size = compressed.size() - stream.avail_out;
+    deflateEnd(&stream);
+    if (result != Z_OK || stream.avail_in != 0 || size < static_cast<int>(sizeof(TRAILER))) {
+        return QByteArray();
+    }
+
+    compressed.resize(size - sizeof(TRAILER));
+    return compressed;
+}
+
+Inflater::Inflater(const PerMessageDeflate::Parameters &parameters, int maxSize)
+    : m_contextTakeover{parameters.clientContextTakeover}, m_maxSize{maxSize}
+{
+    // A larger window than the one of the client inflates its messages too
+    const int windowBits = std::max(parameters.clientMaxWindowBits, PerMessageDeflate::MIN_WINDOW_BITS);
+    m_valid = inflateInit2(&m_stream, -windowBits) == Z_OK;
+}
+
+Inflater::~Inflater()
+{
+    if (m_valid) {
+        inflateEnd(&m_stream);
+    }
+}
+
+bool Inflater::inflate(const QByteArray &payload, QByteArray &message)
+{
+    if (!m_valid) {
+        return false;
+    }
+
+    QByteArray input {payload};
+    input.append(TRAILER, sizeof(TRAILER));
+    m_stream.next_in = reinterpret_cast<Bytef *>(input.data());
+    m_stream.avail_in = input.size();
+
+    message.clear();
+    bool ok {true};
+    bool end {false};
+    int result {Z_OK};
+    do {
+        const int size = message.size();
+        message.resize(size + CHUNK_SIZE);
+        m_stream.next_out = reinterpret_cast<Bytef *>(message.data() + size);
+        m_stream.avail_out = CHUNK_SIZE;
+        result = ::inflate(&m_stream, Z_SYNC_FLUSH);
+        message.resize(size + CHUNK_SIZE - m_stream.avail_out);
+        // A final block ends the stream, and the sender starts a new one
+        end = result == Z_STREAM_END;
+        ok = (result == Z_OK || result == Z_BUF_ERROR || end) && message.size() <= m_maxSize;
+    } while (ok && !end && (m_stream.avail_out == 0 || (m_stream.avail_in > 0 && result == Z_OK)));
+
+    if (!m_contextTakeover || !ok || end) {
+        inflateReset(&m_stream);
+    }
+    return ok;
+}
+
+}}
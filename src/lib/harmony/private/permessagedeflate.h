@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef PERMESSAGEDEFLATE_H
+#define PERMESSAGEDEFLATE_H
+
+#include <zlib.h>
+#include <QtCore/QByteArray>
+#include "iserver.h"
+
+namespace harmony { namespace private_impl {
+
+/**
+ * @brief permessage-deflate (RFC 7692) negotiation and compression
+ */
+class PerMessageDeflate final
+{
+public:
+    using Options = IServer::Options::WebSocket::Deflate;
+    // zlib does not support raw deflate with a 256 bytes window
+    static const int MIN_WINDOW_BITS = 9;
+    static const int MAX_WINDOW_BITS = 15;
+    struct Parameters
+    {
+        int serverMaxWindowBits {MAX_WINDOW_BITS};
+        int clientMaxWindowBits {MAX_WINDOW_BITS};
+        bool clientContextTakeover {true};
+    };
+    /*
+     * Picks the first acceptable offer in a Sec-WebSocket-Extensions
+     * header. Returns the value of the Sec-WebSocket-Extensions response
+     * header, or an empty array if no offer is acceptable.
+     */
+    static QByteArray negotiate(const Options &options, const QByteArray &offers, Parameters &parameters);
+    // Window of the messages sent to the clients that did not ask for a smaller one
+    static int serverWindowBits(const Options &options);
+    // Compresses a message without context takeover
+    static QByteArray deflate(const Options &options, int windowBits, const QByteArray &message);
+};
+
+/**
+ * @brief Decompresses the messages of a client
+ */
+class Inflater final
+{
+public:
+    explicit Inflater(const PerMessageDeflate::Parameters &parameters, int maxSize);
+    ~Inflater();
+    Inflater(const Inflater &) = delete;
+    Inflater & operator=(const Inflater &) = delete;
+    bool inflate(const QByteArray &payload, QByteArray &message);
+private:
+    z_stream m_stream {};
+    const bool m_contextTakeover {true};
+    const int m_maxSize {0};
+    bool m_valid {false};
+};
+
+}}
+
+#endif // PERMESSAGEDEFLATE_H
@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "ratelimiter.h"
+#include <algorithm>
+#include <chrono>
+
+namespace harmony { namespace private_impl {
+
+// The state of an entry is its tag (20 bits), the index of its window
+// (20 bits), and its counts in the current and previous windows (12
+// bits each), so that the client of an entry changes with its counts
+static const std::uint64_t TAG_MASK = 0xfffff;
+static const std::uint32_t WINDOW_MASK = 0xfffff;
+static const std::uint64_t COUNT_MAX = 0xfff;
+
+static std::uint64_t hash(const char *client)
+{
+    // FNV-1a, with the finalizer of MurmurHash3, as the tag uses the high bits
+    std::uint64_t hash {14695981039346656037ull};
+    for (const char *it = client; *it != '\0'; ++it) {
+        hash ^= static_cast<unsigned char>(*it);
+        hash *= 1099511628211ull;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// 0 is used by empty entries
+static std::uint64_t keyTag(std::uint64_t key)
+{
+    const std::uint64_t tag = (key >> 44) & TAG_MASK;
+    return tag != 0 ? tag : 1;
+}
+
+static std::uint64_t stateTag(std::uint64_t state)
+{
+    return state >> 44;
+}
+
+static std::uint32_t stateWindow(std::uint64_t state)
+{
+    return static_cast<std::uint32_t>(state >> 24) & WINDOW_MASK;
+}
+
+static std::uint64_t stateCurrent(std::uint64_t state)
+{
+    return (state >> 12) & COUNT_MAX;
+}
+
+static std::uint64_t statePrevious(std::uint64_t state)
+{
+    return state & COUNT_MAX;
+}
+
+static std::uint64_t makeState(std::uint64_t tag, std::uint32_t window, std::uint64_t current, std::uint64_t previous)
+{
+    return (tag << 44) | (static_cast<std::uint64_t>(window & WINDOW_MASK) << 24)
+            | (std::min(current, COUNT_MAX) << 12) | std::min(previous, COUNT_MAX);
+}
+
+// Windows since the one of the state, that wrap around
+static std::uint32_t stateAge(std::uint64_t state, std::uint32_t window)
+{
+    return (window - stateWindow(state)) & WINDOW_MASK;
+}
+
+// Counts of the current and previous windows, that are 0 once the entry is not used in the sliding window anymore
+static void stateCounts(std::uint64_t state, std::uint32_t window, std::uint64_t &current, std::uint64_t &previous)
+{
+    current = 0;
+    previous = 0;
+    if (state == 0) {
+        return;
+    }
+    const std::uint32_t age = stateAge(state, window);
+    if (age == 0) {
+        current = stateCurrent(state);
+        previous = statePrevious(state);
+    } else if (age == 1) {
+        previous = stateCurrent(state);
+    }
+}
+
+static bool isFree(std::uint64_t state, std::uint32_t window)
+{
+    return state == 0 || stateAge(state, window) > 1;
+}
+
+RateLimiter::RateLimiter(int limit, int windowMs, int shardCount, int shardSize)
+    : m_limit{limit}, m_windowMs{windowMs}, m_shardCount{shardCount}, m_shardSize{shardSize}
+    , m_entries{new Entry[shardCount * shardSize]}
+{
+}
+
+int RateLimiter::windowMs() const
+{
+    return m_windowMs;
+}
+
+bool RateLimiter::tryAcquire(const char *client)
+{
+    return tryAcquire(client, currentTimeMs());
+}
+
+bool RateLimiter::tryAcquire(const char *client, std::int64_t nowMs)
+{
+    const std::uint32_t currentWindow = window(nowMs);
+    const std::int64_t elapsed = nowMs % m_windowMs;
+    const std::uint64_t key = hash(client);
+    const std::uint64_t tag = keyTag(key);
+
+    while (true) {
+        std::uint64_t state {0};
+        Entry *clientEntry = find(key, currentWindow, state);
+        if (!clientEntry) {
+            clientEntry = findFree(key, currentWindow, state);
+        }
+        if (!clientEntry) {
+            // Clients that do not fit are not limited, rather than sharing the limit of others
+            return true;
+        }
+
+        std::uint64_t current {0};
+        std::uint64_t previous {0};
+        if (stateTag(state) == tag) {
+            stateCounts(state, currentWindow, current, previous);
+        }
+        if (estimate(previous, current, elapsed) >= m_limit) {
+            return false;
+        }
+
+        // Fails if the entry was updated, or given to another client, in the meantime
+        const std::uint64_t newState = makeState(tag, currentWindow, current + 1, previous);
+        if (clientEntry->state.compare_exchange_strong(state, newState, std::memory_order_acq_rel,
+                                                       std::memory_order_acquire)) {
+            return true;
+        }
+    }
+}
+
+void RateLimiter::release(const char *client)
+{
+    release(client, currentTimeMs());
+}
+
+// The attempt is taken back from the window it was counted in, if it is still used
+void RateLimiter::release(const char *client, std::int64_t nowMs)
+{
+    const std::uint32_t currentWindow = window(nowMs);
+    const std::uint64_t key = hash(client);
+    const std::uint64_t tag = keyTag(key);
+
+    while (true) {
+        std::uint64_t state {0};
+        Entry *clientEntry = find(key, currentWindow, state);
+        if (!clientEntry) {
+            return;
+        }
+        std::uint64_t newState {0};
+        const std::uint32_t age = stateAge(state, currentWindow);
+        if (age == 0 && stateCurrent(state) > 0) {
+            newState = makeState(tag, currentWindow, stateCurrent(state) - 1, statePrevious(state));
+        } else if (age == 0 && statePrevious(state) > 0) {
+            newState = makeState(tag, currentWindow, 0, statePrevious(state) - 1);
+        } else if (age == 1 && stateCurrent(state) > 0) {
+            newState = makeState(tag, currentWindow, 0, stateCurrent(state) - 1);
+        } else {
+            return;
+        }
+        if (clientEntry->state.compare_exchange_strong(state, newState, std::memory_order_acq_rel,
+                                                       std::memory_order_acquire)) {
+            return;
+        }
+    }
+}
+
+std::int64_t RateLimiter::retryAfterMs(const char *client)
+{
+    return retryAfterMs(client, currentTimeMs());
+}
+
+std::int64_t RateLimiter::retryAfterMs(const char *client, std::int64_t nowMs)
+{
+    const std::uint32_t currentWindow = window(nowMs);
+    const std::int64_t elapsed = nowMs % m_windowMs;
+    const std::uint64_t key = hash(client);
+    std::uint64_t state {0};
+    std::uint64_t currentCount {0};
+    std::uint64_t previousCount {0};
+    if (find(key, currentWindow, state)) {
+        stateCounts(state, currentWindow, currentCount, previousCount);
+    }
+    const std::int64_t current = static_cast<std::int64_t>(currentCount);
+    const std::int64_t previous = static_cast<std::int64_t>(previousCount);
+
+    if (estimate(previousCount, currentCount, elapsed) < m_limit) {
+        return 0;
+    }
+    if (m_limit <= 0) {
+        return m_windowMs - elapsed;
+    }
+    if (current < m_limit) {
+        // The weight of the previous window decreases until the estimate is below the limit
+        const std::int64_t remaining = ((m_limit - current) * m_windowMs - 1) / previous;
+        return m_windowMs - elapsed - remaining;
+    }
+    // Otherwise, the current window has to become the previous one first
+    const std::int64_t remaining = (static_cast<std::int64_t>(m_limit) * m_windowMs - 1) / current;
+    return m_windowMs - elapsed + m_windowMs - remaining;
+}
+
+std::int64_t RateLimiter::currentTimeMs()
+{
+    namespace chrono = std::chrono;
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    return chrono::duration_cast<chrono::milliseconds>(now.time_since_epoch()).count();
+}
+
+std::uint32_t RateLimiter::window(std::int64_t nowMs) const
+{
+    return static_cast<std::uint32_t>(nowMs / m_windowMs);
+}
+
+// Weights the previous window with the part that is still in the sliding window
+std::int64_t RateLimiter::estimate(std::uint64_t previous, std::uint64_t current, std::int64_t elapsed) const
+{
+    return static_cast<std::int64_t>(previous) * (m_windowMs - elapsed) / m_windowMs
+            + static_cast<std::int64_t>(current);
+}
+
+RateLimiter::Entry * RateLimiter::shard(std::uint64_t key) const
+{
+    return m_entries.get() + (key % m_shardCount) * m_shardSize;
+}
+
+int RateLimiter::start(std::uint64_t key) const
+{
+    return static_cast<int>((key / m_shardCount) % m_shardSize);
+}
+
+// Does not claim any entry
+RateLimiter::Entry * RateLimiter::find(std::uint64_t key, std::uint32_t window, std::uint64_t &state) const
+{
+    Entry *entries = shard(key);
+    const std::uint64_t tag = keyTag(key);
+    for (int i = 0; i < m_shardSize; ++i) {
+        Entry &candidate = entries[(start(key) + i) % m_shardSize];
+        const std::uint64_t candidateState = candidate.state.load(std::memory_order_acquire);
+        if (candidateState != 0 && stateTag(candidateState) == tag && !isFree(candidateState, window)) {
+            state = candidateState;
+            return &candidate;
+        }
+    }
+    return nullptr;
+}
+
+// Empty entries, and entries that are not used in the sliding window anymore, are claimed by tryAcquire
+RateLimiter::Entry * RateLimiter::findFree(std::uint64_t key, std::uint32_t window, std::uint64_t &state) const
+{
+    Entry *entries = shard(key);
+    for (int i = 0; i < m_shardSize; ++i) {
+        Entry &candidate = entries[(start(key) + i) % m_shardSize];
+        const std::uint64_t candidateState = candidate.state.load(std::memory_order_acquire);
+        if (isFree(candidateState, window)) {
+            state = candidateState;
+            return &candidate;
+        }
+    }
+    return nullptr;
+}
+
+}}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace harmony { namespace private_impl {
+
+/**
+ * @brief Per-client sliding window rate limiter
+ *
+ * Clients are identified by a string, like their remote address. Each
+ * client is allowed a number of attempts in a sliding window, estimated
+ * from the counts of the current and previous fixed windows. Attempts
+ * that should not count, like successful ones, are given back with
+ * release.
+ *
+ * Clients are stored in a fixed size table, split in shards. Shards are
+ * probed linearly, and entries are claimed and updated with atomic
+ * compare-and-swap, so no lock is taken. The state of an entry holds a
+ * tag of its client with its counts, so that an entry is claimed, or
+ * recycled once its windows are over, in one step. Looking a client up
+ * does not claim an entry. When a shard is full, the clients that do
+ * not fit are not limited, instead of being limited with others.
+ */
+class RateLimiter final
+{
+public:
+    explicit RateLimiter(int limit, int windowMs, int shardCount = 16, int shardSize = 32);
+    RateLimiter(const RateLimiter &) = delete;
+    RateLimiter & operator=(const RateLimiter &) = delete;
+    int windowMs() const;
+    bool tryAcquire(const char *client);
+    bool tryAcquire(const char *client, std::int64_t nowMs);
+    void release(const char *client);
+    void release(const char *client, std::int64_t nowMs);
+    // Milliseconds until the client can try again, 0 if it can now
+    std::int64_t retryAfterMs(const char *client);
+    std::int64_t retryAfterMs(const char *client, std::int64_t nowMs);
+private:
+    struct Entry
+    {
+        // Tag of the client (20 bits), window index (20 bits), count in
+        // the current window and count in the previous window (12 bits each)
+        std::atomic<std::uint64_t> state {0};
+    };
+    static std::int64_t currentTimeMs();
+    Entry * shard(std::uint64_t key) const;
+    int start(std::uint64_t key) const;
+    Entry * find(std::uint64_t key, std::uint32_t window, std::uint64_t &state) const;
+    Entry * findFree(std::uint64_t key, std::uint32_t window, std::uint64_t &state) const;
+    std::uint32_t window(std::int64_t nowMs) const;
+    std::int64_t estimate(std::uint64_t previous, std::uint64_t current, std::int64_t elapsed) const;
+    const int m_limit {0};
+    const int m_windowMs {0};
+    const int m_shardCount {0};
+    const int m_shardSize {0};
+    std::unique_ptr<Entry[]> m_entries {};
+};
+
+}}
+
+#endif // RATELIMITER_H
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "sessionstore.h"
+#include <algorithm>
+
+namespace harmony { namespace private_impl {
+
+SessionStore::SessionStore(int slotCount, int tickDuration)
+    : m_tickDuration{tickDuration}, m_wheel(slotCount)
+{
+}
+
+void SessionStore::add(const QByteArray &jti, qint64 exp, qint64 now)
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    sweep(now);
+    m_sessions.insert(jti, exp);
+    m_wheel[slot(exp / m_tickDuration)].push_back(jti);
+}
+
+bool SessionStore::contains(const QByteArray &jti, qint64 now)
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    sweep(now);
+    QHash<QByteArray, qint64>::const_iterator it = m_sessions.constFind(jti);
+    return it != m_sessions.constEnd() && now < it.value();
+}
+
+bool SessionStore::remove(const QByteArray &jti)
+{
+    // The entry in the wheel is dropped when its slot is swept
+    std::lock_guard<std::mutex> lock {m_mutex};
+    return m_sessions.remove(jti) > 0;
+}
+
+void SessionStore::clear()
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    m_sessions.clear();
+    for (std::vector<QByteArray> &slot : m_wheel) {
+        std::vector<QByteArray>().swap(slot);
+    }
+}
+
+int SessionStore::count() const
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    return m_sessions.count();
+}
+
+std::size_t SessionStore::slot(qint64 tick) const
+{
+    return static_cast<std::size_t>(tick) % m_wheel.size();
+}
+
+void SessionStore::sweep(qint64 now)
+{
+    const qint64 tick = now / m_tickDuration;
+    if (m_sweptTick < 0) {
+        m_sweptTick = tick - 1;
+        return;
+    }
+
+    // Only sweep ticks that are over, and do not turn the wheel more than once
+    const qint64 first = std::max(m_sweptTick + 1, tick - static_cast<qint64>(m_wheel.size()));
+    for (qint64 i = first; i < tick; ++i) {
+        std::vector<QByteArray> &entries = m_wheel[slot(i)];
+        std::vector<QByteArray> remaining {};
+        for (QByteArray &jti : entries) {
+            QHash<QByteArray, qint64>::iterator it = m_sessions.find(jti);
+            if (it == m_sessions.end()) {
+                continue; // Revoked
+            }
+            if (it.value() <= now) {
+                m_sessions.erase(it);
+            } else {
+                // Expires in a later turn of the wheel
+                remaining.push_back(std::move(jti));
+            }
+        }
+        entries.swap(remaining);
+    }
+    m_sweptTick = std::max(m_sweptTick, tick - 1);
+}
+
+}}
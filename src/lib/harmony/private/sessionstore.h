@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef SESSIONSTORE_H
+#define SESSIONSTORE_H
+
+#include <mutex>
+#include <vector>
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+
+namespace harmony { namespace private_impl {
+
+/**
+ * @brief Live sessions, keyed by the jti of their token
+ *
+ * Sessions are looked up in a hash table. Expired sessions are dropped
+ * by a hashed timer wheel: each session is stored in the slot matching
+ * its expiration tick, and the slots that are due are swept while the
+ * store is used. Memory is then proportional to the number of live
+ * sessions.
+ *
+ * All times are in seconds since epoch.
+ */
+class SessionStore final
+{
+public:
+    explicit SessionStore(int slotCount = 256, int tickDuration = 600);
+    SessionStore(const SessionStore &) = delete;
+    SessionStore & operator=(const SessionStore &) = delete;
+    void add(const QByteArray &jti, qint64 exp, qint64 now);
+    bool contains(const QByteArray &jti, qint64 now);
+    bool remove(const QByteArray &jti);
+    void clear();
+    int count() const;
+private:
+    std::size_t slot(qint64 tick) const;
+    void sweep(qint64 now);
+    const int m_tickDuration {0};
+    QHash<QByteArray, qint64> m_sessions {};
+    std::vector<std::vector<QByteArray>> m_wheel {};
+    qint64 m_sweptTick {-1};
+    mutable std::mutex m_mutex {};
+};
+
+}}
+
+#endif // SESSIONSTORE_H
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "statestore.h"
+
+namespace harmony { namespace private_impl {
+
+QJsonObject StateStore::diff(const QJsonObject &from, const QJsonObject &to)
+{
+    QJsonObject patch {};
+    for (auto it = from.constBegin(); it != from.constEnd(); ++it) {
+        if (!to.contains(it.key())) {
+            patch.insert(it.key(), QJsonValue::Null);
+        }
+    }
+    for (auto it = to.constBegin(); it != to.constEnd(); ++it) {
+        const QJsonValue &previous = from.value(it.key());
+        if (previous == it.value()) {
+            continue;
+        }
+        if (previous.isObject() && it.value().isObject()) {
+            patch.insert(it.key(), diff(previous.toObject(), it.value().toObject()));
+        } else {
+            patch.insert(it.key(), it.value());
+        }
+    }
+    return patch;
+}
+
+bool StateStore::update(const std::string &topic, const QJsonObject &state, quint64 &version, QJsonObject &patch)
+{
+    Entry &entry = m_entries[topic];
+    patch = diff(entry.state, state);
+    if (entry.version > 0 && patch.isEmpty()) {
+        return false;
+    }
+    entry.state = state;
+    version = ++entry.version;
+    return true;
+}
+
+bool StateStore::snapshot(const std::string &topic, quint64 &version, QJsonObject &state) const
+{
+    auto it = m_entries.find(topic);
+    if (it == m_entries.end()) {
+        return false;
+    }
+    version = it->second.version;
+    state = it->second.state;
+    return true;
+}
+
+}}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef STATESTORE_H
+#define STATESTORE_H
+
+#include <map>
+#include <string>
+#include <QtCore/QJsonObject>
+
+namespace harmony { namespace private_impl {
+
+/**
+ * @brief Latest published version of the state documents
+ *
+ * Each topic has a state document, and a version that is incremented
+ * every time the document changes. Changes are described as JSON merge
+ * patches (RFC 7386): members that changed are set to their new value,
+ * nested objects are patched recursively, and removed members are set
+ * to null. Arrays are replaced as a whole, and null values cannot be
+ * part of a state, as they mean removal.
+ *
+ * This class is not thread-safe.
+ */
+class StateStore final
+{
+public:
+    // Computes the merge patch that turns from into to
+    static QJsonObject diff(const QJsonObject &from, const QJsonObject &to);
+    // Returns false if the state did not change, otherwise sets the new version and the patch
+    bool update(const std::string &topic, const QJsonObject &state, quint64 &version, QJsonObject &patch);
+    // Returns false if nothing was published on this topic
+    bool snapshot(const std::string &topic, quint64 &version, QJsonObject &state) const;
+private:
+    struct Entry
+    {
+        quint64 version {0};
+        QJsonObject state {};
+    };
+    std::map<std::string, Entry> m_entries {};
+};
+
+}}
+
+#endif // STATESTORE_H
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "topicindex.h"
+#include <algorithm>
+
+namespace harmony { namespace private_impl {
+
+TopicIndex::TopicIndex()
+{
+}
+
+void TopicIndex::add(mg_connection *connection)
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    if (!m_connections.emplace(connection, Subscription()).second) {
+        return;
+    }
+    m_index.update([connection](Index &index) {
+        insertConnection(index.unfiltered, connection);
+        return true;
+    });
+}
+
+void TopicIndex::remove(mg_connection *connection)
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    auto it = m_connections.find(connection);
+    if (it == m_connections.end()) {
+        return;
+    }
+
+    const Subscription subscription {std::move(it->second)};
+    m_connections.erase(it);
+    m_index.update([connection, &subscription](Index &index) {
+        for (const std::string &topic : subscription.topics) {
+            removeSubscriber(index, connection, topic);
+        }
+        if (!subscription.filtered) {
+            eraseConnection(index.unfiltered, connection);
+        }
+        return true;
+    });
+}
+
+void TopicIndex::clear()
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    m_connections.clear();
+    m_index.reset();
+}
+
+bool TopicIndex::contains(mg_connection *connection) const
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    return m_connections.find(connection) != m_connections.end();
+}
+
+bool TopicIndex::receives(mg_connection *connection, const std::string &topic) const
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    auto it = m_connections.find(connection);
+    if (it == m_connections.end()) {
+        return false;
+    }
+    return !it->second.filtered || it->second.topics.find(topic) != it->second.topics.end();
+}
+
+bool TopicIndex::subscribe(mg_connection *connection, const std::string &topic)
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    auto it = m_connections.find(connection);
+    if (it == m_connections.end()) {
+        return false;
+    }
+
+    const bool filtered {it->second.filtered};
+    const bool inserted {it->second.topics.insert(topic).second};
+    it->second.filtered = true;
+    if (filtered && !inserted) {
+        return true;
+    }
+    m_index.update([connection, &topic, filtered, inserted](Index &index) {
+        if (!filtered) {
+            eraseConnection(index.unfiltered, connection);
+        }
+        if (inserted) {
+            insertConnection(index.subscribers[topic], connection);
+        }
+        return true;
+    });
+    return true;
+}
+
+bool TopicIndex::unsubscribe(mg_connection *connection, const std::string &topic)
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    auto it = m_connections.find(connection);
+    if (it == m_connections.end()) {
+        return false;
+    }
+
+    const bool filtered {it->second.filtered};
+    const bool erased {it->second.topics.erase(topic) > 0};
+    it->second.filtered = true;
+    if (filtered && !erased) {
+        return true;
+    }
+    m_index.update([connection, &topic, filtered, erased](Index &index) {
+        if (!filtered) {
+            eraseConnection(index.unfiltered, connection);
+        }
+        if (erased) {
+            removeSubscriber(index, connection, topic);
+        }
+        return true;
+    });
+    return true;
+}
+
+std::vector<mg_connection *> TopicIndex::subscribers(const std::string &topic) const
+{
+    const CopyOnWrite<Index>::Ptr &index = m_index.load();
+    std::vector<mg_connection *> returned {*index->unfiltered};
+    auto subscribers = index->subscribers.find(topic);
+    if (subscribers != index->subscribers.end()) {
+        returned.insert(returned.end(), subscribers->second->begin(), subscribers->second->end());
+    }
+    return returned;
+}
+
+// Lists are shared with the previous versions of the index, so they are copied before they are changed
+void TopicIndex::insertConnection(ConnectionsPtr_t &connections, mg_connection *connection)
+{
+    std::shared_ptr<Connections_t> copy {connections ? std::make_shared<Connections_t>(*connections)
+                                                     : std::make_shared<Connections_t>()};
+    copy->push_back(connection);
+    connections = std::move(copy);
+}
+
+void TopicIndex::eraseConnection(ConnectionsPtr_t &connections, mg_connection *connection)
+{
+    std::shared_ptr<Connections_t> copy {std::make_shared<Connections_t>(*connections)};
+    copy->erase(std::remove(copy->begin(), copy->end(), connection), copy->end());
+    connections = std::move(copy);
+}
+
+// Removes the connection from the subscribers of a topic
+void TopicIndex::removeSubscriber(Index &index, mg_connection *connection, const std::string &topic)
+{
+    auto subscribers = index.subscribers.find(topic);
+    eraseConnection(subscribers->second, connection);
+    if (subscribers->second->empty()) {
+        index.subscribers.erase(subscribers);
+    }
+}
+
+}}
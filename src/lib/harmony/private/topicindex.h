@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef TOPICINDEX_H
+#define TOPICINDEX_H
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "copyonwrite.h"
+
+struct mg_connection;
+
+namespace harmony { namespace private_impl {
+
+/**
+ * @brief Index from topics to the WebSockets that subscribed to them
+ *
+ * A WebSocket that never subscribed receives every topic. Once it
+ * subscribed, it only receives the topics it subscribed to, even if it
+ * unsubscribed from all of them.
+ *
+ * Broadcasts read a snapshot of the index without taking any lock, and
+ * (un)subscriptions publish a new version of the index. The lists of
+ * subscribers are shared between versions, so that an update only
+ * copies the list it changes, and the topics of each WebSocket are
+ * kept out of the snapshot.
+ */
+class TopicIndex final
+{
+public:
+    explicit TopicIndex();
+    TopicIndex(const TopicIndex &) = delete;
+    TopicIndex & operator=(const TopicIndex &) = delete;
+    void add(mg_connection *connection);
+    void remove(mg_connection *connection);
+    void clear();
+    bool contains(mg_connection *connection) const;
+    // If the connection gets the broadcasts of the topic
+    bool receives(mg_connection *connection, const std::string &topic) const;
+    bool subscribe(mg_connection *connection, const std::string &topic);
+    bool unsubscribe(mg_connection *connection, const std::string &topic);
+    std::vector<mg_connection *> subscribers(const std::string &topic) const;
+private:
+    using Connections_t = std::vector<mg_connection *>;
+    using ConnectionsPtr_t = std::shared_ptr<const Connections_t>;
+    struct Index
+    {
+        std::unordered_map<std::string, ConnectionsPtr_t> subscribers {};
+        ConnectionsPtr_t unfiltered {std::make_shared<const Connections_t>()};
+    };
+    struct Subscription
+    {
+        std::unordered_set<std::string> topics {};
+        bool filtered {false};
+    };
+    static void insertConnection(ConnectionsPtr_t &connections, mg_connection *connection);
+    static void eraseConnection(ConnectionsPtr_t &connections, mg_connection *connection);
+    static void removeSubscriber(Index &index, mg_connection *connection, const std::string &topic);
+    CopyOnWrite<Index> m_index {};
+    // Topics of each connection, used under m_mutex
+    std::unordered_map<mg_connection *, Subscription> m_connections {};
+    mutable std::mutex m_mutex {};
+};
+
+}}
+
+#endif // TOPICINDEX_H
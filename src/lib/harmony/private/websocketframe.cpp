@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "websocketframe.h"
+#include <algorithm>
+
+static const unsigned char FIN = 0x80;
+static const unsigned char RSV1 = 0x40;
+static const int OPCODE_CONTROL = 0x8;
+static const int PAYLOAD_SIZE_16 = 126;
+static const int PAYLOAD_SIZE_64 = 127;
+
+namespace harmony { namespace private_impl {
+
+QByteArray WebSocketFrame::build(int opcode, const QByteArray &payload, bool compressed)
+{
+    const int size = payload.size();
+    QByteArray frame {};
+    frame.reserve(headerSize(size) + size);
+    frame.append(static_cast<char>(FIN | (compressed ? RSV1 : 0) | (opcode & 0xf)));
+    if (size < PAYLOAD_SIZE_16) {
+        frame.append(static_cast<char>(size));
+    } else if (size <= 0xffff) {
+        frame.append(static_cast<char>(PAYLOAD_SIZE_16));
+        frame.append(static_cast<char>((size >> 8) & 0xff));
+        frame.append(static_cast<char>(size & 0xff));
+    } else {
+        frame.append(static_cast<char>(PAYLOAD_SIZE_64));
+        const quint64 size64 = static_cast<quint64>(size);
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            frame.append(static_cast<char>((size64 >> shift) & 0xff));
+        }
+    }
+    frame.append(payload);
+    return frame;
+}
+
+int WebSocketFrame::headerSize(int payloadSize)
+{
+    if (payloadSize < PAYLOAD_SIZE_16) {
+        return 2;
+    } else if (payloadSize <= 0xffff) {
+        return 4;
+    }
+    return 10;
+}
+
+WebSocketMessage::WebSocketMessage(int opcode, const QByteArray &payload)
+    : m_opcode{opcode}, m_payload{payload}, m_frame{WebSocketFrame::build(opcode, payload)}
+{
+}
+
+int WebSocketMessage::opcode() const
+{
+    return m_opcode;
+}
+
+QByteArray WebSocketMessage::payload() const
+{
+    return m_payload;
+}
+
+QByteArray WebSocketMessage::frame() const
+{
+    return m_frame;
+}
+
+QByteArray WebSocketMessage::deflatedFrame(const PerMessageDeflate::Options &options, int windowBits) const
+{
+    // Control frames and small messages are not compressed
+    if ((m_opcode & OPCODE_CONTROL) != 0 || m_payload.size() < options.minSize) {
+        return m_frame;
+    }
+
+    windowBits = std::max(std::min(windowBits, PerMessageDeflate::MAX_WINDOW_BITS), PerMessageDeflate::MIN_WINDOW_BITS);
+    const int index = windowBits - PerMessageDeflate::MIN_WINDOW_BITS;
+    std::call_once(m_deflatedFlags[index], [this, &options, windowBits, index]() {
+        const QByteArray &compressed = PerMessageDeflate::deflate(options, windowBits, m_payload);
+        if (compressed.isEmpty() || compressed.size() >= m_payload.size()) {
+            m_deflatedFrames[index] = m_frame;
+        } else {
+            m_deflatedFrames[index] = WebSocketFrame::build(m_opcode, compressed, true);
+        }
+    });
+    return m_deflatedFrames[index];
+}
+
+}}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef WEBSOCKETFRAME_H
+#define WEBSOCKETFRAME_H
+
+#include <mutex>
+#include <QtCore/QByteArray>
+#include "permessagedeflate.h"
+
+namespace harmony { namespace private_impl {
+
+// Result of writing a frame without blocking
+enum class WebSocketWriteResult
+{
+    Written,
+    // Nothing was written, as the socket has no room for the frame yet
+    WouldBlock,
+    Failed
+};
+
+/**
+ * @brief Builds unmasked, unfragmented WebSocket frames
+ *
+ * The header and the payload are written in a single buffer, so that a
+ * frame can be built once and written as is to many connections.
+ */
+class WebSocketFrame final
+{
+public:
+    static QByteArray build(int opcode, const QByteArray &payload, bool compressed = false);
+    static int headerSize(int payloadSize);
+};
+
+/**
+ * @brief A message sent to many WebSockets
+ *
+ * The plain frame is built once. The compressed frame, for the clients
+ * that negotiated permessage-deflate, is built once too for each window
+ * size, by the first writer that needs it.
+ */
+class WebSocketMessage final
+{
+public:
+    explicit WebSocketMessage(int opcode, const QByteArray &payload);
+    WebSocketMessage(const WebSocketMessage &) = delete;
+    WebSocketMessage & operator=(const WebSocketMessage &) = delete;
+    int opcode() const;
+    QByteArray payload() const;
+    QByteArray frame() const;
+    QByteArray deflatedFrame(const PerMessageDeflate::Options &options, int windowBits) const;
+private:
+    static const int WINDOW_COUNT = PerMessageDeflate::MAX_WINDOW_BITS - PerMessageDeflate::MIN_WINDOW_BITS + 1;
+    const int m_opcode {0};
+    const QByteArray m_payload {};
+    const QByteArray m_frame {};
+    // By window size
+    mutable std::once_flag m_deflatedFlags[WINDOW_COUNT] {};
+    mutable QByteArray m_deflatedFrames[WINDOW_COUNT] {};
+};
+
+}}
+
+#endif // WEBSOCKETFRAME_H
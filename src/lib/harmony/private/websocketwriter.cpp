@@ -0,0 +1,353 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "websocketwriter.h"
+#include <algorithm>
+#include <CivetServer.h>
+
+// A writer drains at most this number of messages before letting
+// other WebSockets go first
+static const int WRITE_BATCH_SIZE = 16;
+// Delay before a WebSocket whose write would block is tried again
+static const int WRITE_RETRY_MS = 10;
+// Close frame payload, with the 1008 (policy violation) status code
+static const char CLOSE_POLICY_VIOLATION[] = {'\x03', '\xf0'};
+
+namespace harmony { namespace private_impl {
+
+WebSocketWriter::Connection::Connection(const Options &options, WriteFunction_t writeFunction,
+                                        CloseFunction_t closeFunction)
+    : writeFunction{std::move(writeFunction)}, closeFunction{std::move(closeFunction)}
+    , queue{options.queueCapacity, options.overflowPolicy}
+{
+}
+
+WebSocketWriter::WebSocketWriter(WriteFunction_t writeFunction, CloseFunction_t closeFunction)
+    : m_writeFunction{std::move(writeFunction)}, m_closeFunction{std::move(closeFunction)}
+{
+}
+
+WebSocketWriter::~WebSocketWriter()
+{
+    stop();
+}
+
+void WebSocketWriter::start(const Options &options)
+{
+    stop();
+    std::lock_guard<std::mutex> lock {m_mutex};
+    m_options = options;
+    m_stopping = false;
+    for (int i = 0; i < std::max(options.writerCount, 1); ++i) {
+        m_writers.emplace_back(&WebSocketWriter::run, this);
+    }
+}
+
+void WebSocketWriter::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        m_stopping = true;
+    }
+    m_readyCondition.notify_all();
+    for (std::thread &writer : m_writers) {
+        writer.join();
+    }
+    m_writers.clear();
+    clear();
+}
+
+void WebSocketWriter::add(mg_connection *connection, WriteFunction_t writeFunction, CloseFunction_t closeFunction)
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    if (m_connections.find(connection) == m_connections.end()) {
+        std::unique_ptr<Connection> state {new Connection(m_options,
+                                                          writeFunction ? std::move(writeFunction) : m_writeFunction,
+                                                          closeFunction ? std::move(closeFunction) : m_closeFunction)};
+        m_connections.emplace(connection, std::move(state));
+    }
+}
+
+void WebSocketWriter::remove(mg_connection *connection)
+{
+    std::unique_lock<std::mutex> lock {m_mutex};
+    auto it = m_connections.find(connection);
+    if (it == m_connections.end()) {
+        return;
+    }
+    Connection *state = it->second.get();
+    state->closing = true;
+    state->queue.clear();
+    m_idleCondition.wait(lock, [state]() { return !state->writing; });
+    m_connections.erase(connection);
+}
+
+void WebSocketWriter::clear()
+{
+    std::unique_lock<std::mutex> lock {m_mutex};
+    for (auto &entry : m_connections) {
+        entry.second->closing = true;
+        entry.second->queue.clear();
+    }
+    m_idleCondition.wait(lock, [this]() {
+        for (const auto &entry : m_connections) {
+            if (entry.second->writing) {
+                return false;
+            }
+        }
+        return true;
+    });
+    m_connections.clear();
+    m_ready.clear();
+    m_blocked.clear();
+}
+
+void WebSocketWriter::disconnect(mg_connection *connection)
+{
+    bool scheduled {false};
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        auto it = m_connections.find(connection);
+        if (it == m_connections.end() || it->second->closing) {
+            return;
+        }
+        Connection &state = *it->second;
+        scheduled = !state.scheduled;
+        state.queue.clear();
+        disconnect(connection, state);
+    }
+    if (scheduled) {
+        m_readyCondition.notify_one();
+    }
+}
+
+bool WebSocketWriter::send(mg_connection *connection, const OutboundMessage &message)
+{
+    bool scheduled {false};
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        auto it = m_connections.find(connection);
+        if (it == m_connections.end()) {
+            return false;
+        }
+        Connection &state = *it->second;
+        scheduled = !state.scheduled;
+        push(connection, state, message);
+        scheduled = scheduled && state.scheduled;
+    }
+    if (scheduled) {
+        m_readyCondition.notify_one();
+    }
+    return true;
+}
+
+void WebSocketWriter::send(const std::vector<mg_connection *> &connections, const OutboundMessage &message)
+{
+    int scheduled {0};
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        const std::size_t ready = m_ready.size();
+        for (mg_connection *connection : connections) {
+            auto it = m_connections.find(connection);
+            if (it != m_connections.end()) {
+                push(connection, *it->second, message);
+            }
+        }
+        scheduled = m_ready.size() - ready;
+    }
+    notify(scheduled);
+}
+
+void WebSocketWriter::broadcast(const OutboundMessage &message)
+{
+    int scheduled {0};
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        const std::size_t ready = m_ready.size();
+        for (auto &entry : m_connections) {
+            push(entry.first, *entry.second, message);
+        }
+        scheduled = m_ready.size() - ready;
+    }
+    notify(scheduled);
+}
+
+int WebSocketWriter::count() const
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    return m_connections.size();
+}
+
+void WebSocketWriter::notify(int scheduled)
+{
+    if (scheduled == 1) {
+        m_readyCondition.notify_one();
+    } else if (scheduled > 1) {
+        m_readyCondition.notify_all();
+    }
+}
+
+void WebSocketWriter::push(mg_connection *connection, Connection &state, const OutboundMessage &message)
+{
+    if (state.closing) {
+        return;
+    }
+
+    if (!state.queue.push(message)) {
+        // Overflow with the Disconnect policy
+        disconnect(connection, state);
+        return;
+    }
+
+    if (!state.scheduled) {
+        state.scheduled = true;
+        m_ready.push_back(connection);
+    }
+}
+
+// The writer sends a close frame, and closes the socket
+void WebSocketWriter::disconnect(mg_connection *connection, Connection &state)
+{
+    state.closing = true;
+    state.disconnecting = true;
+    OutboundMessage close {};
+    close.message = std::make_shared<WebSocketMessage>(WEBSOCKET_OPCODE_CONNECTION_CLOSE,
+                                                       QByteArray(CLOSE_POLICY_VIOLATION, sizeof(CLOSE_POLICY_VIOLATION)));
+    state.queue.push(std::move(close));
+
+    if (!state.scheduled) {
+        state.scheduled = true;
+        m_ready.push_back(connection);
+    }
+}
+
+void WebSocketWriter::run()
+{
+    std::unique_lock<std::mutex> lock {m_mutex};
+    while (true) {
+        const auto isReady = [this]() { return m_stopping || !m_ready.empty(); };
+        if (m_blocked.empty()) {
+            m_readyCondition.wait(lock, isReady);
+        } else {
+            m_readyCondition.wait_until(lock, m_blocked.front().first, isReady);
+        }
+        if (m_stopping) {
+            return;
+        }
+
+        // Blocked WebSockets are tried again once their delay is over
+        const auto now = std::chrono::steady_clock::now();
+        while (!m_blocked.empty() && m_blocked.front().first <= now) {
+            m_ready.push_back(m_blocked.front().second);
+            m_blocked.pop_front();
+        }
+        if (m_ready.empty()) {
+            continue;
+        }
+
+        mg_connection *connection = m_ready.front();
+        m_ready.pop_front();
+        auto it = m_connections.find(connection);
+        if (it == m_connections.end()) {
+            continue;
+        }
+
+        // The state is not erased while it is being written to
+        Connection &state = *it->second;
+        if (state.writing) {
+            // Already drained by another writer, that reschedules it if needed
+            continue;
+        }
+        state.writing = true;
+        int written {0};
+        bool blocked {false};
+        while (!state.queue.isEmpty() && written < WRITE_BATCH_SIZE) {
+            OutboundMessage message {state.queue.pop()};
+            lock.unlock();
+            // The functions of the state are constant, and the state is not erased while it is being written to
+            WebSocketWriteResult result {WebSocketWriteResult::Failed};
+            if (state.writeFunction) {
+                result = state.writeFunction(connection, *message.message);
+            }
+            lock.lock();
+            ++written;
+            if (result == WebSocketWriteResult::Written) {
+                state.blockedSince = std::chrono::steady_clock::time_point();
+            } else if (result == WebSocketWriteResult::Failed) {
+                state.closing = true;
+                state.queue.clear();
+            } else if (state.closing) {
+                // The close frame, or the messages of a WebSocket being removed, are not waited for
+                state.queue.clear();
+            } else {
+                const auto blockedAt = std::chrono::steady_clock::now();
+                if (state.blockedSince == std::chrono::steady_clock::time_point()) {
+                    state.blockedSince = blockedAt;
+                }
+                if (blockedAt - state.blockedSince >= std::chrono::milliseconds(m_options.writeTimeout)) {
+                    // The client does not read anymore
+                    state.closing = true;
+                    state.disconnecting = true;
+                    state.queue.clear();
+                } else {
+                    state.queue.pushFront(std::move(message));
+                    blocked = true;
+                    break;
+                }
+            }
+        }
+        if (state.disconnecting && state.queue.isEmpty()) {
+            // The connection is not released while it is being written to
+            state.disconnecting = false;
+            lock.unlock();
+            if (state.closeFunction) {
+                state.closeFunction(connection);
+            }
+            lock.lock();
+        }
+        state.writing = false;
+
+        if (blocked) {
+            // Still scheduled, and tried again later without holding a writer
+            m_blocked.emplace_back(std::chrono::steady_clock::now() + std::chrono::milliseconds(WRITE_RETRY_MS),
+                                   connection);
+            m_readyCondition.notify_one();
+        } else if (!state.queue.isEmpty()) {
+            m_ready.push_back(connection);
+            m_readyCondition.notify_one();
+        } else {
+            state.scheduled = false;
+        }
+        m_idleCondition.notify_all();
+    }
+}
+
+}}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef WEBSOCKETWRITER_H
+#define WEBSOCKETWRITER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "outboundqueue.h"
+
+struct mg_connection;
+
+namespace harmony { namespace private_impl {
+
+/**
+ * @brief Writes messages to WebSockets from a pool of writer threads
+ *
+ * Each WebSocket gets a bounded outbound queue. Sending a message only
+ * enqueues it, and schedules the WebSocket on the writer pool, so that
+ * a broadcast never blocks on the network. A WebSocket is drained by
+ * at most one writer at a time, and writers do not block: messages
+ * that would block are put back in the queue, and the WebSocket is tried
+ * again a bit later. So a slow client does not hold any writer, and only
+ * its own queue fills up. WebSockets that stay blocked for the write
+ * timeout are closed.
+ *
+ * WebSockets are written to, and closed, with the functions they were
+ * added with, or with the functions of the writer, so that WebSockets
+ * of several servers can share the writers.
+ */
+class WebSocketWriter final
+{
+public:
+    using Options = IServer::Options::WebSocket;
+    using WriteFunction_t = std::function<WebSocketWriteResult (mg_connection *connection,
+                                                                const WebSocketMessage &message)>;
+    // Closes the socket of a WebSocket that is disconnected by the Disconnect overflow policy, by disconnect,
+    // or because it stayed blocked for the write timeout
+    using CloseFunction_t = std::function<void (mg_connection *connection)>;
+    explicit WebSocketWriter(WriteFunction_t writeFunction, CloseFunction_t closeFunction = CloseFunction_t());
+    ~WebSocketWriter();
+    WebSocketWriter(const WebSocketWriter &) = delete;
+    WebSocketWriter & operator=(const WebSocketWriter &) = delete;
+    void start(const Options &options);
+    void stop();
+    // Empty functions are replaced by the ones of the writer
+    void add(mg_connection *connection, WriteFunction_t writeFunction = WriteFunction_t(),
+             CloseFunction_t closeFunction = CloseFunction_t());
+    // Waits until the connection is not being written to anymore
+    void remove(mg_connection *connection);
+    void clear();
+    // Drops the pending messages, and closes the WebSocket with a policy violation close frame
+    void disconnect(mg_connection *connection);
+    bool send(mg_connection *connection, const OutboundMessage &message);
+    void send(const std::vector<mg_connection *> &connections, const OutboundMessage &message);
+    void broadcast(const OutboundMessage &message);
+    int count() const;
+private:
+    struct Connection
+    {
+        explicit Connection(const Options &options, WriteFunction_t writeFunction, CloseFunction_t closeFunction);
+        const WriteFunction_t writeFunction;
+        const CloseFunction_t closeFunction;
+        OutboundQueue queue;
+        bool scheduled {false};
+        bool writing {false};
+        bool closing {false};
+        bool disconnecting {false};
+        // Set when a write would block, and reset when a write succeeds
+        std::chrono::steady_clock::time_point blockedSince {};
+    };
+    using Blocked_t = std::pair<std::chrono::steady_clock::time_point, mg_connection *>;
+    void push(mg_connection *connection, Connection &state, const OutboundMessage &message);
+    void disconnect(mg_connection *connection, Connection &state);
+    void notify(int scheduled);
+    void run();
+    const WriteFunction_t m_writeFunction {};
+    const CloseFunction_t m_closeFunction {};
+    Options m_options {};
+    std::unordered_map<mg_connection *, std::unique_ptr<Connection>> m_connections {};
+    std::deque<mg_connection *> m_ready {};
+    // WebSockets whose writes would block, by the time they are tried again
+    std::deque<Blocked_t> m_blocked {};
+    std::vector<std::thread> m_writers {};
+    bool m_stopping {false};
+    mutable std::mutex m_mutex {};
+    std::condition_variable m_readyCondition {};
+    std::condition_variable m_idleCondition {};
+};
+
+}}
+
+#endif // WEBSOCKETWRITER_H
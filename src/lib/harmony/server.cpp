@@ -31,43 +31,118 @@
 
 #include "iserver.h"
 #include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <CivetServer.h>
+#include <QtCore/QDateTime>
 #include <QtCore/QDir>
 #include <QtCore/QFile>
 #include <QtCore/QJsonArray>
 #include <QtCore/QStandardPaths>
 #include <QtCore/QLoggingCategory>
+#include "private/admissioncontrol.h"
+#include "private/broadcastcoalescer.h"
+#include "private/broadcasthistory.h"
 #include "private/enhancedcivetserver.h"
+#include "private/epollwebsocketserver.h"
+#include "private/eventstream.h"
+#include "private/ratelimiter.h"
+#include "private/topicindex.h"
+#include "private/websocketframe.h"
+#include "private/websocketwriter.h"
 #include "iauthentificationservice.h"
 #include "harmonyextension.h"
 #include "iextensionmanager.h"
 
 static const char *CERTIFICATE_DIR = "ssl";
 static const char *CERTIFICATE = "harmony.pem";
+static const int AUTHENTIFICATION_ATTEMPTS = 5;
+static const int AUTHENTIFICATION_WINDOW_MS = 60000;
+static const int EVENTS_KEEP_ALIVE_MS = 30000;
+
+// civetweb does not start if one of its ports cannot be opened
+static bool hasIpv6Loopback()
+{
+    const int fd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    sockaddr_in6 address {};
+    address.sin6_family = AF_INET6;
+    address.sin6_addr = in6addr_loopback;
+    const bool ok = bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+    close(fd);
+    return ok;
+}
 
 namespace harmony {
 
+using AdmissionControl = private_impl::AdmissionControl;
+using BroadcastCoalescer = private_impl::BroadcastCoalescer;
+using BroadcastHistory = private_impl::BroadcastHistory;
+using CivetRequestHandler = private_impl::CivetRequestHandler;
 using CivetWebSocketHandler = private_impl::CivetWebSocketHandler;
 using EnhancedCivetServer = private_impl::EnhancedCivetServer;
+using EpollWebSocketServer = private_impl::EpollWebSocketServer;
+using EventStream = private_impl::EventStream;
+using RateLimiter = private_impl::RateLimiter;
+using WebSocketWriter = private_impl::WebSocketWriter;
+using OutboundMessage = private_impl::OutboundMessage;
+using TopicIndex = private_impl::TopicIndex;
+using WebSocketMessage = private_impl::WebSocketMessage;
+using WebSocketWriteResult = private_impl::WebSocketWriteResult;
 
 class Server: public IServer
 {
 public:
     explicit Server(IAuthentificationService &authentificationService,
                     IExtensionManager &extensionManager, int port, const std::string &publicFolder);
+    ~Server();
     int port() const override;
     void setPort(int port) override;
     std::string publicFolder() const override;
     void setPublicFolder(const std::string &publicFolder) override;
+    Options options() const override;
+    void setOptions(const Options &options) override;
     bool isRunning() const override;
     bool start() override;
     void stop() override;
+    std::vector<ShardStatistics> shardStatistics() const override;
+    AdmissionStatistics admissionStatistics() const override;
 private:
     class CertificateException : public std::runtime_error {
     public:
         CertificateException(const std::string &message) : std::runtime_error(message) {}
     };
+    /*
+     * Admits every request served by civetweb, including the static
+     * files and /ping, before its token or body is read. Event streams
+     * and WebSockets are long lived, and are not limited.
+     */
+    class AdmissionHandler: public CivetRequestHandler
+    {
+    public:
+        explicit AdmissionHandler(Server &server);
+        bool handleBegin(EnhancedCivetServer *server, mg_connection *connection) override;
+        void handleEnd(EnhancedCivetServer *server, const mg_connection *connection) override;
+    private:
+        Server &m_server;
+        // Route of the admitted requests, by connection
+        std::unordered_map<const mg_connection *, std::string> m_admitted {};
+        std::mutex m_mutex {};
+    };
     class PingHandler: public CivetHandler
     {
     public:
@@ -78,6 +153,23 @@ private:
     public:
         explicit AuthentificationHandler(Server &server);
         bool handlePost(CivetServer *, mg_connection *connection) override;
+    private:
+        Server &m_server;
+        RateLimiter m_rateLimiter {AUTHENTIFICATION_ATTEMPTS, AUTHENTIFICATION_WINDOW_MS};
+    };
+    class RefreshHandler: public CivetHandler
+    {
+    public:
+        explicit RefreshHandler(Server &server);
+        bool handlePost(CivetServer *, mg_connection *connection) override;
+    private:
+        Server &m_server;
+    };
+    class LogoutHandler: public CivetHandler
+    {
+    public:
+        explicit LogoutHandler(Server &server);
+        bool handlePost(CivetServer *, mg_connection *connection) override;
     private:
         Server &m_server;
     };
@@ -104,7 +196,23 @@ private:
         std::string m_cache {};
         Server &m_server;
     };
-    class WebSocketHandler: public CivetWebSocketHandler
+    class StateHandler: public CivetHandler
+    {
+    public:
+        explicit StateHandler(Server &server);
+        bool handleGet(CivetServer *, mg_connection *connection) override;
+    private:
+        Server &m_server;
+    };
+    class EventsHandler: public CivetHandler
+    {
+    public:
+        explicit EventsHandler(Server &server);
+        bool handleGet(CivetServer *, mg_connection *connection) override;
+    private:
+        Server &m_server;
+    };
+    class WebSocketHandler: public CivetWebSocketHandler, public EpollWebSocketServer::IHandler
     {
     public:
         explicit WebSocketHandler(Server &server);
@@ -113,55 +221,113 @@ private:
         bool handleData(EnhancedCivetServer *server, mg_connection *connection, int bits,
                         const char *data, size_t len);
         void handleClose(EnhancedCivetServer *server, const mg_connection *connection);
+        bool handleData(EpollWebSocketServer *server, mg_connection *connection, int bits,
+                        const char *data, size_t len) override;
+        void handleClose(EpollWebSocketServer *server, const mg_connection *connection) override;
     private:
+        // eventLoop is null for civetweb WebSockets
+        bool handleMessage(EpollWebSocketServer *eventLoop, mg_connection *connection, const QByteArray &data,
+                           std::chrono::steady_clock::time_point &deadline);
         Server &m_server;
     };
     class WebSocketContainer: public IExtensionManager::ICallback
     {
     public:
-        explicit WebSocketContainer(IExtensionManager &extensionManager, Server &server);
+        explicit WebSocketContainer(IExtensionManager &extensionManager);
         ~WebSocketContainer();
-        void addSocket(mg_connection *socket);
+        void start(const Options::WebSocket &options);
+        void stop();
+        // Sockets are written to, and closed, by the server that owns them
+        void addSocket(mg_connection *socket, const QByteArray &jti, WebSocketWriter::WriteFunction_t writeFunction,
+                       WebSocketWriter::CloseFunction_t closeFunction);
         void removeSocket(mg_connection *socket);
-        void clear();
-        void operator()(const QByteArray &data) const;
+        bool handleMessage(mg_connection *socket, const QByteArray &message);
+        std::shared_ptr<EventStream> addStream(const std::unordered_set<std::string> &topics, const QByteArray &lastEventId,
+                                               const QByteArray &jti);
+        void removeStream(const std::shared_ptr<EventStream> &stream);
+        void closeStreams();
+        void revoke(const QByteArray &jti);
+        void operator()(const Broadcast &broadcast) const;
     private:
+        void send(const Broadcast &broadcast) const;
+        void call(mg_connection *socket, const QJsonObject &request) const;
+        void resume(mg_connection *socket, const QJsonValue &sequence, const QByteArray &epoch);
         IExtensionManager &m_extensionManager;
-        Server &m_server;
-        std::set<mg_connection *> m_sockets {};
-        mutable std::mutex m_mutex {};
+        // Endpoints that can be called over the WebSocket, by extension id and endpoint name
+        std::map<std::pair<std::string, std::string>, std::pair<const Extension *, Endpoint>> m_endpoints {};
+        mutable WebSocketWriter m_writer;
+        TopicIndex m_topics {};
+        mutable BroadcastCoalescer m_coalescer;
+        // Sequenced sockets, tokens, streams and the history are used under m_historyMutex
+        std::unique_ptr<BroadcastHistory> m_history {};
+        std::unordered_set<mg_connection *> m_sequenced {};
+        // jti of the token that authorized each socket, and each stream
+        std::unordered_map<mg_connection *, QByteArray> m_tokens {};
+        std::map<std::shared_ptr<EventStream>, QByteArray> m_streams {};
+        bool m_streaming {false};
+        int m_queueCapacity {0};
+        mutable std::mutex m_historyMutex {};
+        // Taken before m_historyMutex is released, so that broadcasts are fanned out in order
+        mutable std::mutex m_fanOutMutex {};
     };
 
     static QByteArray getCertificateFilePath();
+    static QByteArray getBearerToken(mg_connection *connection);
+    static void writeResponse(mg_connection *connection, const std::string &status, const std::string &contentType,
+                              const std::string &body, const std::string &headers = std::string());
     static void writeAuthorizationRequired(mg_connection *connection);
+    void writeServiceUnavailable(mg_connection *connection);
+    void writeTokens(mg_connection *connection, const JsonWebToken &token, const JsonWebToken &refreshToken);
     bool checkAuthorization(mg_connection *connection);
 
     std::unique_ptr<EnhancedCivetServer> m_server {};
+    // Serve WebSockets on Options::WebSocket::eventLoopPort, if set
+    std::vector<std::unique_ptr<EpollWebSocketServer>> m_eventLoops {};
+    // Serves WebSockets on Options::localSocket, if set
+    std::unique_ptr<EpollWebSocketServer> m_localEventLoop {};
 
     int m_port {0};
     std::string m_publicFolder {};
+    Options m_options {};
     IAuthentificationService &m_authentificationService;
     const IExtensionManager &m_extensionManager;
     WebSocketContainer m_webSocketContainer;
+    AdmissionControl m_admissionControl {};
+    AdmissionHandler m_admissionHandler;
 
     PingHandler m_pingHandler {};
     AuthentificationHandler m_authentificationHandler;
+    RefreshHandler m_refreshHandler;
+    LogoutHandler m_logoutHandler;
     std::vector<RequestHandler> m_handlers {};
     ApiListHandler m_apiListHandler;
+    StateHandler m_stateHandler;
+    EventsHandler m_eventsHandler;
     WebSocketHandler m_webSocketHandler;
 };
 
 Server::Server(IAuthentificationService &authentificationService,
                IExtensionManager &extensionManager, int port, const std::string &publicFolder)
     : m_port{port}, m_publicFolder{publicFolder}, m_authentificationService{authentificationService}
-    , m_extensionManager{extensionManager}, m_webSocketContainer{extensionManager, *this}
-    , m_authentificationHandler{*this}, m_apiListHandler{*this}, m_webSocketHandler{*this}
+    , m_extensionManager{extensionManager}
+    , m_webSocketContainer{extensionManager}, m_admissionHandler{*this}
+    , m_authentificationHandler{*this}, m_refreshHandler{*this}
+    , m_logoutHandler{*this}, m_apiListHandler{*this}, m_stateHandler{*this}, m_eventsHandler{*this}, m_webSocketHandler{*this}
 {
     for (const Extension *extension : m_extensionManager.extensions()) {
         for (const Endpoint &endpoint : extension->endpoints()) {
             m_handlers.push_back(RequestHandler(*this, *extension, endpoint));
         }
     }
+    // WebSockets and event streams are closed when their token is revoked
+    m_authentificationService.setRevokedCallback([this](const QByteArray &jti) {
+        m_webSocketContainer.revoke(jti);
+    });
+}
+
+Server::~Server()
+{
+    m_authentificationService.setRevokedCallback(IAuthentificationService::RevokedCallback_t());
 }
 
 int Server::port() const
@@ -190,6 +356,19 @@ void Server::setPublicFolder(const std::string &publicFolder)
     m_publicFolder = publicFolder;
 }
 
+IServer::Options Server::options() const
+{
+    return m_options;
+}
+
+void Server::setOptions(const Options &options)
+{
+    if (isRunning()) {
+        qCWarning(QLoggingCategory("server")) << "Harmony server is running. Options will be changed when the server is restarted.";
+    }
+    m_options = options;
+}
+
 bool Server::isRunning() const
 {
     return m_server != nullptr;
@@ -197,10 +376,19 @@ bool Server::isRunning() const
 
 bool Server::start()
 {
+    m_admissionControl.setOptions(m_options.admission);
     bool ok = true;
     try {
         std::string port {std::to_string(m_port)};
         port.append("s");
+        if (m_options.loopbackPort > 0) {
+            // Plain HTTP, for local clients that do not need TLS
+            const std::string &loopbackPort = std::to_string(m_options.loopbackPort);
+            port.append(",127.0.0.1:" + loopbackPort);
+            if (hasIpv6Loopback()) {
+                port.append(",[::1]:" + loopbackPort);
+            }
+        }
 
         const QByteArray &certificatePath = getCertificateFilePath();
 
@@ -209,25 +397,48 @@ bool Server::start()
         qCDebug(QLoggingCategory("server")) << "Using certificate from" << certificatePath;
 #endif
 
+        const std::string threads {std::to_string(m_options.threadCount)};
         const char *optionsNoPublic[] = {"listening_ports", port.c_str(),
                                          "ssl_certificate", certificatePath.data(),
+                                         "num_threads", threads.c_str(),
                                          nullptr };
         const char *optionsPublic[] = {"listening_ports", port.c_str(),
                                        "ssl_certificate", certificatePath.data(),
+                                       "num_threads", threads.c_str(),
                                        "document_root", m_publicFolder.c_str(),
                                        nullptr };
         if (m_publicFolder.empty()) {
-            m_server.reset(new EnhancedCivetServer(optionsNoPublic));
+            m_server.reset(new EnhancedCivetServer(optionsNoPublic, nullptr, m_options.webSocket, &m_admissionHandler));
         } else {
-            m_server.reset(new EnhancedCivetServer(optionsPublic));
+            m_server.reset(new EnhancedCivetServer(optionsPublic, nullptr, m_options.webSocket, &m_admissionHandler));
         }
         m_server->addHandler("/ping", m_pingHandler);
         m_server->addHandler("/authenticate", m_authentificationHandler);
+        m_server->addHandler("/authenticate/refresh", m_refreshHandler);
+        m_server->addHandler("/authenticate/logout", m_logoutHandler);
         for (RequestHandler &handler : m_handlers) {
             m_server->addHandler(handler.endpoint(), handler);
         }
         m_server->addHandler("/api/list", m_apiListHandler);
+        m_server->addHandler("/api/state", m_stateHandler);
+        m_server->addHandler("/api/events", m_eventsHandler);
         m_server->addWebSocketHandler("/api/ws", &m_webSocketHandler);
+        if (m_options.webSocket.eventLoopPort > 0) {
+            const int cpuCount = std::max<int>(std::thread::hardware_concurrency(), 1);
+            for (int i = 0; i < std::max(m_options.webSocket.eventLoopShards, 1); ++i) {
+                const int cpu = m_options.webSocket.eventLoopAffinity ? i % cpuCount : -1;
+                m_eventLoops.emplace_back(new EpollWebSocketServer(m_options.webSocket.eventLoopPort,
+                                                                   certificatePath.toStdString(), "/api/ws",
+                                                                   m_webSocketHandler, m_options.webSocket,
+                                                                   m_options.webSocket.eventLoopWorkers, cpu));
+            }
+        }
+        if (!m_options.localSocket.empty()) {
+            m_localEventLoop.reset(new EpollWebSocketServer(m_options.localSocket, "/api/ws", m_webSocketHandler,
+                                                            m_options.webSocket,
+                                                            m_options.webSocket.eventLoopWorkers));
+        }
+        m_webSocketContainer.start(m_options.webSocket);
     } catch (const CertificateException &e) {
 #ifdef HARMONY_DEBUG
         qWarning() << "Exception when creating certificate:" << e.what();
@@ -242,6 +453,16 @@ bool Server::start()
         Q_UNUSED(e)
 #endif
         ok = false;
+    } catch (const EpollWebSocketServer::Exception &e) {
+#ifdef HARMONY_DEBUG
+        qWarning() << "Exception when starting the WebSocket event loop:" << e.what();
+#else
+        Q_UNUSED(e)
+#endif
+        m_eventLoops.clear();
+        m_localEventLoop.reset();
+        m_server.reset();
+        ok = false;
     } catch (...) {
         ok = false;
     }
@@ -251,8 +472,34 @@ bool Server::start()
 
 void Server::stop()
 {
+    // Event streams hold civetweb threads, that are joined when the server stops
+    m_webSocketContainer.closeStreams();
+    // Event loops notify their handlers, that use the container, when they stop
+    for (const std::unique_ptr<EpollWebSocketServer> &eventLoop : m_eventLoops) {
+        eventLoop->stop();
+    }
+    if (m_localEventLoop) {
+        m_localEventLoop->stop();
+    }
+    // Writers use the civetweb connections, that are released when the server stops
+    m_webSocketContainer.stop();
     m_server.reset();
-    m_webSocketContainer.clear();
+    m_eventLoops.clear();
+    m_localEventLoop.reset();
+}
+
+IServer::AdmissionStatistics Server::admissionStatistics() const
+{
+    return m_admissionControl.statistics();
+}
+
+std::vector<IServer::ShardStatistics> Server::shardStatistics() const
+{
+    std::vector<ShardStatistics> statistics {};
+    for (const std::unique_ptr<EpollWebSocketServer> &eventLoop : m_eventLoops) {
+        statistics.push_back(eventLoop->statistics());
+    }
+    return statistics;
 }
 
 QByteArray Server::getCertificateFilePath()
@@ -291,26 +538,68 @@ QByteArray Server::getCertificateFilePath()
     return dir.absoluteFilePath(CERTIFICATE).toLocal8Bit();
 }
 
-void Server::writeAuthorizationRequired(mg_connection *connection)
+/*
+ * Writes a whole response. It is written with mg_write, and not with
+ * mg_printf, so that bodies that come from extensions or clients are
+ * never used as a format string. headers are extra header lines, each
+ * ending with \r\n.
+ */
+void Server::writeResponse(mg_connection *connection, const std::string &status, const std::string &contentType,
+                           const std::string &body, const std::string &headers)
 {
     std::stringstream ss;
-    ss << "HTTP/1.1 401 Unauthorized\r\n"
-       << "\r\n"
-       << "Unauthorized";
-    mg_printf(connection, ss.str().c_str());
+    ss << "HTTP/1.1 " << status << "\r\n"
+       << headers;
+    if (!contentType.empty()) {
+        ss << "Content-Type: " << contentType << "\r\n";
+    }
+    // 204 responses cannot have a body, nor a Content-Length
+    if (status.compare(0, 3, "204") != 0) {
+        ss << "Content-Length: " << body.size() << "\r\n";
+    }
+    ss << "\r\n"
+       << body;
+    const std::string &response = ss.str();
+    mg_write(connection, response.data(), response.size());
 }
 
-bool Server::checkAuthorization(mg_connection *connection)
+void Server::writeAuthorizationRequired(mg_connection *connection)
 {
-    const char *authorizationCharArray = CivetServer::getHeader(connection, "Authorization");
-    std::string authorization = authorizationCharArray ? std::string(authorizationCharArray) : std::string();
-    if (authorization.empty() || authorization.find("Bearer ") != 0) {
-        writeAuthorizationRequired(connection);
-        return false;
+    writeResponse(connection, "401 Unauthorized", "text/plain", "Unauthorized");
+}
+
+// Shed requests are answered right away, clients should come back later
+void Server::writeServiceUnavailable(mg_connection *connection)
+{
+    std::stringstream headers;
+    headers << "Retry-After: " << m_admissionControl.retryAfter() << "\r\n";
+    writeResponse(connection, "503 Service Unavailable", "text/plain", "Service unavailable", headers.str());
+}
+
+QByteArray Server::getBearerToken(mg_connection *connection)
+{
+    const char *authorization = CivetServer::getHeader(connection, "Authorization");
+    if (!authorization || strncmp(authorization, "Bearer ", 7) != 0) {
+        return QByteArray();
+    }
+    return QByteArray(authorization + 7);
+}
+
+void Server::writeTokens(mg_connection *connection, const JsonWebToken &token, const JsonWebToken &refreshToken)
+{
+    std::stringstream ss;
+    ss << "{\"token\":\"" << m_authentificationService.hashJwt(token).data() << "\"";
+    if (!refreshToken.isNull()) {
+        ss << ",\"refreshToken\":\"" << m_authentificationService.hashJwt(refreshToken).data() << "\"";
     }
+    ss << "}";
+    writeResponse(connection, "200 OK", "application/json", ss.str());
+}
 
-    authorization = authorization.substr(7);
-    if (!m_authentificationService.isAuthorized(QByteArray::fromStdString(authorization))) {
+bool Server::checkAuthorization(mg_connection *connection)
+{
+    const QByteArray &token = getBearerToken(connection);
+    if (token.isEmpty() || !m_authentificationService.isAuthorized(token)) {
         writeAuthorizationRequired(connection);
         return false;
     }
@@ -326,14 +615,48 @@ IServer::Ptr IServer::create(IAuthentificationService &authentificationService,
 
 bool Server::PingHandler::handleGet(CivetServer *, mg_connection *connection)
 {
-    std::stringstream ss;
-    ss << "HTTP/1.1 200 OK\r\n"
-       << "\r\n"
-       << "pong";
-    mg_printf(connection, ss.str().c_str());
+    writeResponse(connection, "200 OK", "text/plain", "pong");
+    return true;
+}
+
+Server::AdmissionHandler::AdmissionHandler(Server &server)
+    : m_server{server}
+{
+}
+
+bool Server::AdmissionHandler::handleBegin(EnhancedCivetServer *server, mg_connection *connection)
+{
+    Q_UNUSED(server);
+    const struct mg_request_info *requestInfo = mg_get_request_info(connection);
+    const std::string route {requestInfo->local_uri ? requestInfo->local_uri : ""};
+    if (route == "/api/events" || route == "/api/ws") {
+        return true;
+    }
+    if (!m_server.m_admissionControl.acquire(route)) {
+        m_server.writeServiceUnavailable(connection);
+        return false;
+    }
+    std::lock_guard<std::mutex> lock {m_mutex};
+    m_admitted[connection] = route;
     return true;
 }
 
+void Server::AdmissionHandler::handleEnd(EnhancedCivetServer *server, const mg_connection *connection)
+{
+    Q_UNUSED(server);
+    std::string route {};
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        auto it = m_admitted.find(connection);
+        if (it == m_admitted.end()) {
+            return;
+        }
+        route = std::move(it->second);
+        m_admitted.erase(it);
+    }
+    m_server.m_admissionControl.release(route);
+}
+
 Server::AuthentificationHandler::AuthentificationHandler(Server &server)
     : m_server{server}
 {
@@ -341,29 +664,91 @@ Server::AuthentificationHandler::AuthentificationHandler(Server &server)
 
 bool Server::AuthentificationHandler::handlePost(CivetServer *, mg_connection *connection)
 {
+    // Reject clients that failed too many times before doing any work
+    const struct mg_request_info *requestInfo = mg_get_request_info(connection);
+    if (!m_rateLimiter.tryAcquire(requestInfo->remote_addr)) {
+        const std::int64_t retryAfterMs = m_rateLimiter.retryAfterMs(requestInfo->remote_addr);
+        std::stringstream headers;
+        headers << "Retry-After: " << std::max<std::int64_t>((retryAfterMs + 999) / 1000, 1) << "\r\n";
+        writeResponse(connection, "429 Too Many Requests", "text/plain", "Too many authentification attempts",
+                      headers.str());
+        return true;
+    }
+
     std::string data = EnhancedCivetServer::getPostData(connection);
     QJsonDocument dataDocument = QJsonDocument::fromJson(QByteArray::fromStdString(data));
     if (dataDocument.isObject()) {
         const QJsonObject &object = dataDocument.object();
         const QString &code = object.value("password").toString();
 
-        const JsonWebToken token = m_server.m_authentificationService.authenticate(code.toStdString());
+        // Clients that want to keep their session ask for a refresh token
+        JsonWebToken refreshToken {};
+        const bool withRefreshToken = object.value("refresh").toBool();
+        const JsonWebToken token = m_server.m_authentificationService.authenticate(code.toStdString(),
+                                                                                   withRefreshToken ? &refreshToken : nullptr);
         if (!token.isNull()) {
-            std::stringstream ss;
-            ss << "HTTP/1.1 200 OK\r\n"
-               << "\r\n"
-               << "{\"token\":\"" << m_server.m_authentificationService.hashJwt(token).data()
-               << "\"}";
-            mg_printf(connection, ss.str().c_str());
+            // Only failed attempts count
+            m_rateLimiter.release(requestInfo->remote_addr);
+            m_server.writeTokens(connection, token, refreshToken);
             return true;
         }
     }
 
-    std::stringstream ss;
-    ss << "HTTP/1.1 401 Unauthorized\r\n"
-       << "\r\n"
-       << "Wrong authentification code";
-    mg_printf(connection, ss.str().c_str());
+    writeResponse(connection, "401 Unauthorized", "text/plain", "Wrong authentification code");
+    return true;
+}
+
+Server::RefreshHandler::RefreshHandler(Server &server)
+    : m_server{server}
+{
+}
+
+bool Server::RefreshHandler::handlePost(CivetServer *, mg_connection *connection)
+{
+    std::string data = EnhancedCivetServer::getPostData(connection);
+    QJsonDocument dataDocument = QJsonDocument::fromJson(QByteArray::fromStdString(data));
+    if (dataDocument.isObject()) {
+        const QJsonObject &object = dataDocument.object();
+        const QByteArray &refreshJwt = object.value("refreshToken").toString().toLatin1();
+
+        JsonWebToken refreshToken {};
+        const JsonWebToken token = m_server.m_authentificationService.refresh(refreshJwt, &refreshToken);
+        if (!token.isNull()) {
+            m_server.writeTokens(connection, token, refreshToken);
+            return true;
+        }
+    }
+
+    writeAuthorizationRequired(connection);
+    return true;
+}
+
+Server::LogoutHandler::LogoutHandler(Server &server)
+    : m_server{server}
+{
+}
+
+bool Server::LogoutHandler::handlePost(CivetServer *, mg_connection *connection)
+{
+    const QByteArray &token = getBearerToken(connection);
+    JsonWebToken::Claims claims {};
+    if (token.isEmpty() || !m_server.m_authentificationService.isAuthorized(token, &claims)
+        || !m_server.m_authentificationService.revoke(token)) {
+        writeAuthorizationRequired(connection);
+        return true;
+    }
+
+    // The refresh token, if any, is revoked with the access token, if it belongs to the same session
+    std::string data = EnhancedCivetServer::getPostData(connection);
+    QJsonDocument dataDocument = QJsonDocument::fromJson(QByteArray::fromStdString(data));
+    if (dataDocument.isObject() && !claims.sid.isEmpty()) {
+        const QByteArray &refreshJwt = dataDocument.object().value("refreshToken").toString().toLatin1();
+        if (!refreshJwt.isEmpty()) {
+            m_server.m_authentificationService.revoke(refreshJwt, claims.sid);
+        }
+    }
+
+    writeResponse(connection, "204 No Content", std::string(), std::string());
     return true;
 }
 
@@ -416,44 +801,40 @@ void Server::RequestHandler::handle(mg_connection *connection, bool hasData)
     }
 
     Reply reply {m_extension.handleRequest(m_endpoint, query, data)};
-    std::stringstream ss;
-    ss << "HTTP/1.1 ";
+    std::string status {};
     switch (reply.status()) {
     case 200:
-        ss << "200 OK";
+        status = "200 OK";
         break;
     case 201:
-        ss << "201 Created";
+        status = "201 Created";
         break;
     case 202:
-        ss << "202 Accepted";
+        status = "202 Accepted";
         break;
     case 204:
-        ss << "204 No Content";
+        status = "204 No Content";
         break;
     case 401:
-        ss << "401 Unauthorized";
+        status = "401 Unauthorized";
         break;
     case 403:
-        ss << "403 Forbidden";
+        status = "403 Forbidden";
         break;
     case 404:
-        ss << "404 Not Found";
+        status = "404 Not Found";
         break;
     default:
-        ss << "400 Bad Request";
+        status = "400 Bad Request";
         break;
     }
 
-    ss << "\r\n\r\n";
-    switch (reply.type()) {
-    case Reply::Type::Json:
-        ss << reply.value();
-        break;
-    default:
-        break;
+    // 204 responses have no body
+    if (reply.type() == Reply::Type::Json && reply.status() != 204) {
+        writeResponse(connection, status, "application/json", reply.value());
+    } else {
+        writeResponse(connection, status, std::string(), std::string());
     }
-    mg_printf(connection, ss.str().c_str());
 }
 
 Server::ApiListHandler::ApiListHandler(Server &server)
@@ -500,13 +881,110 @@ bool Server::ApiListHandler::handleGet(CivetServer *, mg_connection *connection)
             list.append(extensionObject);
         }
 
-        std::stringstream ss {};
-        ss << "HTTP/1.1 200 OK\r\n"
-           << "\r\n"
-           << QJsonDocument(list).toJson(QJsonDocument::Compact).toStdString();
-        m_cache = ss.str();
+        m_cache = QJsonDocument(list).toJson(QJsonDocument::Compact).toStdString();
+    }
+    writeResponse(connection, "200 OK", "application/json", m_cache);
+    return true;
+}
+
+Server::StateHandler::StateHandler(Server &server)
+    : m_server{server}
+{
+}
+
+// Whole state published on ?topic=, that clients patch with the broadcasts
+bool Server::StateHandler::handleGet(CivetServer *, mg_connection *connection)
+{
+    if (!m_server.checkAuthorization(connection)) {
+        return true;
+    }
+
+    const QUrlQuery query {QString::fromStdString(EnhancedCivetServer::getParameters(connection))};
+    quint64 version {0};
+    QJsonObject state {};
+    if (!m_server.m_extensionManager.state(query.queryItemValue("topic").toStdString(), version, state)) {
+        writeResponse(connection, "404 Not Found", std::string(), std::string());
+        return true;
     }
-    mg_printf(connection, m_cache.c_str());
+
+    QJsonObject object {};
+    object.insert("version", static_cast<double>(version));
+    object.insert("state", state);
+    writeResponse(connection, "200 OK", "application/json",
+                  QJsonDocument(object).toJson(QJsonDocument::Compact).toStdString());
+    return true;
+}
+
+Server::EventsHandler::EventsHandler(Server &server)
+    : m_server{server}
+{
+}
+
+/*
+ * Server-Sent Events stream of the broadcasts. The civetweb worker
+ * thread of the request serves the stream until the client disconnects,
+ * or its token expires or is revoked, so each client holds one of the
+ * Options::threadCount workers for as long as it is connected, unlike
+ * WebSockets served by an event loop. Clients can select topics with
+ * ?topics=a,b, and resume with the Last-Event-ID header.
+ *
+ * Browsers cannot set headers on an EventSource, so the token and the
+ * last event id can also be passed as ?token= and ?lastEventId=. Only
+ * this handler reads tokens from the query, since URLs end up in the
+ * logs of proxies, and in the access log, if civetweb is configured
+ * with one. Clients that can set headers should use the Authorization
+ * header, and others should pass the short-lived access tokens that
+ * /authenticate returns with a refresh token.
+ */
+bool Server::EventsHandler::handleGet(CivetServer *, mg_connection *connection)
+{
+    QByteArray token = getBearerToken(connection);
+    const QUrlQuery query {QString::fromStdString(EnhancedCivetServer::getParameters(connection))};
+    if (token.isEmpty()) {
+        token = query.queryItemValue("token").toLatin1();
+    }
+    JsonWebToken::Claims claims {};
+    if (token.isEmpty() || !m_server.m_authentificationService.isAuthorized(token, &claims)) {
+        writeAuthorizationRequired(connection);
+        return true;
+    }
+
+    std::unordered_set<std::string> topics {};
+    for (const QString &topic : query.queryItemValue("topics").split(',', QString::SkipEmptyParts)) {
+        topics.insert(topic.toStdString());
+    }
+    const char *lastEventIdHeader = CivetServer::getHeader(connection, "Last-Event-ID");
+    const QByteArray &lastEventId = lastEventIdHeader ? QByteArray(lastEventIdHeader)
+                                                      : query.queryItemValue("lastEventId").toLatin1();
+
+    std::stringstream ss;
+    ss << "HTTP/1.1 200 OK\r\n"
+       << "Content-Type: text/event-stream\r\n"
+       << "Cache-Control: no-cache\r\n"
+       << "Connection: close\r\n"
+       << "\r\n";
+    const std::string &headers = ss.str();
+    mg_write(connection, headers.data(), headers.size());
+
+    const Options::WebSocket &options = m_server.m_options.webSocket;
+    const auto deadline = std::chrono::steady_clock::now()
+            + std::chrono::seconds(claims.exp - QDateTime::currentMSecsSinceEpoch() / 1000);
+    const std::chrono::milliseconds keepAlive {options.pingInterval > 0 ? options.pingInterval : EVENTS_KEEP_ALIVE_MS};
+
+    std::shared_ptr<EventStream> stream = m_server.m_webSocketContainer.addStream(topics, lastEventId, claims.jti);
+    stream->setDeadline(deadline);
+    std::deque<QByteArray> events {};
+    bool ok {true};
+    while (ok && stream->wait(events, keepAlive)) {
+        if (events.empty()) {
+            // Comments keep proxies from closing idle streams, and detect closed clients
+            ok = mg_write(connection, ":\n\n", 3) > 0;
+        }
+        for (const QByteArray &event : events) {
+            ok = ok && mg_write(connection, event.constData(), event.size()) > 0;
+        }
+    }
+    m_server.m_webSocketContainer.removeStream(stream);
     return true;
 }
 
@@ -532,20 +1010,20 @@ void Server::WebSocketHandler::handleReady(EnhancedCivetServer *server, mg_conne
 bool Server::WebSocketHandler::handleData(EnhancedCivetServer *server, mg_connection *connection,
                                           int bits, const char *data, size_t len)
 {
-    Q_UNUSED(server);
-    Q_UNUSED(connection);
     Q_UNUSED(bits);
     QByteArray dataArray (data, len);
 #ifdef HARMONY_DEBUG
     const struct mg_request_info *requestInfo = mg_get_request_info(connection);
     qCDebug(QLoggingCategory("ws")) << "Received from " << requestInfo->remote_addr << dataArray;
 #endif
-    bool ok = m_server.m_authentificationService.isAuthorized(data);
-    if (ok) {
-        m_server.m_webSocketContainer.addSocket(connection);
+    std::chrono::steady_clock::time_point deadline {};
+    if (!handleMessage(nullptr, connection, dataArray, deadline)) {
+        return false;
     }
-
-    return ok;
+    if (deadline != std::chrono::steady_clock::time_point()) {
+        server->wsSetDeadline(connection, deadline);
+    }
+    return true;
 }
 
 void Server::WebSocketHandler::handleClose(EnhancedCivetServer *server,
@@ -555,9 +1033,79 @@ void Server::WebSocketHandler::handleClose(EnhancedCivetServer *server,
     m_server.m_webSocketContainer.removeSocket(const_cast<mg_connection *>(connection));
 }
 
-Server::WebSocketContainer::WebSocketContainer(IExtensionManager &extensionManager, Server &server)
-    : m_extensionManager{extensionManager}, m_server{server}
+bool Server::WebSocketHandler::handleData(EpollWebSocketServer *server, mg_connection *connection,
+                                          int bits, const char *data, size_t len)
 {
+    Q_UNUSED(bits);
+    QByteArray dataArray (data, len);
+#ifdef HARMONY_DEBUG
+    qCDebug(QLoggingCategory("ws")) << "Received from event loop connection" << dataArray;
+#endif
+    std::chrono::steady_clock::time_point deadline {};
+    if (!handleMessage(server, connection, dataArray, deadline)) {
+        return false;
+    }
+    if (deadline != std::chrono::steady_clock::time_point()) {
+        server->wsSetDeadline(connection, deadline);
+    }
+    return true;
+}
+
+void Server::WebSocketHandler::handleClose(EpollWebSocketServer *server,
+                                           const mg_connection *connection)
+{
+    Q_UNUSED(server);
+    m_server.m_webSocketContainer.removeSocket(const_cast<mg_connection *>(connection));
+}
+
+// Sets deadline when the message is a token
+bool Server::WebSocketHandler::handleMessage(EpollWebSocketServer *eventLoop, mg_connection *connection,
+                                             const QByteArray &dataArray,
+                                             std::chrono::steady_clock::time_point &deadline)
+{
+    // Tokens are sent as is, and other messages are JSON objects, that
+    // are only accepted once the connection is authorized
+    if (dataArray.startsWith('{')) {
+        return m_server.m_webSocketContainer.handleMessage(connection, dataArray);
+    }
+
+    /*
+     * The connection stays authorized until the token expires, or is
+     * revoked, and is then closed by the server. Sending a newer token,
+     * for example after a refresh, extends the authorization.
+     */
+    JsonWebToken::Claims claims {};
+    if (!m_server.m_authentificationService.isAuthorized(dataArray, &claims)) {
+        return false;
+    }
+
+    // The connections of the event loops are not civetweb connections, and
+    // are written to by the event loop that owns them
+    if (eventLoop) {
+        m_server.m_webSocketContainer.addSocket(connection, claims.jti,
+                                                [eventLoop](mg_connection *socket, const WebSocketMessage &message) {
+            return eventLoop->wsWriteMessage(socket, message);
+        }, [eventLoop](mg_connection *socket) {
+            eventLoop->wsClose(socket);
+        });
+    } else {
+        m_server.m_webSocketContainer.addSocket(connection, claims.jti, &EnhancedCivetServer::wsWriteMessage,
+                                                &EnhancedCivetServer::wsClose);
+    }
+    const qint64 validity = claims.exp - QDateTime::currentMSecsSinceEpoch() / 1000;
+    deadline = std::chrono::steady_clock::now() + std::chrono::seconds(validity);
+    return true;
+}
+
+Server::WebSocketContainer::WebSocketContainer(IExtensionManager &extensionManager)
+    : m_extensionManager{extensionManager}, m_writer{WebSocketWriter::WriteFunction_t()}
+    , m_coalescer{[this](const Broadcast &broadcast) { send(broadcast); }}
+{
+    for (const Extension *extension : m_extensionManager.extensions()) {
+        for (const Endpoint &endpoint : extension->endpoints()) {
+            m_endpoints.emplace(std::make_pair(extension->id(), endpoint.name()), std::make_pair(extension, endpoint));
+        }
+    }
     m_extensionManager.addCallback(*this);
 }
 
@@ -566,29 +1114,349 @@ Server::WebSocketContainer::~WebSocketContainer()
     m_extensionManager.removeCallback(*this);
 }
 
-void Server::WebSocketContainer::addSocket(mg_connection *socket)
+void Server::WebSocketContainer::start(const Options::WebSocket &options)
 {
-    std::lock_guard<std::mutex> lock {m_mutex};
-    m_sockets.insert(socket);
+    {
+        std::lock_guard<std::mutex> lock {m_historyMutex};
+        m_history.reset(options.historySize > 0 ? new BroadcastHistory(options.historySize) : nullptr);
+        m_queueCapacity = options.queueCapacity;
+        m_streaming = true;
+    }
+    m_writer.start(options);
+    m_coalescer.start(std::chrono::milliseconds(options.coalesceWindow), options.coalescedTopics);
+}
+
+void Server::WebSocketContainer::stop()
+{
+    m_coalescer.stop();
+    m_writer.stop();
+    m_topics.clear();
+    std::lock_guard<std::mutex> lock {m_historyMutex};
+    m_history.reset();
+    m_sequenced.clear();
+    m_tokens.clear();
+    m_streaming = false;
+    for (const auto &stream : m_streams) {
+        stream.first->close();
+    }
+    m_streams.clear();
+}
+
+void Server::WebSocketContainer::addSocket(mg_connection *socket, const QByteArray &jti,
+                                           WebSocketWriter::WriteFunction_t writeFunction,
+                                           WebSocketWriter::CloseFunction_t closeFunction)
+{
+    m_writer.add(socket, std::move(writeFunction), std::move(closeFunction));
+    m_topics.add(socket);
+    std::lock_guard<std::mutex> lock {m_historyMutex};
+    m_tokens[socket] = jti;
 }
 
 void Server::WebSocketContainer::removeSocket(mg_connection *socket)
 {
-    std::lock_guard<std::mutex> lock {m_mutex};
-    m_sockets.erase(socket);
+    m_topics.remove(socket);
+    {
+        std::lock_guard<std::mutex> lock {m_historyMutex};
+        m_sequenced.erase(socket);
+        m_tokens.erase(socket);
+    }
+    m_writer.remove(socket);
 }
 
-void Server::WebSocketContainer::clear()
+/*
+ * Handles {"subscribe": ["topic", ...]} and {"unsubscribe": ["topic", ...]}
+ * from authorized sockets. Topics are extension ids, or topic names
+ * broadcasted by extensions.
+ *
+ * Also handles calls to extension endpoints, see call.
+ */
+bool Server::WebSocketContainer::handleMessage(mg_connection *socket, const QByteArray &message)
 {
-    std::lock_guard<std::mutex> lock {m_mutex};
-    m_sockets.clear();
+    if (!m_topics.contains(socket)) {
+        return false;
+    }
+
+    const QJsonObject &object = QJsonDocument::fromJson(message).object();
+    if (object.contains("method")) {
+        call(socket, object);
+        return true;
+    }
+    if (object.contains("resume")) {
+        resume(socket, object.value("resume"), object.value("epoch").toString().toLatin1());
+        return true;
+    }
+    for (const QJsonValue &topic : object.value("subscribe").toArray()) {
+        m_topics.subscribe(socket, topic.toString().toStdString());
+    }
+    for (const QJsonValue &topic : object.value("unsubscribe").toArray()) {
+        m_topics.unsubscribe(socket, topic.toString().toStdString());
+    }
+    return true;
 }
 
-void Server::WebSocketContainer::operator()(const QByteArray &data) const
+/*
+ * Calls an extension endpoint like RequestHandler, without the HTTP
+ * request and the authorization check, that was done once for the
+ * WebSocket. The request
+ * {"id": 1, "method": "get", "extension": "id", "endpoint": "name",
+ *  "params": {"key": "value"}, "body": {...}}
+ * is answered with {"id": 1, "status": 200, "body": {...}}. The id
+ * is copied as is, so that clients can match replies with their calls.
+ */
+void Server::WebSocketContainer::call(mg_connection *socket, const QJsonObject &request) const
 {
-    std::lock_guard<std::mutex> lock {m_mutex};
-    for (mg_connection *socket : m_sockets) {
-        m_server.m_server->wsWrite(socket, WEBSOCKET_OPCODE_TEXT, data);
+    int status {404};
+    std::string body {};
+    const std::string &method = request.value("method").toString().toLower().toStdString();
+    auto it = m_endpoints.find(std::make_pair(request.value("extension").toString().toStdString(),
+                                              request.value("endpoint").toString().toStdString()));
+    if (it != m_endpoints.end()) {
+        const Extension &extension = *it->second.first;
+        const Endpoint &endpoint = it->second.second;
+        const bool methodMatches = (method == "get" && endpoint.type() == Endpoint::Type::Get)
+                || (method == "post" && endpoint.type() == Endpoint::Type::Post)
+                || (method == "delete" && endpoint.type() == Endpoint::Type::Delete);
+        if (methodMatches) {
+            QUrlQuery query {};
+            const QJsonValue &params = request.value("params");
+            if (params.isString()) {
+                query.setQuery(params.toString());
+            }
+            const QJsonObject &paramsObject = params.toObject();
+            for (auto param = paramsObject.begin(); param != paramsObject.end(); ++param) {
+                query.addQueryItem(param.key(), param.value().toVariant().toString());
+            }
+
+            QJsonDocument data {};
+            const QJsonValue &requestBody = request.value("body");
+            if (requestBody.isObject()) {
+                data = QJsonDocument(requestBody.toObject());
+            } else if (requestBody.isArray()) {
+                data = QJsonDocument(requestBody.toArray());
+            }
+
+            Reply reply {extension.handleRequest(endpoint, query, data)};
+            status = reply.status();
+            if (reply.type() == Reply::Type::Json) {
+                body = reply.value();
+            }
+        } else {
+            status = 405;
+        }
+    }
+
+    // The reply body is already serialized, and is not parsed again
+    const QByteArray &id = QJsonDocument(QJsonArray({request.value("id")})).toJson(QJsonDocument::Compact);
+    QByteArray response {"{\"id\":"};
+    response.append(id.mid(1, id.size() - 2));
+    response.append(",\"status\":");
+    response.append(QByteArray::number(status));
+    if (!body.empty()) {
+        response.append(",\"body\":");
+        response.append(body.data(), body.size());
+    }
+    response.append('}');
+
+    // Replies go through the outbound queue, like broadcasts, so that
+    // frames are not interleaved, but they are never dropped
+    OutboundMessage message {};
+    message.message = std::make_shared<WebSocketMessage>(WEBSOCKET_OPCODE_TEXT, response);
+    message.reply = true;
+    m_writer.send(socket, message);
+}
+
+/*
+ * Handles {"resume": sequence, "epoch": "epoch"}, sent by clients that
+ * reconnect with the sequence number of the last broadcast they got,
+ * and the epoch it belongs to. The broadcasts they missed are replayed,
+ * and are followed by {"resumed": sequence, "epoch": "epoch"}. If some
+ * of them are not in the history anymore, or the server restarted since,
+ * nothing is replayed, and {"resync": sequence, "epoch": "epoch"} tells
+ * the client to fetch its state again. Clients without a sequence number
+ * send {"resume": true}. In all cases, the socket then gets sequenced
+ * broadcasts.
+ */
+void Server::WebSocketContainer::resume(mg_connection *socket, const QJsonValue &sequence, const QByteArray &epoch)
+{
+    std::lock_guard<std::mutex> lock {m_historyMutex};
+    if (!m_history) {
+        OutboundMessage reply {};
+        reply.message = std::make_shared<WebSocketMessage>(WEBSOCKET_OPCODE_TEXT, "{\"resync\":0}");
+        reply.reply = true;
+        m_writer.send(socket, reply);
+        return;
+    }
+
+    std::vector<BroadcastHistory::Entry *> entries {};
+    bool complete {true};
+    if (sequence.isDouble()) {
+        complete = m_history->since(epoch, static_cast<quint64>(sequence.toDouble()), entries);
+    }
+    // Replaying more than the queue can hold would drop messages silently
+    if (complete && static_cast<int>(entries.size()) >= m_queueCapacity) {
+        complete = false;
+    }
+
+    if (complete) {
+        for (BroadcastHistory::Entry *entry : entries) {
+            if (m_topics.receives(socket, entry->broadcast().topic())) {
+                OutboundMessage message {};
+                message.message = entry->message();
+                m_writer.send(socket, message);
+            }
+        }
+    }
+
+    QByteArray response {complete ? "{\"resumed\":" : "{\"resync\":"};
+    response.append(QByteArray::number(m_history->sequence()));
+    response.append(",\"epoch\":\"");
+    response.append(m_history->epoch());
+    response.append("\"}");
+    OutboundMessage reply {};
+    reply.message = std::make_shared<WebSocketMessage>(WEBSOCKET_OPCODE_TEXT, response);
+    reply.reply = true;
+    m_writer.send(socket, reply);
+    m_sequenced.insert(socket);
+}
+
+/*
+ * Registers a Server-Sent Events stream. If lastEventId is set, the
+ * events the client missed are queued first, or a resync event is
+ * sent if they are not in the history anymore.
+ */
+std::shared_ptr<EventStream> Server::WebSocketContainer::addStream(const std::unordered_set<std::string> &topics,
+                                                                   const QByteArray &lastEventId,
+                                                                   const QByteArray &jti)
+{
+    std::shared_ptr<EventStream> stream {std::make_shared<EventStream>(m_queueCapacity, topics)};
+    std::lock_guard<std::mutex> lock {m_historyMutex};
+    if (!m_streaming) {
+        // The server is stopping
+        stream->close();
+        return stream;
+    }
+    QByteArray epoch {};
+    quint64 sequence {0};
+    if (!lastEventId.isEmpty() && m_history) {
+        std::vector<BroadcastHistory::Entry *> entries {};
+        const bool ok = BroadcastHistory::parseEventId(lastEventId, epoch, sequence)
+                && m_history->since(epoch, sequence, entries);
+        if (ok && static_cast<int>(entries.size()) < m_queueCapacity) {
+            for (BroadcastHistory::Entry *entry : entries) {
+                const Broadcast &broadcast = entry->broadcast();
+                if (broadcast.type() == Broadcast::Type::Text && stream->receives(broadcast.topic())) {
+                    stream->push(entry->event());
+                }
+            }
+        } else {
+            // The id of the resync event is where the client resumes from, once it fetched its state again
+            QByteArray resync {"id: "};
+            resync.append(BroadcastHistory::eventId(m_history->epoch(), m_history->sequence()));
+            resync.append("\nevent: resync\ndata: ");
+            resync.append(QByteArray::number(m_history->sequence()));
+            resync.append("\n\n");
+            stream->push(resync);
+        }
+    }
+    m_streams.emplace(stream, jti);
+    return stream;
+}
+
+void Server::WebSocketContainer::removeStream(const std::shared_ptr<EventStream> &stream)
+{
+    std::lock_guard<std::mutex> lock {m_historyMutex};
+    m_streams.erase(stream);
+}
+
+void Server::WebSocketContainer::closeStreams()
+{
+    std::lock_guard<std::mutex> lock {m_historyMutex};
+    m_streaming = false;
+    for (const auto &stream : m_streams) {
+        stream.first->close();
+    }
+    m_streams.clear();
+}
+
+/*
+ * Closes the WebSockets and the event streams that were authorized by
+ * the revoked token, or all of them if jti is empty.
+ */
+void Server::WebSocketContainer::revoke(const QByteArray &jti)
+{
+    std::lock_guard<std::mutex> lock {m_historyMutex};
+    for (const auto &token : m_tokens) {
+        if (jti.isEmpty() || token.second == jti) {
+            m_writer.disconnect(token.first);
+        }
+    }
+    for (const auto &stream : m_streams) {
+        if (jti.isEmpty() || stream.second == jti) {
+            stream.first->close();
+        }
+    }
+}
+
+void Server::WebSocketContainer::operator()(const Broadcast &broadcast) const
+{
+    if (!m_coalescer.push(broadcast)) {
+        send(broadcast);
+    }
+}
+
+void Server::WebSocketContainer::send(const Broadcast &broadcast) const
+{
+    // The frames are built once, and shared by all the outbound queues
+    OutboundMessage message {};
+    const int opcode = broadcast.type() == Broadcast::Type::Binary ? WEBSOCKET_OPCODE_BINARY : WEBSOCKET_OPCODE_TEXT;
+    message.message = std::make_shared<WebSocketMessage>(opcode, broadcast.data());
+    message.key = QByteArray::fromStdString(broadcast.topic());
+    std::vector<mg_connection *> subscribers = m_topics.subscribers(broadcast.topic());
+
+    // The entry, and the recipients, are gathered under m_historyMutex,
+    // and the broadcast is fanned out once it is released
+    std::vector<mg_connection *> sequenced {};
+    OutboundMessage sequencedMessage {};
+    std::vector<std::shared_ptr<EventStream>> streams {};
+    QByteArray event {};
+    std::unique_lock<std::mutex> fanOutLock {};
+    {
+        std::lock_guard<std::mutex> lock {m_historyMutex};
+        BroadcastHistory::Entry *entry = m_history ? &m_history->push(broadcast) : nullptr;
+
+        // Sequenced sockets get the message with its sequence number
+        if (entry && !m_sequenced.empty()) {
+            auto it = std::partition(subscribers.begin(), subscribers.end(), [this](mg_connection *subscriber) {
+                return m_sequenced.find(subscriber) == m_sequenced.end();
+            });
+            sequenced.assign(it, subscribers.end());
+            subscribers.erase(it, subscribers.end());
+            if (!sequenced.empty()) {
+                sequencedMessage.message = entry->message();
+                sequencedMessage.key = message.key;
+            }
+        }
+
+        // Server-Sent Events only carry text, and the event is shared by all the streams
+        if (!m_streams.empty() && broadcast.type() == Broadcast::Type::Text) {
+            for (const auto &stream : m_streams) {
+                if (stream.first->receives(broadcast.topic())) {
+                    streams.push_back(stream.first);
+                }
+            }
+            if (!streams.empty()) {
+                event = entry ? entry->event() : BroadcastHistory::event(QByteArray(), broadcast);
+            }
+        }
+        fanOutLock = std::unique_lock<std::mutex>(m_fanOutMutex);
+    }
+
+    m_writer.send(subscribers, message);
+    if (!sequenced.empty()) {
+        m_writer.send(sequenced, sequencedMessage);
+    }
+    for (const std::shared_ptr<EventStream> &stream : streams) {
+        stream->push(event);
     }
 }
 
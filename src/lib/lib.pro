@@ -1,2 +1,5 @@
 TEMPLATE = subdirs
 SUBDIRS = civet harmony
+
+# The civetweb headers are patched when civet.pro is processed
+harmony.depends = civet
@@ -63,6 +63,7 @@ public:
         endpoints.push_back(Endpoint(Endpoint::Type::Post, "test_post"));
         endpoints.push_back(Endpoint(Endpoint::Type::Delete, "test_delete"));
         endpoints.push_back(Endpoint(Endpoint::Type::Get, "test_ws"));
+        endpoints.push_back(Endpoint(Endpoint::Type::Get, "test_ws_topic"));
         return endpoints;
     }
 
@@ -72,12 +73,21 @@ public:
         return Reply(QJsonDocument(QJsonObject()));
     }
 
+    Reply handleWsTopicRequest() const
+    {
+        emit broadcastToTopic("test/topic", "Hello topic");
+        return Reply(QJsonDocument(QJsonObject()));
+    }
+
     Reply handleRequest(const Endpoint &endpoint, const QUrlQuery &params,
                         const QJsonDocument &body) const override
     {
         if (endpoint.name() == "test_ws" && endpoint.type() == Endpoint::Type::Get) {
             return handleWsRequest();
         }
+        if (endpoint.name() == "test_ws_topic" && endpoint.type() == Endpoint::Type::Get) {
+            return handleWsTopicRequest();
+        }
 
         QJsonObject returned {};
         QString type {};
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+/*
+ * Fan-out benchmark
+ *
+ * Measures the cost of broadcasting a message to 1, 10, 100 and 1000
+ * WebSockets, either by framing the message for each socket, with
+ * wsWrite, or like the server does, by framing it once, and writing it
+ * from the WebSocketWriter pool.
+ *
+ * Run with -tickcounter or -perf to measure CPU instead of walltime.
+ */
+
+#include <QtTest/QtTest>
+#include <QtCore/QThread>
+#include <QtWebSockets/QWebSocket>
+#include <private/enhancedcivetserver.h>
+#include <private/websocketwriter.h>
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <thread>
+
+using namespace harmony;
+using namespace harmony::private_impl;
+
+static const int PORT = 8081;
+static const int MESSAGE_SIZE = 512;
+
+class Handler: public CivetWebSocketHandler
+{
+public:
+    bool handleConnect(EnhancedCivetServer *, const mg_connection *) override
+    {
+        return true;
+    }
+    void handleReady(EnhancedCivetServer *, mg_connection *connection) override
+    {
+        std::lock_guard<std::mutex> lock (m_mutex);
+        m_connections.insert(connection);
+    }
+    bool handleData(EnhancedCivetServer *, mg_connection *, int, const char *, size_t) override
+    {
+        return true;
+    }
+    void handleClose(EnhancedCivetServer *, const mg_connection *connection) override
+    {
+        std::lock_guard<std::mutex> lock (m_mutex);
+        m_connections.erase(const_cast<mg_connection *>(connection));
+    }
+    std::set<mg_connection *> connections() const
+    {
+        std::lock_guard<std::mutex> lock (m_mutex);
+        return m_connections;
+    }
+private:
+    std::set<mg_connection *> m_connections {};
+    mutable std::mutex m_mutex {};
+};
+
+// Clients live in their own thread, so that they keep reading while the benchmark runs
+class Clients: public QObject
+{
+    Q_OBJECT
+public Q_SLOTS:
+    void open(int count)
+    {
+        for (int i = 0; i < count; ++i) {
+            QWebSocket *socket = new QWebSocket(QString(), QWebSocketProtocol::VersionLatest, this);
+            socket->open(QUrl(QString("ws://localhost:%1/bench").arg(PORT)));
+        }
+    }
+    void close()
+    {
+        qDeleteAll(findChildren<QWebSocket *>());
+    }
+};
+
+class BenchBroadcast: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void benchFanOut_data()
+    {
+        QTest::addColumn<int>("clients");
+        QTest::addColumn<bool>("encodeOnce");
+        for (int clients : {1, 10, 100, 1000}) {
+            QTest::newRow(QString("%1 clients, per socket").arg(clients).toLatin1()) << clients << false;
+            QTest::newRow(QString("%1 clients, writer pool").arg(clients).toLatin1()) << clients << true;
+        }
+    }
+    void benchFanOut()
+    {
+        QFETCH(int, clients);
+        QFETCH(bool, encodeOnce);
+
+        // civetweb needs one thread per WebSocket
+        const QByteArray &port = QByteArray::number(PORT);
+        const QByteArray &threads = QByteArray::number(clients + 10);
+        const char *options[] = {"listening_ports", port.data(), "num_threads", threads.data(), nullptr};
+        Handler handler;
+        EnhancedCivetServer server (options);
+        server.addWebSocketHandler("/bench", &handler);
+
+        QThread thread;
+        Clients clientsObject;
+        clientsObject.moveToThread(&thread);
+        thread.start();
+        QMetaObject::invokeMethod(&clientsObject, "open", Q_ARG(int, clients));
+        QTRY_COMPARE_WITH_TIMEOUT(static_cast<int>(handler.connections().size()), clients, 60000);
+
+        const std::set<mg_connection *> &connections = handler.connections();
+        std::atomic_int written {0};
+        WebSocketWriter writer {[&written](mg_connection *connection, const WebSocketMessage &message) {
+            const WebSocketWriteResult result = EnhancedCivetServer::wsWriteMessage(connection, message);
+            // Writes that would block are tried again
+            if (result != WebSocketWriteResult::WouldBlock) {
+                ++written;
+            }
+            return result;
+        }};
+        writer.start(IServer::Options::WebSocket());
+        for (mg_connection *connection : connections) {
+            writer.add(connection);
+        }
+
+        const QByteArray message (MESSAGE_SIZE, 'a');
+        QBENCHMARK {
+            if (encodeOnce) {
+                OutboundMessage outbound {};
+                outbound.message = std::make_shared<WebSocketMessage>(WEBSOCKET_OPCODE_TEXT, message);
+                written = 0;
+                writer.broadcast(outbound);
+                // Writes are asynchronous
+                while (written.load() < clients) {
+                    std::this_thread::yield();
+                }
+            } else {
+                for (mg_connection *connection : connections) {
+                    EnhancedCivetServer::wsWrite(connection, WEBSOCKET_OPCODE_TEXT, message);
+                }
+            }
+        }
+        writer.stop();
+
+        QMetaObject::invokeMethod(&clientsObject, "close", Qt::BlockingQueuedConnection);
+        thread.quit();
+        thread.wait();
+    }
+};
+
+QTEST_MAIN(BenchBroadcast)
+
+#include "bench_broadcast.moc"
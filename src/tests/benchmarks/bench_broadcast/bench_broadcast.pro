@@ -0,0 +1,13 @@
+TEMPLATE = app
+TARGET = bench_broadcast
+
+QT = core network testlib websockets
+
+include(../../../config.pri)
+include(../../../lib/civet/civet-deps.pri)
+
+INCLUDEPATH += ../../../lib/harmony
+LIBS += -L../../../lib/harmony -lharmony \
+    -L../../../lib/civet -lcivet
+
+SOURCES += bench_broadcast.cpp
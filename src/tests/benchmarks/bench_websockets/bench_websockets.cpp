@@ -0,0 +1,324 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+/*
+ * Scalability benchmark
+ *
+ * Connects N authenticated WebSockets to a local Server, broadcasts
+ * through the test extension, and reports the time needed to connect
+ * the clients, the broadcast latency distribution, and the memory and
+ * threads used by the server for each connection.
+ *
+ * The clients run in a child process, so that they are not accounted
+ * for in the memory and the threads of the server. Broadcasts carry the
+ * time they were emitted, from the monotonic clock, that is shared by
+ * both processes. civetweb starts its worker threads upfront, one per
+ * client, so the server threads are created before the clients connect.
+ * With --event-loop, the clients connect to the epoll event loop
+ * instead, that serves them with a fixed number of threads. --shards
+ * runs several event loops on the same port, and the load of each of
+ * them is reported.
+ *
+ * Usage: bench_websockets [--clients N] [--broadcasts M] [--rate R]
+ *                         [--event-loop [--shards S] [--affinity]]
+ *
+ * Thousands of clients need as many file descriptors, the soft limit
+ * is raised to the hard limit if needed.
+ */
+
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QProcess>
+#include <QtCore/QSocketNotifier>
+#include <QtCore/QTimer>
+#include <QtCore/QtPlugin>
+#include <QtWebSockets/QWebSocket>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <iauthentificationservice.h>
+#include <iextensionmanager.h>
+#include <iserver.h>
+
+Q_IMPORT_PLUGIN(HarmonyTestExtension)
+
+using namespace harmony;
+
+static const int PORT = 8082;
+static const int EVENT_LOOP_PORT = 8084;
+// Connections that are being opened at the same time
+static const int CONNECT_BATCH = 64;
+
+static qint64 now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void raiseFileLimit()
+{
+    struct rlimit limit {};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+// Reads a field of /proc/self/status, such as VmRSS (in kB) or Threads
+static qint64 status(const QByteArray &field)
+{
+    QFile file {"/proc/self/status"};
+    if (!file.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+    for (const QByteArray &line : file.readAll().split('\n')) {
+        if (line.startsWith(field + ':')) {
+            return line.mid(field.size() + 1).trimmed().split(' ').first().toLongLong();
+        }
+    }
+    return -1;
+}
+
+// Opens the WebSockets, and reports the latencies of the broadcasts they receive
+class Clients: public QObject
+{
+    Q_OBJECT
+public:
+    explicit Clients(int count, int broadcasts, const QByteArray &jwt, int port, QObject *parent = 0)
+        : QObject(parent), m_count{count}, m_broadcasts{broadcasts}, m_jwt{jwt}, m_port{port}
+    {
+    }
+    void start()
+    {
+        m_latencies.reserve(static_cast<std::size_t>(m_count) * m_broadcasts);
+        m_timer.start();
+        while (m_opened < std::min(m_count, CONNECT_BATCH)) {
+            open();
+        }
+    }
+    // Called when no broadcast is expected anymore
+    void report()
+    {
+        if (m_reported) {
+            return;
+        }
+        m_reported = true;
+        std::sort(m_latencies.begin(), m_latencies.end());
+        auto percentile = [this](double ratio) -> qint64 {
+            if (m_latencies.empty()) {
+                return 0;
+            }
+            return m_latencies.at(static_cast<std::size_t>(ratio * (m_latencies.size() - 1)));
+        };
+        std::cout << "latency " << m_latencies.size() << " " << percentile(0.5) << " " << percentile(0.9)
+                  << " " << percentile(0.99) << " " << percentile(1.) << std::endl;
+        QCoreApplication::quit();
+    }
+private:
+    void open()
+    {
+        ++m_opened;
+        QWebSocket *socket = new QWebSocket(QString(), QWebSocketProtocol::VersionLatest, this);
+        connect(socket, &QWebSocket::sslErrors, socket, [socket]() {
+            socket->ignoreSslErrors();
+        });
+        connect(socket, &QWebSocket::connected, socket, [this, socket]() {
+            // Resuming needs an authorized socket, so the reply tells that the token was accepted
+            socket->sendBinaryMessage(m_jwt);
+            socket->sendTextMessage("{\"resume\":true}");
+        });
+        connect(socket, &QWebSocket::textMessageReceived, socket, [this](const QString &message) {
+            handleMessage(message);
+        });
+        connect(socket, &QWebSocket::disconnected, socket, [this]() {
+            std::cerr << "Client disconnected" << std::endl;
+        });
+        socket->open(QUrl(QString("wss://localhost:%1/api/ws").arg(m_port)));
+    }
+    void handleMessage(const QString &message)
+    {
+        const qint64 received = now();
+        const QJsonObject &object = QJsonDocument::fromJson(message.toUtf8()).object();
+        if (object.contains("resumed")) {
+            ++m_ready;
+            if (m_opened < m_count) {
+                open();
+            }
+            if (m_ready == m_count) {
+                std::cout << "ready " << m_timer.elapsed() << std::endl;
+            }
+            return;
+        }
+        m_latencies.push_back(received - object.value("data").toString().toLongLong());
+        if (m_latencies.size() == static_cast<std::size_t>(m_count) * m_broadcasts) {
+            report();
+        }
+    }
+    const int m_count {0};
+    const int m_broadcasts {0};
+    const QByteArray m_jwt {};
+    const int m_port {0};
+    int m_opened {0};
+    int m_ready {0};
+    bool m_reported {false};
+    QElapsedTimer m_timer {};
+    std::vector<qint64> m_latencies {};
+};
+
+static int runClients(int count, int broadcasts, const QByteArray &jwt, int port)
+{
+    Clients clients {count, broadcasts, jwt, port};
+    clients.start();
+    // The server writes to stdin when broadcasting is done, missing broadcasts are then not waited for long
+    QSocketNotifier input {STDIN_FILENO, QSocketNotifier::Read};
+    QObject::connect(&input, &QSocketNotifier::activated, [&input, &clients]() {
+        input.setEnabled(false);
+        QTimer::singleShot(5000, &clients, &Clients::report);
+    });
+    return QCoreApplication::exec();
+}
+
+static int runServer(const QString &program, int count, int broadcasts, int rate, bool eventLoop,
+                     int shards, bool affinity)
+{
+    IAuthentificationService::Ptr as = IAuthentificationService::create("bench");
+    IExtensionManager::Ptr em = IExtensionManager::create();
+    IServer::Ptr server = IServer::create(*as, *em, PORT);
+    IServer::Options options {};
+    if (eventLoop) {
+        options.webSocket.eventLoopPort = EVENT_LOOP_PORT;
+        options.webSocket.eventLoopShards = shards;
+        options.webSocket.eventLoopAffinity = affinity;
+    } else {
+        // civetweb needs one thread per WebSocket
+        options.threadCount = count + 16;
+    }
+    server->setOptions(options);
+    if (!server->start()) {
+        std::cerr << "Failed to start the server" << std::endl;
+        return 1;
+    }
+    const QByteArray &jwt = as->hashJwt(as->authenticate(as->password()));
+    Extension *extension = em->extensions().front();
+
+    const qint64 rssBefore = status("VmRSS");
+    const qint64 threadsBefore = status("Threads");
+
+    QProcess clients {};
+    clients.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    QTimer broadcaster {};
+    int sent {0};
+    QObject::connect(&broadcaster, &QTimer::timeout, [&]() {
+        emit extension->broadcastUtf8(QByteArray::number(now()));
+        if (++sent == broadcasts) {
+            broadcaster.stop();
+            clients.write("done\n");
+            clients.closeWriteChannel();
+        }
+    });
+    QObject::connect(&clients, &QProcess::readyReadStandardOutput, [&]() {
+        while (clients.canReadLine()) {
+            const QList<QByteArray> &fields = clients.readLine().trimmed().split(' ');
+            if (fields.first() == "ready") {
+                const qint64 rss = status("VmRSS");
+                const qint64 threads = status("Threads");
+                std::cout << "Clients: " << count << std::endl
+                          << "Connect time: " << fields.at(1).toLongLong() << " ms" << std::endl
+                          << "Server memory: " << rssBefore << " kB -> " << rss << " kB, "
+                          << (rss - rssBefore) / count << " kB per connection" << std::endl
+                          << "Server threads: " << threadsBefore << " -> " << threads << std::endl;
+                broadcaster.start(1000 / rate);
+            } else if (fields.first() == "latency" && fields.size() == 6) {
+                std::cout << "Broadcasts: " << broadcasts << " at " << rate << "/s, received "
+                          << fields.at(1).toLongLong() << " of " << static_cast<qint64>(count) * broadcasts
+                          << std::endl
+                          << "Latency (us): p50 " << fields.at(2).toLongLong() << ", p90 " << fields.at(3).toLongLong()
+                          << ", p99 " << fields.at(4).toLongLong() << ", max " << fields.at(5).toLongLong() << std::endl;
+            }
+        }
+    });
+    QObject::connect(&clients, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+                     [](int code, QProcess::ExitStatus) {
+        QCoreApplication::exit(code);
+    });
+    clients.start(program, {"--client", "--clients", QString::number(count),
+                            "--broadcasts", QString::number(broadcasts), "--token", QString::fromLatin1(jwt),
+                            "--port", QString::number(eventLoop ? EVENT_LOOP_PORT : PORT)});
+    const int code = QCoreApplication::exec();
+    const IExtensionManager::Statistics &statistics = em->statistics();
+    std::cout << "Dispatched: " << statistics.dispatched << ", dropped: " << statistics.dropped
+              << ", max queue depth: " << statistics.maxDepth << std::endl;
+    const std::vector<IServer::ShardStatistics> &shardStatistics = server->shardStatistics();
+    for (std::size_t i = 0; i < shardStatistics.size(); ++i) {
+        std::cout << "Shard " << i << ": " << shardStatistics.at(i).accepted << " accepted, "
+                  << shardStatistics.at(i).connections << " open, "
+                  << shardStatistics.at(i).messages << " messages" << std::endl;
+    }
+    server->stop();
+    return code;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app (argc, argv);
+    Q_INIT_RESOURCE(harmony);
+    raiseFileLimit();
+
+    QCommandLineParser parser {};
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("clients", "Number of WebSockets.", "N", "100"));
+    parser.addOption(QCommandLineOption("broadcasts", "Number of broadcasts.", "M", "100"));
+    parser.addOption(QCommandLineOption("rate", "Broadcasts per second.", "R", "10"));
+    parser.addOption(QCommandLineOption("event-loop", "Serve the WebSockets with the epoll event loop."));
+    parser.addOption(QCommandLineOption("shards", "Number of event loops.", "S", "1"));
+    parser.addOption(QCommandLineOption("affinity", "Run each event loop on its own CPU."));
+    parser.addOption(QCommandLineOption("client", "Run the clients (internal)."));
+    parser.addOption(QCommandLineOption("token", "Token of the clients (internal).", "JWT"));
+    parser.addOption(QCommandLineOption("port", "Port of the clients (internal).", "PORT"));
+    parser.process(app);
+
+    const int count = std::max(parser.value("clients").toInt(), 1);
+    const int broadcasts = std::max(parser.value("broadcasts").toInt(), 1);
+    const int rate = std::min(std::max(parser.value("rate").toInt(), 1), 1000);
+    if (parser.isSet("client")) {
+        return runClients(count, broadcasts, parser.value("token").toLatin1(), parser.value("port").toInt());
+    }
+    return runServer(app.applicationFilePath(), count, broadcasts, rate, parser.isSet("event-loop"),
+                     std::max(parser.value("shards").toInt(), 1), parser.isSet("affinity"));
+}
+
+#include "bench_websockets.moc"
@@ -0,0 +1,14 @@
+TEMPLATE = app
+TARGET = bench_websockets
+
+QT = core network websockets
+
+include(../../../config.pri)
+include(../../../lib/civet/civet-deps.pri)
+
+INCLUDEPATH += ../../../lib/harmony
+LIBS += -L../../../plugins/test -lharmonytestextension \
+    -L../../../lib/harmony -lharmony \
+    -L../../../lib/civet -lcivet
+
+SOURCES += bench_websockets.cpp
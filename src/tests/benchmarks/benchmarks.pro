@@ -0,0 +1,3 @@
+TEMPLATE = subdirs
+SUBDIRS += bench_broadcast \
+    bench_websockets
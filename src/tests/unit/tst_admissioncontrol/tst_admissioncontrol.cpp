@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include <QtTest/QtTest>
+#include <thread>
+#include <private/admissioncontrol.h>
+
+using namespace harmony::private_impl;
+
+class TstAdmissionControl: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testUnlimited()
+    {
+        AdmissionControl admissionControl {};
+        for (int i = 0; i < 100; ++i) {
+            QVERIFY(admissionControl.acquire("/a"));
+        }
+        QCOMPARE(admissionControl.statistics().inFlight, 100);
+        for (int i = 0; i < 100; ++i) {
+            admissionControl.release("/a");
+        }
+        QCOMPARE(admissionControl.statistics().inFlight, 0);
+        QCOMPARE(admissionControl.statistics().admitted, static_cast<std::uint64_t>(100));
+    }
+    void testLimits()
+    {
+        AdmissionControl::Options options {};
+        options.maxRequests = 3;
+        options.maxRouteRequests = 2;
+        options.maxWaitMs = 0;
+        AdmissionControl admissionControl {};
+        admissionControl.setOptions(options);
+
+        QVERIFY(admissionControl.acquire("/a"));
+        QVERIFY(admissionControl.acquire("/a"));
+        // Routes are limited on their own
+        QVERIFY(!admissionControl.acquire("/a"));
+        QVERIFY(admissionControl.acquire("/b"));
+        // And all together
+        QVERIFY(!admissionControl.acquire("/c"));
+
+        admissionControl.release("/a");
+        QVERIFY(admissionControl.acquire("/c"));
+
+        const AdmissionControl::Statistics &statistics = admissionControl.statistics();
+        QCOMPARE(statistics.inFlight, 3);
+        QCOMPARE(statistics.waiting, 0);
+        QCOMPARE(statistics.admitted, static_cast<std::uint64_t>(4));
+        QCOMPARE(statistics.shed, static_cast<std::uint64_t>(2));
+    }
+    void testWait()
+    {
+        AdmissionControl::Options options {};
+        options.maxRequests = 1;
+        options.maxWaitMs = 5000;
+        AdmissionControl admissionControl {};
+        admissionControl.setOptions(options);
+
+        QVERIFY(admissionControl.acquire("/a"));
+        bool admitted {false};
+        std::thread waiter {[&admissionControl, &admitted]() {
+            admitted = admissionControl.acquire("/b");
+        }};
+        QTRY_COMPARE(admissionControl.statistics().waiting, 1);
+        admissionControl.release("/a");
+        waiter.join();
+        QVERIFY(admitted);
+        QCOMPARE(admissionControl.statistics().waiting, 0);
+        QCOMPARE(admissionControl.statistics().inFlight, 1);
+    }
+    void testShed()
+    {
+        AdmissionControl::Options options {};
+        options.maxRequests = 1;
+        options.maxWaiting = 1;
+        options.maxWaitMs = 200;
+        AdmissionControl admissionControl {};
+        admissionControl.setOptions(options);
+
+        QVERIFY(admissionControl.acquire("/a"));
+        bool admitted {true};
+        std::thread waiter {[&admissionControl, &admitted]() {
+            admitted = admissionControl.acquire("/a");
+        }};
+        QTRY_COMPARE(admissionControl.statistics().waiting, 1);
+        // The queue is full, so this request is shed right away
+        QElapsedTimer timer {};
+        timer.start();
+        QVERIFY(!admissionControl.acquire("/a"));
+        QVERIFY(timer.elapsed() < 200);
+
+        // And the waiting one is shed when it times out
+        waiter.join();
+        QVERIFY(!admitted);
+        QCOMPARE(admissionControl.statistics().shed, static_cast<std::uint64_t>(2));
+        QCOMPARE(admissionControl.statistics().waiting, 0);
+    }
+};
+
+
+QTEST_MAIN(TstAdmissionControl)
+
+#include "tst_admissioncontrol.moc"
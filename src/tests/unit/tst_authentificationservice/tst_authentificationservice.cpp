@@ -33,11 +33,18 @@
 #include <QtTest/QSignalSpy>
 #include <QtCore/QDebug>
 #include <QtCore/QDateTime>
+#include <string>
 #include <iauthentificationservice.h>
+#include <private/ratelimiter.h>
 
 using namespace harmony;
+using RateLimiter = private_impl::RateLimiter;
 
 static const int PORT = 8080;
+// Same as the server and the service
+static const int AUTHENTIFICATION_ATTEMPTS = 5;
+static const int AUTHENTIFICATION_WINDOW_MS = 60000;
+static const int PASSWORD_FAILURES_MAX = 1000;
 
 class TstAuthentificationService: public QObject
 {
@@ -57,12 +64,34 @@ private Q_SLOTS:
         IAuthentificationService::Ptr service = IAuthentificationService::create("test", [&changed](const std::string &) {
             changed = true;
         });
-        QVERIFY(service->authenticate("test").isNull());
+        // Failed attempts are throttled by the server, and do not change the password
+        const std::string password = service->password();
+        for (int i = 0; i < 10; ++i) {
+            QVERIFY(service->authenticate("test").isNull());
+        }
         QVERIFY(!changed);
-        service->authenticate("test");
-        QVERIFY(!changed);
-        service->authenticate("test");
+        QCOMPARE(service->password(), password);
+    }
+    void testPasswordFailures()
+    {
+        bool changed {false};
+        IAuthentificationService::Ptr service = IAuthentificationService::create("test", [&changed](const std::string &) {
+            changed = true;
+        });
+        RateLimiter limiter {AUTHENTIFICATION_ATTEMPTS, AUTHENTIFICATION_WINDOW_MS, 16, 256};
+
+        // Clients that each stay under their own limit still exhaust the
+        // failures of the password
+        const std::string password = service->password();
+        for (int i = 0; i < PASSWORD_FAILURES_MAX; ++i) {
+            QVERIFY(!changed);
+            const std::string client = "client" + std::to_string(i);
+            QVERIFY(limiter.tryAcquire(client.c_str(), 1000));
+            QVERIFY(service->authenticate(password == "00000000" ? "00000001" : "00000000").isNull());
+        }
         QVERIFY(changed);
+        QVERIFY(service->password() != password);
+        QVERIFY(!service->authenticate(service->password()).isNull());
     }
     void testPasswordChanged2()
     {
@@ -86,6 +115,110 @@ private Q_SLOTS:
         payload.insert("exp", 10);
         JsonWebToken expiredToken {payload};
         QVERIFY(!service->isAuthorized(service->hashJwt(expiredToken)));
+
+        // Not issued by authenticate
+        JsonWebToken::Claims claims {token.claims()};
+        claims.jti = "unknown";
+        QVERIFY(!service->isAuthorized(service->hashJwt(JsonWebToken(claims))));
+    }
+    void testRevoke()
+    {
+        IAuthentificationService::Ptr service = IAuthentificationService::create("test");
+        const QByteArray &jwt1 = service->hashJwt(service->authenticate(service->password()));
+        const QByteArray &jwt2 = service->hashJwt(service->authenticate(service->password()));
+        const QByteArray &jwt3 = service->hashJwt(service->authenticate(service->password()));
+        QVERIFY(service->isAuthorized(jwt1));
+        QVERIFY(service->isAuthorized(jwt2));
+        QVERIFY(service->isAuthorized(jwt3));
+
+        QVERIFY(service->revoke(jwt1));
+        QVERIFY(!service->revoke(jwt1));
+        QVERIFY(!service->isAuthorized(jwt1));
+        QVERIFY(service->isAuthorized(jwt2));
+
+        service->revokeAll();
+        QVERIFY(!service->isAuthorized(jwt2));
+        QVERIFY(!service->isAuthorized(jwt3));
+        QVERIFY(!service->revoke("test"));
+    }
+    void testRefresh()
+    {
+        IAuthentificationService::Ptr service = IAuthentificationService::create("test");
+        const std::string password = service->password();
+        JsonWebToken refreshToken {};
+        const JsonWebToken &token = service->authenticate(password, &refreshToken);
+        QVERIFY(!token.isNull());
+        QVERIFY(!refreshToken.isNull());
+        QVERIFY(token.claims().exp - token.claims().iat < refreshToken.claims().exp - refreshToken.claims().iat);
+        QVERIFY(service->password() != password);
+
+        const QByteArray &jwt = service->hashJwt(token);
+        const QByteArray &refreshJwt = service->hashJwt(refreshToken);
+        QVERIFY(service->isAuthorized(jwt));
+        QVERIFY(!service->isAuthorized(refreshJwt));
+        QVERIFY(service->refresh(jwt).isNull());
+
+        // Refresh does not rotate the password
+        const std::string currentPassword = service->password();
+        const JsonWebToken &refreshed = service->refresh(refreshJwt);
+        QVERIFY(!refreshed.isNull());
+        QVERIFY(service->isAuthorized(service->hashJwt(refreshed)));
+        QCOMPARE(service->password(), currentPassword);
+
+        // Rotation revokes the refresh token that was used
+        JsonWebToken rotatedToken {};
+        QVERIFY(!service->refresh(refreshJwt, &rotatedToken).isNull());
+        QVERIFY(!rotatedToken.isNull());
+        QVERIFY(service->refresh(refreshJwt, &rotatedToken).isNull());
+        const QByteArray &rotatedJwt = service->hashJwt(rotatedToken);
+        QVERIFY(!service->refresh(rotatedJwt).isNull());
+
+        QVERIFY(service->revoke(rotatedJwt));
+        QVERIFY(service->refresh(rotatedJwt).isNull());
+    }
+    void testSessions()
+    {
+        IAuthentificationService::Ptr service = IAuthentificationService::create("test");
+        JsonWebToken refreshToken {};
+        const JsonWebToken &token = service->authenticate(service->password(), &refreshToken);
+        JsonWebToken otherRefreshToken {};
+        const JsonWebToken &otherToken = service->authenticate(service->password(), &otherRefreshToken);
+        QVERIFY(!token.claims().sid.isEmpty());
+        QCOMPARE(refreshToken.claims().sid, token.claims().sid);
+        QVERIFY(otherToken.claims().sid != token.claims().sid);
+
+        // Refreshed tokens stay in the session
+        JsonWebToken rotatedToken {};
+        const JsonWebToken &refreshed = service->refresh(service->hashJwt(refreshToken), &rotatedToken);
+        QCOMPARE(refreshed.claims().sid, token.claims().sid);
+        QCOMPARE(rotatedToken.claims().sid, token.claims().sid);
+
+        // Tokens of another session cannot be revoked
+        const QByteArray &otherRefreshJwt = service->hashJwt(otherRefreshToken);
+        QVERIFY(!service->revoke(otherRefreshJwt, token.claims().sid));
+        QVERIFY(!service->refresh(otherRefreshJwt).isNull());
+        QVERIFY(service->revoke(service->hashJwt(rotatedToken), token.claims().sid));
+    }
+    void testRevokedCallback()
+    {
+        IAuthentificationService::Ptr service = IAuthentificationService::create("test");
+        QList<QByteArray> revoked {};
+        service->setRevokedCallback([&revoked](const QByteArray &jti) {
+            revoked.append(jti);
+        });
+        const JsonWebToken &token = service->authenticate(service->password());
+        const QByteArray &jwt = service->hashJwt(token);
+        QVERIFY(service->revoke(jwt));
+        QVERIFY(!service->revoke(jwt));
+        QCOMPARE(revoked, QList<QByteArray>({token.claims().jti}));
+
+        // An empty jti revokes all the tokens
+        service->revokeAll();
+        QCOMPARE(revoked, QList<QByteArray>({token.claims().jti, QByteArray()}));
+
+        service->setRevokedCallback(IAuthentificationService::RevokedCallback_t());
+        service->revokeAll();
+        QCOMPARE(revoked.count(), 2);
     }
 };
 
@@ -4,6 +4,7 @@ TARGET = tst_authentificationservice
 QT = core testlib
 
 include(../../../config.pri)
+include(../../../lib/civet/civet-deps.pri)
 
 INCLUDEPATH += ../../../lib/harmony
 LIBS += -L../../../lib/harmony -lharmony
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include <QtTest/QtTest>
+#include <mutex>
+#include <vector>
+#include <private/broadcastcoalescer.h>
+
+using namespace harmony;
+using namespace harmony::private_impl;
+
+class Flushed
+{
+public:
+    void operator()(const Broadcast &broadcast)
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        m_broadcasts.push_back(broadcast);
+    }
+    std::vector<Broadcast> broadcasts() const
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        return m_broadcasts;
+    }
+    int count() const
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        return m_broadcasts.size();
+    }
+private:
+    std::vector<Broadcast> m_broadcasts {};
+    mutable std::mutex m_mutex {};
+};
+
+class TstBroadcastCoalescer: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testDisabled()
+    {
+        Flushed flushed {};
+        BroadcastCoalescer coalescer {[&flushed](const Broadcast &broadcast) { flushed(broadcast); }};
+        QVERIFY(!coalescer.push(Broadcast("test", "data")));
+        coalescer.start(std::chrono::milliseconds(0), {"test"});
+        QVERIFY(!coalescer.push(Broadcast("test", "data")));
+        coalescer.start(std::chrono::milliseconds(200), {});
+        QVERIFY(!coalescer.push(Broadcast("test", "data")));
+        QCOMPARE(flushed.count(), 0);
+    }
+    void testEvents()
+    {
+        Flushed flushed {};
+        BroadcastCoalescer coalescer {[&flushed](const Broadcast &broadcast) { flushed(broadcast); }};
+        coalescer.start(std::chrono::milliseconds(200), {"test/state"});
+
+        // Events are not coalesced, and are sent by the caller
+        for (int i = 0; i < 10; ++i) {
+            QVERIFY(!coalescer.push(Broadcast("test/events", QByteArray::number(i))));
+        }
+        QVERIFY(coalescer.push(Broadcast("test/state", "1")));
+        QVERIFY(coalescer.push(Broadcast("test/state", "2")));
+        QCOMPARE(coalescer.count(), 1);
+        QTRY_COMPARE(flushed.count(), 1);
+        QVERIFY(flushed.broadcasts().front() == Broadcast("test/state", "2"));
+    }
+    void testLatest()
+    {
+        Flushed flushed {};
+        BroadcastCoalescer coalescer {[&flushed](const Broadcast &broadcast) { flushed(broadcast); }};
+        coalescer.start(std::chrono::milliseconds(200), {"test/a", "test/b"});
+
+        for (int i = 0; i < 100; ++i) {
+            QVERIFY(coalescer.push(Broadcast("test/a", QByteArray::number(i))));
+        }
+        QVERIFY(coalescer.push(Broadcast("test/b", "b", Broadcast::Type::Binary)));
+        QCOMPARE(coalescer.count(), 2);
+
+        QTRY_COMPARE(flushed.count(), 2);
+        const std::vector<Broadcast> &broadcasts = flushed.broadcasts();
+        QVERIFY(broadcasts.at(0) == Broadcast("test/a", "99"));
+        QVERIFY(broadcasts.at(1) == Broadcast("test/b", "b", Broadcast::Type::Binary));
+        QCOMPARE(coalescer.count(), 0);
+
+        // A new window starts with the next broadcast
+        QVERIFY(coalescer.push(Broadcast("test/a", "100")));
+        QTRY_COMPARE(flushed.count(), 3);
+        QVERIFY(flushed.broadcasts().back() == Broadcast("test/a", "100"));
+    }
+    void testStop()
+    {
+        Flushed flushed {};
+        BroadcastCoalescer coalescer {[&flushed](const Broadcast &broadcast) { flushed(broadcast); }};
+        coalescer.start(std::chrono::seconds(60), {"test"});
+        QVERIFY(coalescer.push(Broadcast("test", "data")));
+
+        // Pending broadcasts are flushed without waiting for the window
+        coalescer.stop();
+        QCOMPARE(flushed.count(), 1);
+        QVERIFY(!coalescer.push(Broadcast("test", "data")));
+    }
+};
+
+
+QTEST_MAIN(TstBroadcastCoalescer)
+
+#include "tst_broadcastcoalescer.moc"
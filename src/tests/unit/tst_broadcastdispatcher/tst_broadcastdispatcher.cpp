@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include <QtTest/QtTest>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <private/broadcastdispatcher.h>
+
+using namespace harmony;
+using namespace harmony::private_impl;
+
+// Records the dispatched broadcasts, and can block the dispatcher
+class Receiver
+{
+public:
+    void operator()(const Broadcast &broadcast)
+    {
+        std::unique_lock<std::mutex> lock {m_mutex};
+        m_condition.wait(lock, [this]() { return !m_blocked; });
+        m_data.push_back(broadcast.data());
+        m_threadId = std::this_thread::get_id();
+    }
+    void setBlocked(bool blocked)
+    {
+        {
+            std::lock_guard<std::mutex> lock {m_mutex};
+            m_blocked = blocked;
+        }
+        m_condition.notify_all();
+    }
+    std::vector<QByteArray> data() const
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        return m_data;
+    }
+    std::thread::id threadId() const
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        return m_threadId;
+    }
+private:
+    bool m_blocked {false};
+    std::vector<QByteArray> m_data {};
+    std::thread::id m_threadId {};
+    mutable std::mutex m_mutex {};
+    std::condition_variable m_condition {};
+};
+
+class TstBroadcastDispatcher: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testDispatch()
+    {
+        Receiver receiver {};
+        BroadcastDispatcher dispatcher {16, [&receiver](const Broadcast &broadcast) { receiver(broadcast); }};
+        for (int i = 0; i < 10; ++i) {
+            dispatcher.post(Broadcast("test", QByteArray::number(i)));
+        }
+        QTRY_COMPARE(dispatcher.statistics().dispatched, quint64(10));
+
+        // In order, from the worker
+        const std::vector<QByteArray> &data = receiver.data();
+        QCOMPARE(static_cast<int>(data.size()), 10);
+        for (int i = 0; i < 10; ++i) {
+            QCOMPARE(data.at(i), QByteArray::number(i));
+        }
+        QVERIFY(receiver.threadId() != std::this_thread::get_id());
+        QCOMPARE(dispatcher.statistics().dropped, quint64(0));
+    }
+    void testCapacity()
+    {
+        Receiver receiver {};
+        receiver.setBlocked(true);
+        BroadcastDispatcher dispatcher {2, [&receiver](const Broadcast &broadcast) { receiver(broadcast); }};
+
+        // The worker takes the first broadcast, and is blocked
+        dispatcher.post(Broadcast("test", "0"));
+        QTRY_COMPARE(dispatcher.statistics().depth, 0);
+        for (int i = 1; i <= 3; ++i) {
+            dispatcher.post(Broadcast("test", QByteArray::number(i)));
+        }
+
+        IExtensionManager::Statistics statistics = dispatcher.statistics();
+        QCOMPARE(statistics.depth, 2);
+        QCOMPARE(statistics.maxDepth, 2);
+        QCOMPARE(statistics.dropped, quint64(1));
+
+        receiver.setBlocked(false);
+        QTRY_COMPARE(dispatcher.statistics().dispatched, quint64(3));
+        QVERIFY(receiver.data() == std::vector<QByteArray>({"0", "2", "3"}));
+    }
+    void testStop()
+    {
+        Receiver receiver {};
+        BroadcastDispatcher dispatcher {16, [&receiver](const Broadcast &broadcast) { receiver(broadcast); }};
+        dispatcher.post(Broadcast("test", "0"));
+        dispatcher.post(Broadcast("test", "1"));
+
+        // Queued broadcasts are dispatched before stopping
+        dispatcher.stop();
+        QCOMPARE(static_cast<int>(receiver.data().size()), 2);
+        dispatcher.post(Broadcast("test", "2"));
+        QCOMPARE(dispatcher.statistics().dropped, quint64(1));
+    }
+};
+
+
+QTEST_MAIN(TstBroadcastDispatcher)
+
+#include "tst_broadcastdispatcher.moc"
@@ -0,0 +1,12 @@
+TEMPLATE = app
+TARGET = tst_broadcastdispatcher
+
+QT = core testlib
+
+include(../../../config.pri)
+include(../../../lib/civet/civet-deps.pri)
+
+INCLUDEPATH += ../../../lib/harmony
+LIBS += -L../../../lib/harmony -lharmony
+
+SOURCES += tst_broadcastdispatcher.cpp
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include <QtTest/QtTest>
+#include <QtCore/QtEndian>
+#include <CivetServer.h>
+#include <private/broadcasthistory.h>
+
+using namespace harmony;
+using namespace harmony::private_impl;
+
+class TstBroadcastHistory: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testSince()
+    {
+        BroadcastHistory history {3};
+        const QByteArray &epoch = history.epoch();
+        QVERIFY(!epoch.isEmpty());
+        QCOMPARE(history.sequence(), quint64(0));
+        std::vector<BroadcastHistory::Entry *> entries {};
+        QVERIFY(history.since(epoch, 0, entries));
+        QVERIFY(entries.empty());
+
+        for (int i = 1; i <= 5; ++i) {
+            QCOMPARE(history.push(Broadcast("test", QByteArray::number(i))).sequence(), quint64(i));
+        }
+        QCOMPARE(history.sequence(), quint64(5));
+
+        // 3, 4 and 5 are kept
+        QVERIFY(history.since(epoch, 2, entries));
+        QCOMPARE(static_cast<int>(entries.size()), 3);
+        QCOMPARE(entries.at(0)->sequence(), quint64(3));
+        QCOMPARE(entries.at(2)->broadcast().data(), QByteArray("5"));
+
+        QVERIFY(history.since(epoch, 4, entries));
+        QCOMPARE(static_cast<int>(entries.size()), 1);
+        QVERIFY(history.since(epoch, 5, entries));
+        QVERIFY(entries.empty());
+
+        // Evicted
+        QVERIFY(!history.since(epoch, 1, entries));
+        QVERIFY(entries.empty());
+        // Unknown to this history
+        QVERIFY(!history.since(epoch, 6, entries));
+        QVERIFY(!history.since("other", 4, entries));
+        QVERIFY(entries.empty());
+
+        // A new epoch starts, where older sequence numbers are unknown
+        history.clear();
+        QCOMPARE(history.sequence(), quint64(0));
+        QVERIFY(history.epoch() != epoch);
+        QVERIFY(!history.since(epoch, 0, entries));
+        QVERIFY(!history.since(history.epoch(), 2, entries));
+
+        // Another history has another epoch
+        QVERIFY(BroadcastHistory(3).epoch() != BroadcastHistory(3).epoch());
+    }
+    void testMessage()
+    {
+        BroadcastHistory history {3};
+        BroadcastHistory::Entry &text = history.push(Broadcast("test/topic", "H\xc3\xa9llo"));
+        const BroadcastHistory::Message_t &textMessage = text.message();
+        QCOMPARE(textMessage->opcode(), static_cast<int>(WEBSOCKET_OPCODE_TEXT));
+        const QJsonObject &object = QJsonDocument::fromJson(textMessage->payload()).object();
+        QCOMPARE(object.value("seq").toInt(), 1);
+        QCOMPARE(object.value("topic").toString(), QString("test/topic"));
+        QCOMPARE(object.value("data").toString(), QString::fromUtf8("H\xc3\xa9llo"));
+        // Built once
+        QCOMPARE(text.message().get(), textMessage.get());
+
+        BroadcastHistory::Entry &binary = history.push(Broadcast("test", QByteArray("\x00\x01", 2), Broadcast::Type::Binary));
+        const QByteArray &payload = binary.message()->payload();
+        QCOMPARE(binary.message()->opcode(), static_cast<int>(WEBSOCKET_OPCODE_BINARY));
+        QCOMPARE(payload.size(), 10);
+        QCOMPARE(qFromBigEndian<quint64>(reinterpret_cast<const uchar *>(payload.constData())), quint64(2));
+        QCOMPARE(payload.mid(8), QByteArray("\x00\x01", 2));
+    }
+    void testEvent()
+    {
+        BroadcastHistory history {3};
+        BroadcastHistory::Entry &entry = history.push(Broadcast("test/topic", "Hello\r\nworld"));
+        QCOMPARE(entry.event(), "id: " + history.epoch() + ":1\nevent: test/topic\ndata: Hello\ndata: world\n\n");
+        // Built once
+        QCOMPARE(entry.event().constData(), entry.event().constData());
+
+        // Without history, the event has no id
+        QCOMPARE(BroadcastHistory::event(QByteArray(), Broadcast("test", "")), QByteArray("event: test\ndata: \n\n"));
+
+        QByteArray epoch {};
+        quint64 sequence {0};
+        QVERIFY(BroadcastHistory::parseEventId(BroadcastHistory::eventId("abc", 42), epoch, sequence));
+        QCOMPARE(epoch, QByteArray("abc"));
+        QCOMPARE(sequence, quint64(42));
+        QVERIFY(!BroadcastHistory::parseEventId("42", epoch, sequence));
+        QVERIFY(!BroadcastHistory::parseEventId("abc:", epoch, sequence));
+    }
+};
+
+
+QTEST_MAIN(TstBroadcastHistory)
+
+#include "tst_broadcasthistory.moc"
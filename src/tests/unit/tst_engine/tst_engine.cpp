@@ -29,6 +29,7 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
  */
 
+#include <mutex>
 #include <QtTest/QtTest>
 #include <QtCore/QDebug>
 #include <QtNetwork/QNetworkAccessManager>
@@ -38,6 +39,8 @@
 #include <iextensionmanager.h>
 #include <dbus/idbusengine.h>
 
+Q_IMPORT_PLUGIN(HarmonyTestExtension)
+
 using namespace harmony;
 
 static const int PORT = 8080;
@@ -64,6 +67,52 @@ private:
     bool m_changed {false};
 };
 
+class BroadcastListener: public QObject
+{
+    Q_OBJECT
+public:
+    explicit BroadcastListener(QObject *parent = 0)
+        : QObject(parent)
+    {
+    }
+    QStringList topics() const
+    {
+        return m_topics;
+    }
+    QList<QByteArray> data() const
+    {
+        return m_data;
+    }
+public slots:
+    void broadcastReceived(const QString &topic, const QByteArray &data, bool binary)
+    {
+        Q_UNUSED(binary)
+        m_topics.append(topic);
+        m_data.append(data);
+    }
+private:
+    QStringList m_topics {};
+    QList<QByteArray> m_data {};
+};
+
+class BroadcastCallback: public IExtensionManager::ICallback
+{
+public:
+    void operator()(const Broadcast &broadcast) const override
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        m_data.append(broadcast.data());
+    }
+    QList<QByteArray> data() const
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        return m_data;
+    }
+private:
+    mutable QList<QByteArray> m_data {};
+    mutable std::mutex m_mutex {};
+};
+
 class TstEngine: public QObject
 {
     Q_OBJECT
@@ -115,6 +164,70 @@ private Q_SLOTS:
         }
         QCOMPARE(reply->error(), QNetworkReply::ConnectionRefusedError);
     }
+    void testInvoke()
+    {
+        IEngine::Ptr engine {IEngine::create("test", IAuthentificationService::PasswordChangedCallback_t(), PORT)};
+        BroadcastCallback callback {};
+        engine->addCallback(callback);
+
+        // Endpoints are called without the server
+        QUrlQuery params {};
+        params.addQueryItem("key", "value");
+        QJsonObject body {};
+        body.insert("data", 42);
+        const Reply &post = engine->invoke("test", Endpoint(Endpoint::Type::Post, "test_post"), params,
+                                           QJsonDocument(body));
+        QCOMPARE(post.status(), 200);
+        const QJsonObject &postValue = post.valueJson().object();
+        QCOMPARE(postValue.value("type").toString(), QString("post"));
+        QCOMPARE(postValue.value("params").toObject().value("key").toString(), QString("value"));
+        QCOMPARE(postValue.value("body").toObject().value("data").toInt(), 42);
+
+        QCOMPARE(engine->invoke("test", Endpoint(Endpoint::Type::Post, "test_get"), QUrlQuery(), QJsonDocument()).status(), 405);
+        QCOMPARE(engine->invoke("test", Endpoint(Endpoint::Type::Get, "unknown"), QUrlQuery(), QJsonDocument()).status(), 404);
+        QCOMPARE(engine->invoke("unknown", Endpoint(Endpoint::Type::Get, "test_get"), QUrlQuery(), QJsonDocument()).status(), 404);
+
+        // Broadcasts of the extensions are received in process
+        QCOMPARE(engine->invoke("test", Endpoint(Endpoint::Type::Get, "test_ws"), QUrlQuery(), QJsonDocument()).status(), 200);
+        QTRY_COMPARE(callback.data().count(), 1);
+        QCOMPARE(callback.data().first(), QByteArray("Hello world"));
+        engine->removeCallback(callback);
+    }
+    void testInvokeDBus()
+    {
+        IDBusEngine::Ptr engine {IDBusEngine::create("test", IAuthentificationService::PasswordChangedCallback_t(), PORT)};
+        QVERIFY(engine != nullptr);
+        QDBusInterface interface {"harbour.harmony", "/", "harbour.harmony"};
+        BroadcastListener listener {};
+        QDBusConnection::sessionBus().connect("harbour.harmony", "/", "harbour.harmony", "BroadcastReceived",
+                                              &listener, SLOT(broadcastReceived(QString,QByteArray,bool)));
+
+        QDBusMessage result {interface.call("Invoke", "test", "test_get", "get", "key=value", QString())};
+        QCOMPARE(result.type(), QDBusMessage::ReplyMessage);
+        QCOMPARE(result.arguments().count(), 1);
+        const QJsonObject &reply = QJsonDocument::fromJson(result.arguments().at(0).toString().toUtf8()).object();
+        QCOMPARE(reply.value("status").toInt(), 200);
+        QCOMPARE(reply.value("body").toObject().value("params").toObject().value("key").toString(), QString("value"));
+
+        result = interface.call("Invoke", "test", "unknown", "get", QString(), QString());
+        QCOMPARE(result.type(), QDBusMessage::ReplyMessage);
+        const QJsonObject &notFound = QJsonDocument::fromJson(result.arguments().at(0).toString().toUtf8()).object();
+        QCOMPARE(notFound.value("status").toInt(), 404);
+        QVERIFY(!notFound.contains("body"));
+
+        // Unknown methods are rejected before looking for the endpoint
+        result = interface.call("Invoke", "test", "test_get", "patch", QString(), QString());
+        QCOMPARE(result.type(), QDBusMessage::ReplyMessage);
+        const QJsonObject &badMethod = QJsonDocument::fromJson(result.arguments().at(0).toString().toUtf8()).object();
+        QCOMPARE(badMethod.value("status").toInt(), 400);
+        QVERIFY(!badMethod.contains("body"));
+
+        result = interface.call("Invoke", "test", "test_ws_topic", "get", QString(), QString());
+        QCOMPARE(result.type(), QDBusMessage::ReplyMessage);
+        QTRY_COMPARE(listener.data().count(), 1);
+        QCOMPARE(listener.topics().first(), QString("test/topic"));
+        QCOMPARE(listener.data().first(), QByteArray("Hello topic"));
+    }
     void testAuthentification()
     {
         QNetworkAccessManager network {};
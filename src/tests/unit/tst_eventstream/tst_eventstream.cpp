@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include <QtTest/QtTest>
+#include <deque>
+#include <thread>
+#include <private/eventstream.h>
+
+using namespace harmony::private_impl;
+
+class TstEventStream: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testReceives()
+    {
+        EventStream all {4, {}};
+        QVERIFY(all.receives("a"));
+        QVERIFY(all.receives("b"));
+
+        EventStream filtered {4, {"a"}};
+        QVERIFY(filtered.receives("a"));
+        QVERIFY(!filtered.receives("b"));
+    }
+    void testWait()
+    {
+        EventStream stream {2, {}};
+        std::deque<QByteArray> events {};
+        // Times out without events
+        QVERIFY(stream.wait(events, std::chrono::milliseconds(10)));
+        QVERIFY(events.empty());
+
+        // The oldest event is dropped when the stream is full
+        stream.push("1");
+        stream.push("2");
+        stream.push("3");
+        QVERIFY(stream.wait(events, std::chrono::milliseconds(10)));
+        QCOMPARE(static_cast<int>(events.size()), 2);
+        QCOMPARE(events.at(0), QByteArray("2"));
+        QCOMPARE(events.at(1), QByteArray("3"));
+        QCOMPARE(stream.dropped(), 1);
+    }
+    void testClose()
+    {
+        EventStream stream {2, {}};
+        std::thread thread {[&stream]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            stream.close();
+        }};
+        std::deque<QByteArray> events {};
+        QVERIFY(!stream.wait(events, std::chrono::seconds(10)));
+        thread.join();
+
+        // Closed streams ignore events
+        stream.push("1");
+        QVERIFY(!stream.wait(events, std::chrono::milliseconds(10)));
+        QVERIFY(events.empty());
+    }
+    void testDeadline()
+    {
+        EventStream stream {2, {}};
+        stream.setDeadline(std::chrono::steady_clock::now() + std::chrono::milliseconds(50));
+        std::deque<QByteArray> events {};
+        QVERIFY(stream.wait(events, std::chrono::milliseconds(10)));
+
+        // The deadline ends long waits
+        QElapsedTimer timer {};
+        timer.start();
+        QVERIFY(!stream.wait(events, std::chrono::seconds(10)));
+        QVERIFY(timer.elapsed() < 5000);
+        stream.push("1");
+        QVERIFY(!stream.wait(events, std::chrono::milliseconds(10)));
+    }
+};
+
+
+QTEST_MAIN(TstEventStream)
+
+#include "tst_eventstream.moc"
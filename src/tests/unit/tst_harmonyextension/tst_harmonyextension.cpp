@@ -32,25 +32,35 @@
 #include <QtTest/QtTest>
 #include <harmonyextension.h>
 #include <iextensionmanager.h>
+#include <mutex>
 
 Q_IMPORT_PLUGIN(HarmonyTestExtension)
 
 using namespace harmony;
 
+// Broadcasts are dispatched from another thread
 class Callback: public IExtensionManager::ICallback
 {
 public:
     explicit Callback() {}
-    const QByteArray & data() const { return m_data; }
-    int count() const { return m_count; }
-    void operator()(const QByteArray &data) const override
+    QByteArray data() const { std::lock_guard<std::mutex> lock {m_mutex}; return m_data; }
+    std::string topic() const { std::lock_guard<std::mutex> lock {m_mutex}; return m_topic; }
+    Broadcast::Type type() const { std::lock_guard<std::mutex> lock {m_mutex}; return m_type; }
+    int count() const { std::lock_guard<std::mutex> lock {m_mutex}; return m_count; }
+    void operator()(const Broadcast &broadcast) const override
     {
-        m_data = data;
+        std::lock_guard<std::mutex> lock {m_mutex};
+        m_data = broadcast.data();
+        m_topic = broadcast.topic();
+        m_type = broadcast.type();
         ++m_count;
     }
 private:
     mutable QByteArray m_data;
+    mutable std::string m_topic;
+    mutable Broadcast::Type m_type {Broadcast::Type::Text};
     mutable int m_count {0};
+    mutable std::mutex m_mutex {};
 };
 
 class TstHarmonyExtension : public QObject
@@ -59,8 +69,10 @@ class TstHarmonyExtension : public QObject
 private Q_SLOTS:
     void testEndpoint();
     void testReply();
+    void testBroadcast();
     void testExtensionManager();
     void testExtensionManagerObservers();
+    void testExtensionManagerState();
 };
 
 void TstHarmonyExtension::testEndpoint()
@@ -107,6 +119,29 @@ void TstHarmonyExtension::testReply()
     QVERIFY(!(reply2 == reply3));
 }
 
+void TstHarmonyExtension::testBroadcast()
+{
+    Broadcast broadcast1 {};
+    QVERIFY(broadcast1.isNull());
+    QVERIFY(broadcast1.topic().empty());
+    QVERIFY(broadcast1.data().isEmpty());
+
+    Broadcast broadcast2 {"test", "data"};
+    QVERIFY(!broadcast2.isNull());
+    QCOMPARE(broadcast2.topic(), std::string("test"));
+    QCOMPARE(broadcast2.data(), QByteArray("data"));
+
+    QCOMPARE(broadcast2.type(), Broadcast::Type::Text);
+
+    Broadcast broadcast3 {"test/topic", "data"};
+    QVERIFY(broadcast2 == broadcast2);
+    QVERIFY(!(broadcast2 == broadcast3));
+
+    Broadcast broadcast4 {"test", "data", Broadcast::Type::Binary};
+    QCOMPARE(broadcast4.type(), Broadcast::Type::Binary);
+    QVERIFY(!(broadcast2 == broadcast4));
+}
+
 void TstHarmonyExtension::testExtensionManager()
 {
     IExtensionManager::Ptr extensionManager = IExtensionManager::create();
@@ -121,18 +156,54 @@ void TstHarmonyExtension::testExtensionManager()
     QCOMPARE(testExtension->description(), QString("The Harmony test plugin."));
 
     const std::vector<Endpoint> &endpoints = testExtension->endpoints();
-    QCOMPARE(static_cast<int>(endpoints.size()), 4);
+    QCOMPARE(static_cast<int>(endpoints.size()), 5);
 
     // Test the broadcasting capabilities
     QSignalSpy spy (testExtension, SIGNAL(broadcast(QString)));
     testExtension->handleRequest(Endpoint(Endpoint::Type::Get, "test_ws"), QUrlQuery(), QJsonDocument());
 
+    QTRY_COMPARE(callback.count(), 1);
     QCOMPARE(callback.data(), QByteArray("Hello world"));
-    QCOMPARE(callback.count(), 1);
+    QCOMPARE(callback.topic(), std::string("test"));
     QCOMPARE(spy.count(), 1);
     const QVariantList &args = spy.first();
     QCOMPARE(args.count(), 1);
     QCOMPARE(args.first().toString(), QString("Hello world"));
+
+    // Broadcast to a topic
+    testExtension->handleRequest(Endpoint(Endpoint::Type::Get, "test_ws_topic"), QUrlQuery(), QJsonDocument());
+    QTRY_COMPARE(callback.count(), 2);
+    QCOMPARE(callback.data(), QByteArray("Hello topic"));
+    QCOMPARE(callback.topic(), std::string("test/topic"));
+
+    // Text is sent as UTF-8
+    emit testExtension->broadcast(QString::fromUtf8("\xc3\xa9t\xc3\xa9"));
+    QTRY_COMPARE(callback.count(), 3);
+    QCOMPARE(callback.data(), QByteArray("\xc3\xa9t\xc3\xa9"));
+    QCOMPARE(callback.type(), Broadcast::Type::Text);
+
+    // Preformatted data is shared, and not converted
+    const QByteArray utf8 {"{\"level\":42}"};
+    emit testExtension->broadcastUtf8ToTopic("test/topic", utf8);
+    QTRY_COMPARE(callback.count(), 4);
+    QCOMPARE(callback.data(), utf8);
+    QCOMPARE(callback.data().constData(), utf8.constData());
+    QCOMPARE(callback.topic(), std::string("test/topic"));
+    QCOMPARE(callback.type(), Broadcast::Type::Text);
+
+    const QByteArray binary {"\x00\x01\x02", 3};
+    emit testExtension->broadcastBinary(binary);
+    QTRY_COMPARE(callback.count(), 5);
+    QCOMPARE(callback.data(), binary);
+    QCOMPARE(callback.data().constData(), binary.constData());
+    QCOMPARE(callback.topic(), std::string("test"));
+    QCOMPARE(callback.type(), Broadcast::Type::Binary);
+
+    QTRY_COMPARE(extensionManager->statistics().dispatched, quint64(5));
+    const IExtensionManager::Statistics &statistics = extensionManager->statistics();
+    QCOMPARE(statistics.dropped, quint64(0));
+    QCOMPARE(statistics.depth, 0);
+    QVERIFY(statistics.maxDepth >= 1);
 }
 
 void TstHarmonyExtension::testExtensionManagerObservers()
@@ -147,10 +218,52 @@ void TstHarmonyExtension::testExtensionManagerObservers()
     Extension *testExtension = *extensions.begin();
 
     testExtension->handleRequest(Endpoint(Endpoint::Type::Get, "test_ws"), QUrlQuery(), QJsonDocument());
+    QTRY_COMPARE(callback.count(), 1);
     QCOMPARE(callback.data(), QByteArray("Hello world"));
+
+    // Removed callbacks are not called anymore
+    extensionManager->removeCallback(callback);
+    testExtension->handleRequest(Endpoint(Endpoint::Type::Get, "test_ws"), QUrlQuery(), QJsonDocument());
+    QTRY_COMPARE(extensionManager->statistics().dispatched, quint64(2));
     QCOMPARE(callback.count(), 1);
 }
 
+void TstHarmonyExtension::testExtensionManagerState()
+{
+    IExtensionManager::Ptr extensionManager = IExtensionManager::create();
+    Callback callback;
+    extensionManager->addCallback(callback);
+    Extension *testExtension = *extensionManager->extensions().begin();
+
+    quint64 version {0};
+    QJsonObject state {};
+    QVERIFY(!extensionManager->state("test/state", version, state));
+
+    QJsonObject battery {};
+    battery.insert("level", 42);
+    battery.insert("charging", false);
+    emit testExtension->broadcastState("test/state", battery);
+    QTRY_COMPARE(callback.count(), 1);
+    QCOMPARE(callback.topic(), std::string("test/state"));
+    QCOMPARE(callback.data(), QByteArray("{\"patch\":{\"charging\":false,\"level\":42},\"version\":1}"));
+
+    // Only the changes are broadcast
+    battery.insert("level", 41);
+    emit testExtension->broadcastState("test/state", battery);
+    QTRY_COMPARE(callback.count(), 2);
+    QCOMPARE(callback.data(), QByteArray("{\"patch\":{\"level\":41},\"version\":2}"));
+
+    // Nothing is broadcast if nothing changed
+    emit testExtension->broadcastState("test/state", battery);
+    QTRY_COMPARE(extensionManager->statistics().dispatched, quint64(2));
+    QCOMPARE(callback.count(), 2);
+
+    QVERIFY(extensionManager->state("test/state", version, state));
+    QCOMPARE(version, quint64(2));
+    QCOMPARE(state, battery);
+    extensionManager->removeCallback(callback);
+}
+
 QTEST_MAIN(TstHarmonyExtension)
 
 #include "tst_harmonyextension.moc"
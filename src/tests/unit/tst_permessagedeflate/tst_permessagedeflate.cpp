@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include <QtTest/QtTest>
+#include <private/permessagedeflate.h>
+#include <private/websocketframe.h>
+
+using namespace harmony::private_impl;
+
+static const int OPCODE_TEXT = 0x1;
+static const int MAX_SIZE = 1024 * 1024;
+
+class TstPerMessageDeflate: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testNegotiate_data()
+    {
+        QTest::addColumn<QByteArray>("offers");
+        QTest::addColumn<QByteArray>("response");
+        QTest::addColumn<int>("serverMaxWindowBits");
+        QTest::addColumn<int>("clientMaxWindowBits");
+
+        QTest::newRow("browser") << QByteArray("permessage-deflate; client_max_window_bits")
+                                 << QByteArray("permessage-deflate; server_no_context_takeover; client_max_window_bits=12")
+                                 << 15 << 12;
+        QTest::newRow("small client window") << QByteArray("permessage-deflate; client_max_window_bits=10")
+                                             << QByteArray("permessage-deflate; server_no_context_takeover; client_max_window_bits=10")
+                                             << 15 << 10;
+        // The client window is never larger than the offered one
+        QTest::newRow("smallest client window") << QByteArray("permessage-deflate; client_max_window_bits=8")
+                                                << QByteArray("permessage-deflate; server_no_context_takeover; client_max_window_bits=8")
+                                                << 15 << 8;
+        QTest::newRow("server window") << QByteArray("permessage-deflate; server_max_window_bits=15; client_max_window_bits")
+                                       << QByteArray("permessage-deflate; server_no_context_takeover; server_max_window_bits=15; client_max_window_bits=12")
+                                       << 15 << 12;
+        // The client cannot bound its window, so the memory is not bounded
+        QTest::newRow("no client window") << QByteArray("permessage-deflate") << QByteArray() << 0 << 0;
+        // The server window is lowered to the offered one
+        QTest::newRow("small server window") << QByteArray("permessage-deflate; server_max_window_bits=10; client_max_window_bits")
+                                             << QByteArray("permessage-deflate; server_no_context_takeover; server_max_window_bits=10; client_max_window_bits=12")
+                                             << 10 << 12;
+        // zlib cannot compress with a 256 bytes window
+        QTest::newRow("smallest server window") << QByteArray("permessage-deflate; server_max_window_bits=8; client_max_window_bits")
+                                                << QByteArray() << 0 << 0;
+        QTest::newRow("unknown parameter") << QByteArray("permessage-deflate; client_max_window_bits; unknown")
+                                           << QByteArray() << 0 << 0;
+        QTest::newRow("second offer") << QByteArray("permessage-deflate; server_max_window_bits=8, permessage-deflate; client_max_window_bits")
+                                      << QByteArray("permessage-deflate; server_no_context_takeover; client_max_window_bits=12")
+                                      << 15 << 12;
+        QTest::newRow("other extension") << QByteArray("x-webkit-deflate-frame") << QByteArray() << 0 << 0;
+    }
+    void testNegotiate()
+    {
+        QFETCH(QByteArray, offers);
+        QFETCH(QByteArray, response);
+        QFETCH(int, serverMaxWindowBits);
+        QFETCH(int, clientMaxWindowBits);
+
+        PerMessageDeflate::Options options {};
+        PerMessageDeflate::Parameters parameters {};
+        QCOMPARE(PerMessageDeflate::negotiate(options, offers, parameters), response);
+        if (!response.isEmpty()) {
+            QCOMPARE(parameters.serverMaxWindowBits, serverMaxWindowBits);
+            QCOMPARE(parameters.clientMaxWindowBits, clientMaxWindowBits);
+            QVERIFY(parameters.clientContextTakeover);
+        }
+    }
+    void testNegotiateOptions()
+    {
+        PerMessageDeflate::Options options {};
+        options.clientContextTakeover = false;
+        PerMessageDeflate::Parameters parameters {};
+        QCOMPARE(PerMessageDeflate::negotiate(options, "permessage-deflate; client_max_window_bits", parameters),
+                 QByteArray("permessage-deflate; server_no_context_takeover; client_no_context_takeover; client_max_window_bits=12"));
+        QVERIFY(!parameters.clientContextTakeover);
+
+        options.enabled = false;
+        QVERIFY(PerMessageDeflate::negotiate(options, "permessage-deflate; client_max_window_bits", parameters).isEmpty());
+    }
+    void testRoundTrip()
+    {
+        PerMessageDeflate::Options options {};
+        PerMessageDeflate::Parameters parameters {};
+        parameters.clientMaxWindowBits = 15;
+        Inflater inflater {parameters, MAX_SIZE};
+
+        QByteArray message {};
+        for (int i = 0; i < 100; ++i) {
+            message.append("{\"battery\":{\"level\":");
+            message.append(QByteArray::number(i));
+            message.append("}}");
+        }
+
+        for (int i = 0; i < 3; ++i) {
+            const QByteArray &compressed = PerMessageDeflate::deflate(options, 15, message);
+            QVERIFY(!compressed.isEmpty());
+            QVERIFY(compressed.size() < message.size());
+            QVERIFY(!compressed.endsWith(QByteArray("\x00\x00\xff\xff", 4)));
+
+            QByteArray inflated {};
+            QVERIFY(inflater.inflate(compressed, inflated));
+            QCOMPARE(inflated, message);
+        }
+
+        // Too large
+        Inflater smallInflater {parameters, 100};
+        QByteArray inflated {};
+        QVERIFY(!smallInflater.inflate(PerMessageDeflate::deflate(options, 15, message), inflated));
+
+        // Smaller windows
+        parameters.clientMaxWindowBits = 8;
+        Inflater smallWindowInflater {parameters, MAX_SIZE};
+        QVERIFY(smallWindowInflater.inflate(PerMessageDeflate::deflate(options, 9, message), inflated));
+        QCOMPARE(inflated, message);
+
+        // Garbage
+        QVERIFY(!inflater.inflate(QByteArray("\xff\xff\xff\xff\xff", 5), inflated));
+    }
+    void testDeflatedFrame()
+    {
+        PerMessageDeflate::Options options {};
+        WebSocketMessage small {OPCODE_TEXT, "Hello"};
+        QCOMPARE(small.deflatedFrame(options, 15), small.frame());
+
+        WebSocketMessage large {OPCODE_TEXT, QByteArray(1000, 'a')};
+        const QByteArray &frame = large.deflatedFrame(options, 15);
+        QVERIFY(frame.size() < large.frame().size());
+        // FIN, RSV1 and the text opcode
+        QCOMPARE(frame.at(0), '\xc1');
+        QCOMPARE(large.deflatedFrame(options, 15), frame);
+        QCOMPARE(large.deflatedFrame(options, 10).at(0), '\xc1');
+    }
+};
+
+
+QTEST_MAIN(TstPerMessageDeflate)
+
+#include "tst_permessagedeflate.moc"
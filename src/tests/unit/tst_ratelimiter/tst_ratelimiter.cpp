@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include <QtTest/QtTest>
+#include <string>
+#include <private/ratelimiter.h>
+
+using namespace harmony::private_impl;
+
+static const int WINDOW_MS = 60000;
+
+class TstRateLimiter: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testWindow()
+    {
+        RateLimiter limiter {5, WINDOW_MS};
+        for (int i = 0; i < 5; ++i) {
+            QVERIFY(limiter.tryAcquire("a", 1000));
+        }
+        QVERIFY(!limiter.tryAcquire("a", 1000));
+        // Other clients are not limited
+        QVERIFY(limiter.tryAcquire("b", 1000));
+
+        // The attempts of the previous window count, in proportion of
+        // the part of it that is still in the sliding window
+        QVERIFY(limiter.tryAcquire("a", WINDOW_MS + 1000));
+        QVERIFY(!limiter.tryAcquire("a", WINDOW_MS + 1000));
+        QVERIFY(limiter.tryAcquire("a", WINDOW_MS + 25000));
+        QVERIFY(limiter.tryAcquire("a", WINDOW_MS + 25000));
+        QVERIFY(!limiter.tryAcquire("a", WINDOW_MS + 25000));
+
+        // And are forgotten after two windows
+        for (int i = 0; i < 5; ++i) {
+            QVERIFY(limiter.tryAcquire("a", 3 * WINDOW_MS));
+        }
+    }
+    void testRelease()
+    {
+        RateLimiter limiter {2, WINDOW_MS};
+        QVERIFY(limiter.tryAcquire("a", 1000));
+        QVERIFY(limiter.tryAcquire("a", 1000));
+        QVERIFY(!limiter.tryAcquire("a", 1000));
+
+        // Released attempts do not count
+        limiter.release("a", 1000);
+        QVERIFY(limiter.tryAcquire("a", 1000));
+
+        // Even if they were counted in the previous window
+        limiter.release("a", WINDOW_MS + 1000);
+        QVERIFY(limiter.tryAcquire("a", WINDOW_MS + 1000));
+        QVERIFY(limiter.tryAcquire("a", WINDOW_MS + 1000));
+        QVERIFY(!limiter.tryAcquire("a", WINDOW_MS + 1000));
+    }
+    void testRetryAfter()
+    {
+        RateLimiter limiter {5, WINDOW_MS};
+        QCOMPARE(limiter.retryAfterMs("a", 1000), std::int64_t(0));
+        for (int i = 0; i < 5; ++i) {
+            QVERIFY(limiter.tryAcquire("a", 1000));
+        }
+
+        // The current window has to end, and the weight of its attempts has to decrease
+        const std::int64_t retryAfter = limiter.retryAfterMs("a", 1000);
+        QCOMPARE(retryAfter, std::int64_t(WINDOW_MS - 1000 + 1));
+        QVERIFY(!limiter.tryAcquire("a", 1000 + retryAfter - 1));
+        QCOMPARE(limiter.retryAfterMs("a", 1000 + retryAfter), std::int64_t(0));
+        QVERIFY(limiter.tryAcquire("a", 1000 + retryAfter));
+
+        // Within the window, only the weight has to decrease
+        const std::int64_t nextRetryAfter = limiter.retryAfterMs("a", 1000 + retryAfter);
+        QVERIFY(nextRetryAfter > 0);
+        QVERIFY(nextRetryAfter < WINDOW_MS);
+        QVERIFY(!limiter.tryAcquire("a", 1000 + retryAfter + nextRetryAfter - 1));
+        QVERIFY(limiter.tryAcquire("a", 1000 + retryAfter + nextRetryAfter));
+    }
+    void testShards()
+    {
+        // 2 shards of 4 entries, clients that do not fit are not limited
+        RateLimiter limiter {1, WINDOW_MS, 2, 4};
+        int acquired {0};
+        for (int i = 0; i < 100; ++i) {
+            if (limiter.tryAcquire(std::to_string(i).c_str(), 1000)) {
+                ++acquired;
+            }
+        }
+        QCOMPARE(acquired, 100);
+        int limited {0};
+        for (int i = 0; i < 100; ++i) {
+            if (!limiter.tryAcquire(std::to_string(i).c_str(), 1000)) {
+                ++limited;
+            }
+        }
+        QCOMPARE(limited, 2 * 4);
+
+        // Entries are recycled when their windows are over
+        limited = 0;
+        for (int i = 0; i < 100; ++i) {
+            limiter.tryAcquire(std::to_string(i + 100).c_str(), 3 * WINDOW_MS);
+            if (!limiter.tryAcquire(std::to_string(i + 100).c_str(), 3 * WINDOW_MS)) {
+                ++limited;
+            }
+        }
+        QCOMPARE(limited, 2 * 4);
+    }
+    void testLookup()
+    {
+        // Looking a client up does not claim an entry
+        RateLimiter limiter {1, WINDOW_MS, 1, 2};
+        QCOMPARE(limiter.retryAfterMs("a", 1000), std::int64_t(0));
+        limiter.release("b", 1000);
+        QVERIFY(limiter.tryAcquire("c", 1000));
+        QVERIFY(limiter.tryAcquire("d", 1000));
+        QVERIFY(!limiter.tryAcquire("c", 1000));
+        QVERIFY(!limiter.tryAcquire("d", 1000));
+        QVERIFY(limiter.retryAfterMs("c", 1000) > 0);
+
+        // Clients that do not fit do not share the limit of the others
+        QVERIFY(limiter.tryAcquire("e", 1000));
+        QVERIFY(limiter.tryAcquire("e", 1000));
+        QCOMPARE(limiter.retryAfterMs("e", 1000), std::int64_t(0));
+
+        // And get an entry once one is recycled, without the counts of its previous client
+        QVERIFY(limiter.tryAcquire("e", 3 * WINDOW_MS));
+        QVERIFY(!limiter.tryAcquire("e", 3 * WINDOW_MS));
+    }
+};
+
+
+QTEST_MAIN(TstRateLimiter)
+
+#include "tst_ratelimiter.moc"
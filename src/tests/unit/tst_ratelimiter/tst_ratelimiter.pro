@@ -0,0 +1,12 @@
+TEMPLATE = app
+TARGET = tst_ratelimiter
+
+QT = core testlib
+
+include(../../../config.pri)
+include(../../../lib/civet/civet-deps.pri)
+
+INCLUDEPATH += ../../../lib/harmony
+LIBS += -L../../../lib/harmony -lharmony
+
+SOURCES += tst_ratelimiter.cpp
@@ -36,6 +36,7 @@
 #include <QtNetwork/QNetworkAccessManager>
 #include <QtNetwork/QNetworkReply>
 #include <QtNetwork/QNetworkRequest>
+#include <QtNetwork/QTcpSocket>
 #include <jsonwebtoken.h>
 #include <iserver.h>
 #include <iauthentificationservice.h>
@@ -46,6 +47,7 @@ Q_IMPORT_PLUGIN(HarmonyTestExtension)
 using namespace harmony;
 
 static const int PORT = 8080;
+static const int LOOPBACK_PORT = 8085;
 
 class TstServer: public QObject
 {
@@ -151,6 +153,42 @@ private Q_SLOTS:
 
         QCOMPARE(reply->error(), QNetworkReply::AuthenticationRequiredError);
     }
+    void testAuthentificationThrottling()
+    {
+        QNetworkAccessManager network {};
+        std::unique_ptr<QNetworkReply> reply {};
+
+        IAuthentificationService::Ptr as = IAuthentificationService::create("test");
+        IExtensionManager::Ptr em = IExtensionManager::create();
+        IServer::Ptr server = IServer::create(*as, *em, PORT);
+        QVERIFY(server->start());
+
+        QNetworkRequest postRequest (QUrl("https://localhost:8080/authenticate"));
+        postRequest.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
+        QJsonObject object;
+        object.insert("password", "test");
+        QByteArray query = QJsonDocument(object).toJson(QJsonDocument::Compact);
+
+        for (int i = 0; i < 5; ++i) {
+            reply.reset(network.post(postRequest, query));
+            handleSslErrors(*reply);
+            while (!reply->isFinished()) {
+                QTest::qWait(100);
+            }
+            QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 401);
+        }
+
+        // Even with the right password
+        object.insert("password", QString::fromStdString(as->password()));
+        query = QJsonDocument(object).toJson(QJsonDocument::Compact);
+        reply.reset(network.post(postRequest, query));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 429);
+        QVERIFY(reply->hasRawHeader("Retry-After"));
+    }
     void testMultiRequest()
     {
         QNetworkAccessManager network {};
@@ -224,6 +262,116 @@ private Q_SLOTS:
         });
         QCOMPARE(count, 1);
     }
+    void testLoopback()
+    {
+        QNetworkAccessManager network {};
+        std::unique_ptr<QNetworkReply> reply {};
+
+        IAuthentificationService::Ptr as = IAuthentificationService::create("test");
+        IExtensionManager::Ptr em = IExtensionManager::create();
+        IServer::Ptr server = IServer::create(*as, *em, PORT);
+        IServer::Options options {};
+        options.loopbackPort = LOOPBACK_PORT;
+        server->setOptions(options);
+        QVERIFY(server->start());
+
+        // Plain HTTP on the loopback port, TLS is still used on the main port
+        reply.reset(network.get(QNetworkRequest(QUrl("http://127.0.0.1:8085/ping"))));
+        QTRY_VERIFY(reply->isFinished());
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+        QCOMPARE(reply->readAll(), QByteArray("pong"));
+
+        reply.reset(network.get(QNetworkRequest(QUrl("https://localhost:8080/ping"))));
+        handleSslErrors(*reply);
+        QTRY_VERIFY(reply->isFinished());
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+
+        // Tokens are still needed
+        reply.reset(network.get(QNetworkRequest(QUrl("http://127.0.0.1:8085/api/test/test_get"))));
+        QTRY_VERIFY(reply->isFinished());
+        QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 401);
+
+        QNetworkRequest getRequest (QUrl("http://127.0.0.1:8085/api/test/test_get"));
+        getRequest.setRawHeader("Authorization", "Bearer " + as->hashJwt(as->authenticate(as->password())));
+        reply.reset(network.get(getRequest));
+        QTRY_VERIFY(reply->isFinished());
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+    }
+    void testAdmission()
+    {
+        QNetworkAccessManager network {};
+        std::unique_ptr<QNetworkReply> reply {};
+
+        IAuthentificationService::Ptr as = IAuthentificationService::create("test");
+        IExtensionManager::Ptr em = IExtensionManager::create();
+        IServer::Ptr server = IServer::create(*as, *em, PORT);
+        IServer::Options options {};
+        options.admission.maxRequests = 1;
+        server->setOptions(options);
+        QVERIFY(server->start());
+
+        // Requests that are not handled by an extension are admitted too
+        reply.reset(network.get(QNetworkRequest(QUrl("https://localhost:8080/ping"))));
+        handleSslErrors(*reply);
+        QTRY_VERIFY(reply->isFinished());
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+        QTRY_COMPARE(server->admissionStatistics().inFlight, 0);
+        QCOMPARE(server->admissionStatistics().admitted, std::uint64_t(1));
+
+        reply.reset(network.get(QNetworkRequest(QUrl("https://localhost:8080/api/test/test_get"))));
+        handleSslErrors(*reply);
+        QTRY_VERIFY(reply->isFinished());
+        QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 401);
+        QTRY_COMPARE(server->admissionStatistics().inFlight, 0);
+        QCOMPARE(server->admissionStatistics().admitted, std::uint64_t(2));
+        server->stop();
+    }
+    void testAdmissionShed()
+    {
+        QNetworkAccessManager network {};
+        std::unique_ptr<QNetworkReply> reply {};
+
+        IAuthentificationService::Ptr as = IAuthentificationService::create("test");
+        IExtensionManager::Ptr em = IExtensionManager::create();
+        IServer::Ptr server = IServer::create(*as, *em, PORT);
+        IServer::Options options {};
+        options.loopbackPort = LOOPBACK_PORT;
+        options.admission.maxRequests = 1;
+        options.admission.maxWaitMs = 0;
+        server->setOptions(options);
+        QVERIFY(server->start());
+
+        // The request holds its slot while its body is read
+        QTcpSocket socket {};
+        socket.connectToHost("127.0.0.1", LOOPBACK_PORT);
+        QVERIFY(socket.waitForConnected());
+        socket.write("POST /authenticate HTTP/1.1\r\n"
+                     "Host: localhost\r\n"
+                     "Content-Length: 8\r\n"
+                     "\r\n");
+        QTRY_COMPARE(server->admissionStatistics().inFlight, 1);
+
+        // Static files and /ping are shed too
+        reply.reset(network.get(QNetworkRequest(QUrl("http://127.0.0.1:8085/ping"))));
+        QTRY_VERIFY(reply->isFinished());
+        QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 503);
+        QVERIFY(!reply->rawHeader("Retry-After").isEmpty());
+        QCOMPARE(server->admissionStatistics().shed, std::uint64_t(1));
+
+        // And the slot is released at the end of the request
+        socket.write("00000000");
+        QByteArray received {};
+        while (!received.contains("\r\n\r\n") && socket.waitForReadyRead(5000)) {
+            received.append(socket.readAll());
+        }
+        QVERIFY(received.startsWith("HTTP/1.1 401"));
+        QTRY_COMPARE(server->admissionStatistics().inFlight, 0);
+        reply.reset(network.get(QNetworkRequest(QUrl("http://127.0.0.1:8085/ping"))));
+        QTRY_VERIFY(reply->isFinished());
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+        server->stop();
+    }
+
     void testRequests()
     {
         QNetworkAccessManager network {};
@@ -261,7 +409,10 @@ private Q_SLOTS:
         }
 
         QCOMPARE(reply->error(), QNetworkReply::NoError);
-        QCOMPARE(reply->readAll(), QByteArray("{\"body\":{},\"name\":\"test_get\",\"params\":{\"int\":\"3\",\"string\":\"test\"},\"type\":\"get\"}"));
+        QCOMPARE(reply->header(QNetworkRequest::ContentTypeHeader).toString(), QString("application/json"));
+        const QByteArray &getReply = reply->readAll();
+        QCOMPARE(getReply, QByteArray("{\"body\":{},\"name\":\"test_get\",\"params\":{\"int\":\"3\",\"string\":\"test\"},\"type\":\"get\"}"));
+        QCOMPARE(reply->header(QNetworkRequest::ContentLengthHeader).toInt(), getReply.size());
 
         // Post
         QJsonObject postData;
@@ -283,6 +434,19 @@ private Q_SLOTS:
         QCOMPARE(reply->error(), QNetworkReply::NoError);
         QCOMPARE(reply->readAll(), QByteArray("{\"body\":{\"array\":[\"a\",\"b\",\"c\"],\"bool\":true,\"int\":12345,\"string\":\"test2\"},\"name\":\"test_post\",\"params\":{\"int\":\"3\",\"string\":\"test\"},\"type\":\"post\"}"));
 
+        // Replies are not format strings
+        QJsonObject formatData;
+        formatData.insert("string", "%s%n%x");
+        reply.reset(network.post(postRequest, QJsonDocument(formatData).toJson(QJsonDocument::Compact)));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+        QCOMPARE(QJsonDocument::fromJson(reply->readAll()).object().value("body").toObject().value("string").toString(),
+                 QString("%s%n%x"));
+
         // Delete
         QNetworkRequest deleteRequest (QUrl("https://localhost:8080/api/test/test_delete?string=test&int=3"));
         deleteRequest.setRawHeader("Authorization", token);
@@ -311,6 +475,53 @@ private Q_SLOTS:
         const QJsonObject &extension = document.array().first().toObject();
         QCOMPARE(extension.value("id").toString(), QString("test"));
     }
+    void testState()
+    {
+        QNetworkAccessManager network {};
+        std::unique_ptr<QNetworkReply> reply {};
+
+        IAuthentificationService::Ptr as = IAuthentificationService::create("test");
+        IExtensionManager::Ptr em = IExtensionManager::create();
+        IServer::Ptr server = IServer::create(*as, *em, PORT);
+        QVERIFY(server->start());
+
+        QNetworkRequest authorizationRequest (QUrl("https://localhost:8080/authenticate"));
+        authorizationRequest.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
+        QJsonObject object;
+        object.insert("password", QString::fromStdString(as->password()));
+        reply.reset(network.post(authorizationRequest, QJsonDocument(object).toJson(QJsonDocument::Compact)));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+        QByteArray token {"Bearer "};
+        token.append(QJsonDocument::fromJson(reply->readAll()).object().value("token").toString());
+
+        // Nothing published yet
+        QNetworkRequest stateRequest (QUrl("https://localhost:8080/api/state?topic=test/state"));
+        stateRequest.setRawHeader("Authorization", token);
+        reply.reset(network.get(stateRequest));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 404);
+
+        QJsonObject state {};
+        state.insert("level", 42);
+        emit em->extensions().front()->broadcastState("test/state", state);
+        state.insert("level", 41);
+        emit em->extensions().front()->broadcastState("test/state", state);
+
+        reply.reset(network.get(stateRequest));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+        QCOMPARE(reply->readAll(), QByteArray("{\"state\":{\"level\":41},\"version\":2}"));
+    }
     void testUnauthorizedRequests()
     {
         QNetworkAccessManager network {};
@@ -529,6 +740,138 @@ private Q_SLOTS:
         QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 400);
         QCOMPARE(reply->readAll(), QByteArray("{\"body\":{},\"name\":\"test_get\",\"params\":{\"status\":\"12345\"},\"type\":\"get\"}"));
     }
+    void testLogout()
+    {
+        QNetworkAccessManager network {};
+        std::unique_ptr<QNetworkReply> reply {};
+
+        IAuthentificationService::Ptr as = IAuthentificationService::create("test");
+        IExtensionManager::Ptr em = IExtensionManager::create();
+        IServer::Ptr server = IServer::create(*as, *em, PORT);
+        QVERIFY(server->start());
+
+        // Authorization
+        QNetworkRequest authorizationRequest (QUrl("https://localhost:8080/authenticate"));
+        authorizationRequest.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
+        QJsonObject object;
+        object.insert("password", QString::fromStdString(as->password()));
+        QByteArray query = QJsonDocument(object).toJson(QJsonDocument::Compact);
+        reply.reset(network.post(authorizationRequest, query));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+        QByteArray token {"Bearer "};
+
+        QJsonDocument result {QJsonDocument::fromJson(reply->readAll())};
+        token.append(result.object().value("token").toString());
+
+        // Logout
+        QNetworkRequest logoutRequest (QUrl("https://localhost:8080/authenticate/logout"));
+        logoutRequest.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
+        logoutRequest.setRawHeader("Authorization", token);
+        reply.reset(network.post(logoutRequest, "{}"));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+        QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 204);
+
+        // The token is revoked
+        QNetworkRequest getRequest (QUrl("https://localhost:8080/api/test/test_get"));
+        getRequest.setRawHeader("Authorization", token);
+        reply.reset(network.get(getRequest));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QCOMPARE(reply->error(), QNetworkReply::AuthenticationRequiredError);
+
+        reply.reset(network.post(logoutRequest, "{}"));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QCOMPARE(reply->error(), QNetworkReply::AuthenticationRequiredError);
+    }
+    void testRefresh()
+    {
+        QNetworkAccessManager network {};
+        std::unique_ptr<QNetworkReply> reply {};
+
+        IAuthentificationService::Ptr as = IAuthentificationService::create("test");
+        IExtensionManager::Ptr em = IExtensionManager::create();
+        IServer::Ptr server = IServer::create(*as, *em, PORT);
+        QVERIFY(server->start());
+
+        // Authorization with a refresh token
+        QNetworkRequest authorizationRequest (QUrl("https://localhost:8080/authenticate"));
+        authorizationRequest.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
+        QJsonObject object;
+        object.insert("password", QString::fromStdString(as->password()));
+        object.insert("refresh", true);
+        QByteArray query = QJsonDocument(object).toJson(QJsonDocument::Compact);
+        reply.reset(network.post(authorizationRequest, query));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+        QJsonObject result {QJsonDocument::fromJson(reply->readAll()).object()};
+        QString refreshToken {result.value("refreshToken").toString()};
+        QVERIFY(!result.value("token").toString().isEmpty());
+        QVERIFY(!refreshToken.isEmpty());
+
+        // Refresh
+        const std::string password = as->password();
+        QNetworkRequest refreshRequest (QUrl("https://localhost:8080/authenticate/refresh"));
+        refreshRequest.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
+        QJsonObject refreshObject;
+        refreshObject.insert("refreshToken", refreshToken);
+        query = QJsonDocument(refreshObject).toJson(QJsonDocument::Compact);
+        reply.reset(network.post(refreshRequest, query));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+        QCOMPARE(as->password(), password);
+        result = QJsonDocument::fromJson(reply->readAll()).object();
+        QByteArray token {"Bearer "};
+        token.append(result.value("token").toString());
+        QVERIFY(result.value("refreshToken").toString() != refreshToken);
+
+        // The refresh token that was used is revoked
+        reply.reset(network.post(refreshRequest, query));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QCOMPARE(reply->error(), QNetworkReply::AuthenticationRequiredError);
+
+        // Logout revokes the new refresh token
+        refreshToken = result.value("refreshToken").toString();
+        refreshObject.insert("refreshToken", refreshToken);
+        query = QJsonDocument(refreshObject).toJson(QJsonDocument::Compact);
+        QNetworkRequest logoutRequest (QUrl("https://localhost:8080/authenticate/logout"));
+        logoutRequest.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
+        logoutRequest.setRawHeader("Authorization", token);
+        reply.reset(network.post(logoutRequest, query));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 204);
+
+        reply.reset(network.post(refreshRequest, query));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QCOMPARE(reply->error(), QNetworkReply::AuthenticationRequiredError);
+    }
 };
 
 
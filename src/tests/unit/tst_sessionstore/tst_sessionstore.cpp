@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include <QtTest/QtTest>
+#include <private/sessionstore.h>
+
+using namespace harmony::private_impl;
+
+class TstSessionStore: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testSimple()
+    {
+        SessionStore store {8, 10};
+        store.add("a", 1050, 1000);
+        store.add("b", 1100, 1000);
+        QCOMPARE(store.count(), 2);
+        QVERIFY(store.contains("a", 1000));
+        QVERIFY(store.contains("b", 1049));
+        QVERIFY(!store.contains("c", 1000));
+
+        // Expired, but its tick is not over
+        QVERIFY(!store.contains("a", 1050));
+        QCOMPARE(store.count(), 2);
+
+        QVERIFY(!store.contains("a", 1060));
+        QCOMPARE(store.count(), 1);
+        QVERIFY(store.contains("b", 1060));
+
+        QVERIFY(store.remove("b"));
+        QVERIFY(!store.remove("b"));
+        QCOMPARE(store.count(), 0);
+    }
+    void testWheelTurns()
+    {
+        SessionStore store {4, 10};
+        // Expires after several turns of the wheel
+        store.add("a", 1205, 1000);
+        store.add("b", 1015, 1000);
+        QVERIFY(store.contains("a", 1100));
+        QCOMPARE(store.count(), 1);
+        QVERIFY(store.contains("a", 1200));
+        QVERIFY(!store.contains("a", 1500));
+        QCOMPARE(store.count(), 0);
+    }
+    void testClear()
+    {
+        SessionStore store {};
+        store.add("a", 2000, 1000);
+        store.add("b", 3000, 1000);
+        store.clear();
+        QCOMPARE(store.count(), 0);
+        QVERIFY(!store.contains("a", 1000));
+    }
+};
+
+QTEST_MAIN(TstSessionStore)
+
+#include "tst_sessionstore.moc"
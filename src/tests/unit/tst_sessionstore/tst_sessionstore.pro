@@ -0,0 +1,11 @@
+TEMPLATE = app
+TARGET = tst_sessionstore
+
+QT = core testlib
+
+include(../../../config.pri)
+
+INCLUDEPATH += ../../../lib/harmony
+LIBS += -L../../../lib/harmony -lharmony
+
+SOURCES += tst_sessionstore.cpp
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include <QtTest/QtTest>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <private/statestore.h>
+
+using namespace harmony::private_impl;
+
+class TstStateStore: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testDiff()
+    {
+        const QJsonObject &from = QJsonDocument::fromJson("{\"level\":42,\"charging\":false,\"removed\":1,"
+                                                          "\"nested\":{\"a\":1,\"b\":2},\"array\":[1,2]}").object();
+        const QJsonObject &to = QJsonDocument::fromJson("{\"level\":41,\"charging\":false,\"added\":\"yes\","
+                                                        "\"nested\":{\"a\":1,\"b\":3},\"array\":[1,2,3]}").object();
+        const QJsonObject &patch = StateStore::diff(from, to);
+        QCOMPARE(QJsonDocument(patch).toJson(QJsonDocument::Compact),
+                 QByteArray("{\"added\":\"yes\",\"array\":[1,2,3],\"level\":41,\"nested\":{\"b\":3},\"removed\":null}"));
+
+        QVERIFY(StateStore::diff(to, to).isEmpty());
+        QCOMPARE(StateStore::diff(QJsonObject(), to), to);
+    }
+    void testUpdate()
+    {
+        StateStore store {};
+        quint64 version {0};
+        QJsonObject state {};
+        QJsonObject patch {};
+        QVERIFY(!store.snapshot("test", version, state));
+
+        // The first state is sent as a whole
+        QJsonObject object {};
+        object.insert("level", 42);
+        QVERIFY(store.update("test", object, version, patch));
+        QCOMPARE(version, quint64(1));
+        QCOMPARE(patch, object);
+
+        // Unchanged states are not published again
+        QVERIFY(!store.update("test", object, version, patch));
+        QVERIFY(store.snapshot("test", version, state));
+        QCOMPARE(version, quint64(1));
+
+        object.insert("level", 41);
+        QVERIFY(store.update("test", object, version, patch));
+        QCOMPARE(version, quint64(2));
+        QCOMPARE(patch.value("level").toInt(), 41);
+        QVERIFY(store.snapshot("test", version, state));
+        QCOMPARE(version, quint64(2));
+        QCOMPARE(state, object);
+
+        // Topics are versioned independently
+        QVERIFY(store.update("other", QJsonObject(), version, patch));
+        QCOMPARE(version, quint64(1));
+        QVERIFY(patch.isEmpty());
+    }
+};
+
+
+QTEST_MAIN(TstStateStore)
+
+#include "tst_statestore.moc"
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include <QtTest/QtTest>
+#include <atomic>
+#include <thread>
+#include <private/copyonwrite.h>
+#include <private/topicindex.h>
+
+using namespace harmony::private_impl;
+
+static mg_connection * connection(int index)
+{
+    return reinterpret_cast<mg_connection *>(static_cast<quintptr>(index));
+}
+
+class TstTopicIndex: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testSubscribe()
+    {
+        TopicIndex index {};
+        index.add(connection(1));
+        index.add(connection(2));
+        index.add(connection(1));
+        QCOMPARE(static_cast<int>(index.subscribers("a").size()), 2);
+
+        // Subscribed WebSockets only receive their topics
+        QVERIFY(index.subscribe(connection(1), "a"));
+        QCOMPARE(static_cast<int>(index.subscribers("a").size()), 2);
+        QVERIFY(index.subscribers("b") == std::vector<mg_connection *>({connection(2)}));
+
+        QVERIFY(index.unsubscribe(connection(1), "a"));
+        QVERIFY(index.subscribers("a") == std::vector<mg_connection *>({connection(2)}));
+
+        QVERIFY(index.subscribe(connection(1), "b"));
+        index.remove(connection(1));
+        QVERIFY(!index.contains(connection(1)));
+        QVERIFY(index.subscribers("b") == std::vector<mg_connection *>({connection(2)}));
+        QVERIFY(!index.subscribe(connection(1), "b"));
+
+        index.clear();
+        QVERIFY(!index.contains(connection(2)));
+        QVERIFY(index.subscribers("b").empty());
+    }
+    void testSnapshot()
+    {
+        CopyOnWrite<std::vector<int>> data {};
+        const CopyOnWrite<std::vector<int>>::Ptr &empty = data.load();
+        QVERIFY(data.update([](std::vector<int> &values) {
+            values.push_back(1);
+            return true;
+        }));
+        QVERIFY(!data.update([](std::vector<int> &values) {
+            values.push_back(2);
+            return false;
+        }));
+
+        // Readers keep the version they loaded
+        QVERIFY(empty->empty());
+        QVERIFY(*data.load() == std::vector<int>({1}));
+        data.reset();
+        QVERIFY(data.load()->empty());
+    }
+    void testConcurrentReaders()
+    {
+        TopicIndex index {};
+        std::atomic_bool stopping {false};
+        std::thread reader ([&index, &stopping]() {
+            while (!stopping) {
+                for (mg_connection *subscriber : index.subscribers("a")) {
+                    Q_UNUSED(subscriber);
+                }
+            }
+        });
+        for (int i = 1; i <= 1000; ++i) {
+            index.add(connection(i));
+            index.subscribe(connection(i), "a");
+            if (i % 2 == 0) {
+                index.remove(connection(i - 1));
+            }
+        }
+        stopping = true;
+        reader.join();
+        QCOMPARE(static_cast<int>(index.subscribers("a").size()), 500);
+    }
+};
+
+
+QTEST_MAIN(TstTopicIndex)
+
+#include "tst_topicindex.moc"
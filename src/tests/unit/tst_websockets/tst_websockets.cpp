@@ -32,9 +32,12 @@
 #include <QtTest/QtTest>
 #include <QtTest/QSignalSpy>
 #include <QtCore/QDebug>
+#include <QtCore/QUrlQuery>
+#include <QtNetwork/QLocalSocket>
 #include <QtNetwork/QNetworkAccessManager>
 #include <QtNetwork/QNetworkReply>
 #include <QtNetwork/QNetworkRequest>
+#include <QtNetwork/QTcpSocket>
 #include <QtWebSockets/QWebSocket>
 #include <private/enhancedcivetserver.h>
 #include <jsonwebtoken.h>
@@ -50,6 +53,7 @@ using namespace harmony;
 using namespace harmony::private_impl;
 
 static const int PORT = 8080;
+static const int EVENT_LOOP_PORT = 8083;
 
 class Handler: public QObject, public CivetWebSocketHandler
 {
@@ -146,6 +150,62 @@ class TstWebSockets: public QObject
 {
     Q_OBJECT
 private:
+    // Client frames are masked, with a zero mask that leaves the payload as is
+    static QByteArray clientFrame(int opcode, const QByteArray &payload)
+    {
+        QByteArray frame {};
+        frame.append(char(0x80 | opcode));
+        if (payload.size() < 126) {
+            frame.append(char(0x80 | payload.size()));
+        } else {
+            frame.append(char(0x80 | 126));
+            frame.append(char(payload.size() >> 8));
+            frame.append(char(payload.size() & 0xff));
+        }
+        frame.append(QByteArray(4, '\0'));
+        frame.append(payload);
+        return frame;
+    }
+
+    // Headers of the handshake response, that are removed from received
+    static QByteArray readHandshake(QIODevice &socket, QByteArray &received)
+    {
+        while (!received.contains("\r\n\r\n") && socket.waitForReadyRead(5000)) {
+            received.append(socket.readAll());
+        }
+        const int end = received.indexOf("\r\n\r\n");
+        if (end < 0) {
+            return QByteArray();
+        }
+        const QByteArray &headers = received.left(end + 2);
+        received.remove(0, end + 4);
+        return headers;
+    }
+
+    // Payload of the next server frame, shorter than 64 KiB
+    static QByteArray readFrame(QIODevice &socket, QByteArray &received)
+    {
+        while (true) {
+            if (received.size() >= 2) {
+                int header {2};
+                int size = received.at(1) & 0x7f;
+                if (size == 126) {
+                    header = 4;
+                    size = received.size() >= header ? (uchar(received.at(2)) << 8) | uchar(received.at(3)) : -1;
+                }
+                if (size >= 0 && received.size() >= header + size) {
+                    const QByteArray &payload = received.mid(header, size);
+                    received.remove(0, header + size);
+                    return payload;
+                }
+            }
+            if (!socket.waitForReadyRead(5000)) {
+                return QByteArray();
+            }
+            received.append(socket.readAll());
+        }
+    }
+
     static void handleSslErrors(QNetworkReply &reply)
     {
         connect(&reply, &QNetworkReply::sslErrors, [&reply](const QList<QSslError> &sslErrors) {
@@ -315,6 +375,172 @@ private Q_SLOTS:
         QCOMPARE(handlerSpy.at(1).first().toInt(), static_cast<int>(Handler::Disconnected));
     }
 
+    void testWebSocketPing()
+    {
+        // Server
+        const char *options[] = {"listening_ports", "8080", nullptr };
+        Handler handler;
+        EnhancedCivetServer server (options);
+        server.addWebSocketHandler("/test", &handler);
+
+        // Client
+        QWebSocket socket;
+        QSignalSpy pongSpy (&socket, SIGNAL(pong(quint64,QByteArray)));
+        socket.open(QUrl("ws://localhost:8080/test"));
+
+        while (socket.state() != QAbstractSocket::ConnectedState) {
+            QTest::qWait(100);
+        }
+
+        // Pings are answered, and do not close the connection
+        socket.ping("payload");
+        QTRY_COMPARE(pongSpy.count(), 1);
+        QCOMPARE(pongSpy.at(0).at(1).toByteArray(), QByteArray("payload"));
+        QCOMPARE(socket.state(), QAbstractSocket::ConnectedState);
+        QCOMPARE(handler.state(), Handler::Ready);
+    }
+
+    void testHeartbeat()
+    {
+        // Server, with a single thread, that is held by each WebSocket
+        const char *options[] = {"listening_ports", "8080", "num_threads", "1", nullptr };
+        EnhancedCivetServer::WebSocketOptions webSocketOptions {};
+        webSocketOptions.pingInterval = 200;
+        webSocketOptions.pingTimeout = 200;
+        Handler handler;
+        EnhancedCivetServer server (options, nullptr, webSocketOptions);
+        server.addWebSocketHandler("/test", &handler);
+
+        // QWebSocket answers pings, and stays connected
+        QWebSocket socket;
+        socket.open(QUrl("ws://localhost:8080/test"));
+        QTRY_COMPARE(socket.state(), QAbstractSocket::ConnectedState);
+        QTest::qWait(1000);
+        QCOMPARE(socket.state(), QAbstractSocket::ConnectedState);
+        QCOMPARE(handler.state(), Handler::Ready);
+        socket.close();
+        QTRY_COMPARE(handler.state(), Handler::Disconnected);
+
+        // A client that never answers is closed
+        QTcpSocket silent;
+        silent.connectToHost("localhost", 8080);
+        QVERIFY(silent.waitForConnected());
+        silent.write("GET /test HTTP/1.1\r\n"
+                     "Host: localhost:8080\r\n"
+                     "Upgrade: websocket\r\n"
+                     "Connection: Upgrade\r\n"
+                     "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                     "Sec-WebSocket-Version: 13\r\n\r\n");
+        QTRY_COMPARE(handler.state(), Handler::Ready);
+        QTRY_COMPARE_WITH_TIMEOUT(handler.state(), Handler::Disconnected, 2000);
+        QVERIFY(handler.connection() == nullptr);
+
+        // Its socket is shut down, so the thread is released for the next client
+        QTRY_COMPARE(silent.state(), QAbstractSocket::UnconnectedState);
+        QWebSocket next;
+        next.open(QUrl("ws://localhost:8080/test"));
+        QTRY_COMPARE(next.state(), QAbstractSocket::ConnectedState);
+        QTRY_COMPARE(handler.state(), Handler::Ready);
+        next.close();
+        QTRY_COMPARE(handler.state(), Handler::Disconnected);
+    }
+
+    void testDeadline()
+    {
+        // Server
+        const char *options[] = {"listening_ports", "8080", nullptr };
+        Handler handler;
+        EnhancedCivetServer server (options);
+        server.addWebSocketHandler("/test", &handler);
+
+        // Client
+        QWebSocket socket;
+        QSignalSpy disconnectedSpy (&socket, SIGNAL(disconnected()));
+        socket.open(QUrl("ws://localhost:8080/test"));
+        QTRY_COMPARE(socket.state(), QAbstractSocket::ConnectedState);
+        QTRY_VERIFY(handler.connection() != nullptr);
+
+        server.wsSetDeadline(handler.connection(), std::chrono::steady_clock::now() + std::chrono::milliseconds(500));
+        QTest::qWait(200);
+        QCOMPARE(handler.state(), Handler::Ready);
+
+        // The server closes the WebSocket by itself
+        QTRY_COMPARE(handler.state(), Handler::Disconnected);
+        QTRY_COMPARE(disconnectedSpy.count(), 1);
+        QCOMPARE(socket.closeCode(), QWebSocketProtocol::CloseCodePolicyViolated);
+    }
+
+    void testDeflateNegotiation()
+    {
+        // Server
+        const char *options[] = {"listening_ports", "8080", nullptr };
+        Handler handler;
+        EnhancedCivetServer server (options);
+        server.addWebSocketHandler("/test", &handler);
+
+        // The server window is lowered to the one offered by the client
+        QTcpSocket socket;
+        socket.connectToHost("localhost", 8080);
+        QVERIFY(socket.waitForConnected());
+        socket.write("GET /test HTTP/1.1\r\n"
+                     "Host: localhost:8080\r\n"
+                     "Upgrade: websocket\r\n"
+                     "Connection: Upgrade\r\n"
+                     "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                     "Sec-WebSocket-Version: 13\r\n"
+                     "Sec-WebSocket-Extensions: permessage-deflate; server_max_window_bits=10; client_max_window_bits\r\n"
+                     "\r\n");
+        QByteArray received {};
+        QByteArray headers = readHandshake(socket, received);
+        QVERIFY(headers.startsWith("HTTP/1.1 101 Switching Protocols\r\n"));
+        QCOMPARE(headers.count("HTTP/1.1"), 1);
+        QVERIFY(headers.contains("\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"));
+        QVERIFY(headers.contains("\r\nSec-WebSocket-Extensions: permessage-deflate; server_no_context_takeover; "
+                                 "server_max_window_bits=10; client_max_window_bits=12\r\n"));
+
+        // Messages are compressed with this window
+        QTRY_VERIFY(handler.connection() != nullptr);
+        QByteArray message {};
+        for (int i = 0; i < 100; ++i) {
+            message.append("{\"battery\":{\"level\":");
+            message.append(QByteArray::number(i));
+            message.append("}}");
+        }
+        QVERIFY(EnhancedCivetServer::wsWriteMessage(handler.connection(), WebSocketMessage {WEBSOCKET_OPCODE_TEXT, message})
+                == WebSocketWriteResult::Written);
+        while (received.isEmpty() && socket.waitForReadyRead(5000)) {
+            received.append(socket.readAll());
+        }
+        QVERIFY(!received.isEmpty());
+        // FIN, RSV1 and the text opcode
+        QCOMPARE(received.at(0), '\xc1');
+        PerMessageDeflate::Parameters parameters {};
+        parameters.clientMaxWindowBits = 10;
+        Inflater inflater {parameters, 1024 * 1024};
+        QByteArray inflated {};
+        QVERIFY(inflater.inflate(readFrame(socket, received), inflated));
+        QCOMPARE(inflated, message);
+        socket.close();
+        QTRY_VERIFY(handler.connection() == nullptr);
+
+        // Offers that cannot be honored are declined, and the handshake has no extension
+        QTcpSocket declined;
+        declined.connectToHost("localhost", 8080);
+        QVERIFY(declined.waitForConnected());
+        declined.write("GET /test HTTP/1.1\r\n"
+                       "Host: localhost:8080\r\n"
+                       "Upgrade: websocket\r\n"
+                       "Connection: Upgrade\r\n"
+                       "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                       "Sec-WebSocket-Version: 13\r\n"
+                       "Sec-WebSocket-Extensions: permessage-deflate; server_max_window_bits=8; client_max_window_bits\r\n"
+                       "\r\n");
+        received.clear();
+        headers = readHandshake(declined, received);
+        QVERIFY(headers.startsWith("HTTP/1.1 101 Switching Protocols\r\n"));
+        QVERIFY(!headers.contains("Sec-WebSocket-Extensions"));
+    }
+
     void testAuthentification()
     {
         QNetworkAccessManager network {};
@@ -368,10 +594,563 @@ private Q_SLOTS:
         QCOMPARE(reply->error(), QNetworkReply::NoError);
         QCOMPARE(reply->readAll(), QByteArray("{}"));
 
-        QCOMPARE(spy.count(), 1);
+        // Broadcasts are written asynchronously
+        QTRY_COMPARE(spy.count(), 1);
         QCOMPARE(spy.at(0).first().toString(), QString("Hello world"));
     }
 
+    void testTopics()
+    {
+        QNetworkAccessManager network {};
+        std::unique_ptr<QNetworkReply> reply {};
+
+        IAuthentificationService::Ptr as = IAuthentificationService::create("test");
+        IExtensionManager::Ptr em = IExtensionManager::create();
+        IServer::Ptr server = IServer::create(*as, *em, PORT);
+        QVERIFY(server->start());
+
+        QNetworkRequest postRequest (QUrl("https://localhost:8080/authenticate"));
+        postRequest.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
+        QJsonObject object;
+        object.insert("password", QString::fromStdString(as->password()));
+        QByteArray query = QJsonDocument(object).toJson(QJsonDocument::Compact);
+        reply.reset(network.post(postRequest, query));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+
+        QJsonDocument result {QJsonDocument::fromJson(reply->readAll())};
+        QByteArray jwt {result.object().value("token").toString().toLocal8Bit()};
+        QByteArray token {"Bearer "};
+        token.append(jwt);
+
+        // The first socket subscribes to a topic, the second one receives everything
+        QWebSocket subscribedSocket;
+        subscribedSocket.open(QUrl("wss://localhost:8080/api/ws"));
+        subscribedSocket.ignoreSslErrors();
+        QWebSocket socket;
+        socket.open(QUrl("wss://localhost:8080/api/ws"));
+        socket.ignoreSslErrors();
+
+        while (subscribedSocket.state() != QAbstractSocket::ConnectedState
+               || socket.state() != QAbstractSocket::ConnectedState) {
+            QTest::qWait(100);
+        }
+
+        subscribedSocket.sendBinaryMessage(jwt);
+        subscribedSocket.sendTextMessage("{\"subscribe\":[\"test/topic\"]}");
+        socket.sendBinaryMessage(jwt);
+        QTest::qWait(500);
+
+        QSignalSpy subscribedSpy (&subscribedSocket, SIGNAL(textMessageReceived(QString)));
+        QSignalSpy spy (&socket, SIGNAL(textMessageReceived(QString)));
+
+        QNetworkRequest getRequest (QUrl("https://localhost:8080/api/test/test_ws"));
+        getRequest.setRawHeader("Authorization", token);
+        reply.reset(network.get(getRequest));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+
+        QNetworkRequest getTopicRequest (QUrl("https://localhost:8080/api/test/test_ws_topic"));
+        getTopicRequest.setRawHeader("Authorization", token);
+        reply.reset(network.get(getTopicRequest));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+
+        QTRY_COMPARE(spy.count(), 2);
+        QCOMPARE(spy.at(0).first().toString(), QString("Hello world"));
+        QCOMPARE(spy.at(1).first().toString(), QString("Hello topic"));
+        QTRY_COMPARE(subscribedSpy.count(), 1);
+        QCOMPARE(subscribedSpy.at(0).first().toString(), QString("Hello topic"));
+
+        // Unsubscribed sockets do not receive everything again
+        subscribedSocket.sendTextMessage("{\"unsubscribe\":[\"test/topic\"]}");
+        QTest::qWait(500);
+        reply.reset(network.get(getTopicRequest));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QTRY_COMPARE(spy.count(), 3);
+        QCOMPARE(subscribedSpy.count(), 1);
+    }
+
+    void testResume()
+    {
+        QNetworkAccessManager network {};
+        std::unique_ptr<QNetworkReply> reply {};
+
+        IAuthentificationService::Ptr as = IAuthentificationService::create("test");
+        IExtensionManager::Ptr em = IExtensionManager::create();
+        IServer::Ptr server = IServer::create(*as, *em, PORT);
+        QVERIFY(server->start());
+
+        QNetworkRequest postRequest (QUrl("https://localhost:8080/authenticate"));
+        postRequest.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
+        QJsonObject object;
+        object.insert("password", QString::fromStdString(as->password()));
+        reply.reset(network.post(postRequest, QJsonDocument(object).toJson(QJsonDocument::Compact)));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+        QByteArray jwt {QJsonDocument::fromJson(reply->readAll()).object().value("token").toString().toLocal8Bit()};
+        QByteArray token {"Bearer "};
+        token.append(jwt);
+
+        QWebSocket socket;
+        QSignalSpy spy (&socket, SIGNAL(textMessageReceived(QString)));
+        socket.open(QUrl("wss://localhost:8080/api/ws"));
+        socket.ignoreSslErrors();
+        QTRY_COMPARE(socket.state(), QAbstractSocket::ConnectedState);
+        socket.sendBinaryMessage(jwt);
+        socket.sendTextMessage("{\"resume\":true}");
+        QTRY_COMPARE(spy.count(), 1);
+        const QJsonObject &started = QJsonDocument::fromJson(spy.at(0).first().toString().toUtf8()).object();
+        QCOMPARE(started.value("resumed").toInt(), 0);
+        const QString &epoch = started.value("epoch").toString();
+        QVERIFY(!epoch.isEmpty());
+
+        // Broadcasts are sequenced
+        QNetworkRequest getRequest (QUrl("https://localhost:8080/api/test/test_ws"));
+        getRequest.setRawHeader("Authorization", token);
+        reply.reset(network.get(getRequest));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QTRY_COMPARE(spy.count(), 2);
+        const QJsonObject &sequenced = QJsonDocument::fromJson(spy.at(1).first().toString().toUtf8()).object();
+        QCOMPARE(sequenced.value("seq").toInt(), 1);
+        QCOMPARE(sequenced.value("topic").toString(), QString("test"));
+        QCOMPARE(sequenced.value("data").toString(), QString("Hello world"));
+
+        // A client that reconnects gets what it missed
+        QWebSocket resumedSocket;
+        QSignalSpy resumedSpy (&resumedSocket, SIGNAL(textMessageReceived(QString)));
+        resumedSocket.open(QUrl("wss://localhost:8080/api/ws"));
+        resumedSocket.ignoreSslErrors();
+        QTRY_COMPARE(resumedSocket.state(), QAbstractSocket::ConnectedState);
+        resumedSocket.sendBinaryMessage(jwt);
+        resumedSocket.sendTextMessage(QString("{\"resume\":0,\"epoch\":\"%1\"}").arg(epoch));
+        QTRY_COMPARE(resumedSpy.count(), 2);
+        QCOMPARE(resumedSpy.at(0).first(), spy.at(1).first());
+        QCOMPARE(resumedSpy.at(1).first().toString(), QString("{\"resumed\":1,\"epoch\":\"%1\"}").arg(epoch));
+
+        // Unknown sequence numbers ask for a resync
+        resumedSocket.sendTextMessage(QString("{\"resume\":42,\"epoch\":\"%1\"}").arg(epoch));
+        QTRY_COMPARE(resumedSpy.count(), 3);
+        QCOMPARE(resumedSpy.at(2).first().toString(), QString("{\"resync\":1,\"epoch\":\"%1\"}").arg(epoch));
+
+        // So do sequence numbers of a previous run of the server
+        server->stop();
+        QVERIFY(server->start());
+        QWebSocket restartedSocket;
+        QSignalSpy restartedSpy (&restartedSocket, SIGNAL(textMessageReceived(QString)));
+        restartedSocket.open(QUrl("wss://localhost:8080/api/ws"));
+        restartedSocket.ignoreSslErrors();
+        QTRY_COMPARE(restartedSocket.state(), QAbstractSocket::ConnectedState);
+        restartedSocket.sendBinaryMessage(jwt);
+        restartedSocket.sendTextMessage(QString("{\"resume\":0,\"epoch\":\"%1\"}").arg(epoch));
+        QTRY_COMPARE(restartedSpy.count(), 1);
+        const QJsonObject &restarted = QJsonDocument::fromJson(restartedSpy.at(0).first().toString().toUtf8()).object();
+        QCOMPARE(restarted.value("resync").toInt(), 0);
+        QVERIFY(restarted.value("epoch").toString() != epoch);
+    }
+
+    void testCall()
+    {
+        QNetworkAccessManager network {};
+        std::unique_ptr<QNetworkReply> reply {};
+
+        IAuthentificationService::Ptr as = IAuthentificationService::create("test");
+        IExtensionManager::Ptr em = IExtensionManager::create();
+        IServer::Ptr server = IServer::create(*as, *em, PORT);
+        QVERIFY(server->start());
+
+        QNetworkRequest postRequest (QUrl("https://localhost:8080/authenticate"));
+        postRequest.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
+        QJsonObject object;
+        object.insert("password", QString::fromStdString(as->password()));
+        reply.reset(network.post(postRequest, QJsonDocument(object).toJson(QJsonDocument::Compact)));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+        QByteArray jwt {QJsonDocument::fromJson(reply->readAll()).object().value("token").toString().toLocal8Bit()};
+
+        QWebSocket socket;
+        socket.open(QUrl("wss://localhost:8080/api/ws"));
+        socket.ignoreSslErrors();
+        QTRY_COMPARE(socket.state(), QAbstractSocket::ConnectedState);
+        socket.sendBinaryMessage(jwt);
+        QTest::qWait(500);
+
+        // Several calls over the same WebSocket
+        QSignalSpy spy (&socket, SIGNAL(textMessageReceived(QString)));
+        socket.sendTextMessage("{\"id\":1,\"method\":\"get\",\"extension\":\"test\",\"endpoint\":\"test_get\","
+                               "\"params\":{\"key\":\"value\"}}");
+        socket.sendTextMessage("{\"id\":\"two\",\"method\":\"post\",\"extension\":\"test\",\"endpoint\":\"test_post\","
+                               "\"params\":\"status=201\",\"body\":{\"data\":42}}");
+        socket.sendTextMessage("{\"id\":3,\"method\":\"post\",\"extension\":\"test\",\"endpoint\":\"test_get\"}");
+        socket.sendTextMessage("{\"id\":4,\"method\":\"get\",\"extension\":\"test\",\"endpoint\":\"unknown\"}");
+        QTRY_COMPARE(spy.count(), 4);
+
+        const QJsonObject &get = QJsonDocument::fromJson(spy.at(0).first().toString().toUtf8()).object();
+        QCOMPARE(get.value("id").toInt(), 1);
+        QCOMPARE(get.value("status").toInt(), 200);
+        QCOMPARE(get.value("body").toObject().value("type").toString(), QString("get"));
+        QCOMPARE(get.value("body").toObject().value("params").toObject().value("key").toString(), QString("value"));
+
+        const QJsonObject &post = QJsonDocument::fromJson(spy.at(1).first().toString().toUtf8()).object();
+        QCOMPARE(post.value("id").toString(), QString("two"));
+        QCOMPARE(post.value("status").toInt(), 201);
+        QCOMPARE(post.value("body").toObject().value("body").toObject().value("data").toInt(), 42);
+
+        const QJsonObject &wrongMethod = QJsonDocument::fromJson(spy.at(2).first().toString().toUtf8()).object();
+        QCOMPARE(wrongMethod.value("id").toInt(), 3);
+        QCOMPARE(wrongMethod.value("status").toInt(), 405);
+
+        const QJsonObject &notFound = QJsonDocument::fromJson(spy.at(3).first().toString().toUtf8()).object();
+        QCOMPARE(notFound.value("id").toInt(), 4);
+        QCOMPARE(notFound.value("status").toInt(), 404);
+        QVERIFY(!notFound.contains("body"));
+
+        // Calls need an authorized WebSocket
+        QWebSocket unauthorizedSocket;
+        unauthorizedSocket.open(QUrl("wss://localhost:8080/api/ws"));
+        unauthorizedSocket.ignoreSslErrors();
+        QTRY_COMPARE(unauthorizedSocket.state(), QAbstractSocket::ConnectedState);
+        unauthorizedSocket.sendTextMessage("{\"id\":1,\"method\":\"get\",\"extension\":\"test\",\"endpoint\":\"test_get\"}");
+        QTRY_COMPARE(unauthorizedSocket.state(), QAbstractSocket::UnconnectedState);
+    }
+
+    void testRevoke()
+    {
+        IAuthentificationService::Ptr as = IAuthentificationService::create("test");
+        IExtensionManager::Ptr em = IExtensionManager::create();
+        IServer::Ptr server = IServer::create(*as, *em, PORT);
+        QVERIFY(server->start());
+
+        const QByteArray &jwt1 = as->hashJwt(as->authenticate(as->password()));
+        const QByteArray &jwt2 = as->hashJwt(as->authenticate(as->password()));
+        const QByteArray &jwt3 = as->hashJwt(as->authenticate(as->password()));
+        std::vector<std::unique_ptr<QWebSocket>> sockets {};
+        for (const QByteArray &jwt : {jwt1, jwt2, jwt3}) {
+            sockets.emplace_back(new QWebSocket());
+            QWebSocket &socket = *sockets.back();
+            socket.open(QUrl("wss://localhost:8080/api/ws"));
+            socket.ignoreSslErrors();
+            QTRY_COMPARE(socket.state(), QAbstractSocket::ConnectedState);
+            socket.sendBinaryMessage(jwt);
+
+            // The reply to a call tells that the WebSocket is authorized
+            QSignalSpy spy (&socket, SIGNAL(textMessageReceived(QString)));
+            socket.sendTextMessage("{\"id\":1,\"method\":\"get\",\"extension\":\"test\",\"endpoint\":\"unknown\"}");
+            QTRY_COMPARE(spy.count(), 1);
+        }
+
+        // Only the WebSocket authorized by the revoked token is closed
+        QVERIFY(as->revoke(jwt1));
+        QTRY_COMPARE(sockets.at(0)->state(), QAbstractSocket::UnconnectedState);
+        QCOMPARE(sockets.at(0)->closeCode(), QWebSocketProtocol::CloseCodePolicyViolated);
+        QTest::qWait(200);
+        QCOMPARE(sockets.at(1)->state(), QAbstractSocket::ConnectedState);
+        QCOMPARE(sockets.at(2)->state(), QAbstractSocket::ConnectedState);
+
+        // Revoking all the sessions closes the others
+        as->revokeAll();
+        QTRY_COMPARE(sockets.at(1)->state(), QAbstractSocket::UnconnectedState);
+        QTRY_COMPARE(sockets.at(2)->state(), QAbstractSocket::UnconnectedState);
+    }
+
+    void testEvents()
+    {
+        QNetworkAccessManager network {};
+        std::unique_ptr<QNetworkReply> reply {};
+
+        IAuthentificationService::Ptr as = IAuthentificationService::create("test");
+        IExtensionManager::Ptr em = IExtensionManager::create();
+        IServer::Ptr server = IServer::create(*as, *em, PORT);
+        QVERIFY(server->start());
+
+        QNetworkRequest postRequest (QUrl("https://localhost:8080/authenticate"));
+        postRequest.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
+        QJsonObject object;
+        object.insert("password", QString::fromStdString(as->password()));
+        reply.reset(network.post(postRequest, QJsonDocument(object).toJson(QJsonDocument::Compact)));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+        QByteArray jwt {QJsonDocument::fromJson(reply->readAll()).object().value("token").toString().toLocal8Bit()};
+        QByteArray token {"Bearer "};
+        token.append(jwt);
+
+        // Unauthorized streams are refused
+        reply.reset(network.get(QNetworkRequest(QUrl("https://localhost:8080/api/events"))));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 401);
+
+        QNetworkRequest eventsRequest (QUrl("https://localhost:8080/api/events?topics=test"));
+        eventsRequest.setRawHeader("Authorization", token);
+        std::unique_ptr<QNetworkReply> events {network.get(eventsRequest)};
+        handleSslErrors(*events);
+        QByteArray stream {};
+        connect(events.get(), &QNetworkReply::readyRead, [&events, &stream]() {
+            stream.append(events->readAll());
+        });
+        QTRY_COMPARE(events->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 200);
+        QCOMPARE(events->header(QNetworkRequest::ContentTypeHeader).toString(), QString("text/event-stream"));
+
+        // Only the selected topics are streamed
+        QNetworkRequest topicRequest (QUrl("https://localhost:8080/api/test/test_ws_topic"));
+        topicRequest.setRawHeader("Authorization", token);
+        reply.reset(network.get(topicRequest));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QNetworkRequest getRequest (QUrl("https://localhost:8080/api/test/test_ws"));
+        getRequest.setRawHeader("Authorization", token);
+        reply.reset(network.get(getRequest));
+        handleSslErrors(*reply);
+        while (!reply->isFinished()) {
+            QTest::qWait(100);
+        }
+        QTRY_VERIFY(stream.endsWith("\n\n"));
+        // Event ids are epoch:sequence
+        const QByteArray &epoch = stream.mid(4, stream.indexOf(':', 4) - 4);
+        QCOMPARE(stream, "id: " + epoch + ":2\nevent: test\ndata: Hello world\n\n");
+
+        // A client that reconnects gets what it missed, with the token in the query
+        QUrl resumedUrl (QUrl("https://localhost:8080/api/events"));
+        QUrlQuery resumedQuery {};
+        resumedQuery.addQueryItem("token", QString::fromLatin1(jwt));
+        resumedQuery.addQueryItem("lastEventId", QString::fromLatin1(epoch + ":0"));
+        resumedUrl.setQuery(resumedQuery);
+        std::unique_ptr<QNetworkReply> resumed {network.get(QNetworkRequest(resumedUrl))};
+        handleSslErrors(*resumed);
+        QByteArray resumedStream {};
+        connect(resumed.get(), &QNetworkReply::readyRead, [&resumed, &resumedStream]() {
+            resumedStream.append(resumed->readAll());
+        });
+        QTRY_COMPARE(resumedStream, "id: " + epoch + ":1\nevent: test/topic\ndata: Hello topic\n\n"
+                                    "id: " + epoch + ":2\nevent: test\ndata: Hello world\n\n");
+
+        // Unknown event ids ask for a resync
+        QNetworkRequest resyncRequest (QUrl("https://localhost:8080/api/events"));
+        resyncRequest.setRawHeader("Authorization", token);
+        resyncRequest.setRawHeader("Last-Event-ID", epoch + ":42");
+        std::unique_ptr<QNetworkReply> resync {network.get(resyncRequest)};
+        handleSslErrors(*resync);
+        QByteArray resyncStream {};
+        connect(resync.get(), &QNetworkReply::readyRead, [&resync, &resyncStream]() {
+            resyncStream.append(resync->readAll());
+        });
+        QTRY_COMPARE(resyncStream, "id: " + epoch + ":2\nevent: resync\ndata: 2\n\n");
+
+        // Stopping the server ends the streams
+        server->stop();
+        QTRY_VERIFY(events->isFinished());
+        QTRY_VERIFY(resumed->isFinished());
+        QTRY_VERIFY(resync->isFinished());
+    }
+
+    void testEventLoop()
+    {
+        QNetworkAccessManager network {};
+        std::unique_ptr<QNetworkReply> reply {};
+
+        IAuthentificationService::Ptr as = IAuthentificationService::create("test");
+        IExtensionManager::Ptr em = IExtensionManager::create();
+        IServer::Ptr server = IServer::create(*as, *em, PORT);
+        IServer::Options options {};
+        options.webSocket.eventLoopPort = EVENT_LOOP_PORT;
+        server->setOptions(options);
+        QVERIFY(server->start());
+
+        QNetworkRequest postRequest (QUrl("https://localhost:8080/authenticate"));
+        postRequest.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
+        QJsonObject object;
+        object.insert("password", QString::fromStdString(as->password()));
+        reply.reset(network.post(postRequest, QJsonDocument(object).toJson(QJsonDocument::Compact)));
+        handleSslErrors(*reply);
+        QTRY_VERIFY(reply->isFinished());
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+        QByteArray jwt {QJsonDocument::fromJson(reply->readAll()).object().value("token").toString().toLocal8Bit()};
+        QByteArray token {"Bearer "};
+        token.append(jwt);
+
+        // Unknown paths are not upgraded
+        QWebSocket unknownSocket;
+        QSignalSpy unknownSpy (&unknownSocket, SIGNAL(disconnected()));
+        unknownSocket.open(QUrl("wss://localhost:8083/api/unknown"));
+        unknownSocket.ignoreSslErrors();
+        QTRY_COMPARE(unknownSpy.count(), 1);
+
+        QWebSocket socket;
+        socket.open(QUrl("wss://localhost:8083/api/ws"));
+        socket.ignoreSslErrors();
+        QTRY_COMPARE(socket.state(), QAbstractSocket::ConnectedState);
+        socket.sendBinaryMessage(jwt);
+
+        // Pings are answered by the event loop
+        QSignalSpy pongSpy (&socket, SIGNAL(pong(quint64,QByteArray)));
+        socket.ping("ping");
+        QTRY_COMPARE(pongSpy.count(), 1);
+        QCOMPARE(pongSpy.at(0).at(1).toByteArray(), QByteArray("ping"));
+
+        // Calls are answered, and broadcasts are sent, like for civetweb WebSockets
+        QSignalSpy spy (&socket, SIGNAL(textMessageReceived(QString)));
+        socket.sendTextMessage("{\"id\":1,\"method\":\"get\",\"extension\":\"test\",\"endpoint\":\"test_get\"}");
+        QTRY_COMPARE(spy.count(), 1);
+        const QJsonObject &get = QJsonDocument::fromJson(spy.at(0).first().toString().toUtf8()).object();
+        QCOMPARE(get.value("id").toInt(), 1);
+        QCOMPARE(get.value("status").toInt(), 200);
+
+        QNetworkRequest getRequest (QUrl("https://localhost:8080/api/test/test_ws"));
+        getRequest.setRawHeader("Authorization", token);
+        reply.reset(network.get(getRequest));
+        handleSslErrors(*reply);
+        QTRY_VERIFY(reply->isFinished());
+        QCOMPARE(reply->error(), QNetworkReply::NoError);
+        QTRY_COMPARE(spy.count(), 2);
+        QCOMPARE(spy.at(1).first().toString(), QString("Hello world"));
+
+        // Wrong tokens close the WebSocket
+        QWebSocket unauthorizedSocket;
+        unauthorizedSocket.open(QUrl("wss://localhost:8083/api/ws"));
+        unauthorizedSocket.ignoreSslErrors();
+        QTRY_COMPARE(unauthorizedSocket.state(), QAbstractSocket::ConnectedState);
+        unauthorizedSocket.sendBinaryMessage("test");
+        QTRY_COMPARE(unauthorizedSocket.state(), QAbstractSocket::UnconnectedState);
+
+        // Stopping the server closes the WebSockets
+        server->stop();
+        QTRY_COMPARE(socket.state(), QAbstractSocket::UnconnectedState);
+        QCOMPARE(socket.closeCode(), QWebSocketProtocol::CloseCodeGoingAway);
+    }
+
+    void testEventLoopShards()
+    {
+        IAuthentificationService::Ptr as = IAuthentificationService::create("test");
+        IExtensionManager::Ptr em = IExtensionManager::create();
+        IServer::Ptr server = IServer::create(*as, *em, PORT);
+        IServer::Options options {};
+        options.webSocket.eventLoopPort = EVENT_LOOP_PORT;
+        options.webSocket.eventLoopShards = 2;
+        options.webSocket.eventLoopAffinity = true;
+        server->setOptions(options);
+        QVERIFY(server->start());
+        QCOMPARE(server->shardStatistics().size(), std::size_t(2));
+        const QByteArray &jwt = as->hashJwt(as->authenticate(as->password()));
+
+        // Connections are spread between the shards, that all get the broadcasts
+        std::vector<std::unique_ptr<QWebSocket>> sockets {};
+        std::vector<std::unique_ptr<QSignalSpy>> spies {};
+        for (int i = 0; i < 8; ++i) {
+            sockets.emplace_back(new QWebSocket());
+            QWebSocket &socket = *sockets.back();
+            spies.emplace_back(new QSignalSpy(&socket, SIGNAL(textMessageReceived(QString))));
+            socket.open(QUrl("wss://localhost:8083/api/ws"));
+            socket.ignoreSslErrors();
+            QTRY_COMPARE(socket.state(), QAbstractSocket::ConnectedState);
+            socket.sendBinaryMessage(jwt);
+        }
+
+        auto total = [&server]() {
+            IServer::ShardStatistics total {};
+            for (const IServer::ShardStatistics &statistics : server->shardStatistics()) {
+                total.connections += statistics.connections;
+                total.accepted += statistics.accepted;
+                total.messages += statistics.messages;
+            }
+            return total;
+        };
+        QTRY_COMPARE(total().messages, std::uint64_t(8));
+        QCOMPARE(total().connections, 8);
+        QCOMPARE(total().accepted, std::uint64_t(8));
+
+        emit em->extensions().front()->broadcast("Hello shards");
+        for (const std::unique_ptr<QSignalSpy> &spy : spies) {
+            QTRY_COMPARE(spy->count(), 1);
+            QCOMPARE(spy->at(0).first().toString(), QString("Hello shards"));
+        }
+
+        server->stop();
+        QVERIFY(server->shardStatistics().empty());
+    }
+
+    void testLocalSocket()
+    {
+        const QString &path = QDir::temp().absoluteFilePath("harmony-test.sock");
+        IAuthentificationService::Ptr as = IAuthentificationService::create("test");
+        IExtensionManager::Ptr em = IExtensionManager::create();
+        IServer::Ptr server = IServer::create(*as, *em, PORT);
+        IServer::Options options {};
+        options.localSocket = path.toStdString();
+        server->setOptions(options);
+        QVERIFY(server->start());
+        QVERIFY(QFile::exists(path));
+        QCOMPARE(QFile::permissions(path) & (QFile::ReadGroup | QFile::WriteGroup | QFile::ReadOther | QFile::WriteOther),
+                 QFile::Permissions());
+
+        // Plain WebSocket handshake, without TLS
+        QLocalSocket socket;
+        socket.connectToServer(path);
+        QVERIFY(socket.waitForConnected());
+        socket.write("GET /api/ws HTTP/1.1\r\n"
+                     "Host: localhost\r\n"
+                     "Upgrade: websocket\r\n"
+                     "Connection: Upgrade\r\n"
+                     "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                     "Sec-WebSocket-Version: 13\r\n"
+                     "\r\n");
+        QByteArray received {};
+        while (!received.contains("\r\n\r\n") && socket.waitForReadyRead(5000)) {
+            received.append(socket.readAll());
+        }
+        const int end = received.indexOf("\r\n\r\n");
+        QVERIFY(end > 0);
+        QVERIFY(received.startsWith("HTTP/1.1 101"));
+        QVERIFY(received.contains("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo="));
+        received.remove(0, end + 4);
+
+        // Tokens are still needed to call endpoints
+        socket.write(clientFrame(0x2, as->hashJwt(as->authenticate(as->password()))));
+        socket.write(clientFrame(0x1, "{\"id\":1,\"method\":\"get\",\"extension\":\"test\",\"endpoint\":\"test_get\"}"));
+        const QJsonObject &reply = QJsonDocument::fromJson(readFrame(socket, received)).object();
+        QCOMPARE(reply.value("id").toInt(), 1);
+        QCOMPARE(reply.value("status").toInt(), 200);
+
+        server->stop();
+        QVERIFY(!QFile::exists(path));
+
+        // Files that are not sockets are not replaced
+        QFile file {path};
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.close();
+        QVERIFY(!server->start());
+        QVERIFY(file.exists());
+        QVERIFY(file.remove());
+    }
+
     void testAuthentificationFailure()
     {
         IAuthentificationService::Ptr as = IAuthentificationService::create("test");
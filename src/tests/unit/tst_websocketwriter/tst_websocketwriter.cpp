@@ -0,0 +1,340 @@
+/*
+ * Copyright (C) 2014 Lucien XU <sfietkonstantin@free.fr>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * The names of its contributors may not be used to endorse or promote
+ *     products derived from this software without specific prior written
+ *     permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include <QtTest/QtTest>
+#include <atomic>
+#include <private/websocketframe.h>
+#include <private/websocketwriter.h>
+
+using namespace harmony;
+using namespace harmony::private_impl;
+
+static const int OPCODE_TEXT = 0x1;
+static const int OPCODE_CLOSE = 0x8;
+
+static OutboundMessage createMessage(const QByteArray &data, const QByteArray &key = QByteArray())
+{
+    OutboundMessage message {};
+    message.message = std::make_shared<WebSocketMessage>(OPCODE_TEXT, data);
+    message.key = key;
+    return message;
+}
+
+static OutboundMessage createReply(const QByteArray &data)
+{
+    OutboundMessage message {createMessage(data)};
+    message.reply = true;
+    return message;
+}
+
+// Fake connections, that are never dereferenced
+static mg_connection *connection(quintptr index)
+{
+    return reinterpret_cast<mg_connection *>(index);
+}
+
+class TstWebSocketWriter: public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testFrame()
+    {
+        QByteArray frame = WebSocketFrame::build(OPCODE_TEXT, "Hello");
+        QCOMPARE(frame, QByteArray("\x81\x05Hello"));
+        QCOMPARE(WebSocketFrame::headerSize(5), 2);
+
+        frame = WebSocketFrame::build(OPCODE_TEXT, QByteArray(200, 'a'));
+        QCOMPARE(frame.size(), 204);
+        QCOMPARE(frame.left(4), QByteArray("\x81\x7e\x00\xc8", 4));
+
+        frame = WebSocketFrame::build(OPCODE_TEXT, QByteArray(70000, 'a'));
+        QCOMPARE(frame.size(), 70010);
+        QCOMPARE(frame.left(10), QByteArray("\x81\x7f\x00\x00\x00\x00\x00\x01\x11\x70", 10));
+    }
+    void testDropOldest()
+    {
+        OutboundQueue queue {2, OutboundQueue::OverflowPolicy::DropOldest};
+        QVERIFY(queue.push(createMessage("a")));
+        QVERIFY(queue.push(createMessage("b")));
+        QVERIFY(queue.push(createMessage("c")));
+        QCOMPARE(queue.count(), 2);
+        QCOMPARE(queue.dropped(), 1);
+        QCOMPARE(queue.pop().message->payload(), QByteArray("b"));
+        QCOMPARE(queue.pop().message->payload(), QByteArray("c"));
+        QVERIFY(queue.isEmpty());
+    }
+    void testCoalesce()
+    {
+        OutboundQueue queue {2, OutboundQueue::OverflowPolicy::Coalesce};
+        QVERIFY(queue.push(createMessage("a1", "a")));
+        QVERIFY(queue.push(createMessage("b1", "b")));
+        QVERIFY(queue.push(createMessage("a2", "a")));
+        QCOMPARE(queue.count(), 2);
+        QCOMPARE(queue.pop().message->payload(), QByteArray("a2"));
+        QCOMPARE(queue.pop().message->payload(), QByteArray("b1"));
+
+        // Without a matching key, the oldest message is dropped
+        QVERIFY(queue.push(createMessage("a1", "a")));
+        QVERIFY(queue.push(createMessage("b1", "b")));
+        QVERIFY(queue.push(createMessage("c1", "c")));
+        QCOMPARE(queue.pop().message->payload(), QByteArray("b1"));
+        QCOMPARE(queue.pop().message->payload(), QByteArray("c1"));
+        QCOMPARE(queue.dropped(), 2);
+    }
+    void testDisconnect()
+    {
+        OutboundQueue queue {2, OutboundQueue::OverflowPolicy::Disconnect};
+        QVERIFY(queue.push(createMessage("a")));
+        QVERIFY(queue.push(createMessage("b")));
+        QVERIFY(!queue.push(createMessage("c")));
+        QVERIFY(queue.isEmpty());
+    }
+    void testReplies()
+    {
+        // Replies are not dropped by broadcasts
+        OutboundQueue queue {2, OutboundQueue::OverflowPolicy::DropOldest};
+        QVERIFY(queue.push(createReply("r1")));
+        QVERIFY(queue.push(createMessage("a")));
+        QVERIFY(queue.push(createMessage("b")));
+        QVERIFY(queue.push(createMessage("c")));
+        QVERIFY(queue.push(createReply("r2")));
+        QCOMPARE(queue.count(), 4);
+        QCOMPARE(queue.dropped(), 1);
+        QCOMPARE(queue.pop().message->payload(), QByteArray("r1"));
+        QCOMPARE(queue.pop().message->payload(), QByteArray("b"));
+        QCOMPARE(queue.pop().message->payload(), QByteArray("c"));
+        QCOMPARE(queue.pop().message->payload(), QByteArray("r2"));
+
+        // Nor replaced
+        OutboundQueue coalesced {1, OutboundQueue::OverflowPolicy::Coalesce};
+        OutboundMessage reply {createReply("r1")};
+        reply.key = "a";
+        QVERIFY(coalesced.push(reply));
+        QVERIFY(coalesced.push(createMessage("a1", "a")));
+        QVERIFY(coalesced.push(createMessage("a2", "a")));
+        QCOMPARE(coalesced.pop().message->payload(), QByteArray("r1"));
+        QCOMPARE(coalesced.pop().message->payload(), QByteArray("a2"));
+
+        // A client that does not read its replies is disconnected
+        QVERIFY(coalesced.push(createReply("r1")));
+        QVERIFY(!coalesced.push(createReply("r2")));
+        QVERIFY(coalesced.isEmpty());
+    }
+    void testBroadcast()
+    {
+        std::mutex mutex {};
+        QHash<mg_connection *, QList<QByteArray>> written {};
+        WebSocketWriter writer {[&mutex, &written](mg_connection *connection, const WebSocketMessage &message) {
+            std::lock_guard<std::mutex> lock {mutex};
+            written[connection].append(message.payload());
+            return WebSocketWriteResult::Written;
+        }};
+        writer.start(IServer::Options::WebSocket());
+        writer.add(connection(1));
+        writer.add(connection(2));
+        QCOMPARE(writer.count(), 2);
+
+        writer.broadcast(createMessage("a"));
+        writer.broadcast(createMessage("b"));
+        QVERIFY(writer.send(connection(2), createMessage("c")));
+        QVERIFY(!writer.send(connection(3), createMessage("c")));
+
+        QTRY_COMPARE([&mutex, &written]() {
+            std::lock_guard<std::mutex> lock {mutex};
+            return written.value(connection(1)).count() + written.value(connection(2)).count();
+        }(), 5);
+        QCOMPARE(written.value(connection(1)), QList<QByteArray>() << "a" << "b");
+        QCOMPARE(written.value(connection(2)), QList<QByteArray>() << "a" << "b" << "c");
+
+        writer.remove(connection(1));
+        QCOMPARE(writer.count(), 1);
+        writer.stop();
+        QCOMPARE(writer.count(), 0);
+    }
+    void testSlowConsumer()
+    {
+        std::atomic_bool blocked {true};
+        std::atomic_int fastCount {0};
+        std::atomic_int closeCount {0};
+        std::atomic_int closedCount {0};
+        WebSocketWriter writer {[&](mg_connection *connection, const WebSocketMessage &message) {
+            if (message.opcode() == OPCODE_CLOSE) {
+                ++closeCount;
+            } else if (connection == ::connection(1)) {
+                while (blocked) {
+                    QThread::msleep(10);
+                }
+            } else {
+                ++fastCount;
+            }
+            return WebSocketWriteResult::Written;
+        }, [&](mg_connection *connection) {
+            // The socket is closed after the close frame
+            QCOMPARE(connection, ::connection(1));
+            QCOMPARE(closeCount.load(), 1);
+            ++closedCount;
+        }};
+        IServer::Options::WebSocket options {};
+        options.queueCapacity = 4;
+        options.overflowPolicy = IServer::Options::WebSocket::OverflowPolicy::Disconnect;
+        writer.start(options);
+        writer.add(connection(1));
+        writer.add(connection(2));
+
+        // The slow client does not hold the others, and is disconnected
+        for (int i = 0; i < 10; ++i) {
+            writer.broadcast(createMessage("a"));
+            QTRY_COMPARE(fastCount.load(), i + 1);
+        }
+        blocked = false;
+        QTRY_COMPARE(closeCount.load(), 1);
+        QTRY_COMPARE(closedCount.load(), 1);
+        writer.stop();
+    }
+    void testWouldBlock()
+    {
+        std::atomic_bool blocked {true};
+        std::atomic_int fastCount {0};
+        std::mutex mutex {};
+        QList<QByteArray> written {};
+        WebSocketWriter writer {[&](mg_connection *connection, const WebSocketMessage &message) {
+            if (connection != ::connection(1)) {
+                ++fastCount;
+                return WebSocketWriteResult::Written;
+            }
+            if (blocked) {
+                return WebSocketWriteResult::WouldBlock;
+            }
+            std::lock_guard<std::mutex> lock {mutex};
+            written.append(message.payload());
+            return WebSocketWriteResult::Written;
+        }};
+        IServer::Options::WebSocket options {};
+        options.queueCapacity = 4;
+        options.writerCount = 1;
+        writer.start(options);
+        writer.add(connection(1));
+        writer.add(connection(2));
+
+        // A client whose socket is full does not hold the only writer
+        for (int i = 0; i < 10; ++i) {
+            writer.broadcast(createMessage(QByteArray::number(i)));
+            QTRY_COMPARE(fastCount.load(), i + 1);
+        }
+
+        // Its messages are kept in its queue, with the overflow policy
+        blocked = false;
+        QTRY_VERIFY([&mutex, &written]() {
+            std::lock_guard<std::mutex> lock {mutex};
+            return !written.isEmpty() && written.last() == "9";
+        }());
+        QVERIFY(written.count() <= options.queueCapacity + 1);
+        writer.stop();
+    }
+    void testWriteTimeout()
+    {
+        std::atomic_int closedCount {0};
+        WebSocketWriter writer {[](mg_connection *, const WebSocketMessage &) {
+            return WebSocketWriteResult::WouldBlock;
+        }, [&closedCount](mg_connection *) {
+            ++closedCount;
+        }};
+        IServer::Options::WebSocket options {};
+        options.writeTimeout = 100;
+        writer.start(options);
+        writer.add(connection(1));
+
+        // Clients that do not read anymore are closed
+        writer.broadcast(createMessage("a"));
+        QTRY_COMPARE(closedCount.load(), 1);
+        writer.stop();
+    }
+    void testForcedDisconnect()
+    {
+        std::mutex mutex {};
+        QList<int> opcodes {};
+        std::atomic_int closedCount {0};
+        WebSocketWriter writer {[&mutex, &opcodes](mg_connection *, const WebSocketMessage &message) {
+            std::lock_guard<std::mutex> lock {mutex};
+            opcodes.append(message.opcode());
+            return WebSocketWriteResult::Written;
+        }, [&closedCount](mg_connection *connection) {
+            QCOMPARE(connection, ::connection(1));
+            ++closedCount;
+        }};
+        writer.start(IServer::Options::WebSocket());
+        writer.add(connection(1));
+
+        // Disconnected WebSockets get a close frame, and nothing else
+        writer.disconnect(connection(1));
+        writer.disconnect(connection(1));
+        writer.disconnect(connection(2));
+        QVERIFY(writer.send(connection(1), createMessage("a")));
+        QTRY_COMPARE(closedCount.load(), 1);
+        QCOMPARE(opcodes, QList<int>() << OPCODE_CLOSE);
+        writer.stop();
+    }
+    void testConnectionFunctions()
+    {
+        std::atomic_int defaultCount {0};
+        std::atomic_int ownCount {0};
+        std::atomic_int closedCount {0};
+        WebSocketWriter writer {[&defaultCount](mg_connection *connection, const WebSocketMessage &) {
+            QCOMPARE(connection, ::connection(1));
+            ++defaultCount;
+            return WebSocketWriteResult::Written;
+        }};
+        writer.start(IServer::Options::WebSocket());
+        writer.add(connection(1));
+
+        // WebSockets are written to, and closed, with their own functions
+        writer.add(connection(2), [&ownCount](mg_connection *connection, const WebSocketMessage &) {
+            QCOMPARE(connection, ::connection(2));
+            ++ownCount;
+            return WebSocketWriteResult::Written;
+        }, [&closedCount](mg_connection *connection) {
+            QCOMPARE(connection, ::connection(2));
+            ++closedCount;
+        });
+        writer.broadcast(createMessage("a"));
+        QTRY_COMPARE(defaultCount.load(), 1);
+        QTRY_COMPARE(ownCount.load(), 1);
+        writer.disconnect(connection(2));
+        QTRY_COMPARE(closedCount.load(), 1);
+        QCOMPARE(ownCount.load(), 2);
+        writer.stop();
+    }
+};
+
+
+QTEST_MAIN(TstWebSocketWriter)
+
+#include "tst_websocketwriter.moc"
@@ -1,6 +1,17 @@
 TEMPLATE = subdirs
 SUBDIRS += tst_authentificationservice \
     tst_jwt \
+    tst_sessionstore \
+    tst_ratelimiter \
+    tst_websocketwriter \
+    tst_permessagedeflate \
+    tst_admissioncontrol \
+    tst_broadcastcoalescer \
+    tst_broadcastdispatcher \
+    tst_broadcasthistory \
+    tst_eventstream \
+    tst_statestore \
+    tst_topicindex \
     tst_harmonyextension \
     tst_server \
     tst_websockets \